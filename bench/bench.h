@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* Each benchmark includes the source file it measures so that it can
+   call static functions directly. Everything it doesn't use is dropped
+   at link time with --gc-sections, which means no X server, GL context
+   or plugin loader is needed to run it. */
+
+#ifndef _COMPIZ_BENCH_H
+#define _COMPIZ_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+static inline double
+benchNow (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static unsigned int benchSeed = 1;
+
+static inline unsigned int
+benchRandom (void)
+{
+    benchSeed = benchSeed * 1103515245 + 12345;
+
+    return (benchSeed >> 16) & 0x7fff;
+}
+
+static inline void
+benchReport (const char *name,
+	     int	n,
+	     double	start)
+{
+    double elapsed = benchNow () - start;
+
+    printf ("%-40s %10d iterations %12.3f us/iteration\n",
+	    name, n, elapsed / n);
+}
+
+/* keeps the compiler from optimizing away results */
+static volatile unsigned long benchSink;
+
+#endif
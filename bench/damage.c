@@ -0,0 +1,159 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../src/display.c"
+
+#include "bench.h"
+
+CompCore core;
+REGION	 emptyRegion;
+
+static unsigned int backBufferAge;
+
+/* regionArea lives in screen.c, which can't be included as well */
+static int
+benchRegionArea (Region region)
+{
+    int i, area = 0;
+
+    for (i = 0; i < region->numRects; i++)
+	area += (region->rects[i].x2 - region->rects[i].x1) *
+	    (region->rects[i].y2 - region->rects[i].y1);
+
+    return area;
+}
+
+static void
+queryBackBufferAge (Display	 *dpy,
+		    GLXDrawable	 drawable,
+		    int		 attribute,
+		    unsigned int *value)
+{
+    *value = backBufferAge;
+}
+
+/* a blinking cursor, a line of text being typed and a clock in a
+   panel, the kind of damage an idle desktop produces */
+static void
+makeFrameDamage (Region damage,
+		 int	frame)
+{
+    XRectangle rect;
+
+    EMPTY_REGION (damage);
+
+    rect.x	= 200 + (frame % 80) * 9;
+    rect.y	= 300;
+    rect.width  = 18;
+    rect.height = 20;
+    XUnionRectWithRegion (&rect, damage, damage);
+
+    if (frame % 30 == 0)
+    {
+	rect.x	    = 1800;
+	rect.y	    = 4;
+	rect.width  = 100;
+	rect.height = 20;
+	XUnionRectWithRegion (&rect, damage, damage);
+    }
+}
+
+/* replays frames against a back buffer of a fixed age and reports the
+   area repainted per frame, an age of zero means unknown */
+static void
+benchBufferAge (unsigned int age)
+{
+    CompDisplay	 d;
+    CompScreen	 s;
+    char	 name[64];
+    double	 start, area = 0.0, damageArea = 0.0;
+    unsigned int mask;
+    int		 i, nRepair, n = 100000;
+
+    memset (&d, 0, sizeof (CompDisplay));
+    memset (&s, 0, sizeof (CompScreen));
+
+    s.display	    = &d;
+    s.width	    = 1920;
+    s.height	    = 1080;
+    s.queryDrawable = queryBackBufferAge;
+
+    s.region.rects    = &s.region.extents;
+    s.region.numRects = 1;
+    s.region.extents.x2 = s.width;
+    s.region.extents.y2 = s.height;
+
+    for (i = 0; i < BUFFER_AGE_HISTORY; i++)
+	s.damageHistory[i] = XCreateRegion ();
+
+    core.tmpRegion    = XCreateRegion ();
+    core.outputRegion = XCreateRegion ();
+
+    backBufferAge = age;
+
+    sprintf (name, "repairBufferAge, age %u", age);
+    start = benchNow ();
+    for (i = 0; i < n; i++)
+    {
+	makeFrameDamage (core.tmpRegion, i);
+
+	damageArea += benchRegionArea (core.tmpRegion);
+
+	mask = repairBufferAge (&s, COMP_SCREEN_DAMAGE_REGION_MASK,
+				&nRepair);
+	if (mask & COMP_SCREEN_DAMAGE_ALL_MASK)
+	    area += s.width * s.height;
+	else
+	    area += benchRegionArea (core.tmpRegion);
+
+	recordBufferAge (&s, mask, nRepair);
+    }
+    benchReport (name, n, start);
+
+    printf ("%-40s %10.0f pixels/frame, %.0f damaged\n", "",
+	    area / n, damageArea / n);
+
+    if (!age && s.bufferAgeFullFrames != n)
+	printf ("%u of %d frames repainted fully\n",
+		s.bufferAgeFullFrames, n);
+
+    for (i = 0; i < BUFFER_AGE_HISTORY; i++)
+	XDestroyRegion (s.damageHistory[i]);
+
+    XDestroyRegion (core.tmpRegion);
+    XDestroyRegion (core.outputRegion);
+}
+
+int
+main (void)
+{
+    emptyRegion.rects = &emptyRegion.extents;
+
+    benchBufferAge (0);
+    benchBufferAge (1);
+    benchBufferAge (2);
+    benchBufferAge (3);
+    benchBufferAge (4);
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../src/pixel.c"
+
+#include "bench.h"
+
+/* the loops pixel.c replaced */
+static void
+scalarPremultiply (void *data,
+		   int	n)
+{
+    unsigned char *base = (unsigned char *) data;
+    int		  i;
+
+    for (i = 0; i < n; i++, base += 4)
+    {
+	unsigned int alpha = base[3];
+
+	base[0] = base[0] * alpha / 255;
+	base[1] = base[1] * alpha / 255;
+	base[2] = base[2] * alpha / 255;
+    }
+}
+
+static void
+scalarSwapRedBlue (void *data,
+		   int	n)
+{
+    unsigned char *base = (unsigned char *) data;
+    unsigned char tmp;
+    int		  i;
+
+    for (i = 0; i < n; i++, base += 4)
+    {
+	tmp	= base[0];
+	base[0] = base[2];
+	base[2] = tmp;
+    }
+}
+
+static void
+fillImage (unsigned char *data,
+	   int		 n)
+{
+    int i;
+
+    benchSeed = 1;
+
+    for (i = 0; i < n * 4; i++)
+	data[i] = benchRandom ();
+}
+
+static void
+benchConversion (const char *name,
+		 void	    (*convert) (void *, int),
+		 int	    width,
+		 int	    height)
+{
+    unsigned char *data;
+    char	  title[64];
+    double	  start;
+    int		  i, n = 20;
+
+    data = malloc (width * height * 4);
+    fillImage (data, width * height);
+
+    sprintf (title, "%s, %dx%d", name, width, height);
+    start = benchNow ();
+    for (i = 0; i < n; i++)
+	(*convert) (data, width * height);
+    benchReport (title, n, start);
+
+    benchSink += data[benchRandom () % (width * height * 4)];
+
+    free (data);
+}
+
+/* every channel and alpha pair, plus odd lengths for the tails */
+static void
+checkConversions (void)
+{
+    unsigned char a[65536 * 4 + 12], b[65536 * 4 + 12];
+    int		  i, n;
+
+    for (i = 0; i < 65536; i++)
+    {
+	a[i * 4 + 0] = i & 0xff;
+	a[i * 4 + 1] = i & 0xff;
+	a[i * 4 + 2] = (i + 7) & 0xff;
+	a[i * 4 + 3] = i >> 8;
+    }
+
+    for (n = 65536; n <= 65539; n++)
+    {
+	memcpy (b, a, sizeof (a));
+
+	premultiplyPixels (a, n);
+	scalarPremultiply (b, n);
+
+	if (memcmp (a, b, n * 4))
+	    printf ("premultiplyPixels differs for %d pixels\n", n);
+
+	swapRedBluePixels (a, n);
+	scalarSwapRedBlue (b, n);
+
+	if (memcmp (a, b, n * 4))
+	    printf ("swapRedBluePixels differs for %d pixels\n", n);
+    }
+}
+
+int
+main (void)
+{
+    checkConversions ();
+
+    benchConversion ("scalar premultiply", scalarPremultiply, 3840, 2160);
+    benchConversion ("premultiplyPixels", premultiplyPixels, 3840, 2160);
+    benchConversion ("scalar premultiply", scalarPremultiply, 7680, 4320);
+    benchConversion ("premultiplyPixels", premultiplyPixels, 7680, 4320);
+
+    benchConversion ("scalar red/blue swap", scalarSwapRedBlue, 3840, 2160);
+    benchConversion ("swapRedBluePixels", swapRedBluePixels, 3840, 2160);
+    benchConversion ("scalar red/blue swap", scalarSwapRedBlue, 7680, 4320);
+    benchConversion ("swapRedBluePixels", swapRedBluePixels, 7680, 4320);
+
+    return 0;
+}
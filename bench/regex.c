@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../plugins/regex.c"
+
+#include "bench.h"
+
+void
+compLogMessage (const char   *componentName,
+		CompLogLevel level,
+		const char   *format,
+		...)
+{
+}
+
+static const char *titlePatterns[] = {
+    "Mozilla Firefox$", "^Picture-in-Picture$", "- VLC media player$",
+    "^Steam$", "Thunderbird", "^MPlayer", "GIMP", "Chromium$",
+    "^Terminal", "LibreOffice Impress$", "^Volume Control$",
+    "^Save As", "^Open File", "Inkscape$", "^xeyes$", "Blender",
+    "^Preferences$", "- Evince$", "Pidgin", "^Calculator$",
+    "^Emacs", "- Vim$", "^Conky", "Skype", "^Wine", "Zoom Meeting",
+    "^Screenshot", "^Downloads$", "Spotify", "^htop"
+};
+
+/* what a window title looks like while a terminal, browser or editor
+   updates it, mostly matching none of the patterns */
+static void
+makeTitle (char *title,
+	   int  i)
+{
+    switch (i % 5) {
+    case 0:
+	sprintf (title, "user@host: ~/src/compiz/build-%d", i);
+	break;
+    case 1:
+	sprintf (title, "Document %d - LibreOffice Writer", i);
+	break;
+    case 2:
+	sprintf (title, "make[%d]: Entering directory", i);
+	break;
+    case 3:
+	sprintf (title, "(%d) Inbox - Mail", i);
+	break;
+    default:
+	sprintf (title, "Page %d - Mozilla Firefox", i);
+	break;
+    }
+}
+
+/* replays a stream of title changes and evaluates every title
+   expression after each one, as core does when the match cache of
+   the window is invalidated */
+static void
+benchTitleChanges (int nPattern)
+{
+    RegexPattern *pattern[ARRAY_SIZE (titlePatterns)];
+    RegexWindow  rw;
+    char	 title[256], name[64];
+    double	 start;
+    int		 i, j, n = 100000, nMatch = 0;
+
+    memset (&rw, 0, sizeof (RegexWindow));
+
+    for (i = 0; i < nPattern; i++)
+	pattern[i] = regexGetPattern (titlePatterns[i], 0, REGEX_FIELD_TITLE);
+
+    sprintf (name, "regexec per pattern, %d patterns", nPattern);
+    start = benchNow ();
+    for (i = 0; i < n; i++)
+    {
+	makeTitle (title, i);
+
+	for (j = 0; j < nPattern; j++)
+	    benchSink += !regexec (&pattern[j]->preg, title, 0, NULL, 0);
+    }
+    benchReport (name, n, start);
+
+    sprintf (name, "regexMatchString, %d patterns", nPattern);
+    start = benchNow ();
+    for (i = 0; i < n; i++)
+    {
+	makeTitle (title, i);
+	regexClearResults (&rw, REGEX_FIELD_TITLE);
+
+	for (j = 0; j < nPattern; j++)
+	    benchSink += regexMatchString (&rw, pattern[j],
+					   REGEX_FIELD_TITLE, title);
+    }
+    benchReport (name, n, start);
+
+    for (i = 0; i < 1000; i++)
+    {
+	makeTitle (title, i);
+	regexClearResults (&rw, REGEX_FIELD_TITLE);
+
+	for (j = 0; j < nPattern; j++)
+	{
+	    Bool value = !regexec (&pattern[j]->preg, title, 0, NULL, 0);
+
+	    if (regexMatchString (&rw, pattern[j],
+				  REGEX_FIELD_TITLE, title) != value)
+		printf ("\"%s\" against \"%s\" differs\n",
+			titlePatterns[j], title);
+
+	    nMatch += value;
+	}
+    }
+
+    if (!nMatch)
+	printf ("no title matched\n");
+
+    for (i = 0; i < nPattern; i++)
+	regexReleasePattern (pattern[i]);
+
+    free (rw.table[REGEX_FIELD_TITLE].result);
+}
+
+int
+main (void)
+{
+    benchTitleChanges (1);
+    benchTitleChanges (5);
+    benchTitleChanges (10);
+    benchTitleChanges (30);
+
+    return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../plugins/scale.c"
+
+#include "bench.h"
+
+#define BENCH_MAX_WINDOWS 200
+
+static CompDisplay  display;
+static CompScreen   screen;
+static CompOutput   output;
+static CompWindow   windows[BENCH_MAX_WINDOWS];
+static ScaleDisplay scaleDisplay;
+static ScaleScreen  scaleScreen;
+static ScaleWindow  scaleWindows[BENCH_MAX_WINDOWS];
+static CompPrivate  displayPrivate, screenPrivate;
+static CompPrivate  windowPrivates[BENCH_MAX_WINDOWS];
+
+/* only called in the all outputs mode, the benchmark uses one output */
+int
+outputDeviceForWindow (CompWindow *w)
+{
+    return 0;
+}
+
+static void
+initScreen (void)
+{
+    int i;
+
+    displayPrivate.ptr = &scaleDisplay;
+    screenPrivate.ptr  = &scaleScreen;
+
+    display.base.privates = &displayPrivate;
+    screen.base.privates  = &screenPrivate;
+    screen.display	  = &display;
+
+    output.workArea.x	   = 0;
+    output.workArea.y	   = 0;
+    output.workArea.width  = 3840;
+    output.workArea.height = 2160;
+
+    screen.outputDev	    = &output;
+    screen.nOutputDev	    = 1;
+    screen.currentOutputDev = 0;
+
+    scaleDisplayPrivateIndex	   = 0;
+    scaleDisplay.screenPrivateIndex = 0;
+    scaleScreen.windowPrivateIndex  = 0;
+
+    scaleScreen.opt[SCALE_SCREEN_OPTION_SPACING].value.i = 10;
+    scaleScreen.opt[SCALE_SCREEN_OPTION_MULTIOUTPUT_MODE].value.i =
+	SCALE_MOMODE_CURRENT;
+
+    scaleScreen.windows = malloc (sizeof (CompWindow *) * BENCH_MAX_WINDOWS);
+    scaleScreen.slots	= malloc (sizeof (ScaleSlot) * BENCH_MAX_WINDOWS);
+    if (!scaleScreen.windows || !scaleScreen.slots)
+	exit (1);
+
+    scaleScreen.windowsSize = BENCH_MAX_WINDOWS;
+    scaleScreen.slotsSize   = BENCH_MAX_WINDOWS;
+
+    /* windows of typical sizes spread over a 4K desktop, many of
+       them overlapping */
+    benchSeed = 1;
+
+    for (i = 0; i < BENCH_MAX_WINDOWS; i++)
+    {
+	CompWindow *w = &windows[i];
+
+	w->screen	 = &screen;
+	w->base.privates = &windowPrivates[i];
+
+	windowPrivates[i].ptr = &scaleWindows[i];
+
+	w->width   = 300 + benchRandom () % 1200;
+	w->height  = 200 + benchRandom () % 800;
+	w->serverX = benchRandom () % (3840 - w->width);
+	w->serverY = benchRandom () % (2160 - w->height);
+    }
+}
+
+/* the assignment that the Hungarian method replaced, a greedy pass
+   that is repeated until no window picked a slot that is taken */
+static void
+greedyFindBestSlots (CompScreen *s)
+{
+    CompWindow *w;
+    int        i, j, d, d0 = 0;
+    float      sx, sy, cx, cy;
+
+    SCALE_SCREEN (s);
+
+    for (i = 0; i < ss->nWindows; i++)
+    {
+	w = ss->windows[i];
+
+	SCALE_WINDOW (w);
+
+	if (sw->slot)
+	    continue;
+
+	sw->sid      = 0;
+	sw->distance = MAXSHORT;
+
+	for (j = 0; j < ss->nSlots; j++)
+	{
+	    if (!ss->slots[j].filled)
+	    {
+		sx = (ss->slots[j].x2 + ss->slots[j].x1) / 2;
+		sy = (ss->slots[j].y2 + ss->slots[j].y1) / 2;
+
+		cx = w->serverX + w->width  / 2;
+		cy = w->serverY + w->height / 2;
+
+		cx -= sx;
+		cy -= sy;
+
+		d = sqrt (cx * cx + cy * cy);
+		if (d0 + d < sw->distance)
+		{
+		    sw->sid      = j;
+		    sw->distance = d0 + d;
+		}
+	    }
+	}
+
+	d0 += sw->distance;
+    }
+}
+
+static Bool
+greedyLayoutSlotsAndAssignWindows (CompScreen *s)
+{
+    CompWindow *w;
+    int	       i, pass;
+
+    SCALE_SCREEN (s);
+
+    layoutSlots (s);
+
+    /* fillInWindows now skips windows without a free slot where it
+       used to stop, either way the loop ends once all are placed */
+    for (pass = 0; pass < ss->nWindows; pass++)
+    {
+	greedyFindBestSlots (s);
+	fillInWindows (s);
+
+	for (i = 0; i < ss->nWindows; i++)
+	{
+	    w = ss->windows[i];
+
+	    if (!GET_SCALE_WINDOW (w, ss)->slot)
+		break;
+	}
+
+	if (i == ss->nWindows)
+	    break;
+    }
+
+    return TRUE;
+}
+
+static void
+resetWindows (int nWindows)
+{
+    int i;
+
+    scaleScreen.nWindows = nWindows;
+
+    for (i = 0; i < nWindows; i++)
+    {
+	scaleScreen.windows[i] = &windows[i];
+	scaleWindows[i].slot   = NULL;
+    }
+}
+
+/* sum of the distances windows travel to their slots */
+static double
+totalDistance (int nWindows)
+{
+    double     total = 0.0;
+    ScaleSlot  *slot;
+    CompWindow *w;
+    float      dx, dy;
+    int	       i;
+
+    for (i = 0; i < nWindows; i++)
+    {
+	w    = &windows[i];
+	slot = scaleWindows[i].slot;
+
+	if (!slot)
+	    continue;
+
+	dx = (slot->x1 + slot->x2) / 2 - (w->serverX + w->width  / 2);
+	dy = (slot->y1 + slot->y2) / 2 - (w->serverY + w->height / 2);
+
+	total += sqrt (dx * dx + dy * dy);
+    }
+
+    return total;
+}
+
+static void
+benchLayout (const char *name,
+	     int	layout,
+	     Bool	(*assign) (CompScreen *s),
+	     int	nWindows)
+{
+    char   str[64];
+    double start;
+    int	   i, n = 0;
+
+    scaleScreen.opt[SCALE_SCREEN_OPTION_LAYOUT].value.i = layout;
+
+    sprintf (str, "%s, %d windows", name, nWindows);
+
+    start = benchNow ();
+    while (benchNow () - start < 200000.0)
+    {
+	for (i = 0; i < 10; i++)
+	{
+	    resetWindows (nWindows);
+	    (*assign) (&screen);
+	}
+
+	n += 10;
+    }
+    benchReport (str, n, start);
+
+    printf ("%-40s total distance %.0f\n", "", totalDistance (nWindows));
+}
+
+int
+main (void)
+{
+    static const int counts[] = { 10, 40, 100, 200 };
+    int		     i;
+
+    initScreen ();
+
+    for (i = 0; i < sizeof (counts) / sizeof (counts[0]); i++)
+    {
+	benchLayout ("grid, greedy", SCALE_LAYOUT_GRID,
+		     greedyLayoutSlotsAndAssignWindows, counts[i]);
+	benchLayout ("grid, findBestSlots", SCALE_LAYOUT_GRID,
+		     layoutSlotsAndAssignWindows, counts[i]);
+	benchLayout ("rows", SCALE_LAYOUT_ROWS,
+		     layoutSlotsAndAssignWindows, counts[i]);
+	benchLayout ("natural", SCALE_LAYOUT_NATURAL,
+		     layoutSlotsAndAssignWindows, counts[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../src/display.c"
+
+#include "bench.h"
+
+CompCore core;
+
+static int nCalled;
+
+static Bool
+countTimeout (void *closure)
+{
+    nCalled++;
+
+    return FALSE;
+}
+
+static Bool
+repeatTimeout (void *closure)
+{
+    nCalled++;
+
+    return TRUE;
+}
+
+static void
+addTimeToNow (struct timeval *tv,
+	      int	     ms)
+{
+    compGetCurrentTime (tv);
+    addTimeToTimeval (tv, tv, ms);
+}
+
+/* adds n timeouts, removes every other one by handle and then runs
+   the rest */
+static void
+benchAddRemove (int n)
+{
+    CompTimeoutHandle *handle;
+    struct timeval    tv;
+    char	      name[64];
+    double	      start;
+    int		      i;
+
+    handle = malloc (n * sizeof (CompTimeoutHandle));
+
+    sprintf (name, "compAddTimeout, %d pending", n);
+    start = benchNow ();
+    for (i = 0; i < n; i++)
+    {
+	int minTime = benchRandom () % 10000;
+
+	handle[i] = compAddTimeout (minTime, minTime + 50,
+				    countTimeout, NULL);
+    }
+    benchReport (name, n, start);
+
+    sprintf (name, "compRemoveTimeout, %d pending", n);
+    start = benchNow ();
+    for (i = 0; i < n; i += 2)
+	compRemoveTimeout (handle[i]);
+    benchReport (name, n / 2, start);
+
+    nCalled = 0;
+
+    addTimeToNow (&tv, 20000);
+
+    sprintf (name, "handleTimeouts, %d pending", core.nTimeout);
+    start = benchNow ();
+    handleTimeouts (&tv);
+    benchReport (name, n - n / 2, start);
+
+    if (nCalled != n - n / 2 || core.nTimeout)
+	printf ("ran %d of %d timeouts, %d left\n",
+		nCalled, n - n / 2, core.nTimeout);
+
+    free (handle);
+}
+
+/* a callback that keeps its timeout with a minTime of zero must run
+   once per pass, and getTimeToNextTimeout must never ask for a zero
+   poll before the first timeout is strictly due */
+static void
+checkZeroTimeout (void)
+{
+    CompTimeoutHandle handle;
+    struct timeval    tv;
+    int		      i;
+
+    handle = compAddTimeout (0, 0, repeatTimeout, NULL);
+
+    nCalled = 0;
+
+    for (i = 0; i < 1000; i++)
+    {
+	compGetCurrentTime (&tv);
+	handleTimeouts (&tv);
+
+	tv = core.timeouts[0]->minDeadline;
+	if (getTimeToNextTimeout (&tv) == 0)
+	{
+	    printf ("zero timeout poll at the deadline\n");
+	    break;
+	}
+    }
+
+    if (nCalled > i)
+	printf ("zero timeout ran %d times in %d passes\n", nCalled, i);
+
+    compRemoveTimeout (handle);
+}
+
+/* the idle loop with many timers that expire every few milliseconds,
+   counts how often it wakes up compared to how many callbacks run */
+static void
+benchIdleLoop (int n)
+{
+    struct timeval tv, end;
+    char	   name[64];
+    double	   start;
+    int		   i, time, nWakeup = 0;
+
+    for (i = 0; i < n; i++)
+	compAddTimeout (1 + benchRandom () % 16, 20 + benchRandom () % 16,
+			repeatTimeout, NULL);
+
+    nCalled = 0;
+
+    addTimeToNow (&end, 500);
+
+    sprintf (name, "idle loop wakeups, %d timers", n);
+    start = benchNow ();
+    do
+    {
+	compGetCurrentTime (&tv);
+
+	time = getTimeToNextTimeout (&tv);
+	if (time)
+	    poll (NULL, 0, time);
+
+	compGetCurrentTime (&tv);
+	handleTimeouts (&tv);
+
+	nWakeup++;
+    } while (TIMEVAL_BEFORE (&tv, &end));
+    benchReport (name, nWakeup, start);
+
+    printf ("%-40s %10d callbacks %11.1f per wakeup\n", "",
+	    nCalled, (float) nCalled / nWakeup);
+
+    while (core.nTimeout)
+	compRemoveTimeout (core.timeouts[0]->handle);
+}
+
+int
+main (void)
+{
+    core.lastTimeoutHandle = 1;
+
+    benchAddRemove (100);
+    benchAddRemove (10000);
+    benchAddRemove (30000);
+
+    checkZeroTimeout ();
+
+    benchIdleLoop (10);
+    benchIdleLoop (1000);
+
+    return 0;
+}
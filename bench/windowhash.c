@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../src/screen.c"
+
+#include "bench.h"
+
+CompWindow *lastFoundWindow = 0;
+
+static CompWindow *
+linearFindWindow (CompScreen *s,
+		  Window     id)
+{
+    CompWindow *w;
+
+    for (w = s->windows; w; w = w->next)
+	if (w->id == id)
+	    return w;
+
+    return 0;
+}
+
+static void
+benchWindowLookup (int nWindow)
+{
+    CompScreen s;
+    CompWindow *windows, *w;
+    Window     *ids;
+    char       name[64];
+    double     start;
+    int	       i, n;
+
+    memset (&s, 0, sizeof (CompScreen));
+
+    s.windowHash     = calloc (WINDOW_HASH_MIN_SIZE, sizeof (CompWindow *));
+    s.frameHash	     = calloc (WINDOW_HASH_MIN_SIZE, sizeof (CompWindow *));
+    s.windowHashSize = WINDOW_HASH_MIN_SIZE;
+
+    /* keep the linear walk from dominating the run time */
+    n = MIN (1000000, 100000000 / nWindow);
+
+    windows = calloc (nWindow, sizeof (CompWindow));
+    ids	    = malloc (n * sizeof (Window));
+
+    /* X hands out ids in small increments from a per client base */
+    for (i = 0; i < nWindow; i++)
+    {
+	w = &windows[i];
+
+	w->screen = &s;
+	w->id	  = ((i % 16) << 21) | (0x200000 + i * 3);
+	w->next	  = s.windows;
+
+	s.windows = w;
+
+	hashWindow (w);
+    }
+
+    for (i = 0; i < n; i++)
+	ids[i] = windows[benchRandom () % nWindow].id;
+
+    sprintf (name, "linear lookup, %d windows", nWindow);
+    start = benchNow ();
+    for (i = 0; i < n; i++)
+	benchSink += (unsigned long) linearFindWindow (&s, ids[i]);
+    benchReport (name, n, start);
+
+    lastFoundWindow = NULL;
+
+    sprintf (name, "findWindowAtScreen, %d windows", nWindow);
+    start = benchNow ();
+    for (i = 0; i < n; i++)
+	benchSink += (unsigned long) findWindowAtScreen (&s, ids[i]);
+    benchReport (name, n, start);
+
+    for (i = 0; i < nWindow; i++)
+	if (findWindowAtScreen (&s, windows[i].id) != &windows[i])
+	    printf ("lookup of window 0x%lx failed\n", windows[i].id);
+
+    for (i = 0; i < nWindow; i++)
+	unhashWindow (&windows[i]);
+
+    if (s.nHashedWindows)
+	printf ("%u windows left in hash table\n", s.nHashedWindows);
+
+    free (ids);
+    free (windows);
+    free (s.windowHash);
+    free (s.frameHash);
+}
+
+int
+main (void)
+{
+    benchWindowLookup (10);
+    benchWindowLookup (100);
+    benchWindowLookup (1000);
+    benchWindowLookup (10000);
+
+    return 0;
+}
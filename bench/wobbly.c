@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../plugins/wobbly.c"
+
+#include "bench.h"
+
+#define BENCH_MODELS 1024
+#define BENCH_STEPS  100
+
+#define FRICTION 3.0f
+#define SPRING_K 8.0f
+
+/* only reached when an object snaps to an edge, which none of the
+   models here do */
+int
+outputDeviceForPoint (CompScreen *s,
+		      int	 x,
+		      int	 y)
+{
+    return 0;
+}
+
+/* the models of windows that were just dropped after being dragged by
+   a corner, as after a viewport switch with many windows wobbling */
+static void
+initModels (Model **models,
+	    int	  gridSize)
+{
+    int i, j;
+
+    benchSeed = 1;
+
+    for (i = 0; i < BENCH_MODELS; i++)
+    {
+	models[i] = createModel (i * 20, i * 10, 400, 300, gridSize, 0);
+	if (!models[i])
+	    exit (1);
+
+	for (j = 0; j < models[i]->numObjects; j++)
+	{
+	    models[i]->positionX[j] += (int) (benchRandom () % 41) - 20;
+	    models[i]->positionY[j] += (int) (benchRandom () % 41) - 20;
+	}
+
+	models[i]->positionX[0] += 80.0f;
+	models[i]->positionY[0] += 60.0f;
+    }
+}
+
+/* how each object was stepped before the state was split into arrays,
+   which is still what models with snapping edges use */
+static void
+stepObjects (Model *model,
+	     float *velocitySum,
+	     float *forceSum)
+{
+    float force;
+    int   i;
+
+    modelExertSpringForces (model, SPRING_K);
+
+    for (i = 0; i < model->numObjects; i++)
+    {
+	*velocitySum += modelStepObject (NULL, model, i, FRICTION, &force);
+	*forceSum += force;
+    }
+}
+
+static void
+benchGrid (int gridSize)
+{
+    Model  *perObject[BENCH_MODELS], *batched[BENCH_MODELS];
+    float  velocitySum = 0.0f, forceSum = 0.0f;
+    char   name[64];
+    double start;
+    int	   i, j, n;
+
+    initModels (perObject, gridSize);
+    initModels (batched, gridSize);
+
+    sprintf (name, "per object, %dx%d grid", gridSize, gridSize);
+
+    start = benchNow ();
+    for (i = 0; i < BENCH_STEPS; i++)
+	for (j = 0; j < BENCH_MODELS; j++)
+	    stepObjects (perObject[j], &velocitySum, &forceSum);
+    benchReport (name, BENCH_STEPS * BENCH_MODELS, start);
+
+    sprintf (name, "modelStepOnce, %dx%d grid", gridSize, gridSize);
+
+    start = benchNow ();
+    for (i = 0; i < BENCH_STEPS; i++)
+	for (j = 0; j < BENCH_MODELS; j++)
+	    modelStepOnce (NULL, batched[j], FRICTION, SPRING_K,
+			   &velocitySum, &forceSum);
+    benchReport (name, BENCH_STEPS * BENCH_MODELS, start);
+
+    benchSink += velocitySum + forceSum;
+
+    /* both ways of stepping must end in exactly the same state */
+    for (i = 0; i < BENCH_MODELS; i++)
+    {
+	n = perObject[i]->numObjects;
+
+	if (memcmp (perObject[i]->positionX, batched[i]->positionX,
+		    sizeof (float) * n * 6))
+	    printf ("%dx%d grid: model %d differs\n", gridSize, gridSize, i);
+
+	freeModel (perObject[i]);
+	freeModel (batched[i]);
+    }
+}
+
+int
+main (void)
+{
+    benchGrid (4);
+    benchGrid (8);
+    benchGrid (16);
+
+    return 0;
+}
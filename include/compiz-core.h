@@ -28,9 +28,10 @@
 
 #include <compiz-plugin.h>
 
-#define CORE_ABIVERSION 20090207
+#define CORE_ABIVERSION 20261016
 
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/time.h>
 
 #include <X11/Xutil.h>
@@ -73,6 +74,7 @@ typedef struct _CompIcon	  CompIcon;
 typedef struct _CompWindowExtents CompWindowExtents;
 typedef struct _CompWindowExtents CompFullscreenMonitorSet;
 typedef struct _CompProgram	  CompProgram;
+typedef struct _CompStoredProgram CompStoredProgram;
 typedef struct _CompFunction	  CompFunction;
 typedef struct _CompFunctionData  CompFunctionData;
 typedef struct _FragmentAttrib    FragmentAttrib;
@@ -80,6 +82,7 @@ typedef struct _CompCursor	  CompCursor;
 typedef struct _CompMatch	  CompMatch;
 typedef struct _CompOutput        CompOutput;
 typedef struct _CompWalker        CompWalker;
+typedef struct _CompPaintProfile  CompPaintProfile;
 
 /* virtual modifiers */
 
@@ -146,6 +149,11 @@ typedef struct _CompWalker        CompWalker;
 #define MAXIMIZE_STATE (CompWindowStateMaximizedHorzMask | \
 			CompWindowStateMaximizedVertMask)
 
+/* events selected on client windows when they are added */
+#define CLIENT_WINDOW_EVENT_MASK (PropertyChangeMask | \
+				  EnterWindowMask    | \
+				  FocusChangeMask)
+
 #define CompWindowActionMoveMask	  (1 << 0)
 #define CompWindowActionResizeMask	  (1 << 1)
 #define CompWindowActionStickMask	  (1 << 2)
@@ -241,12 +249,16 @@ extern CompMetadata coreMetadata;
 
 /* privates.c */
 
-#define WRAP(priv, real, func, wrapFunc) \
-    (priv)->func = (real)->func;	 \
-    (real)->func = (wrapFunc)
+#define WRAP(priv, real, func, wrapFunc)			\
+    ((priv)->func = (real)->func,				\
+     (real)->func = (wrapFunc),					\
+     (paintProfileActive ?					\
+      profileWrap ((FuncPtr) (wrapFunc), #func) : (void) 0))
 
-#define UNWRAP(priv, real, func) \
-    (real)->func = (priv)->func
+#define UNWRAP(priv, real, func)				\
+    ((paintProfileActive ?					\
+      profileUnwrap ((FuncPtr) (real)->func, #func) : (void) 0),	\
+     (real)->func = (priv)->func)
 
 typedef union _CompPrivate {
     void	  *ptr;
@@ -449,11 +461,21 @@ struct _CompAction {
 };
 
 typedef union _CompMatchOp CompMatchOp;
+typedef struct _CompPrefetchedWindow CompPrefetchedWindow;
+typedef struct _CompImageCacheEntry CompImageCacheEntry;
+typedef struct _CompImageCacheWatch CompImageCacheWatch;
+typedef struct _CompMatchInstruction CompMatchInstruction;
 
 struct _CompMatch {
     CompDisplay *display;
     CompMatchOp *op;
     int		nOp;
+
+    /* flattened form of the op tree built by matchUpdate */
+    CompMatchInstruction *code;
+    int			 nCode;
+    unsigned int	 id;
+    unsigned int	 properties;
 };
 
 typedef struct {
@@ -640,8 +662,9 @@ typedef struct _CompTimeout {
     struct _CompTimeout *next;
     int			minTime;
     int			maxTime;
-    int			minLeft;
-    int			maxLeft;
+    struct timeval	minDeadline;
+    struct timeval	maxDeadline;
+    int			heapIndex;
     CallBackProc	callBack;
     void		*closure;
     CompTimeoutHandle   handle;
@@ -670,8 +693,11 @@ struct _CompCore {
     CompFileWatch	*fileWatch;
     CompFileWatchHandle lastFileWatchHandle;
 
-    CompTimeout       *timeouts;
-    struct timeval    lastTimeout;
+    CompTimeout       **timeouts;
+    int		      nTimeout;
+    int		      timeoutSize;
+    CompTimeout       **timeoutHash;
+    int		      timeoutHashSize;
     CompTimeoutHandle lastTimeoutHandle;
 
     CompWatchFd       *watchFds;
@@ -774,7 +800,11 @@ removeFileWatch (CompFileWatchHandle handle);
 #define COMP_DISPLAY_OPTION_IGNORE_HINTS_WHEN_MAXIMIZED      31
 #define COMP_DISPLAY_OPTION_PING_DELAY			     32
 #define COMP_DISPLAY_OPTION_EDGE_DELAY                       33
-#define COMP_DISPLAY_OPTION_NUM				     34
+#define COMP_DISPLAY_OPTION_PAINT_PROFILE                    34
+#define COMP_DISPLAY_OPTION_PAINT_PROFILE_FILE               35
+#define COMP_DISPLAY_OPTION_DUMP_PAINT_PROFILE_KEY           36
+#define COMP_DISPLAY_OPTION_IMAGE_CACHE_SIZE                 37
+#define COMP_DISPLAY_OPTION_NUM				     38
 
 typedef void (*HandleEventProc) (CompDisplay *display,
 				 XEvent	     *event);
@@ -832,10 +862,24 @@ typedef Bool (*CompMatchExpEvalProc) (CompDisplay *display,
 				      CompWindow  *window,
 				      CompPrivate priv);
 
+#define MATCH_PROPERTY_TYPE_MASK	      (1 << 0)
+#define MATCH_PROPERTY_STATE_MASK	      (1 << 1)
+#define MATCH_PROPERTY_ID_MASK		      (1 << 2)
+#define MATCH_PROPERTY_OVERRIDE_REDIRECT_MASK (1 << 3)
+#define MATCH_PROPERTY_ALPHA_MASK	      (1 << 4)
+#define MATCH_PROPERTY_TITLE_MASK	      (1 << 5)
+#define MATCH_PROPERTY_ROLE_MASK	      (1 << 6)
+#define MATCH_PROPERTY_CLASS_MASK	      (1 << 7)
+#define MATCH_PROPERTY_NAME_MASK	      (1 << 8)
+
 typedef struct _CompMatchExp {
     CompMatchExpFiniProc fini;
     CompMatchExpEvalProc eval;
     CompPrivate		 priv;
+
+    /* window properties the result depends on, results of matches
+       using expressions that leave this zero are never cached */
+    unsigned int properties;
 } CompMatchExp;
 
 typedef struct _CompMatchExpOp {
@@ -852,6 +896,14 @@ union _CompMatchOp {
     CompMatchExpOp   exp;
 };
 
+#define MATCH_CACHE_SIZE 32
+
+typedef struct _CompMatchCacheEntry {
+    unsigned int id;
+    unsigned int properties;
+    Bool	 value;
+} CompMatchCacheEntry;
+
 typedef void (*MatchInitExpProc) (CompDisplay  *display,
 				  CompMatchExp *exp,
 				  const char   *value);
@@ -1048,6 +1100,23 @@ struct _CompDisplay {
     CompOptionValue plugin;
     Bool	    dirtyPluginList;
 
+    /* set when some window has property updates pending */
+    Bool	 windowPropertiesPending;
+    Time	 pendingPropertyTime;
+    unsigned int propertyEvents;
+    unsigned int propertyUpdates;
+
+    /* windows fetched ahead of being added */
+    CompPrefetchedWindow *prefetchedWindows;
+    int			 nPrefetchedWindow;
+    CompPrefetchedWindow **prefetchHash;
+    int			 prefetchHashSize;
+
+    /* decoded images, most recently used first */
+    CompImageCacheEntry *imageCache;
+    CompImageCacheWatch *imageCacheWatches;
+    int			imageCacheSize;
+
     HandleEventProc       handleEvent;
     HandleCompizEventProc handleCompizEvent;
 
@@ -1164,6 +1233,9 @@ unsigned int
 keycodeToModifiers (CompDisplay *d,
 		    int         keycode);
 
+void
+compGetCurrentTime (struct timeval *tv);
+
 void
 eventLoop (void);
 
@@ -1265,6 +1337,17 @@ void
 clearTargetOutput (CompDisplay	*display,
 		   unsigned int mask);
 
+Bool
+deferPropertyNotify (CompDisplay *display,
+		     XEvent	 *event);
+
+void
+updatePendingWindowProperties (CompDisplay *display);
+
+void
+updatePendingPropertiesForEvent (CompDisplay *display,
+				 XEvent	     *event);
+
 /* paint.c */
 
 #define MULTIPLY_USHORT(us1, us2)		 \
@@ -1543,6 +1626,9 @@ addWindowGeometry (CompWindow *w,
 		   Region     region,
 		   Region     clip);
 
+void
+freeWindowGeometry (CompWindow *w);
+
 void
 drawWindowTexture (CompWindow		*w,
 		   CompTexture		*texture,
@@ -1569,6 +1655,9 @@ paintCursor (CompCursor		 *cursor,
 	     Region		 region,
 	     unsigned int	 mask);
 
+void
+invalidateScreenOcclusion (CompScreen *screen);
+
 /* texture.c */
 
 #define POWER_OF_TWO(v) ((v & (v - 1)) == 0)
@@ -1684,7 +1773,9 @@ disableTexture (CompScreen  *screen,
 #define COMP_SCREEN_OPTION_FOCUS_PREVENTION_MATCH 13
 #define COMP_SCREEN_OPTION_TEXTURE_COMPRESSION	  14
 #define COMP_SCREEN_OPTION_FORCE_INDEPENDENT      15
-#define COMP_SCREEN_OPTION_NUM		          16
+#define COMP_SCREEN_OPTION_DAMAGE_RECT_BUDGET	  16
+#define COMP_SCREEN_OPTION_BUFFER_AGE		  17
+#define COMP_SCREEN_OPTION_NUM		          18
 
 #ifndef GLX_EXT_texture_from_pixmap
 #define GLX_BIND_TO_TEXTURE_RGB_EXT        0x20D0
@@ -1729,6 +1820,10 @@ typedef void    (*GLXBindTexImageProc)    (Display	 *display,
 typedef void    (*GLXReleaseTexImageProc) (Display	 *display,
 					   GLXDrawable	 drawable,
 					   int		 buffer);
+#ifndef GLX_EXT_buffer_age
+#define GLX_BACK_BUFFER_AGE_EXT 0x20F4
+#endif
+
 typedef void    (*GLXQueryDrawableProc)   (Display	 *display,
 					   GLXDrawable	 drawable,
 					   int		 attribute,
@@ -1800,6 +1895,61 @@ typedef void (*GLFramebufferTexture2DProc) (GLenum target,
 					    GLint  level);
 typedef void (*GLGenerateMipmapProc) (GLenum target);
 
+#ifndef GL_ARB_vertex_buffer_object
+#define GL_ARRAY_BUFFER_ARB	  0x8892
+#define GL_DYNAMIC_DRAW_ARB	  0x88E8
+#endif
+
+typedef void (*GLGenBuffersProc) (GLsizei n,
+				  GLuint  *buffers);
+typedef void (*GLDeleteBuffersProc) (GLsizei	  n,
+				     const GLuint *buffers);
+typedef void (*GLBindBufferProc) (GLenum target,
+				  GLuint buffer);
+typedef void (*GLBufferDataProc) (GLenum	target,
+				  GLsizeiptr	size,
+				  const GLvoid	*data,
+				  GLenum	usage);
+typedef void (*GLBufferSubDataProc) (GLenum	      target,
+				     GLintptr	      offset,
+				     GLsizeiptr	      size,
+				     const GLvoid     *data);
+typedef GLvoid *(*GLMapBufferProc) (GLenum target,
+				    GLenum access);
+typedef GLboolean (*GLUnmapBufferProc) (GLenum target);
+
+#ifndef GL_ARB_pixel_buffer_object
+#define GL_PIXEL_PACK_BUFFER_ARB 0x88EB
+#endif
+
+#ifndef GL_STREAM_READ_ARB
+#define GL_STREAM_READ_ARB 0x88E1
+#define GL_READ_ONLY_ARB   0x88B8
+#endif
+
+#ifndef GL_ARB_timer_query
+#define GL_TIME_ELAPSED 0x88BF
+#define GL_TIMESTAMP    0x8E28
+#endif
+
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT		  0x8866
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+typedef void (*GLGenQueriesProc) (GLsizei n,
+				  GLuint  *ids);
+typedef void (*GLDeleteQueriesProc) (GLsizei      n,
+				     const GLuint *ids);
+typedef void (*GLQueryCounterProc) (GLuint id,
+				    GLenum target);
+typedef void (*GLGetQueryObjectivProc) (GLuint id,
+					GLenum pname,
+					GLint  *params);
+typedef void (*GLGetQueryObjectui64vProc) (GLuint   id,
+					   GLenum   pname,
+					   uint64_t *params);
+
 #define MAX_DEPTH 32
 
 typedef void (*EnterShowDesktopModeProc) (CompScreen *screen);
@@ -1984,6 +2134,12 @@ typedef struct _CompActiveWindowHistory {
     int    activeNum;
 } CompActiveWindowHistory;
 
+#define FRAGMENT_PROGRAM_HASH_SIZE 64
+
+#define BUFFER_AGE_HISTORY 4
+
+#define FRAME_HISTORY_SIZE 16
+
 struct _CompScreen {
     CompObject base;
 
@@ -1992,6 +2148,11 @@ struct _CompScreen {
     CompWindow	*windows;
     CompWindow	*reverseWindows;
 
+    CompWindow	 **windowHash;
+    CompWindow	 **frameHash;
+    unsigned int windowHashSize;
+    unsigned int nHashedWindows;
+
     char *windowPrivateIndices;
     int  windowPrivateLen;
 
@@ -2023,6 +2184,10 @@ struct _CompScreen {
     GLint	      maxTextureSize;
     int		      fbo;
     int		      fragmentProgram;
+    int		      timerQuery;
+    int		      vbo;
+    int		      pbo;
+    int		      bufferAge;
     int		      maxTextureUnits;
     Cursor	      invisibleCursor;
     XRectangle        *exposeRects;
@@ -2088,6 +2253,7 @@ struct _CompScreen {
     int		   rasterX;
     int		   rasterY;
     struct timeval lastRedraw;
+    struct timeval lastSwap;
     int		   nextRedraw;
     int		   redrawTime;
     int		   optimalRedrawTime;
@@ -2097,10 +2263,56 @@ struct _CompScreen {
     int		   timeLeft;
     Bool	   pendingCommands;
 
+    /* rolling history of paint and swap durations in microseconds */
+    int		 paintTimeHistory[FRAME_HISTORY_SIZE];
+    int		 swapTimeHistory[FRAME_HISTORY_SIZE];
+    int		 frameHistoryIndex;
+    int		 predictedPaintTime;
+    unsigned int frameCount;
+    unsigned int missedFrameCount;
+
+    /* opaque coverage from the last occlusion pass, see
+       invalidateScreenOcclusion */
+    Bool	 occlusionValid;
+    unsigned int occlusionSerial;
+    Region	 occlusion;
+    CompWindow	 *occlusionFullscreenWindow;
+    WalkInitProc occlusionWalkLast;
+    WalkStepProc occlusionWalkPrev;
+    int		 occlusionOffsetX;
+    int		 occlusionOffsetY;
+
     int lastFunctionId;
 
     CompFunction *fragmentFunctions;
+
+    /* fragment program cache, most recently used first */
     CompProgram  *fragmentPrograms;
+    CompProgram  *lastFragmentProgram;
+    CompProgram  *fragmentProgramHash[FRAGMENT_PROGRAM_HASH_SIZE];
+    int		 nFragmentProgram;
+    unsigned int fragmentProgramHits;
+    unsigned int fragmentProgramMisses;
+    unsigned int fragmentProgramEvictions;
+    int		 fragmentProgramCompileTime;
+    int		 fragmentProgramMaxCompileTime;
+
+    /* damage of the last BUFFER_AGE_HISTORY - 1 frames, newest at
+       damageHistoryIndex, used to repair back buffers of known age.
+       The slot after the newest holds the frame being painted */
+    Region	 damageHistory[BUFFER_AGE_HISTORY];
+    int		 damageHistoryIndex;
+    int		 damageHistoryCount;
+    unsigned int bufferAgeFrames;
+    unsigned int bufferAgeFullFrames;
+    unsigned int repaintFrames;
+    double	 repaintArea;
+    int		 maxRepaintArea;
+
+    /* programs read from the disk cache that aren't compiled yet */
+    CompStoredProgram *storedFragmentPrograms;
+    CompTimeoutHandle fragmentProgramPrewarmHandle;
+    char	      *fragmentProgramDriver;
 
     int saturateFunction[2][64];
 
@@ -2151,6 +2363,29 @@ struct _CompScreen {
     GLFramebufferTexture2DProc   framebufferTexture2D;
     GLGenerateMipmapProc         generateMipmap;
 
+    GLGenBuffersProc    genBuffers;
+    GLDeleteBuffersProc deleteBuffers;
+    GLBindBufferProc    bindBuffer;
+    GLBufferDataProc    bufferData;
+    GLBufferSubDataProc bufferSubData;
+    GLMapBufferProc     mapBuffer;
+    GLUnmapBufferProc   unmapBuffer;
+
+    /* vertex buffer shared by the geometry of all windows */
+    GLuint	 geometryBuffer;
+    int		 geometryBufferSize;
+    int		 geometryBufferUsed;
+    int		 geometryBufferLive;
+    unsigned int geometryBufferSerial;
+
+    GLGenQueriesProc	      genQueries;
+    GLDeleteQueriesProc	      deleteQueries;
+    GLQueryCounterProc	      queryCounter;
+    GLGetQueryObjectivProc    getQueryObjectiv;
+    GLGetQueryObjectui64vProc getQueryObjectui64v;
+
+    CompPaintProfile *paintProfile;
+
     GLXContext ctx;
 
     CompOption opt[COMP_SCREEN_OPTION_NUM];
@@ -2280,6 +2515,9 @@ damageScreenRegion (CompScreen *screen,
 void
 damageScreen (CompScreen *screen);
 
+int
+regionArea (Region region);
+
 void
 damagePendingOnScreen (CompScreen *s);
 
@@ -2292,6 +2530,18 @@ void
 unhookWindowFromScreen (CompScreen *s,
 			CompWindow *w);
 
+void
+hashWindow (CompWindow *w);
+
+void
+unhashWindow (CompWindow *w);
+
+void
+hashWindowFrame (CompWindow *w);
+
+void
+unhashWindowFrame (CompWindow *w);
+
 void
 forEachWindowOnScreen (CompScreen	 *screen,
 		       ForEachWindowProc proc,
@@ -2539,6 +2789,8 @@ struct _CompWindow {
     CompScreen *screen;
     CompWindow *next;
     CompWindow *prev;
+    CompWindow *hashNext;
+    CompWindow *frameHashNext;
 
     int		      refcnt;
     Window	      id;
@@ -2565,6 +2817,9 @@ struct _CompWindow {
     GLint	      height;
     Region	      region;
     Region	      clip;
+    Region	      occlusion;
+    unsigned int      occlusionSerial;
+    unsigned int      pendingProperties;
     unsigned int      wmType;
     unsigned int      type;
     unsigned int      state;
@@ -2661,6 +2916,25 @@ struct _CompWindow {
     int      texCoordSize;
     int      indexCount;
 
+    /* core geometry kept in the screen's shared vertex buffer */
+    Bool	 geometryValid;
+    unsigned int geometrySerial;
+    int		 geometryOffset;
+    int		 geometrySize;
+    int		 geometryCount;
+    CompMatrix	 geometryMatrix;
+    BoxRec	 geometryExtents;
+    Region	 geometryClip;
+    Bool	 geometryClipped;
+    Bool	 geometryScissor;
+
+    /* results of cacheable matches, indexed by match id */
+    CompMatchCacheEntry matchCache[MATCH_CACHE_SIZE];
+    unsigned int	matchCacheWmType;
+    unsigned int	matchCacheState;
+    Bool		matchCacheOverrideRedirect;
+    Bool		matchCacheAlpha;
+
     /* must be set by addWindowGeometry */
     DrawWindowGeometryProc drawWindowGeometry;
 
@@ -3246,6 +3520,133 @@ void
 disableFragmentAttrib (CompScreen     *s,
 		       FragmentAttrib *attrib);
 
+void
+loadFragmentProgramCache (CompScreen *s);
+
+void
+finiFragmentPrograms (CompScreen *s);
+
+
+/* imagecache.c */
+
+Bool
+readCachedImage (CompDisplay *display,
+		 const char  *name,
+		 int	     *width,
+		 int	     *height,
+		 void	     **data);
+
+void
+cacheImage (CompDisplay *display,
+	    const char	*path,
+	    const char	*name,
+	    int		width,
+	    int		height,
+	    const void	*data);
+
+void
+finiImageCache (CompDisplay *display);
+
+
+/* pixel.c */
+
+void
+premultiplyPixels (void *data,
+		   int  n);
+
+void
+swapRedBluePixels (void *data,
+		   int  n);
+
+void
+flipImage (void	      *dst,
+	   const void *src,
+	   int	      stride,
+	   int	      height);
+
+
+/* prefetch.c */
+
+void
+prefetchWindows (CompDisplay *display,
+		 Window	     *id,
+		 int	     nId);
+
+void
+releasePrefetchedWindows (CompDisplay *display);
+
+Status
+getWindowAttributes (CompDisplay       *display,
+		     Window	       id,
+		     XWindowAttributes *attrib);
+
+int
+getWindowProperty (CompDisplay	 *display,
+		   Window	 id,
+		   Atom		 property,
+		   long		 offset,
+		   long		 length,
+		   Atom		 type,
+		   Atom		 *actualType,
+		   int		 *format,
+		   unsigned long *nItems,
+		   unsigned long *bytesAfter,
+		   unsigned char **data);
+
+Status
+getWMNormalHints (CompDisplay *display,
+		  Window      id,
+		  XSizeHints  *hints,
+		  long	      *supplied);
+
+XWMHints *
+getWMHints (CompDisplay *display,
+	    Window	id);
+
+Status
+getClassHint (CompDisplay *display,
+	      Window	  id,
+	      XClassHint  *classHint);
+
+Status
+getTransientForHint (CompDisplay *display,
+		     Window	 id,
+		     Window	 *transientFor);
+
+Status
+getWMProtocols (CompDisplay *display,
+		Window	    id,
+		Atom	    **protocols,
+		int	    *count);
+
+
+/* profile.c */
+
+extern Bool paintProfileActive;
+
+void
+profileUnwrap (FuncPtr	  func,
+	       const char *hook);
+
+void
+profileWrap (FuncPtr	func,
+	     const char *hook);
+
+void
+profileCore (const char *name);
+
+void
+beginPaintProfile (CompScreen *s);
+
+void
+endPaintProfile (CompScreen *s);
+
+void
+finiPaintProfile (CompScreen *s);
+
+Bool
+writePaintProfile (const char *file);
+
 
 /* matrix.c */
 
@@ -3361,6 +3762,10 @@ void
 matchPropertyChanged (CompDisplay *display,
 		      CompWindow  *window);
 
+void
+invalidateWindowMatchCache (CompWindow   *window,
+			    unsigned int properties);
+
 
 /* metadata.c */
 
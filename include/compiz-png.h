@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _COMPIZ_PNG_H
+#define _COMPIZ_PNG_H
+
+#include <compiz-core.h>
+
+COMPIZ_BEGIN_DECLS
+
+#define PNG_ABIVERSION 20261017
+
+#define PNG_DISPLAY_OPTION_ABI   0
+#define PNG_DISPLAY_OPTION_INDEX 1
+#define PNG_DISPLAY_OPTION_NUM   2
+
+/* encodes the image and writes it to file, unlike writeImageToFile it
+   never goes through the display hooks and may be called from any
+   thread */
+typedef Bool (*PngWriteFileProc) (const char *file,
+				  int	     width,
+				  int	     height,
+				  int	     stride,
+				  void	     *data);
+
+typedef struct _PngDisplay {
+    FileToImageProc fileToImage;
+    ImageToFileProc imageToFile;
+
+    PngWriteFileProc writeFile;
+
+    CompOption opt[PNG_DISPLAY_OPTION_NUM];
+} PngDisplay;
+
+#define GET_PNG_DISPLAY(d)					    \
+    ((PngDisplay *) (d)->base.privates[pngDisplayPrivateIndex].ptr)
+
+#define PNG_DISPLAY(d)			 \
+    PngDisplay *pd = GET_PNG_DISPLAY (d)
+
+COMPIZ_END_DECLS
+
+#endif
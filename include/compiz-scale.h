@@ -30,7 +30,7 @@
 
 COMPIZ_BEGIN_DECLS
 
-#define SCALE_ABIVERSION 20081007
+#define SCALE_ABIVERSION 20261018
 
 #define SCALE_STATE_NONE 0
 #define SCALE_STATE_OUT  1
@@ -46,6 +46,11 @@ COMPIZ_BEGIN_DECLS
 #define SCALE_MOMODE_ALL     1
 #define SCALE_MOMODE_LAST    SCALE_MOMODE_ALL
 
+#define SCALE_LAYOUT_GRID    0
+#define SCALE_LAYOUT_ROWS    1
+#define SCALE_LAYOUT_NATURAL 2
+#define SCALE_LAYOUT_LAST    SCALE_LAYOUT_NATURAL
+
 typedef struct _ScaleSlot {
     int   x1, y1, x2, y2;
     int   filled;
@@ -102,7 +107,9 @@ typedef struct _ScaleDisplay {
 #define SCALE_SCREEN_OPTION_ICON             6
 #define SCALE_SCREEN_OPTION_HOVER_TIME       7
 #define SCALE_SCREEN_OPTION_MULTIOUTPUT_MODE 8
-#define SCALE_SCREEN_OPTION_NUM              9
+#define SCALE_SCREEN_OPTION_MIPMAP           9
+#define SCALE_SCREEN_OPTION_LAYOUT           10
+#define SCALE_SCREEN_OPTION_NUM              11
 
 typedef enum {
     ScaleTypeNormal = 0,
@@ -131,6 +138,7 @@ typedef struct _ScaleScreen {
     DonePaintScreenProc    donePaintScreen;
     PaintOutputProc        paintOutput;
     PaintWindowProc        paintWindow;
+    DrawWindowTextureProc  drawWindowTexture;
     DamageWindowRectProc   damageWindowRect;
 
     ScaleLayoutSlotsAndAssignWindowsProc layoutSlotsAndAssignWindows;
@@ -169,6 +177,8 @@ typedef struct _ScaleScreen {
 
     CompMatch match;
     CompMatch *currentMatch;
+
+    GLuint fbo;
 } ScaleScreen;
 
 typedef struct _ScaleWindow {
@@ -184,6 +194,12 @@ typedef struct _ScaleWindow {
     Bool    adjust;
 
     float lastThumbOpacity;
+
+    /* downscaled copy of the window texture, used when the window
+       texture itself cannot be mipmapped */
+    CompTexture thumbnail;
+    int		thumbWidth, thumbHeight;
+    int		thumbLevel;
 } ScaleWindow;
 
 #define GET_SCALE_DISPLAY(d)						\
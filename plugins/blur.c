@@ -40,7 +40,10 @@ static CompMetadata blurMetadata;
 #define BLUR_FILTER_4X_BILINEAR 0
 #define BLUR_FILTER_GAUSSIAN    1
 #define BLUR_FILTER_MIPMAP      2
-#define BLUR_FILTER_LAST	BLUR_FILTER_MIPMAP
+#define BLUR_FILTER_DUAL        3
+#define BLUR_FILTER_LAST	BLUR_FILTER_DUAL
+
+#define BLUR_DUAL_LEVELS_MAX 6
 
 typedef struct _BlurFunction {
     struct _BlurFunction *next;
@@ -104,7 +107,10 @@ typedef struct _BlurDisplay {
 #define BLUR_SCREEN_OPTION_SATURATION        9
 #define BLUR_SCREEN_OPTION_BLUR_OCCLUSION    10
 #define BLUR_SCREEN_OPTION_INDEPENDENT_TEX   11
-#define BLUR_SCREEN_OPTION_NUM		     12
+#define BLUR_SCREEN_OPTION_DUAL_ITERATIONS   12
+#define BLUR_SCREEN_OPTION_DUAL_OFFSET       13
+#define BLUR_SCREEN_OPTION_CACHE             14
+#define BLUR_SCREEN_OPTION_NUM		     15
 
 typedef struct _BlurScreen {
     int	windowPrivateIndex;
@@ -119,9 +125,6 @@ typedef struct _BlurScreen {
     DrawWindowProc	         drawWindow;
     DrawWindowTextureProc        drawWindowTexture;
 
-    WindowResizeNotifyProc windowResizeNotify;
-    WindowMoveNotifyProc   windowMoveNotify;
-
     Bool alphaBlur;
 
     int	 blurTime;
@@ -138,7 +141,13 @@ typedef struct _BlurScreen {
     Region tmpRegion;
     Region tmpRegion2;
     Region tmpRegion3;
-    Region occlusion;
+
+    /* blur regions above the current window in the occlusion pass
+       with serial occlusionSerial, useClip is false while painting
+       without occlusion detection */
+    Region	 occlusion;
+    unsigned int occlusionSerial;
+    Bool	 useClip;
 
     BoxRec stencilBox;
     GLint  stencilBits;
@@ -163,6 +172,20 @@ typedef struct _BlurScreen {
     float pos[BLUR_GAUSSIAN_RADIUS_MAX];
     int	  numTexop;
 
+    /* half, quarter, ... resolution copies of texture[0] used by the
+       dual filter */
+    GLuint pyramid[BLUR_DUAL_LEVELS_MAX];
+    int	   pyramidWidth[BLUR_DUAL_LEVELS_MAX];
+    int	   pyramidHeight[BLUR_DUAL_LEVELS_MAX];
+    int	   numLevels;
+    GLuint downProgram;
+    GLuint upProgram;
+
+    /* window whose cached blur is currently in the filter textures,
+       cacheSerial changes whenever all caches become stale */
+    CompWindow	 *cacheOwner;
+    unsigned int cacheSerial;
+
     CompTransform mvp;
 } BlurScreen;
 
@@ -174,8 +197,25 @@ typedef struct _BlurWindow {
     BlurState state[BLUR_STATE_NUM];
     Bool      propSet[BLUR_STATE_NUM];
 
-    Region region;
-    Region clip;
+    /* blur region in screen coordinates, it was built for the size
+       and frame extents below and translated to regionX, regionY */
+    Region	      region;
+    int		      regionX, regionY;
+    int		      regionWidth, regionHeight;
+    CompWindowExtents regionOutput;
+
+    /* blur regions above the window, valid for occlusion pass
+       clipSerial */
+    Region	 clip;
+    unsigned int clipSerial;
+
+    /* filtered background from the last update, sampled texels of
+       cacheRegion are stored at cacheX, cacheY in the filter output */
+    GLuint	 cacheTexture;
+    int		 cacheX, cacheY;
+    int		 cacheWidth, cacheHeight;
+    unsigned int cacheSerial;
+    Region	 cacheRegion;
 } BlurWindow;
 
 #define GET_BLUR_CORE(c)				    \
@@ -280,6 +320,35 @@ blurCreateGaussianLinearKernel (int   radius,
     return radius;
 }
 
+/* Number of texels around the blurred boxes each level of the dual
+   filter pyramid must be valid for, level 0 being the screen copy.
+   up[i] is what the upsample from level i + 1, or the window fragment
+   function for level 1, needs. down[i] is what the downsample into
+   level i + 1 needs. Both include the footprint of bilinear sampling. */
+static void
+blurDualMargins (BlurScreen *bs,
+		 int	    n,
+		 int	    *down,
+		 int	    *up)
+{
+    float offset = bs->opt[BLUR_SCREEN_OPTION_DUAL_OFFSET].value.f;
+    int   upReach, downReach, i;
+
+    /* upsampling reads the coarser level offset texels away,
+       downsampling reads the finer level half as far */
+    upReach   = ceilf (offset) + 1;
+    downReach = ceilf (offset * 0.5f) + 1;
+
+    up[0] = 0;
+    up[1] = upReach;
+    for (i = 2; i <= n; i++)
+	up[i] = (up[i - 1] + 1) / 2 + upReach;
+
+    down[n] = up[n];
+    for (i = n - 1; i >= 0; i--)
+	down[i] = down[i + 1] * 2 + downReach;
+}
+
 static void
 blurUpdateFilterRadius (CompScreen *s)
 {
@@ -303,6 +372,16 @@ blurUpdateFilterRadius (CompScreen *s)
 
 	bs->filterRadius = powf (2.0f, ceilf (lod));
     } break;
+    case BLUR_FILTER_DUAL: {
+	int n = bs->opt[BLUR_SCREEN_OPTION_DUAL_ITERATIONS].value.i;
+	int down[BLUR_DUAL_LEVELS_MAX + 1], up[BLUR_DUAL_LEVELS_MAX + 1];
+
+	blurDualMargins (bs, n, down, up);
+
+	/* the first downsample pass reads the screen copy this far
+	   around the blurred boxes */
+	bs->filterRadius = down[0];
+    } break;
     }
 }
 
@@ -341,6 +420,18 @@ blurReset (CompScreen *s)
 	(*s->deletePrograms) (1, &bs->program);
 	bs->program = 0;
     }
+
+    if (bs->downProgram)
+    {
+	(*s->deletePrograms) (1, &bs->downProgram);
+	bs->downProgram = 0;
+    }
+
+    if (bs->upProgram)
+    {
+	(*s->deletePrograms) (1, &bs->upProgram);
+	bs->upProgram = 0;
+    }
 }
 
 static Region
@@ -480,6 +571,60 @@ blurWindowUpdateRegion (CompWindow *w)
 	bw->region = region;
 	XOffsetRegion (bw->region, w->attrib.x, w->attrib.y);
     }
+
+    bw->regionX	     = w->attrib.x;
+    bw->regionY	     = w->attrib.y;
+    bw->regionWidth  = w->width;
+    bw->regionHeight = w->height;
+    bw->regionOutput = w->output;
+
+    /* clip regions of windows below depend on it */
+    invalidateScreenOcclusion (w->screen);
+}
+
+/* Returns the blur region of a window. Moves only translate it, and
+   only once it's needed. It's rebuilt from the blur properties when
+   the size or frame extents have changed since it was built. */
+static Region
+blurWindowRegion (CompWindow *w)
+{
+    BLUR_WINDOW (w);
+
+    if (bw->regionWidth  != w->width  ||
+	bw->regionHeight != w->height ||
+	memcmp (&bw->regionOutput, &w->output, sizeof (CompWindowExtents)))
+    {
+	if (bw->state[BLUR_STATE_CLIENT].threshold ||
+	    bw->state[BLUR_STATE_DECOR].threshold)
+	    blurWindowUpdateRegion (w);
+    }
+    else if (bw->regionX != w->attrib.x || bw->regionY != w->attrib.y)
+    {
+	if (bw->region)
+	    XOffsetRegion (bw->region,
+			   w->attrib.x - bw->regionX,
+			   w->attrib.y - bw->regionY);
+
+	bw->regionX = w->attrib.x;
+	bw->regionY = w->attrib.y;
+    }
+
+    return bw->region;
+}
+
+/* Returns the blur regions above a window from the occlusion pass
+   that the current paint is using */
+static Region
+blurWindowClip (CompWindow *w)
+{
+    BLUR_SCREEN (w->screen);
+    BLUR_WINDOW (w);
+
+    if (bs->blurOcclusion || !bs->useClip ||
+	bw->clipSerial != w->screen->occlusionSerial)
+	return &emptyRegion;
+
+    return bw->clip;
 }
 
 static void
@@ -661,6 +806,38 @@ blurSetScreenOption (CompPlugin      *plugin,
 	    return TRUE;
 	}
 	break;
+    case BLUR_SCREEN_OPTION_DUAL_ITERATIONS:
+	if (compSetIntOption (o, value))
+	{
+	    filter = bs->opt[BLUR_SCREEN_OPTION_FILTER].value.i;
+	    if (filter == BLUR_FILTER_DUAL)
+	    {
+		blurReset (screen);
+		damageScreen (screen);
+	    }
+	    return TRUE;
+	}
+	break;
+    case BLUR_SCREEN_OPTION_DUAL_OFFSET:
+	if (compSetFloatOption (o, value))
+	{
+	    filter = bs->opt[BLUR_SCREEN_OPTION_FILTER].value.i;
+	    if (filter == BLUR_FILTER_DUAL)
+	    {
+		blurReset (screen);
+		damageScreen (screen);
+	    }
+	    return TRUE;
+	}
+	break;
+    case BLUR_SCREEN_OPTION_CACHE:
+	if (compSetBoolOption (o, value))
+	{
+	    blurReset (screen);
+	    damageScreen (screen);
+	    return TRUE;
+	}
+	break;
     case BLUR_SCREEN_OPTION_SATURATION:
 	if (compSetIntOption (o, value))
 	{
@@ -834,28 +1011,52 @@ blurPreparePaintScreen (CompScreen *s,
     (*s->preparePaintScreen) (s, msSinceLastPaint);
     WRAP (bs, s, preparePaintScreen, blurPreparePaintScreen);
 
+    /* cached blur stays valid where damage expanded by the filter
+       radius doesn't reach */
+    if (s->damageMask & COMP_SCREEN_DAMAGE_ALL_MASK)
+    {
+	bs->cacheSerial++;
+	bs->cacheOwner = NULL;
+    }
+    else if (s->damageMask & COMP_SCREEN_DAMAGE_REGION_MASK)
+    {
+	CompWindow *w;
+
+	XSubtractRegion (s->damage, &emptyRegion, bs->tmpRegion);
+	XShrinkRegion (bs->tmpRegion, -bs->filterRadius, -bs->filterRadius);
+
+	for (w = s->windows; w; w = w->next)
+	{
+	    BLUR_WINDOW (w);
+
+	    if (bw->cacheRegion->numRects)
+		XSubtractRegion (bw->cacheRegion, bs->tmpRegion,
+				 bw->cacheRegion);
+	}
+    }
+
     if (s->damageMask & COMP_SCREEN_DAMAGE_REGION_MASK)
     {
 	/* walk from bottom to top and expand damage */
 	if (bs->alphaBlur)
 	{
 	    CompWindow *w;
+	    Region     region;
 	    int	       x1, y1, x2, y2;
 	    int	       count = 0;
 
 	    for (w = s->windows; w; w = w->next)
 	    {
-		BLUR_WINDOW (w);
-
 		if (w->attrib.map_state != IsViewable || !w->damaged)
 		    continue;
 
-		if (bw->region)
+		region = blurWindowRegion (w);
+		if (region)
 		{
-		    x1 = bw->region->extents.x1 - bs->filterRadius;
-		    y1 = bw->region->extents.y1 - bs->filterRadius;
-		    x2 = bw->region->extents.x2 + bs->filterRadius;
-		    y2 = bw->region->extents.y2 + bs->filterRadius;
+		    x1 = region->extents.x1 - bs->filterRadius;
+		    y1 = region->extents.y1 - bs->filterRadius;
+		    x2 = region->extents.x2 + bs->filterRadius;
+		    y2 = region->extents.y2 + bs->filterRadius;
 
 		    if (x1 < s->damage->extents.x2 &&
 			y1 < s->damage->extents.y2 &&
@@ -908,18 +1109,8 @@ blurPaintOutput (CompScreen		 *s,
 	}
     }
 
-    if (!bs->blurOcclusion)
-    {
-	CompWindow *w;
-
-	XSubtractRegion (&emptyRegion, &emptyRegion, bs->occlusion);
-
-	for (w = s->windows; w; w = w->next)
-	    XSubtractRegion (&emptyRegion, &emptyRegion,
-			     GET_BLUR_WINDOW (w, bs)->clip);
-    }
-
-    bs->output = output;
+    bs->useClip = !(mask & PAINT_SCREEN_NO_OCCLUSION_DETECTION_MASK);
+    bs->output  = output;
 
     UNWRAP (bs, s, paintOutput);
     status = (*s->paintOutput) (s, sAttrib, transform, region, output, mask);
@@ -938,16 +1129,7 @@ blurPaintTransformedOutput (CompScreen		    *s,
 {
     BLUR_SCREEN (s);
 
-    if (!bs->blurOcclusion)
-    {
-	CompWindow *w;
-
-	XSubtractRegion (&emptyRegion, &emptyRegion, bs->occlusion);
-
-	for (w = s->windows; w; w = w->next)
-	    XSubtractRegion (&emptyRegion, &emptyRegion,
-			     GET_BLUR_WINDOW (w, bs)->clip);
-    }
+    bs->useClip = !(mask & PAINT_SCREEN_NO_OCCLUSION_DETECTION_MASK);
 
     UNWRAP (bs, s, paintTransformedOutput);
     (*s->paintTransformedOutput) (s, sAttrib, transform,
@@ -995,13 +1177,29 @@ blurPaintWindow (CompWindow		 *w,
     status = (*s->paintWindow) (w, attrib, transform, region, mask);
     WRAP (bs, s, paintWindow, blurPaintWindow);
 
+    /* the core keeps the result of an occlusion pass until stacking or
+       geometry changes, clip regions from that pass are kept as well */
     if (!bs->blurOcclusion && (mask & PAINT_WINDOW_OCCLUSION_DETECTION_MASK))
     {
-	XSubtractRegion (bs->occlusion, &emptyRegion, bw->clip);
+	Region region;
+
+	if (bs->occlusionSerial != s->occlusionSerial)
+	{
+	    XSubtractRegion (&emptyRegion, &emptyRegion, bs->occlusion);
+	    bs->occlusionSerial = s->occlusionSerial;
+	}
+
+	/* only windows that blur use their clip region */
+	region = blurWindowRegion (w);
+	if (region)
+	{
+	    XSubtractRegion (bs->occlusion, &emptyRegion, bw->clip);
+	    bw->clipSerial = s->occlusionSerial;
 
-	if (!(w->lastMask & PAINT_WINDOW_NO_CORE_INSTANCE_MASK) &&
-	    !(w->lastMask & PAINT_WINDOW_TRANSFORMED_MASK) && bw->region)
-	    XUnionRegion (bs->occlusion, bw->region, bs->occlusion);
+	    if (!(w->lastMask & PAINT_WINDOW_NO_CORE_INSTANCE_MASK) &&
+		!(w->lastMask & PAINT_WINDOW_TRANSFORMED_MASK))
+		XUnionRegion (bs->occlusion, region, bs->occlusion);
+	}
     }
 
     return status;
@@ -1311,6 +1509,67 @@ getDstBlurFragmentFunction (CompScreen  *s,
 
 	    ok &= addDataOpToFunctionData (data, str);
 	    break;
+	case BLUR_FILTER_DUAL: {
+	    static char *filterTemp[] = {
+		"t0", "t1", "t2", "t3",
+		"s0", "s1", "s2", "s3"
+	    };
+
+	    for (i = 0; i < sizeof (filterTemp) / sizeof (filterTemp[0]); i++)
+		ok &= addTempHeaderOpToFunctionData (data, filterTemp[i]);
+
+	    ok &= addFetchOpToFunctionData (data, "output", NULL, target);
+	    ok &= addColorOpToFunctionData (data, "output", "output");
+
+	    snprintf (str, 1024,
+		      "MUL fCoord, fragment.position, program.env[%d];",
+		      param);
+
+	    ok &= addDataOpToFunctionData (data, str);
+
+	    /* final upsample from the first pyramid level */
+	    snprintf (str, 1024,
+		      "MAD t0, program.env[%d], { -2.0, 0.0, 0.0, 0.0 }, fCoord;"
+		      "MAD t1, program.env[%d], { 2.0, 0.0, 0.0, 0.0 }, fCoord;"
+		      "MAD t2, program.env[%d], { 0.0, -2.0, 0.0, 0.0 }, fCoord;"
+		      "MAD t3, program.env[%d], { 0.0, 2.0, 0.0, 0.0 }, fCoord;"
+		      "TEX s0, t0, texture[%d], %s;"
+		      "TEX s1, t1, texture[%d], %s;"
+		      "TEX s2, t2, texture[%d], %s;"
+		      "TEX s3, t3, texture[%d], %s;"
+		      "ADD sum, s0, s1;"
+		      "ADD sum, sum, s2;"
+		      "ADD sum, sum, s3;",
+
+		      param + 2, param + 2, param + 2, param + 2,
+		      unit, targetString, unit, targetString,
+		      unit, targetString, unit, targetString);
+
+	    ok &= addDataOpToFunctionData (data, str);
+
+	    snprintf (str, 1024,
+		      "ADD t0, fCoord, program.env[%d];"
+		      "SUB t1, fCoord, program.env[%d];"
+		      "MAD t2, program.env[%d], { -1.0, 1.0, 0.0, 0.0 }, fCoord;"
+		      "MAD t3, program.env[%d], { 1.0, -1.0, 0.0, 0.0 }, fCoord;"
+		      "TEX s0, t0, texture[%d], %s;"
+		      "TEX s1, t1, texture[%d], %s;"
+		      "TEX s2, t2, texture[%d], %s;"
+		      "TEX s3, t3, texture[%d], %s;"
+		      "ADD s0, s0, s1;"
+		      "ADD s0, s0, s2;"
+		      "ADD s0, s0, s3;"
+		      "MAD sum, s0, 2.0, sum;"
+		      "MUL sum, sum, %f;"
+		      "MUL_SAT mask, output.a, program.env[%d];",
+
+		      param + 2, param + 2, param + 2, param + 2,
+		      unit, targetString, unit, targetString,
+		      unit, targetString, unit, targetString,
+		      1.0f / 12.0f, param + 1);
+
+	    ok &= addDataOpToFunctionData (data, str);
+	} break;
 	}
 
 	if (saturation < 100)
@@ -1532,7 +1791,10 @@ loadFilterProgram (CompScreen *s, int numITC)
 }
 
 static int
-fboPrologue (CompScreen *s)
+fboPrologue (CompScreen *s,
+	     GLuint	texture,
+	     int	width,
+	     int	height)
 {
     BLUR_SCREEN (s);
 
@@ -1541,14 +1803,14 @@ fboPrologue (CompScreen *s)
 
     (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, bs->fbo);
 
-    /* bind texture and check status the first time */
+    (*s->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
+				GL_COLOR_ATTACHMENT0_EXT,
+				bs->target, texture,
+				0);
+
+    /* check status the first time, all our textures share one format */
     if (!bs->fboStatus)
     {
-	(*s->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
-				    GL_COLOR_ATTACHMENT0_EXT,
-				    bs->target, bs->texture[1],
-				    0);
-
 	bs->fboStatus = (*s->checkFramebufferStatus) (GL_FRAMEBUFFER_EXT);
 	if (bs->fboStatus != GL_FRAMEBUFFER_COMPLETE_EXT)
 	{
@@ -1574,11 +1836,11 @@ fboPrologue (CompScreen *s)
     glDisable (GL_CLIP_PLANE2);
     glDisable (GL_CLIP_PLANE3);
 
-    glViewport (0, 0, bs->width, bs->height);
+    glViewport (0, 0, width, height);
     glMatrixMode (GL_PROJECTION);
     glPushMatrix ();
     glLoadIdentity ();
-    glOrtho (0.0, bs->width, 0.0, bs->height, -1.0, 1.0);
+    glOrtho (0.0, width, 0.0, height, -1.0, 1.0);
     glMatrixMode (GL_MODELVIEW);
     glPushMatrix ();
     glLoadIdentity ();
@@ -1630,7 +1892,7 @@ fboUpdate (CompScreen *s,
 	if (!loadFilterProgram (s, iTC))
 	    return FALSE;
 
-    if (!fboPrologue (s))
+    if (!fboPrologue (s, bs->texture[1], bs->width, bs->height))
 	return FALSE;
 
     glDisable (GL_CULL_FACE);
@@ -1719,6 +1981,242 @@ fboUpdate (CompScreen *s,
     return TRUE;
 }
 
+/* Texture coordinate scale of pyramid level, level 0 being texture[0] */
+static void
+blurLevelScale (BlurScreen *bs,
+		int	   level,
+		float	   *tx,
+		float	   *ty)
+{
+    if (bs->target != GL_TEXTURE_2D)
+    {
+	*tx = *ty = 1.0f;
+    }
+    else if (level)
+    {
+	*tx = 1.0f / bs->pyramidWidth[level - 1];
+	*ty = 1.0f / bs->pyramidHeight[level - 1];
+    }
+    else
+    {
+	*tx = bs->tx;
+	*ty = bs->ty;
+    }
+}
+
+static Bool
+loadDualFilterPrograms (CompScreen *s)
+{
+    char buffer[2048];
+    char *targetString;
+
+    BLUR_SCREEN (s);
+
+    if (bs->target == GL_TEXTURE_2D)
+	targetString = "2D";
+    else
+	targetString = "RECT";
+
+    /* the 5 tap downsample filter, program.env[0] holds the sample
+       offset in source texture coordinates */
+    if (!bs->downProgram)
+    {
+	snprintf (buffer, sizeof (buffer),
+		  "!!ARBfp1.0"
+		  "PARAM offset = program.env[0];"
+		  "ATTRIB texcoord = fragment.texcoord[0];"
+		  "TEMP sum, t0, t1, t2, t3, s0, s1, s2, s3;"
+		  "ADD t0, texcoord, offset;"
+		  "SUB t1, texcoord, offset;"
+		  "MAD t2, offset, { -1.0, 1.0, 0.0, 0.0 }, texcoord;"
+		  "MAD t3, offset, { 1.0, -1.0, 0.0, 0.0 }, texcoord;"
+		  "TEX sum, texcoord, texture[0], %s;"
+		  "TEX s0, t0, texture[0], %s;"
+		  "TEX s1, t1, texture[0], %s;"
+		  "TEX s2, t2, texture[0], %s;"
+		  "TEX s3, t3, texture[0], %s;"
+		  "MUL sum, sum, 4.0;"
+		  "ADD sum, sum, s0;"
+		  "ADD sum, sum, s1;"
+		  "ADD sum, sum, s2;"
+		  "ADD sum, sum, s3;"
+		  "MUL result.color, sum, 0.125;"
+		  "END",
+		  targetString, targetString, targetString,
+		  targetString, targetString);
+
+	if (!loadFragmentProgram (s, &bs->downProgram, buffer))
+	    return FALSE;
+    }
+
+    /* the 8 tap upsample filter */
+    if (!bs->upProgram)
+    {
+	snprintf (buffer, sizeof (buffer),
+		  "!!ARBfp1.0"
+		  "PARAM offset = program.env[0];"
+		  "ATTRIB texcoord = fragment.texcoord[0];"
+		  "TEMP sum, t0, t1, t2, t3, s0, s1, s2, s3;"
+		  "MAD t0, offset, { -2.0, 0.0, 0.0, 0.0 }, texcoord;"
+		  "MAD t1, offset, { 2.0, 0.0, 0.0, 0.0 }, texcoord;"
+		  "MAD t2, offset, { 0.0, -2.0, 0.0, 0.0 }, texcoord;"
+		  "MAD t3, offset, { 0.0, 2.0, 0.0, 0.0 }, texcoord;"
+		  "TEX s0, t0, texture[0], %s;"
+		  "TEX s1, t1, texture[0], %s;"
+		  "TEX s2, t2, texture[0], %s;"
+		  "TEX s3, t3, texture[0], %s;"
+		  "ADD sum, s0, s1;"
+		  "ADD sum, sum, s2;"
+		  "ADD sum, sum, s3;"
+		  "ADD t0, texcoord, offset;"
+		  "SUB t1, texcoord, offset;"
+		  "MAD t2, offset, { -1.0, 1.0, 0.0, 0.0 }, texcoord;"
+		  "MAD t3, offset, { 1.0, -1.0, 0.0, 0.0 }, texcoord;"
+		  "TEX s0, t0, texture[0], %s;"
+		  "TEX s1, t1, texture[0], %s;"
+		  "TEX s2, t2, texture[0], %s;"
+		  "TEX s3, t3, texture[0], %s;"
+		  "ADD s0, s0, s1;"
+		  "ADD s0, s0, s2;"
+		  "ADD s0, s0, s3;"
+		  "MAD sum, s0, 2.0, sum;"
+		  "MUL result.color, sum, %f;"
+		  "END",
+		  targetString, targetString, targetString, targetString,
+		  targetString, targetString, targetString, targetString,
+		  1.0f / 12.0f);
+
+	if (!loadFragmentProgram (s, &bs->upProgram, buffer))
+	    return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Renders level dst of the pyramid from level src with the currently
+   bound program. Boxes are in screen coordinates and are scaled down to
+   the destination level, then grown by margin texels so that the next
+   pass only reads texels this frame has rendered. */
+static Bool
+fboDualPass (CompScreen *s,
+	     int	src,
+	     int	dst,
+	     int	margin,
+	     BoxPtr	pBox,
+	     int	nBox)
+{
+    float tx, ty, scale;
+    int   width, height, shift, round;
+    int   x1, y1, x2, y2;
+
+    BLUR_SCREEN (s);
+
+    width  = bs->pyramidWidth[dst - 1];
+    height = bs->pyramidHeight[dst - 1];
+
+    if (!fboPrologue (s, bs->pyramid[dst - 1], width, height))
+	return FALSE;
+
+    glBindTexture (bs->target, src ? bs->pyramid[src - 1] : bs->texture[0]);
+
+    blurLevelScale (bs, src, &tx, &ty);
+
+    /* sample at half a source texel times the offset option */
+    scale = 0.5f * bs->opt[BLUR_SCREEN_OPTION_DUAL_OFFSET].value.f;
+
+    (*s->programEnvParameter4f) (GL_FRAGMENT_PROGRAM_ARB, 0,
+				 scale * tx, scale * ty, 0.0f, 0.0f);
+
+    /* destination texel coordinate times scale is the source one */
+    scale = (src > dst) ? 0.5f : 2.0f;
+    tx *= scale;
+    ty *= scale;
+
+    shift = dst;
+    round = (1 << shift) - 1;
+
+    glBegin (GL_QUADS);
+
+    while (nBox--)
+    {
+	x1 = MAX ((pBox->x1 >> shift) - margin, 0);
+	x2 = MIN (((pBox->x2 + round) >> shift) + margin, width);
+	y1 = MAX (((s->height - pBox->y2) >> shift) - margin, 0);
+	y2 = MIN (((s->height - pBox->y1 + round) >> shift) + margin, height);
+
+	glTexCoord2f (tx * x1, ty * y1);
+	glVertex2i   (x1, y1);
+	glTexCoord2f (tx * x2, ty * y1);
+	glVertex2i   (x2, y1);
+	glTexCoord2f (tx * x2, ty * y2);
+	glVertex2i   (x2, y2);
+	glTexCoord2f (tx * x1, ty * y2);
+	glVertex2i   (x1, y2);
+
+	pBox++;
+    }
+
+    glEnd ();
+
+    fboEpilogue (s);
+
+    return TRUE;
+}
+
+/* Dual filter blur. texture[0] is reduced to a pyramid of half
+   resolution levels and then expanded again up to the first level,
+   which the window fragment function upsamples to full resolution.
+   The number of passes only depends on the number of levels and each
+   one touches a quarter of the pixels of the previous one, so the
+   cost stays nearly constant as the blur radius grows. */
+static Bool
+fboUpdateDual (CompScreen *s,
+	       BoxPtr	  pBox,
+	       int	  nBox)
+{
+    Bool status = TRUE;
+    Bool wasCulled = glIsEnabled (GL_CULL_FACE);
+    int  down[BLUR_DUAL_LEVELS_MAX + 1], up[BLUR_DUAL_LEVELS_MAX + 1];
+    int  i, n;
+
+    BLUR_SCREEN (s);
+
+    n = MIN (bs->opt[BLUR_SCREEN_OPTION_DUAL_ITERATIONS].value.i,
+	     bs->numLevels);
+    if (!n)
+	return FALSE;
+
+    blurDualMargins (bs, n, down, up);
+
+    if (!loadDualFilterPrograms (s))
+	return FALSE;
+
+    glDisable (GL_CULL_FACE);
+
+    glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+
+    glEnable (GL_FRAGMENT_PROGRAM_ARB);
+
+    (*s->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, bs->downProgram);
+
+    for (i = 1; status && i <= n; i++)
+	status = fboDualPass (s, i - 1, i, down[i], pBox, nBox);
+
+    (*s->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, bs->upProgram);
+
+    for (i = n; status && i > 1; i--)
+	status = fboDualPass (s, i, i - 1, up[i - 1], pBox, nBox);
+
+    glDisable (GL_FRAGMENT_PROGRAM_ARB);
+
+    glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+
+    if (wasCulled)
+	glEnable (GL_CULL_FACE);
+
+    return status;
+}
+
 #define MAX_VERTEX_PROJECT_COUNT 20
 
 static void
@@ -1864,17 +2362,171 @@ blurProjectRegion (CompWindow	       *w,
     }
 }
 
+/* Texture sampled by the window fragment functions, shift converts
+   screen coordinates to its texel coordinates */
+static GLuint
+blurCacheSource (CompScreen *s,
+		 int	    *width,
+		 int	    *height,
+		 int	    *shift)
+{
+    BLUR_SCREEN (s);
+
+    switch (bs->opt[BLUR_SCREEN_OPTION_FILTER].value.i) {
+    case BLUR_FILTER_GAUSSIAN:
+	*width  = bs->width;
+	*height = bs->height;
+	*shift  = 0;
+	return bs->texture[1];
+    case BLUR_FILTER_DUAL:
+	*width  = bs->pyramidWidth[0];
+	*height = bs->pyramidHeight[0];
+	*shift  = 1;
+	return bs->pyramid[0];
+    default:
+	break;
+    }
+
+    *width  = bs->width;
+    *height = bs->height;
+    *shift  = 0;
+
+    return bs->texture[0];
+}
+
+/* Saves the filter output for the boxes in tmpRegion, which must be
+   those that were just copied and filtered */
+static void
+blurCacheStore (CompWindow *w)
+{
+    CompScreen *s = w->screen;
+    BoxPtr     pExtents;
+    BoxRec     box;
+    GLuint     source;
+    int	       width, height, shift, round;
+
+    BLUR_SCREEN (s);
+    BLUR_WINDOW (w);
+
+    XSubtractRegion (&emptyRegion, &emptyRegion, bw->cacheRegion);
+
+    if (bw->cacheSerial != bs->cacheSerial)
+    {
+	/* texture target may have changed */
+	if (bw->cacheTexture)
+	    glDeleteTextures (1, &bw->cacheTexture);
+
+	bw->cacheTexture = 0;
+	bw->cacheWidth   = 0;
+	bw->cacheHeight  = 0;
+	bw->cacheSerial  = bs->cacheSerial;
+    }
+
+    source = blurCacheSource (s, &width, &height, &shift);
+    round  = (1 << shift) - 1;
+
+    pExtents = &bs->tmpRegion->extents;
+
+    box.x1 = MAX (pExtents->x1 >> shift, 0);
+    box.x2 = MIN ((pExtents->x2 + round) >> shift, width);
+    box.y1 = MAX ((s->height - pExtents->y2) >> shift, 0);
+    box.y2 = MIN ((s->height - pExtents->y1 + round) >> shift, height);
+
+    if (box.x1 >= box.x2 || box.y1 >= box.y2)
+	return;
+
+    if (!bw->cacheTexture)
+	glGenTextures (1, &bw->cacheTexture);
+
+    glBindTexture (bs->target, bw->cacheTexture);
+
+    if (bw->cacheWidth  != box.x2 - box.x1 ||
+	bw->cacheHeight != box.y2 - box.y1)
+    {
+	bw->cacheWidth  = box.x2 - box.x1;
+	bw->cacheHeight = box.y2 - box.y1;
+
+	glTexImage2D (bs->target, 0, GL_RGB,
+		      bw->cacheWidth, bw->cacheHeight, 0,
+		      GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+
+	glTexParameteri (bs->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri (bs->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    if (fboPrologue (s, source, width, height))
+    {
+	glCopyTexSubImage2D (bs->target, 0, 0, 0,
+			     box.x1, box.y1,
+			     bw->cacheWidth, bw->cacheHeight);
+
+	fboEpilogue (s);
+
+	bw->cacheX = box.x1;
+	bw->cacheY = box.y1;
+
+	/* output is only exact where all taps were inside the copy */
+	XSubtractRegion (bs->tmpRegion, &emptyRegion, bw->cacheRegion);
+	XShrinkRegion (bw->cacheRegion, bs->filterRadius, bs->filterRadius);
+
+	bs->cacheOwner = w;
+    }
+
+    glBindTexture (bs->target, 0);
+}
+
+/* Puts the cached filter output of a window back in place, a single
+   copy instead of reading the screen and running the filter again */
+static Bool
+blurCacheRestore (CompWindow *w)
+{
+    CompScreen *s = w->screen;
+    GLuint     source;
+    int	       width, height, shift;
+
+    BLUR_SCREEN (s);
+    BLUR_WINDOW (w);
+
+    if (bs->cacheOwner == w)
+	return TRUE;
+
+    if (!fboPrologue (s, bw->cacheTexture, bw->cacheWidth, bw->cacheHeight))
+	return FALSE;
+
+    source = blurCacheSource (s, &width, &height, &shift);
+
+    glBindTexture (bs->target, source);
+
+    glCopyTexSubImage2D (bs->target, 0,
+			 bw->cacheX, bw->cacheY,
+			 0, 0,
+			 bw->cacheWidth, bw->cacheHeight);
+
+    fboEpilogue (s);
+
+    if (bs->opt[BLUR_SCREEN_OPTION_FILTER].value.i == BLUR_FILTER_MIPMAP)
+	(*s->generateMipmap) (bs->target);
+
+    glBindTexture (bs->target, 0);
+
+    bs->cacheOwner = w;
+
+    return TRUE;
+}
+
 static Bool
 blurUpdateDstTexture (CompWindow	  *w,
 		      const CompTransform *transform,
 		      BoxPtr		  pExtents,
-		      int                 clientThreshold)
+		      int                 clientThreshold,
+		      Bool		  cache)
 {
     CompScreen *s = w->screen;
     BoxPtr     pBox;
     int	       nBox;
     int        y;
     int        filter;
+    Bool       status = TRUE;
 
     BLUR_SCREEN (s);
     BLUR_WINDOW (w);
@@ -1966,6 +2618,24 @@ blurUpdateDstTexture (CompWindow	  *w,
 
     *pExtents = bs->tmpRegion->extents;
 
+    if (cache && bw->cacheTexture && bw->cacheSerial == bs->cacheSerial &&
+	bs->width == s->width && bs->height == s->height)
+    {
+	/* region the window fragment functions will sample */
+	XSubtractRegion (bs->tmpRegion3, &emptyRegion, bs->tmpRegion2);
+	XShrinkRegion (bs->tmpRegion2, bs->filterRadius, bs->filterRadius);
+
+	if (!XEmptyRegion (bs->tmpRegion2))
+	{
+	    XSubtractRegion (bs->tmpRegion2, bw->cacheRegion, bs->tmpRegion2);
+	    if (XEmptyRegion (bs->tmpRegion2) && blurCacheRestore (w))
+		return TRUE;
+	}
+    }
+
+    /* filter textures are about to be overwritten */
+    bs->cacheOwner = NULL;
+
     if (!bs->texture[0] || bs->width != s->width || bs->height != s->height)
     {
 	int i, textures = 1;
@@ -1987,7 +2657,10 @@ blurUpdateDstTexture (CompWindow	  *w,
 	    bs->ty = 1;
 	}
 
-	if (filter == BLUR_FILTER_GAUSSIAN)
+	bs->cacheSerial++;
+
+	if (filter == BLUR_FILTER_GAUSSIAN || filter == BLUR_FILTER_DUAL ||
+	    bs->opt[BLUR_SCREEN_OPTION_CACHE].value.b)
 	{
 	    if (s->fbo && !bs->fbo)
 		(*s->genFramebuffers) (1, &bs->fbo);
@@ -1996,7 +2669,8 @@ blurUpdateDstTexture (CompWindow	  *w,
 		compLogMessage ("blur", CompLogLevelError,
 				"Failed to create framebuffer object");
 
-	    textures = 2;
+	    if (filter == BLUR_FILTER_GAUSSIAN)
+		textures = 2;
 	}
 
 	bs->fboStatus = FALSE;
@@ -2053,6 +2727,42 @@ blurUpdateDstTexture (CompWindow	  *w,
 	    glCopyTexSubImage2D (bs->target, 0, 0, 0, 0, 0,
 				 bs->width, bs->height);
 	}
+
+	bs->numLevels = 0;
+
+	if (filter == BLUR_FILTER_DUAL && bs->fbo)
+	{
+	    for (i = 0; i < BLUR_DUAL_LEVELS_MAX; i++)
+	    {
+		int width  = (bs->width  + (2 << i) - 1) >> (i + 1);
+		int height = (bs->height + (2 << i) - 1) >> (i + 1);
+
+		if (width < 2 || height < 2)
+		    break;
+
+		if (!bs->pyramid[i])
+		    glGenTextures (1, &bs->pyramid[i]);
+
+		bs->pyramidWidth[i]  = width;
+		bs->pyramidHeight[i] = height;
+
+		glBindTexture (bs->target, bs->pyramid[i]);
+
+		glTexImage2D (bs->target, 0, GL_RGB, width, height, 0,
+			      GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+
+		glTexParameteri (bs->target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri (bs->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri (bs->target, GL_TEXTURE_WRAP_S,
+				 GL_CLAMP_TO_EDGE);
+		glTexParameteri (bs->target, GL_TEXTURE_WRAP_T,
+				 GL_CLAMP_TO_EDGE);
+	    }
+
+	    bs->numLevels = i;
+
+	    glBindTexture (bs->target, bs->texture[0]);
+	}
     }
     else
     {
@@ -2074,7 +2784,12 @@ blurUpdateDstTexture (CompWindow	  *w,
 
     switch (filter) {
     case BLUR_FILTER_GAUSSIAN:
-	return fboUpdate (s, bs->tmpRegion->rects, bs->tmpRegion->numRects);
+	status = fboUpdate (s, bs->tmpRegion->rects, bs->tmpRegion->numRects);
+	break;
+    case BLUR_FILTER_DUAL:
+	status = fboUpdateDual (s, bs->tmpRegion->rects,
+				bs->tmpRegion->numRects);
+	break;
     case BLUR_FILTER_MIPMAP:
 	(*s->generateMipmap) (bs->target);
 	break;
@@ -2084,7 +2799,11 @@ blurUpdateDstTexture (CompWindow	  *w,
 
     glBindTexture (bs->target, 0);
 
-    return TRUE;
+    if (status && cache && bs->fbo &&
+	(s->textureNonPowerOfTwo || bs->target != GL_TEXTURE_2D))
+	blurCacheStore (w);
+
+    return status;
 }
 
 static Bool
@@ -2095,14 +2814,19 @@ blurDrawWindow (CompWindow	     *w,
 		unsigned int	     mask)
 {
     CompScreen *s = w->screen;
+    Region     blurRegion = NULL;
     Bool       status;
 
     BLUR_SCREEN (s);
     BLUR_WINDOW (w);
 
-    if (bs->alphaBlur && bw->region)
+    if (bs->alphaBlur)
+	blurRegion = blurWindowRegion (w);
+
+    if (blurRegion)
     {
-	int clientThreshold;
+	Region clip = blurWindowClip (w);
+	int    clientThreshold;
 
 	/* only care about client window blurring when it's translucent */
 	if (mask & PAINT_WINDOW_TRANSLUCENT_MASK)
@@ -2113,6 +2837,7 @@ blurDrawWindow (CompWindow	     *w,
 	if (bw->state[BLUR_STATE_DECOR].threshold || clientThreshold)
 	{
 	    Bool   clipped = FALSE;
+	    Bool   cache;
 	    BoxRec box = { 0, 0, 0, 0 };
 	    Region reg;
 	    int    i;
@@ -2127,11 +2852,17 @@ blurDrawWindow (CompWindow	     *w,
 	    else
 		reg = region;
 
-	    XIntersectRegion (bw->region, reg, bs->tmpRegion);
-	    if (!bs->blurOcclusion && !(mask & PAINT_WINDOW_TRANSFORMED_MASK))
-		XSubtractRegion(bs->tmpRegion, bw->clip, bs->tmpRegion);
+	    XIntersectRegion (blurRegion, reg, bs->tmpRegion);
+	    if (!(mask & PAINT_WINDOW_TRANSFORMED_MASK))
+		XSubtractRegion (bs->tmpRegion, clip, bs->tmpRegion);
 
-	    if (blurUpdateDstTexture (w, transform, &box, clientThreshold))
+	    /* cached blur is kept in screen space */
+	    cache = bs->opt[BLUR_SCREEN_OPTION_CACHE].value.b &&
+		!(mask & (PAINT_WINDOW_TRANSFORMED_MASK |
+			  PAINT_WINDOW_ON_TRANSFORMED_SCREEN_MASK));
+
+	    if (blurUpdateDstTexture (w, transform, &box, clientThreshold,
+				      cache))
 	    {
 		if (clientThreshold)
 		{
@@ -2165,14 +2896,11 @@ blurDrawWindow (CompWindow	     *w,
 		    }
 		}
 
-		if (!bs->blurOcclusion && bw->clip->numRects)
+		if (clip->numRects)
 		    clipped = TRUE;
 	    }
 
-	    if (!bs->blurOcclusion)
-		XSubtractRegion (bw->region, bw->clip, bs->tmpRegion);
-	    else
-		XSubtractRegion (bw->region, &emptyRegion, bs->tmpRegion);
+	    XSubtractRegion (blurRegion, clip, bs->tmpRegion);
 
 	    if (!clientThreshold)
 	    {
@@ -2476,10 +3204,46 @@ blurDrawWindowTexture (CompWindow	    *w,
 						 threshold, threshold);
 		}
 		break;
+	    case BLUR_FILTER_DUAL:
+		param = allocFragmentParameters (&dstFa, 3);
+		unit  = allocFragmentTextureUnits (&dstFa, 1);
+
+		function =
+		    getDstBlurFragmentFunction (s, texture, param, unit, 0, 0);
+		if (function)
+		{
+		    float offset = bs->opt[BLUR_SCREEN_OPTION_DUAL_OFFSET].value.f;
+		    float tx, ty;
+
+		    addFragmentFunction (&dstFa, function);
+
+		    blurLevelScale (bs, 1, &tx, &ty);
+
+		    (*s->activeTexture) (GL_TEXTURE0_ARB + unit);
+		    glBindTexture (bs->target, bs->pyramid[0]);
+		    (*s->activeTexture) (GL_TEXTURE0_ARB);
+
+		    /* screen pixels to first level texture coordinates */
+		    (*s->programEnvParameter4f) (GL_FRAGMENT_PROGRAM_ARB,
+						 param,
+						 0.5f * tx, 0.5f * ty,
+						 0.0f, 0.0f);
+
+		    (*s->programEnvParameter4f) (GL_FRAGMENT_PROGRAM_ARB,
+						 param + 1,
+						 threshold, threshold,
+						 threshold, threshold);
+
+		    (*s->programEnvParameter4f) (GL_FRAGMENT_PROGRAM_ARB,
+						 param + 2,
+						 0.5f * offset * tx,
+						 0.5f * offset * ty,
+						 0.0f, 0.0f);
+		}
+		break;
 	    }
 
-	    if (bw->state[state].clipped ||
-		(!bs->blurOcclusion && bw->clip->numRects))
+	    if (bw->state[state].clipped || blurWindowClip (w)->numRects)
 	    {
 		glEnable (GL_STENCIL_TEST);
 
@@ -2602,46 +3366,6 @@ blurHandleEvent (CompDisplay *d,
     }
 }
 
-static void
-blurWindowResizeNotify (CompWindow *w,
-			int	   dx,
-			int	   dy,
-			int	   dwidth,
-			int	   dheight)
-{
-    BLUR_SCREEN (w->screen);
-
-    if (bs->alphaBlur)
-    {
-	BLUR_WINDOW (w);
-
-	if (bw->state[BLUR_STATE_CLIENT].threshold ||
-	    bw->state[BLUR_STATE_DECOR].threshold)
-	    blurWindowUpdateRegion (w);
-    }
-
-    UNWRAP (bs, w->screen, windowResizeNotify);
-    (*w->screen->windowResizeNotify) (w, dx, dy, dwidth, dheight);
-    WRAP (bs, w->screen, windowResizeNotify, blurWindowResizeNotify);
-}
-
-static void
-blurWindowMoveNotify (CompWindow *w,
-		      int	 dx,
-		      int	 dy,
-		      Bool	 immediate)
-{
-    BLUR_SCREEN (w->screen);
-    BLUR_WINDOW (w);
-
-    if (bw->region)
-	XOffsetRegion (bw->region, dx, dy);
-
-    UNWRAP (bs, w->screen, windowMoveNotify);
-    (*w->screen->windowMoveNotify) (w, dx, dy, immediate);
-    WRAP (bs, w->screen, windowMoveNotify, blurWindowMoveNotify);
-}
-
 static CompOption *
 blurGetDisplayOptions (CompPlugin  *plugin,
 		       CompDisplay *display,
@@ -2880,7 +3604,11 @@ static const CompMetadataOptionInfo blurScreenOptionInfo[] = {
     { "mipmap_lod", "float", "<min>0.1</min><max>5.0</max>", 0, 0 },
     { "saturation", "int", "<min>0</min><max>100</max>", 0, 0 },
     { "occlusion", "bool", 0, 0, 0 },
-    { "independent_tex", "bool", 0, 0, 0 }
+    { "independent_tex", "bool", 0, 0, 0 },
+    { "dual_iterations", "int",
+      RESTOSTRING (1, BLUR_DUAL_LEVELS_MAX), 0, 0 },
+    { "dual_offset", "float", "<min>0.5</min><max>5.0</max>", 0, 0 },
+    { "blur_cache", "bool", 0, 0, 0 }
 };
 
 static Bool
@@ -2973,6 +3701,9 @@ blurInitScreen (CompPlugin *p,
     bs->output = NULL;
     bs->count  = 0;
 
+    bs->occlusionSerial = 0;
+    bs->useClip		= TRUE;
+
     bs->filterRadius = 0;
 
     bs->srcBlurFunctions = NULL;
@@ -2986,6 +3717,16 @@ blurInitScreen (CompPlugin *p,
     for (i = 0; i < 2; i++)
 	bs->texture[i] = 0;
 
+    for (i = 0; i < BLUR_DUAL_LEVELS_MAX; i++)
+	bs->pyramid[i] = 0;
+
+    bs->numLevels   = 0;
+    bs->downProgram = 0;
+    bs->upProgram   = 0;
+
+    bs->cacheOwner  = NULL;
+    bs->cacheSerial = 0;
+
     bs->program   = 0;
     bs->maxTemp   = 32;
     bs->fbo	  = 0;
@@ -3018,8 +3759,6 @@ blurInitScreen (CompPlugin *p,
     WRAP (bs, s, paintWindow, blurPaintWindow);
     WRAP (bs, s, drawWindow, blurDrawWindow);
     WRAP (bs, s, drawWindowTexture, blurDrawWindowTexture);
-    WRAP (bs, s, windowResizeNotify, blurWindowResizeNotify);
-    WRAP (bs, s, windowMoveNotify, blurWindowMoveNotify);
 
     s->base.privates[bd->screenPrivateIndex].ptr = bs;
 
@@ -3054,6 +3793,19 @@ blurFiniScreen (CompPlugin *p,
 	if (bs->texture[i])
 	    glDeleteTextures (1, &bs->texture[i]);
 
+    for (i = 0; i < BLUR_DUAL_LEVELS_MAX; i++)
+	if (bs->pyramid[i])
+	    glDeleteTextures (1, &bs->pyramid[i]);
+
+    if (bs->program)
+	(*s->deletePrograms) (1, &bs->program);
+
+    if (bs->downProgram)
+	(*s->deletePrograms) (1, &bs->downProgram);
+
+    if (bs->upProgram)
+	(*s->deletePrograms) (1, &bs->upProgram);
+
     freeWindowPrivateIndex (s, bs->windowPrivateIndex);
 
     UNWRAP (bs, s, preparePaintScreen);
@@ -3063,8 +3815,6 @@ blurFiniScreen (CompPlugin *p,
     UNWRAP (bs, s, paintWindow);
     UNWRAP (bs, s, drawWindow);
     UNWRAP (bs, s, drawWindowTexture);
-    UNWRAP (bs, s, windowResizeNotify);
-    UNWRAP (bs, s, windowMoveNotify);
 
     compFiniScreenOptions (s, bs->opt, BLUR_SCREEN_OPTION_NUM);
 
@@ -3099,7 +3849,15 @@ blurInitWindow (CompPlugin *p,
 	bw->propSet[i] = FALSE;
     }
 
-    bw->region = NULL;
+    bw->region	     = NULL;
+    bw->regionX	     = 0;
+    bw->regionY	     = 0;
+    bw->regionWidth  = 0;
+    bw->regionHeight = 0;
+
+    memset (&bw->regionOutput, 0, sizeof (CompWindowExtents));
+
+    bw->clipSerial = 0;
 
     bw->clip = XCreateRegion ();
     if (!bw->clip)
@@ -3108,6 +3866,21 @@ blurInitWindow (CompPlugin *p,
 	return FALSE;
     }
 
+    bw->cacheRegion = XCreateRegion ();
+    if (!bw->cacheRegion)
+    {
+	XDestroyRegion (bw->clip);
+	free (bw);
+	return FALSE;
+    }
+
+    bw->cacheTexture = 0;
+    bw->cacheX	     = 0;
+    bw->cacheY	     = 0;
+    bw->cacheWidth   = 0;
+    bw->cacheHeight  = 0;
+    bw->cacheSerial  = 0;
+
     w->base.privates[bs->windowPrivateIndex].ptr = bw;
 
     if (w->base.parent)
@@ -3122,6 +3895,7 @@ blurFiniWindow (CompPlugin *p,
 {
     int i;
 
+    BLUR_SCREEN (w->screen);
     BLUR_WINDOW (w);
 
     for (i = 0; i < BLUR_STATE_NUM; i++)
@@ -3131,6 +3905,13 @@ blurFiniWindow (CompPlugin *p,
     if (bw->region)
 	XDestroyRegion (bw->region);
 
+    if (bs->cacheOwner == w)
+	bs->cacheOwner = NULL;
+
+    if (bw->cacheTexture)
+	glDeleteTextures (1, &bw->cacheTexture);
+
+    XDestroyRegion (bw->cacheRegion);
     XDestroyRegion (bw->clip);
 
     free (bw);
@@ -34,10 +34,13 @@ static CompMetadata inotifyMetadata;
 
 static int corePrivateIndex;
 
+/* inotify hands out the same watch descriptor for every watch on a
+   path, file watches on the same path share it */
 typedef struct _CompInotifyWatch {
     struct _CompInotifyWatch *next;
     CompFileWatchHandle	     handle;
     int			     wd;
+    int			     mask;
 } CompInotifyWatch;
 
 typedef struct _InotifyCore {
@@ -74,20 +77,36 @@ inotifyProcessEvents (void *data)
 	struct inotify_event *event;
 	CompInotifyWatch     *iw;
 	CompFileWatch	     *fw;
+	CompFileWatchHandle  handle;
 	int		     i = 0;
 
 	while (i < len)
 	{
 	    event = (struct inotify_event *) &buf[i];
 
-	    for (iw = ic->watch; iw; iw = iw->next)
-		if (iw->wd == event->wd)
+	    /* call back every watch sharing the descriptor in order of
+	       their handles, callbacks may add or remove watches */
+	    handle = 0;
+	    for (;;)
+	    {
+		CompFileWatchHandle next = 0;
+
+		for (iw = ic->watch; iw; iw = iw->next)
+		{
+		    if (iw->wd != event->wd || !(iw->mask & event->mask))
+			continue;
+
+		    if (iw->handle > handle && (!next || iw->handle < next))
+			next = iw->handle;
+		}
+
+		if (!next)
 		    break;
 
-	    if (iw)
-	    {
+		handle = next;
+
 		for (fw = core.fileWatch; fw; fw = fw->next)
-		    if (fw->handle == iw->handle)
+		    if (fw->handle == handle)
 			break;
 
 		if (fw)
@@ -138,10 +157,13 @@ inotifyFileWatchAdded (CompCore      *c,
     if (!iw)
 	return;
 
+    /* add to the mask of other watches on the same path rather than
+       replacing it */
     iw->handle = fileWatch->handle;
+    iw->mask   = inotifyMask (fileWatch);
     iw->wd     = inotify_add_watch (ic->fd,
 				    fileWatch->path,
-				    inotifyMask (fileWatch));
+				    iw->mask | IN_MASK_ADD);
     if (iw->wd < 0)
     {
 	perror ("inotify_add_watch");
@@ -171,12 +193,19 @@ inotifyFileWatchRemoved (CompCore      *c,
 
     if (iw)
     {
+	CompInotifyWatch *other;
+
 	if (p)
 	    p->next = iw->next;
 	else
 	    ic->watch = iw->next;
 
-	if (inotify_rm_watch (ic->fd, iw->wd))
+	/* the descriptor stays while other watches use it */
+	for (other = ic->watch; other; other = other->next)
+	    if (other->wd == iw->wd)
+		break;
+
+	if (!other && inotify_rm_watch (ic->fd, iw->wd))
 	    perror ("inotify_rm_watch");
 
 	free (iw);
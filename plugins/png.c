@@ -28,50 +28,28 @@
 #include <string.h>
 #include <png.h>
 #include <setjmp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#include <compiz-core.h>
+#include <compiz-png.h>
 
 static CompMetadata pngMetadata;
 
 #define PNG_SIG_SIZE 8
 
-static int displayPrivateIndex;
-
-typedef struct _PngDisplay {
-    FileToImageProc fileToImage;
-    ImageToFileProc imageToFile;
-} PngDisplay;
-
-#define GET_PNG_DISPLAY(d)					 \
-    ((PngDisplay *) (d)->base.privates[displayPrivateIndex].ptr)
-
-#define PNG_DISPLAY(d)			 \
-    PngDisplay *pd = GET_PNG_DISPLAY (d)
+static int pngDisplayPrivateIndex;
 
+#define NUM_OPTIONS(d) (sizeof ((d)->opt) / sizeof (CompOption))
 
 static void
 premultiplyData (png_structp   png,
 		 png_row_infop row_info,
 		 png_bytep     data)
 {
-    unsigned int i;
-
-    for (i = 0; i < row_info->rowbytes; i += 4)
-    {
-	unsigned char *base = &data[i];
-	unsigned char blue  = base[0];
-	unsigned char green = base[1];
-	unsigned char red   = base[2];
-	unsigned char alpha = base[3];
-	int	      p;
-
-	red   = (unsigned) red   * (unsigned) alpha / 255;
-	green = (unsigned) green * (unsigned) alpha / 255;
-	blue  = (unsigned) blue  * (unsigned) alpha / 255;
-
-	p = (alpha << 24) | (red << 16) | (green << 8) | (blue << 0);
-	memcpy (base, &p, sizeof (int));
-    }
+    swapRedBluePixels (data, row_info->rowbytes / 4);
+    premultiplyPixels (data, row_info->rowbytes / 4);
 }
 
 static Bool
@@ -122,7 +100,6 @@ readPngData (png_struct	*png,
     if (interlace != PNG_INTERLACE_NONE)
 	png_set_interlace_handling (png);
 
-    png_set_bgr (png);
     png_set_filler (png, 0xff, PNG_FILLER_AFTER);
 
     png_set_read_user_transform_fn (png, premultiplyData);
@@ -154,20 +131,42 @@ readPngData (png_struct	*png,
     return TRUE;
 }
 
+typedef struct _PngBuffer {
+    const unsigned char *data;
+    size_t		size;
+    size_t		offset;
+} PngBuffer;
+
+static void
+userReadData (png_structp png_ptr,
+	      png_bytep   data,
+	      png_size_t  length)
+{
+    PngBuffer *buffer = (PngBuffer *) png_get_io_ptr (png_ptr);
+
+    if (length > buffer->size - buffer->offset)
+	png_error (png_ptr, "Read Error");
+
+    memcpy (data, buffer->data + buffer->offset, length);
+    buffer->offset += length;
+}
+
 static Bool
-readPngFileToImage (FILE *file,
-		    int  *width,
-		    int  *height,
-		    void **data)
+readPngBuffer (const unsigned char *buffer,
+	       size_t		   size,
+	       void		   **data,
+	       int		   *width,
+	       int		   *height)
 {
-    unsigned char png_sig[PNG_SIG_SIZE];
-    int		  sig_bytes;
-    png_struct	  *png;
-    png_info	  *info;
-    Bool	  status;
-
-    sig_bytes = fread (png_sig, 1, PNG_SIG_SIZE, file);
-    if (png_check_sig (png_sig, sig_bytes) == 0)
+    png_struct *png;
+    png_info   *info;
+    PngBuffer  b;
+    Bool       status;
+
+    if (size < PNG_SIG_SIZE)
+	return FALSE;
+
+    if (png_check_sig ((png_bytep) buffer, PNG_SIG_SIZE) == 0)
 	return FALSE;
 
     png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -178,12 +177,26 @@ readPngFileToImage (FILE *file,
     if (!info)
     {
 	png_destroy_read_struct (&png, NULL, NULL);
+	return FALSE;
+    }
+
+    *data = NULL;
 
+    if (setjmp (png_jmpbuf (png)))
+    {
+	if (*data)
+	    free (*data);
+
+	png_destroy_read_struct (&png, &info, NULL);
 	return FALSE;
     }
 
-    png_init_io (png, file);
-    png_set_sig_bytes (png, sig_bytes);
+    b.data   = buffer;
+    b.size   = size;
+    b.offset = PNG_SIG_SIZE;
+
+    png_set_read_fn (png, (void *) &b, userReadData);
+    png_set_sig_bytes (png, PNG_SIG_SIZE);
 
     status = readPngData (png, info, data, width, height);
 
@@ -192,56 +205,33 @@ readPngFileToImage (FILE *file,
     return status;
 }
 
-#if 0
-static void
-userReadData (png_structp png_ptr,
-	      png_bytep   data,
-	      png_size_t  length)
-{
-    const unsigned char **buffer = (const unsigned char **)
-	png_get_io_ptr (png_ptr);
-
-    memcpy (data, *buffer, length);
-    *buffer += length;
-}
-
+/* maps the file instead of reading it through stdio, the pages are
+   decoded straight from the page cache */
 static Bool
-readPngBuffer (const unsigned char *buffer,
-	       char		   **data,
-	       unsigned int	   *width,
-	       unsigned int	   *height)
+readPngFileToImage (int  fd,
+		    int  *width,
+		    int  *height,
+		    void **data)
 {
-    unsigned char	png_sig[PNG_SIG_SIZE];
-    png_struct		*png;
-    png_info		*info;
-    const unsigned char *b = buffer + PNG_SIG_SIZE;
-    Bool		status;
-
-    memcpy (png_sig, buffer, PNG_SIG_SIZE);
-    if (png_check_sig (png_sig, PNG_SIG_SIZE) == 0)
-	return FALSE;
+    struct stat st;
+    void	*map;
+    Bool	status;
 
-    png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png)
+    if (fstat (fd, &st) || st.st_size < PNG_SIG_SIZE)
 	return FALSE;
 
-    info = png_create_info_struct (png);
-    if (!info)
-    {
-	png_destroy_read_struct (&png, NULL, NULL);
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
 	return FALSE;
-    }
 
-    png_set_read_fn (png, (void *) &b, userReadData);
-    png_set_sig_bytes (png, PNG_SIG_SIZE);
+    madvise (map, st.st_size, MADV_SEQUENTIAL);
 
-    status = readPngData (png, info, data, width, height);
+    status = readPngBuffer (map, st.st_size, data, width, height);
 
-    png_destroy_read_struct (&png, &info, NULL);
+    munmap (map, st.st_size);
 
     return status;
 }
-#endif
 
 static Bool
 writePng (unsigned char *buffer,
@@ -326,6 +316,26 @@ stdioWriteFunc (png_structp png,
 	png_error (png, "Write Error");
 }
 
+static Bool
+pngWriteFile (const char *file,
+	      int	 width,
+	      int	 height,
+	      int	 stride,
+	      void	 *data)
+{
+    Bool status = FALSE;
+    FILE *fp;
+
+    fp = fopen (file, "wb");
+    if (fp)
+    {
+	status = writePng (data, stdioWriteFunc, fp, width, height, stride);
+	fclose (fp);
+    }
+
+    return status;
+}
+
 static char *
 pngExtension (const char *name)
 {
@@ -352,7 +362,6 @@ pngImageToFile (CompDisplay *d,
     Bool status = FALSE;
     char *extension = pngExtension (name);
     char *file;
-    FILE *fp;
     int  len;
 
     PNG_DISPLAY (d);
@@ -370,13 +379,7 @@ pngImageToFile (CompDisplay *d,
 
     if (file && strcasecmp (format, "png") == 0)
     {
-	fp = fopen (file, "wb");
-	if (fp)
-	{
-	    status = writePng (data, stdioWriteFunc, fp, width, height, stride);
-	    fclose (fp);
-	}
-
+	status = pngWriteFile (file, width, height, stride, data);
 	if (status)
 	{
 	    free (file);
@@ -390,14 +393,7 @@ pngImageToFile (CompDisplay *d,
     WRAP (pd, d, imageToFile, pngImageToFile);
 
     if (!status && file)
-    {
-	fp = fopen (file, "wb");
-	if (fp)
-	{
-	    status = writePng (data, stdioWriteFunc, fp, width, height, stride);
-	    fclose (fp);
-	}
-    }
+	status = pngWriteFile (file, width, height, stride, data);
 
     if (file)
 	free (file);
@@ -426,21 +422,21 @@ pngFileToImage (CompDisplay *d,
     file = malloc (len);
     if (file)
     {
-	FILE *fp;
+	int fd;
 
 	if (path)
 	    sprintf (file, "%s/%s%s", path, name, extension);
 	else
 	    sprintf (file, "%s%s", name, extension);
 
-	fp = fopen (file, "r");
-	if (fp)
+	fd = open (file, O_RDONLY);
+	if (fd >= 0)
 	{
-	    status = readPngFileToImage (fp,
+	    status = readPngFileToImage (fd,
 					 width,
 					 height,
 					 data);
-	    fclose (fp);
+	    close (fd);
 	}
 
 	free (file);
@@ -459,6 +455,32 @@ pngFileToImage (CompDisplay *d,
     return status;
 }
 
+static CompOption *
+pngGetDisplayOptions (CompPlugin  *plugin,
+		      CompDisplay *display,
+		      int	  *count)
+{
+    PNG_DISPLAY (display);
+
+    *count = NUM_OPTIONS (pd);
+    return pd->opt;
+}
+
+static Bool
+pngSetDisplayOption (CompPlugin      *plugin,
+		     CompDisplay     *display,
+		     const char      *name,
+		     CompOptionValue *value)
+{
+    /* all png options are read only */
+    return FALSE;
+}
+
+static const CompMetadataOptionInfo pngDisplayOptionInfo[] = {
+    { "abi", "int", 0, 0, 0 },
+    { "index", "int", 0, 0, 0 }
+};
+
 static Bool
 pngInitDisplay (CompPlugin  *p,
 		CompDisplay *d)
@@ -473,10 +495,25 @@ pngInitDisplay (CompPlugin  *p,
     if (!pd)
 	return FALSE;
 
+    if (!compInitDisplayOptionsFromMetadata (d,
+					     &pngMetadata,
+					     pngDisplayOptionInfo,
+					     pd->opt,
+					     PNG_DISPLAY_OPTION_NUM))
+    {
+	free (pd);
+	return FALSE;
+    }
+
+    pd->opt[PNG_DISPLAY_OPTION_ABI].value.i   = PNG_ABIVERSION;
+    pd->opt[PNG_DISPLAY_OPTION_INDEX].value.i = pngDisplayPrivateIndex;
+
+    pd->writeFile = pngWriteFile;
+
     WRAP (pd, d, fileToImage, pngFileToImage);
     WRAP (pd, d, imageToFile, pngImageToFile);
 
-    d->base.privates[displayPrivateIndex].ptr = pd;
+    d->base.privates[pngDisplayPrivateIndex].ptr = pd;
 
     for (s = d->screens; s; s = s->next)
 	updateDefaultIcon (s);
@@ -498,6 +535,8 @@ pngFiniDisplay (CompPlugin  *p,
     for (s = d->screens; s; s = s->next)
 	updateDefaultIcon (s);
 
+    compFiniDisplayOptions (d, pd->opt, PNG_DISPLAY_OPTION_NUM);
+
     free (pd);
 }
 
@@ -525,15 +564,45 @@ pngFiniObject (CompPlugin *p,
     DISPATCH (o, dispTab, ARRAY_SIZE (dispTab), (p, o));
 }
 
+static CompOption *
+pngGetObjectOptions (CompPlugin *plugin,
+		     CompObject *object,
+		     int	*count)
+{
+    static GetPluginObjectOptionsProc dispTab[] = {
+	(GetPluginObjectOptionsProc) 0, /* GetCoreOptions */
+	(GetPluginObjectOptionsProc) pngGetDisplayOptions
+    };
+
+    RETURN_DISPATCH (object, dispTab, ARRAY_SIZE (dispTab),
+		     (void *) (*count = 0), (plugin, object, count));
+}
+
+static CompBool
+pngSetObjectOption (CompPlugin      *plugin,
+		    CompObject      *object,
+		    const char      *name,
+		    CompOptionValue *value)
+{
+    static SetPluginObjectOptionProc dispTab[] = {
+	(SetPluginObjectOptionProc) 0, /* SetCoreOption */
+	(SetPluginObjectOptionProc) pngSetDisplayOption
+    };
+
+    RETURN_DISPATCH (object, dispTab, ARRAY_SIZE (dispTab), FALSE,
+		     (plugin, object, name, value));
+}
+
 static Bool
 pngInit (CompPlugin *p)
 {
     if (!compInitPluginMetadataFromInfo (&pngMetadata, p->vTable->name,
-					 0, 0, 0, 0))
+					 pngDisplayOptionInfo,
+					 PNG_DISPLAY_OPTION_NUM, 0, 0))
 	return FALSE;
 
-    displayPrivateIndex = allocateDisplayPrivateIndex ();
-    if (displayPrivateIndex < 0)
+    pngDisplayPrivateIndex = allocateDisplayPrivateIndex ();
+    if (pngDisplayPrivateIndex < 0)
     {
 	compFiniMetadata (&pngMetadata);
 	return FALSE;
@@ -547,7 +616,7 @@ pngInit (CompPlugin *p)
 static void
 pngFini (CompPlugin *p)
 {
-    freeDisplayPrivateIndex (displayPrivateIndex);
+    freeDisplayPrivateIndex (pngDisplayPrivateIndex);
     compFiniMetadata (&pngMetadata);
 }
 
@@ -564,8 +633,8 @@ CompPluginVTable pngVTable = {
     pngFini,
     pngInitObject,
     pngFiniObject,
-    0, /* GetObjectOptions */
-    0  /* SetObjectOption */
+    pngGetObjectOptions,
+    pngSetObjectOption
 };
 
 CompPluginVTable *
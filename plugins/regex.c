@@ -49,11 +49,62 @@ typedef struct _RegexScreen {
     int	windowPrivateIndex;
 } RegexScreen;
 
+#define REGEX_FIELD_TITLE 0
+#define REGEX_FIELD_ROLE  1
+#define REGEX_FIELD_CLASS 2
+#define REGEX_FIELD_NAME  3
+#define REGEX_FIELD_NUM   4
+
+/* an expression prefix, field and flags together. Expressions with
+   the same prefix are evaluated in a single pass, see regexMatchSet */
+#define REGEX_SET_NUM (REGEX_FIELD_NUM * 2)
+
+/* compiled patterns are shared by all expressions using the same
+   prefix and pattern, no matter which plugin they belong to */
+typedef struct _RegexPattern {
+    struct _RegexPattern *next;
+    char		 *pattern;
+    int			 flags;
+    int			 set;
+    regex_t		 preg;
+    int			 refCount;
+    unsigned int	 id;
+    int			 index;
+} RegexPattern;
+
+/* alternation of all patterns in a set, used to reject strings that
+   match none of them with a single regexec call */
+typedef struct _RegexPatternSet {
+    regex_t preg;
+    Bool    compiled;
+    Bool    dirty;
+    int	    nPattern;
+} RegexPatternSet;
+
+typedef struct _RegexResult {
+    unsigned int id;
+    Bool	 value;
+} RegexResult;
+
+/* results of patterns against one window string, indexed by
+   pattern index and cleared when the string changes */
+typedef struct _RegexResultTable {
+    RegexResult *result;
+    int		nResult;
+} RegexResultTable;
+
 typedef struct _RegexWindow {
-    char *title;
-    char *role;
+    char	     *title;
+    char	     *role;
+    RegexResultTable table[REGEX_FIELD_NUM];
 } RegexWindow;
 
+static RegexPattern *regexPatterns = NULL;
+static unsigned int regexLastPatternId = 0;
+static int regexPatternIndexSize = 0;
+
+static RegexPatternSet regexSets[REGEX_SET_NUM];
+
 #define GET_REGEX_DISPLAY(d)					   \
     ((RegexDisplay *) (d)->base.privates[displayPrivateIndex].ptr)
 
@@ -75,104 +126,312 @@ typedef struct _RegexWindow {
 		      GET_REGEX_DISPLAY (w->screen->display)))
 
 static void
-regexMatchExpFini (CompDisplay *d,
-		   CompPrivate private)
+regexInvalidateSet (int set)
 {
-    regex_t *preg = (regex_t *) private.ptr;
+    RegexPatternSet *s = &regexSets[set];
+
+    if (s->compiled)
+	regfree (&s->preg);
+
+    s->compiled = FALSE;
+    s->dirty    = TRUE;
+}
+
+static RegexPattern *
+regexGetPattern (const char *value,
+		 int	    flags,
+		 int	    set)
+{
+    RegexPattern *pattern, *p;
+    int		 status, index;
+
+    for (pattern = regexPatterns; pattern; pattern = pattern->next)
+    {
+	if (pattern->set == set && strcmp (pattern->pattern, value) == 0)
+	{
+	    pattern->refCount++;
+	    return pattern;
+	}
+    }
+
+    pattern = malloc (sizeof (RegexPattern));
+    if (!pattern)
+	return NULL;
 
-    if (preg)
+    pattern->pattern = strdup (value);
+    if (!pattern->pattern)
     {
-	regfree (preg);
-	free (preg);
+	free (pattern);
+	return NULL;
     }
+
+    status = regcomp (&pattern->preg, value, REG_NOSUB | flags);
+    if (status)
+    {
+	char errMsg[1024];
+
+	regerror (status, &pattern->preg, errMsg, sizeof (errMsg));
+
+	compLogMessage ("regex", CompLogLevelWarn,
+			"%s = %s", errMsg, value);
+
+	regfree (&pattern->preg);
+	free (pattern->pattern);
+	free (pattern);
+	return NULL;
+    }
+
+    /* lowest index not used by another pattern */
+    index = 0;
+    p = regexPatterns;
+    while (p)
+    {
+	if (p->index == index)
+	{
+	    index++;
+	    p = regexPatterns;
+	}
+	else
+	{
+	    p = p->next;
+	}
+    }
+
+    if (index >= regexPatternIndexSize)
+	regexPatternIndexSize = index + 1;
+
+    /* zero is reserved for empty result entries */
+    if (!++regexLastPatternId)
+	regexLastPatternId++;
+
+    pattern->flags    = flags;
+    pattern->set      = set;
+    pattern->refCount = 1;
+    pattern->id	      = regexLastPatternId;
+    pattern->index    = index;
+    pattern->next     = regexPatterns;
+
+    regexPatterns = pattern;
+
+    regexSets[set].nPattern++;
+    regexInvalidateSet (set);
+
+    return pattern;
 }
 
-static Bool
-regexMatchExpEvalTitle (CompDisplay *d,
-			CompWindow  *w,
-			CompPrivate private)
+static void
+regexReleasePattern (RegexPattern *pattern)
 {
-    regex_t *preg = (regex_t *) private.ptr;
-    int	    status;
+    RegexPattern **p;
 
-    REGEX_WINDOW (w);
+    if (--pattern->refCount)
+	return;
 
-    if (!preg)
-	return FALSE;
+    for (p = &regexPatterns; *p; p = &(*p)->next)
+    {
+	if (*p == pattern)
+	{
+	    *p = pattern->next;
+	    break;
+	}
+    }
 
-    if (!rw->title)
-	return FALSE;
+    regexSets[pattern->set].nPattern--;
+    regexInvalidateSet (pattern->set);
 
-    status = regexec (preg, rw->title, 0, NULL, 0);
-    if (status)
-	return FALSE;
+    regfree (&pattern->preg);
+    free (pattern->pattern);
+    free (pattern);
+}
 
-    return TRUE;
+/* builds "\(p1\)\|\(p2\)\|..." from the patterns in a set. Patterns
+   with back-references would be renumbered by the extra groups, so
+   sets containing one are left without an alternation */
+static void
+regexUpdateSet (int set)
+{
+    RegexPatternSet *s = &regexSets[set];
+    RegexPattern    *pattern;
+    char	    *str, *end;
+    int		    size = 1, flags = 0;
+
+    if (!s->dirty)
+	return;
+
+    s->dirty = FALSE;
+
+    if (s->nPattern < 2)
+	return;
+
+    for (pattern = regexPatterns; pattern; pattern = pattern->next)
+    {
+	const char *c;
+
+	if (pattern->set != set)
+	    continue;
+
+	for (c = pattern->pattern; *c; c++)
+	    if (c[0] == '\\' && c[1] >= '1' && c[1] <= '9')
+		return;
+
+	size += strlen (pattern->pattern) + 6;
+	flags = pattern->flags;
+    }
+
+    str = malloc (size);
+    if (!str)
+	return;
+
+    end = str;
+    for (pattern = regexPatterns; pattern; pattern = pattern->next)
+    {
+	if (pattern->set != set)
+	    continue;
+
+	if (end != str)
+	    end += sprintf (end, "\\|");
+
+	end += sprintf (end, "\\(%s\\)", pattern->pattern);
+    }
+
+    s->compiled = !regcomp (&s->preg, str, REG_NOSUB | flags);
+
+    free (str);
 }
 
-static Bool
-regexMatchExpEvalRole (CompDisplay *d,
-		       CompWindow  *w,
-		       CompPrivate private)
+/* evaluates all patterns of a set against a window string at once
+   and stores the results, most strings match none of them and are
+   rejected by the alternation alone */
+static void
+regexMatchSet (RegexResultTable *table,
+	       int		set,
+	       const char	*str)
 {
-    regex_t *preg = (regex_t *) private.ptr;
-    int	    status;
+    RegexPattern *pattern;
+    Bool	 any = TRUE;
 
-    REGEX_WINDOW (w);
+    regexUpdateSet (set);
 
-    if (!preg)
-	return FALSE;
+    if (regexSets[set].compiled)
+	any = !regexec (&regexSets[set].preg, str, 0, NULL, 0);
 
-    if (!rw->role)
-	return FALSE;
+    for (pattern = regexPatterns; pattern; pattern = pattern->next)
+    {
+	RegexResult *result;
 
-    status = regexec (preg, rw->role, 0, NULL, 0);
-    if (status)
-	return FALSE;
+	if (pattern->set != set)
+	    continue;
 
-    return TRUE;
+	result = &table->result[pattern->index];
+
+	result->id    = pattern->id;
+	result->value = any && !regexec (&pattern->preg, str, 0, NULL, 0);
+    }
+}
+
+static void
+regexClearResults (RegexWindow *rw,
+		   int	       field)
+{
+    RegexResultTable *table = &rw->table[field];
+
+    if (table->nResult)
+	memset (table->result, 0, sizeof (RegexResult) * table->nResult);
 }
 
 static Bool
-regexMatchExpEvalClass (CompDisplay *d,
-			CompWindow  *w,
-			CompPrivate private)
+regexMatchString (RegexWindow  *rw,
+		  RegexPattern *pattern,
+		  int	       field,
+		  const char   *str)
 {
-    regex_t *preg = (regex_t *) private.ptr;
-    int	    status;
+    RegexResultTable *table = &rw->table[field];
+    RegexResult	     *result;
 
-    if (!preg)
+    if (!pattern || !str)
 	return FALSE;
 
-    if (!w->resClass)
-	return FALSE;
+    if (regexPatternIndexSize > table->nResult)
+    {
+	int size = regexPatternIndexSize;
 
-    status = regexec (preg, w->resClass, 0, NULL, 0);
-    if (status)
-	return FALSE;
+	result = realloc (table->result, sizeof (RegexResult) * size);
+	if (!result)
+	    return !regexec (&pattern->preg, str, 0, NULL, 0);
 
-    return TRUE;
+	memset (result + table->nResult, 0,
+		sizeof (RegexResult) * (size - table->nResult));
+
+	table->result  = result;
+	table->nResult = size;
+    }
+
+    result = &table->result[pattern->index];
+    if (result->id != pattern->id)
+    {
+	/* a lone pattern is cheaper to run directly */
+	if (regexSets[pattern->set].nPattern > 1)
+	{
+	    regexMatchSet (table, pattern->set, str);
+	}
+	else
+	{
+	    result->id    = pattern->id;
+	    result->value = !regexec (&pattern->preg, str, 0, NULL, 0);
+	}
+    }
+
+    return result->value;
+}
+
+static void
+regexMatchExpFini (CompDisplay *d,
+		   CompPrivate private)
+{
+    RegexPattern *pattern = (RegexPattern *) private.ptr;
+
+    if (pattern)
+	regexReleasePattern (pattern);
 }
 
 static Bool
-regexMatchExpEvalName (CompDisplay *d,
+regexMatchExpEvalTitle (CompDisplay *d,
+			CompWindow  *w,
+			CompPrivate private)
+{
+    REGEX_WINDOW (w);
+
+    return regexMatchString (rw, private.ptr, REGEX_FIELD_TITLE, rw->title);
+}
+
+static Bool
+regexMatchExpEvalRole (CompDisplay *d,
 		       CompWindow  *w,
 		       CompPrivate private)
 {
-    regex_t *preg = (regex_t *) private.ptr;
-    int	    status;
+    REGEX_WINDOW (w);
 
-    if (!preg)
-	return FALSE;
+    return regexMatchString (rw, private.ptr, REGEX_FIELD_ROLE, rw->role);
+}
 
-    if (!w->resName)
-	return FALSE;
+static Bool
+regexMatchExpEvalClass (CompDisplay *d,
+			CompWindow  *w,
+			CompPrivate private)
+{
+    REGEX_WINDOW (w);
 
-    status = regexec (preg, w->resName, 0, NULL, 0);
-    if (status)
-	return FALSE;
+    return regexMatchString (rw, private.ptr, REGEX_FIELD_CLASS, w->resClass);
+}
 
-    return TRUE;
+static Bool
+regexMatchExpEvalName (CompDisplay *d,
+		       CompWindow  *w,
+		       CompPrivate private)
+{
+    REGEX_WINDOW (w);
+
+    return regexMatchString (rw, private.ptr, REGEX_FIELD_NAME, w->resName);
 }
 
 static void
@@ -185,15 +444,20 @@ regexMatchInitExp (CompDisplay  *d,
 	int		     len;
 	CompMatchExpEvalProc eval;
 	unsigned int         flags;
+	unsigned int	     properties;
     } prefix[] = {
-	{ "title=", 6, regexMatchExpEvalTitle, 0 },
-	{ "role=",  5, regexMatchExpEvalRole, 0  },
-	{ "class=", 6, regexMatchExpEvalClass, 0 },
-	{ "name=",  5, regexMatchExpEvalName, 0  },
-	{ "ititle=", 7, regexMatchExpEvalTitle, REG_ICASE },
-	{ "irole=",  6, regexMatchExpEvalRole, REG_ICASE  },
-	{ "iclass=", 7, regexMatchExpEvalClass, REG_ICASE },
-	{ "iname=",  6, regexMatchExpEvalName, REG_ICASE  },
+	{ "title=", 6, regexMatchExpEvalTitle, 0, MATCH_PROPERTY_TITLE_MASK },
+	{ "role=",  5, regexMatchExpEvalRole, 0, MATCH_PROPERTY_ROLE_MASK  },
+	{ "class=", 6, regexMatchExpEvalClass, 0, MATCH_PROPERTY_CLASS_MASK },
+	{ "name=",  5, regexMatchExpEvalName, 0, MATCH_PROPERTY_NAME_MASK  },
+	{ "ititle=", 7, regexMatchExpEvalTitle, REG_ICASE,
+	  MATCH_PROPERTY_TITLE_MASK },
+	{ "irole=",  6, regexMatchExpEvalRole, REG_ICASE,
+	  MATCH_PROPERTY_ROLE_MASK  },
+	{ "iclass=", 7, regexMatchExpEvalClass, REG_ICASE,
+	  MATCH_PROPERTY_CLASS_MASK },
+	{ "iname=",  6, regexMatchExpEvalName, REG_ICASE,
+	  MATCH_PROPERTY_NAME_MASK  },
     };
     int	i;
 
@@ -205,34 +469,11 @@ regexMatchInitExp (CompDisplay  *d,
 
     if (i < sizeof (prefix) / sizeof (prefix[0]))
     {
-	regex_t *preg;
-
-	preg = malloc (sizeof (regex_t));
-	if (preg)
-	{
-	    int status;
-
-	    value += prefix[i].len;
-
-	    status = regcomp (preg, value, REG_NOSUB | prefix[i].flags);
-	    if (status)
-	    {
-		char errMsg[1024];
-
-		regerror (status, preg, errMsg, sizeof (errMsg));
-
-		compLogMessage ("regex", CompLogLevelWarn,
-				"%s = %s", errMsg, value);
-
-		regfree (preg);
-		free (preg);
-		preg = NULL;
-	    }
-	}
-
-	exp->fini     = regexMatchExpFini;
-	exp->eval     = prefix[i].eval;
-	exp->priv.ptr = preg;
+	exp->fini	= regexMatchExpFini;
+	exp->eval	= prefix[i].eval;
+	exp->priv.ptr	= regexGetPattern (value + prefix[i].len,
+					   prefix[i].flags, i);
+	exp->properties = prefix[i].properties;
     }
     else
     {
@@ -320,6 +561,8 @@ regexHandleEvent (CompDisplay *d,
 
 		rw->title = regexGetWindowTitle (w);
 
+		regexClearResults (rw, REGEX_FIELD_TITLE);
+		invalidateWindowMatchCache (w, MATCH_PROPERTY_TITLE_MASK);
 		(*d->matchPropertyChanged) (d, w);
 	    }
 	}
@@ -335,6 +578,8 @@ regexHandleEvent (CompDisplay *d,
 
 		rw->role = regexGetStringProperty (w, rd->roleAtom, XA_STRING);
 
+		regexClearResults (rw, REGEX_FIELD_ROLE);
+		invalidateWindowMatchCache (w, MATCH_PROPERTY_ROLE_MASK);
 		(*d->matchPropertyChanged) (d, w);
 	    }
 	}
@@ -342,7 +587,16 @@ regexHandleEvent (CompDisplay *d,
 	{
 	    w = findWindowAtDisplay (d, event->xproperty.window);
 	    if (w)
+	    {
+		REGEX_WINDOW (w);
+
+		regexClearResults (rw, REGEX_FIELD_CLASS);
+		regexClearResults (rw, REGEX_FIELD_NAME);
+
+		invalidateWindowMatchCache (w, MATCH_PROPERTY_CLASS_MASK |
+					    MATCH_PROPERTY_NAME_MASK);
 		(*d->matchPropertyChanged) (d, w);
+	    }
 	}
     }
 }
@@ -449,6 +703,7 @@ regexInitWindow (CompPlugin *p,
 		 CompWindow *w)
 {
     RegexWindow *rw;
+    int		i;
 
     REGEX_DISPLAY (w->screen->display);
     REGEX_SCREEN (w->screen);
@@ -457,6 +712,12 @@ regexInitWindow (CompPlugin *p,
     if (!rw)
 	return FALSE;
 
+    for (i = 0; i < REGEX_FIELD_NUM; i++)
+    {
+	rw->table[i].result  = NULL;
+	rw->table[i].nResult = 0;
+    }
+
     rw->title = regexGetWindowTitle (w);
     rw->role  = regexGetStringProperty (w, rd->roleAtom, XA_STRING);
 
@@ -469,6 +730,8 @@ static void
 regexFiniWindow (CompPlugin *p,
 		 CompWindow *w)
 {
+    int i;
+
     REGEX_WINDOW (w);
 
     if (rw->title)
@@ -477,6 +740,10 @@ regexFiniWindow (CompPlugin *p,
     if (rw->role)
 	free (rw->role);
 
+    for (i = 0; i < REGEX_FIELD_NUM; i++)
+	if (rw->table[i].result)
+	    free (rw->table[i].result);
+
     free (rw);
 }
 
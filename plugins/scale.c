@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 #include <sys/time.h>
 
 #include <X11/Xatom.h>
@@ -357,6 +358,244 @@ setScaledPaintAttributes (CompWindow        *w,
     return drawScaled;
 }
 
+static Bool
+scaleDownsampleWindow (CompWindow *w)
+{
+    CompScreen *s = w->screen;
+    GLenum     status;
+    GLint      fbo;
+
+    SCALE_SCREEN (s);
+    SCALE_WINDOW (w);
+
+    if (!ss->fbo)
+    {
+	(*s->genFramebuffers) (1, &ss->fbo);
+	if (!ss->fbo)
+	    return FALSE;
+    }
+
+    /* the screen may be painted into another framebuffer object */
+    glGetIntegerv (GL_FRAMEBUFFER_BINDING_EXT, &fbo);
+
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, ss->fbo);
+
+    (*s->framebufferTexture2D) (GL_FRAMEBUFFER_EXT,
+				GL_COLOR_ATTACHMENT0_EXT,
+				sw->thumbnail.target, sw->thumbnail.name,
+				0);
+
+    status = (*s->checkFramebufferStatus) (GL_FRAMEBUFFER_EXT);
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
+    {
+	compLogMessage ("scale", CompLogLevelError,
+			"Framebuffer incomplete");
+
+	(*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, fbo);
+	(*s->deleteFramebuffers) (1, &ss->fbo);
+
+	ss->fbo = 0;
+
+	return FALSE;
+    }
+
+    glPushAttrib (GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT |
+		  GL_CURRENT_BIT);
+
+    glDrawBuffer (GL_COLOR_ATTACHMENT0_EXT);
+
+    glDisable (GL_BLEND);
+    glDisable (GL_SCISSOR_TEST);
+    glDisable (GL_STENCIL_TEST);
+    glDisable (GL_CLIP_PLANE0);
+    glDisable (GL_CLIP_PLANE1);
+    glDisable (GL_CLIP_PLANE2);
+    glDisable (GL_CLIP_PLANE3);
+
+    glViewport (0, 0, sw->thumbWidth, sw->thumbHeight);
+    glMatrixMode (GL_PROJECTION);
+    glPushMatrix ();
+    glLoadIdentity ();
+    glOrtho (0.0, 1.0, 0.0, 1.0, -1.0, 1.0);
+    glMatrixMode (GL_MODELVIEW);
+    glPushMatrix ();
+    glLoadIdentity ();
+
+    glColor4usv (defaultColor);
+
+    /* a half size target samples the center of each 2x2 texel block,
+       so bilinear filtering gives an exact box filter */
+    enableTexture (s, w->texture, COMP_TEXTURE_FILTER_GOOD);
+
+    glBegin (GL_QUADS);
+    glTexCoord2f (0.0f, 0.0f);
+    glVertex2f (0.0f, 0.0f);
+    glTexCoord2f (1.0f, 0.0f);
+    glVertex2f (1.0f, 0.0f);
+    glTexCoord2f (1.0f, 1.0f);
+    glVertex2f (1.0f, 1.0f);
+    glTexCoord2f (0.0f, 1.0f);
+    glVertex2f (0.0f, 1.0f);
+    glEnd ();
+
+    disableTexture (s, w->texture);
+
+    glMatrixMode (GL_PROJECTION);
+    glPopMatrix ();
+    glMatrixMode (GL_MODELVIEW);
+    glPopMatrix ();
+
+    /* the saved draw buffer belongs to the previous framebuffer */
+    (*s->bindFramebuffer) (GL_FRAMEBUFFER_EXT, fbo);
+
+    glPopAttrib ();
+
+    return TRUE;
+}
+
+static Bool
+scaleUpdateThumbnail (CompWindow *w)
+{
+    CompScreen *s = w->screen;
+    float      scale;
+    int	       width, height, level;
+
+    SCALE_WINDOW (w);
+
+    /* windows that core can mipmap don't need a copy */
+    if (w->texture->mipmap || w->texture->target != GL_TEXTURE_2D)
+	return FALSE;
+
+    if (!s->fbo || !s->textureNonPowerOfTwo)
+	return FALSE;
+
+    scale = sw->scale;
+    if (sw->slot)
+	scale = MIN (scale, sw->slot->scale);
+
+    if (scale >= 0.5f)
+	return FALSE;
+
+    width  = (w->width  + 1) / 2;
+    height = (w->height + 1) / 2;
+
+    if (!sw->thumbnail.name     ||
+	sw->thumbWidth  != width ||
+	sw->thumbHeight != height)
+    {
+	finiTexture (s, &sw->thumbnail);
+	initTexture (s, &sw->thumbnail);
+
+	glGenTextures (1, &sw->thumbnail.name);
+	if (!sw->thumbnail.name)
+	    return FALSE;
+
+	glBindTexture (GL_TEXTURE_2D, sw->thumbnail.name);
+
+	glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA,
+#if IMAGE_BYTE_ORDER == MSBFirst
+		      GL_UNSIGNED_INT_8_8_8_8_REV,
+#else
+		      GL_UNSIGNED_BYTE,
+#endif
+		      NULL);
+
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glBindTexture (GL_TEXTURE_2D, 0);
+
+	/* oldMipmaps is set when the window is damaged, a new copy
+	   needs to be taken in that case */
+	sw->thumbnail.filter	 = GL_LINEAR;
+	sw->thumbnail.mipmap	 = TRUE;
+	sw->thumbnail.oldMipmaps = FALSE;
+
+	sw->thumbWidth  = width;
+	sw->thumbHeight = height;
+	sw->thumbLevel  = -1;
+    }
+
+    /* the copy covers the same area as the window texture */
+    sw->thumbnail.matrix = w->texture->matrix;
+
+    /* levels below the one matching the slot size are never sampled */
+    level = 0;
+    while ((1 << level) < 0.5f / scale &&
+	   (MAX (width, height) >> level) > 1)
+	level++;
+
+    if (sw->thumbnail.oldMipmaps || sw->thumbLevel < 0)
+    {
+	if (!scaleDownsampleWindow (w))
+	    return FALSE;
+
+	sw->thumbnail.oldMipmaps = FALSE;
+	sw->thumbLevel = -1;
+    }
+
+    if (level > sw->thumbLevel)
+    {
+	glBindTexture (GL_TEXTURE_2D, sw->thumbnail.name);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level);
+
+	if (level > 0)
+	    (*s->generateMipmap) (GL_TEXTURE_2D);
+
+	glBindTexture (GL_TEXTURE_2D, 0);
+
+	sw->thumbLevel = level;
+    }
+
+    return TRUE;
+}
+
+static void
+scaleFreeThumbnails (CompScreen *s)
+{
+    CompWindow *w;
+
+    for (w = s->windows; w; w = w->next)
+    {
+	SCALE_WINDOW (w);
+
+	if (!sw->thumbnail.name)
+	    continue;
+
+	finiTexture (s, &sw->thumbnail);
+	initTexture (s, &sw->thumbnail);
+
+	sw->thumbWidth = sw->thumbHeight = 0;
+	sw->thumbLevel = -1;
+    }
+}
+
+static void
+scaleDrawWindowTexture (CompWindow	     *w,
+			CompTexture	     *texture,
+			const FragmentAttrib *attrib,
+			unsigned int	     mask)
+{
+    CompScreen *s = w->screen;
+
+    SCALE_SCREEN (s);
+    SCALE_WINDOW (w);
+
+    if (texture == w->texture			 &&
+	ss->state != SCALE_STATE_NONE		 &&
+	(sw->adjust || sw->slot)		 &&
+	(mask & PAINT_WINDOW_TRANSFORMED_MASK)	 &&
+	ss->opt[SCALE_SCREEN_OPTION_MIPMAP].value.b &&
+	scaleUpdateThumbnail (w))
+	texture = &sw->thumbnail;
+
+    UNWRAP (ss, s, drawWindowTexture);
+    (*s->drawWindowTexture) (w, texture, attrib, mask);
+    WRAP (ss, s, drawWindowTexture, scaleDrawWindowTexture);
+}
+
 static Bool
 scalePaintWindow (CompWindow		  *w,
 		  const WindowPaintAttrib *attrib,
@@ -389,6 +628,7 @@ scalePaintWindow (CompWindow		  *w,
 	{
 	    FragmentAttrib fragment;
 	    CompTransform  wTransform = *transform;
+	    int		   filter;
 
 	    if (mask & PAINT_WINDOW_OCCLUSION_DETECTION_MASK)
 		return FALSE;
@@ -405,6 +645,11 @@ scalePaintWindow (CompWindow		  *w,
 			     sw->ty / sw->scale - w->attrib.y,
 			     0.0f);
 
+	    filter = s->display->textureFilter;
+
+	    if (ss->opt[SCALE_SCREEN_OPTION_MIPMAP].value.b)
+		s->display->textureFilter = GL_LINEAR_MIPMAP_LINEAR;
+
 	    glPushMatrix ();
 	    glLoadMatrixf (wTransform.m);
 
@@ -413,6 +658,8 @@ scalePaintWindow (CompWindow		  *w,
 
 	    glPopMatrix ();
 
+	    s->display->textureFilter = filter;
+
 	    (*ss->scalePaintDecoration) (w, &sAttrib, transform, region, mask);
 	}
     }
@@ -426,18 +673,55 @@ scalePaintWindow (CompWindow		  *w,
     return status;
 }
 
+static float
+scaleWindowAspect (CompWindow *w)
+{
+    int width, height;
+
+    width  = w->width  + w->input.left + w->input.right;
+    height = w->height + w->input.top  + w->input.bottom;
+
+    return (float) width / MAX (height, 1);
+}
+
 static int
-compareWindowsDistance (const void *elem1,
+compareWindowsVertical (const void *elem1,
 			const void *elem2)
 {
     CompWindow *w1 = *((CompWindow **) elem1);
     CompWindow *w2 = *((CompWindow **) elem2);
+    int	       d;
+
+    d = (w1->serverY + w1->height / 2) - (w2->serverY + w2->height / 2);
+    if (d)
+	return d;
+
+    return (w1->serverX + w1->width / 2) - (w2->serverX + w2->width / 2);
+}
 
-    SCALE_SCREEN (w1->screen);
+static int
+compareWindowsHorizontal (const void *elem1,
+			  const void *elem2)
+{
+    CompWindow *w1 = *((CompWindow **) elem1);
+    CompWindow *w2 = *((CompWindow **) elem2);
 
-    return
-	GET_SCALE_WINDOW (w1, ss)->distance -
-	GET_SCALE_WINDOW (w2, ss)->distance;
+    return (w1->serverX + w1->width / 2) - (w2->serverX + w2->width / 2);
+}
+
+static int
+compareWindowsOutput (const void *elem1,
+		      const void *elem2)
+{
+    CompWindow *w1 = *((CompWindow **) elem1);
+    CompWindow *w2 = *((CompWindow **) elem2);
+    int	       d;
+
+    d = outputDeviceForWindow (w1) - outputDeviceForWindow (w2);
+    if (d)
+	return d;
+
+    return compareWindowsVertical (elem1, elem2);
 }
 
 static void
@@ -489,6 +773,294 @@ layoutSlotsForArea (CompScreen *s,
     }
 }
 
+/* Splits the windows, sorted top to bottom, into lines of about
+   equal total aspect and returns the number of windows in each line
+   through lineSize. */
+static void
+splitRows (CompWindow **windows,
+	   int	      nWindows,
+	   int	      lines,
+	   int	      *lineSize)
+{
+    float total = 0.0f, target, sum, aspect;
+    int	  i, line;
+
+    for (i = 0; i < nWindows; i++)
+	total += scaleWindowAspect (windows[i]);
+
+    target = total / lines;
+    sum    = 0.0f;
+    line   = 0;
+
+    for (i = 0; i < lines; i++)
+	lineSize[i] = 0;
+
+    for (i = 0; i < nWindows; i++)
+    {
+	aspect = scaleWindowAspect (windows[i]);
+
+	/* start a new line when this window would push the current
+	   one further past the target than it leaves it short, but
+	   keep enough windows for the remaining lines */
+	if (lineSize[line] && line < lines - 1 &&
+	    (sum + aspect / 2.0f > target * (line + 1) ||
+	     nWindows - i <= lines - line - 1))
+	    line++;
+
+	lineSize[line]++;
+	sum += aspect;
+    }
+}
+
+static void
+layoutRowsForArea (CompScreen *s,
+		   XRectangle workArea,
+		   CompWindow **windows,
+		   int	      nWindows)
+{
+    int	  i, j, k, lines, bestLines;
+    int	  *lineSize;
+    float height, bestHeight, lineHeight, rowAspect;
+    float x, y, width;
+    int	  spacing;
+
+    SCALE_SCREEN (s);
+
+    if (!nWindows)
+	return;
+
+    lineSize = malloc (nWindows * sizeof (int));
+    if (!lineSize)
+	return;
+
+    spacing = ss->opt[SCALE_SCREEN_OPTION_SPACING].value.i;
+
+    qsort (windows, nWindows, sizeof (CompWindow *), compareWindowsVertical);
+
+    /* pick the number of lines that gives the biggest thumbnails, all
+       lines share one height so that is the same as the most covered
+       area */
+    bestLines  = 1;
+    bestHeight = 0.0f;
+
+    for (lines = 1; lines <= nWindows; lines++)
+    {
+	height = (float) (workArea.height - (lines + 1) * spacing) / lines;
+	if (height <= 0.0f)
+	    break;
+
+	splitRows (windows, nWindows, lines, lineSize);
+
+	for (i = 0, k = 0; i < lines; i++)
+	{
+	    rowAspect = 0.0f;
+	    for (j = 0; j < lineSize[i]; j++)
+		rowAspect += scaleWindowAspect (windows[k++]);
+
+	    width = workArea.width - (lineSize[i] + 1) * spacing;
+	    height = MIN (height, width / rowAspect);
+	}
+
+	if (height > bestHeight)
+	{
+	    bestHeight = height;
+	    bestLines  = lines;
+	}
+    }
+
+    splitRows (windows, nWindows, bestLines, lineSize);
+
+    lineHeight = MAX (bestHeight, 1.0f);
+
+    y = workArea.y + (workArea.height - bestLines * lineHeight -
+		      (bestLines - 1) * spacing) / 2;
+
+    for (i = 0, k = 0; i < bestLines; i++)
+    {
+	/* keep the left to right order of the windows in each line */
+	qsort (windows + k, lineSize[i], sizeof (CompWindow *),
+	       compareWindowsHorizontal);
+
+	rowAspect = 0.0f;
+	for (j = 0; j < lineSize[i]; j++)
+	    rowAspect += scaleWindowAspect (windows[k + j]);
+
+	x = workArea.x + (workArea.width - rowAspect * lineHeight -
+			  (lineSize[i] - 1) * spacing) / 2;
+
+	for (j = 0; j < lineSize[i]; j++, k++)
+	{
+	    SCALE_WINDOW (windows[k]);
+
+	    width = scaleWindowAspect (windows[k]) * lineHeight;
+
+	    ss->slots[ss->nSlots].x1 = x;
+	    ss->slots[ss->nSlots].y1 = y;
+	    ss->slots[ss->nSlots].x2 = x + width;
+	    ss->slots[ss->nSlots].y2 = y + lineHeight;
+
+	    ss->slots[ss->nSlots].filled = FALSE;
+
+	    sw->sid = ss->nSlots++;
+
+	    x += width + spacing;
+	}
+
+	y += lineHeight + spacing;
+    }
+
+    free (lineSize);
+}
+
+#define NATURAL_MAX_PASSES 100
+
+static void
+layoutNaturalForArea (CompScreen *s,
+		      XRectangle workArea,
+		      CompWindow **windows,
+		      int	 nWindows)
+{
+    CompWindow *w;
+    float      *rect, *r1, *r2;
+    float      ox, oy, dx, dy, scale, bx1, by1, bx2, by2;
+    int	       i, j, pass, spacing;
+    Bool       overlap;
+
+    SCALE_SCREEN (s);
+
+    if (!nWindows)
+	return;
+
+    rect = malloc (nWindows * 4 * sizeof (float));
+    if (!rect)
+	return;
+
+    spacing = ss->opt[SCALE_SCREEN_OPTION_SPACING].value.i;
+
+    /* start from the real window geometry */
+    for (i = 0; i < nWindows; i++)
+    {
+	w  = windows[i];
+	r1 = rect + i * 4;
+
+	r1[0] = w->serverX - w->input.left;
+	r1[1] = w->serverY - w->input.top;
+	r1[2] = w->serverX + w->width  + w->input.right;
+	r1[3] = w->serverY + w->height + w->input.bottom;
+    }
+
+    /* push overlapping windows apart along the axis where they
+       overlap least, so they move as little as possible */
+    for (pass = 0; pass < NATURAL_MAX_PASSES; pass++)
+    {
+	overlap = FALSE;
+
+	for (i = 0; i < nWindows; i++)
+	{
+	    r1 = rect + i * 4;
+
+	    for (j = i + 1; j < nWindows; j++)
+	    {
+		r2 = rect + j * 4;
+
+		ox = MIN (r1[2], r2[2]) - MAX (r1[0], r2[0]) + spacing;
+		oy = MIN (r1[3], r2[3]) - MAX (r1[1], r2[1]) + spacing;
+
+		if (ox <= 0.0f || oy <= 0.0f)
+		    continue;
+
+		overlap = TRUE;
+
+		dx = (r2[0] + r2[2]) - (r1[0] + r1[2]);
+		dy = (r2[1] + r2[3]) - (r1[1] + r1[3]);
+
+		if (ox < oy)
+		{
+		    ox = (dx < 0.0f) ? -ox / 2.0f : ox / 2.0f;
+
+		    r1[0] -= ox;
+		    r1[2] -= ox;
+		    r2[0] += ox;
+		    r2[2] += ox;
+		}
+		else
+		{
+		    oy = (dy < 0.0f) ? -oy / 2.0f : oy / 2.0f;
+
+		    r1[1] -= oy;
+		    r1[3] -= oy;
+		    r2[1] += oy;
+		    r2[3] += oy;
+		}
+	    }
+	}
+
+	if (!overlap)
+	    break;
+    }
+
+    bx1 = by1 = MAXSHORT;
+    bx2 = by2 = MINSHORT;
+
+    for (i = 0; i < nWindows; i++)
+    {
+	r1 = rect + i * 4;
+
+	bx1 = MIN (bx1, r1[0]);
+	by1 = MIN (by1, r1[1]);
+	bx2 = MAX (bx2, r1[2]);
+	by2 = MAX (by2, r1[3]);
+    }
+
+    /* fit the whole arrangement into the work area */
+    scale = MIN ((workArea.width  - 2 * spacing) / (bx2 - bx1),
+		 (workArea.height - 2 * spacing) / (by2 - by1));
+    scale = MIN (scale, 1.0f);
+
+    dx = workArea.x + (workArea.width  - (bx2 - bx1) * scale) / 2;
+    dy = workArea.y + (workArea.height - (by2 - by1) * scale) / 2;
+
+    for (i = 0; i < nWindows; i++)
+    {
+	SCALE_WINDOW (windows[i]);
+
+	r1 = rect + i * 4;
+
+	ss->slots[ss->nSlots].x1 = dx + (r1[0] - bx1) * scale;
+	ss->slots[ss->nSlots].y1 = dy + (r1[1] - by1) * scale;
+	ss->slots[ss->nSlots].x2 = dx + (r1[2] - bx1) * scale;
+	ss->slots[ss->nSlots].y2 = dy + (r1[3] - by1) * scale;
+
+	ss->slots[ss->nSlots].filled = FALSE;
+
+	sw->sid = ss->nSlots++;
+    }
+
+    free (rect);
+}
+
+static void
+layoutArea (CompScreen *s,
+	    XRectangle workArea,
+	    CompWindow **windows,
+	    int	       nWindows)
+{
+    SCALE_SCREEN (s);
+
+    switch (ss->opt[SCALE_SCREEN_OPTION_LAYOUT].value.i) {
+    case SCALE_LAYOUT_ROWS:
+	layoutRowsForArea (s, workArea, windows, nWindows);
+	break;
+    case SCALE_LAYOUT_NATURAL:
+	layoutNaturalForArea (s, workArea, windows, nWindows);
+	break;
+    case SCALE_LAYOUT_GRID:
+    default:
+	layoutSlotsForArea (s, workArea, nWindows);
+	break;
+    }
+}
+
 static SlotArea *
 getSlotAreas (CompScreen *s)
 {
@@ -568,12 +1140,13 @@ getSlotAreas (CompScreen *s)
 static void
 layoutSlots (CompScreen *s)
 {
-    int i;
-    int moMode;
+    int i, n;
+    int moMode, layout;
 
     SCALE_SCREEN (s);
 
     moMode  = ss->opt[SCALE_SCREEN_OPTION_MULTIOUTPUT_MODE].value.i;
+    layout  = ss->opt[SCALE_SCREEN_OPTION_LAYOUT].value.i;
 
     /* if we have only one head, we don't need the
        additional effort of the all outputs mode */
@@ -585,15 +1158,40 @@ layoutSlots (CompScreen *s)
     switch (moMode)
     {
     case SCALE_MOMODE_ALL:
+	if (layout != SCALE_LAYOUT_GRID)
+	{
+	    /* slots are built for specific windows, so start from the
+	       output each window is on */
+	    qsort (ss->windows, ss->nWindows, sizeof (CompWindow *),
+		   compareWindowsOutput);
+	}
+
+	if (layout == SCALE_LAYOUT_NATURAL)
+	{
+	    for (i = 0, n = 0; i < s->nOutputDev; i++)
+	    {
+		int first = n;
+
+		while (n < ss->nWindows &&
+		       outputDeviceForWindow (ss->windows[n]) == i)
+		    n++;
+
+		layoutArea (s, s->outputDev[i].workArea,
+			    ss->windows + first, n - first);
+	    }
+	}
+	else
 	{
 	    SlotArea *slotAreas;
 	    slotAreas = getSlotAreas (s);
 	    if (slotAreas)
 	    {
-		for (i = 0; i < s->nOutputDev; i++)
-		    layoutSlotsForArea (s,
-					slotAreas[i].workArea,
-					slotAreas[i].nWindows);
+		for (i = 0, n = 0; i < s->nOutputDev; i++)
+		{
+		    layoutArea (s, slotAreas[i].workArea,
+				ss->windows + n, slotAreas[i].nWindows);
+		    n += slotAreas[i].nWindows;
+		}
 		free (slotAreas);
 	    }
 	}
@@ -603,60 +1201,175 @@ layoutSlots (CompScreen *s)
 	{
 	    XRectangle workArea;
 	    workArea = s->outputDev[s->currentOutputDev].workArea;
-	    layoutSlotsForArea (s, workArea, ss->nWindows);
+	    layoutArea (s, workArea, ss->windows, ss->nWindows);
 	}
 	break;
     }
 }
 
+/* Assigns windows to the free slots so that the sum of the distances
+   between window and slot centers is minimal. This is the O(n^3)
+   Hungarian method on a windows x slots cost matrix, with rows for
+   windows and columns for slots. */
 static void
 findBestSlots (CompScreen *s)
 {
     CompWindow *w;
-    int        i, j, d, d0 = 0;
+    ScaleSlot  *slot;
+    int        i, j, j0, j1, n, m, delta;
+    int        *row, *col, *cost, *u, *v, *p, *way, *minv;
+    Bool       *used;
     float      sx, sy, cx, cy;
 
     SCALE_SCREEN (s);
 
-    for (i = 0; i < ss->nWindows; i++)
+    row = malloc ((ss->nWindows + ss->nSlots) * sizeof (int));
+    if (!row)
+	return;
+
+    col = row + ss->nWindows;
+
+    for (i = 0, n = 0; i < ss->nWindows; i++)
     {
-	w = ss->windows[i];
+	SCALE_WINDOW (ss->windows[i]);
 
-	SCALE_WINDOW (w);
+	sw->sid = -1;
 
-	if (sw->slot)
-	    continue;
+	if (!sw->slot)
+	    row[n++] = i;
+    }
 
-	sw->sid      = 0;
-	sw->distance = MAXSHORT;
+    for (j = 0, m = 0; j < ss->nSlots; j++)
+	if (!ss->slots[j].filled)
+	    col[m++] = j;
+
+    if (!n || n > m)
+    {
+	free (row);
+	return;
+    }
 
-	for (j = 0; j < ss->nSlots; j++)
+    cost = malloc (n * m * sizeof (int) +
+		   (n + 1) * sizeof (int) +
+		   (m + 1) * 4 * sizeof (int) +
+		   (m + 1) * sizeof (Bool));
+    if (!cost)
+    {
+	free (row);
+	return;
+    }
+
+    u    = cost + n * m;
+    v    = u + n + 1;
+    p    = v + m + 1;
+    way  = p + m + 1;
+    minv = way + m + 1;
+    used = (Bool *) (minv + m + 1);
+
+    for (i = 0; i < n; i++)
+    {
+	w = ss->windows[row[i]];
+
+	cx = w->serverX + w->width  / 2;
+	cy = w->serverY + w->height / 2;
+
+	for (j = 0; j < m; j++)
+	{
+	    slot = &ss->slots[col[j]];
+
+	    sx = (slot->x2 + slot->x1) / 2;
+	    sy = (slot->y2 + slot->y1) / 2;
+
+	    cost[i * m + j] = sqrt ((cx - sx) * (cx - sx) +
+				    (cy - sy) * (cy - sy));
+	}
+    }
+
+    /* potentials u and v, p[j] is the row matched to column j; both
+       are one based so that index 0 can stand for "unmatched" */
+    memset (u, 0, (n + 1) * sizeof (int));
+    memset (v, 0, (m + 1) * 4 * sizeof (int));
+
+    for (i = 1; i <= n; i++)
+    {
+	p[0] = i;
+	j0   = 0;
+
+	for (j = 0; j <= m; j++)
+	{
+	    minv[j] = INT_MAX;
+	    used[j] = FALSE;
+	}
+
+	do
 	{
-	    if (!ss->slots[j].filled)
+	    int i0 = p[j0];
+
+	    used[j0] = TRUE;
+	    delta    = INT_MAX;
+	    j1       = 0;
+
+	    for (j = 1; j <= m; j++)
 	    {
-		sx = (ss->slots[j].x2 + ss->slots[j].x1) / 2;
-		sy = (ss->slots[j].y2 + ss->slots[j].y1) / 2;
+		if (!used[j])
+		{
+		    int cur = cost[(i0 - 1) * m + j - 1] - u[i0] - v[j];
 
-		cx = w->serverX + w->width  / 2;
-		cy = w->serverY + w->height / 2;
+		    if (cur < minv[j])
+		    {
+			minv[j] = cur;
+			way[j]  = j0;
+		    }
 
-		cx -= sx;
-		cy -= sy;
+		    if (minv[j] < delta)
+		    {
+			delta = minv[j];
+			j1    = j;
+		    }
+		}
+	    }
 
-		d = sqrt (cx * cx + cy * cy);
-		if (d0 + d < sw->distance)
+	    for (j = 0; j <= m; j++)
+	    {
+		if (used[j])
 		{
-		    sw->sid      = j;
-		    sw->distance = d0 + d;
+		    u[p[j]] += delta;
+		    v[j]    -= delta;
+		}
+		else
+		{
+		    minv[j] -= delta;
 		}
 	    }
-	}
 
-	d0 += sw->distance;
+	    j0 = j1;
+	} while (p[j0]);
+
+	/* flip the augmenting path */
+	do
+	{
+	    j1    = way[j0];
+	    p[j0] = p[j1];
+	    j0    = j1;
+	} while (j0);
+    }
+
+    for (j = 1; j <= m; j++)
+    {
+	if (p[j])
+	{
+	    SCALE_WINDOW (ss->windows[row[p[j] - 1]]);
+
+	    sw->sid      = col[j - 1];
+	    sw->distance = cost[(p[j] - 1) * m + j - 1];
+	}
     }
+
+    free (cost);
+    free (row);
 }
 
-static Bool
+static void
 fillInWindows (CompScreen *s)
 {
     CompWindow *w;
@@ -673,8 +1386,8 @@ fillInWindows (CompScreen *s)
 
 	if (!sw->slot)
 	{
-	    if (ss->slots[sw->sid].filled)
-		return TRUE;
+	    if (sw->sid < 0 || ss->slots[sw->sid].filled)
+		continue;
 
 	    sw->slot = &ss->slots[sw->sid];
 
@@ -706,8 +1419,6 @@ fillInWindows (CompScreen *s)
 	    sw->adjust = TRUE;
 	}
     }
-
-    return FALSE;
 }
 
 static Bool
@@ -715,19 +1426,16 @@ layoutSlotsAndAssignWindows (CompScreen *s)
 {
     SCALE_SCREEN (s);
 
-    /* create a grid of slots */
+    /* create slots, the grid leaves it to findBestSlots to pick
+       windows for them while the other layouts build one slot for
+       each window */
     layoutSlots (s);
 
-    do
-    {
-	/* find most appropriate slots for windows */
+    /* find most appropriate slots for windows */
+    if (ss->opt[SCALE_SCREEN_OPTION_LAYOUT].value.i == SCALE_LAYOUT_GRID)
 	findBestSlots (s);
 
-	/* sort windows, window with closest distance to a slot first */
-	qsort (ss->windows, ss->nWindows, sizeof (CompWindow *),
-	       compareWindowsDistance);
-
-    } while (fillInWindows (s));
+    fillInWindows (s);
 
     return TRUE;
 }
@@ -943,6 +1651,8 @@ scaleDonePaintScreen (CompScreen *s)
 		   with other plugins. */
 		scaleActivateEvent (s, FALSE);
 		ss->state = SCALE_STATE_NONE;
+
+		scaleFreeThumbnails (s);
 	    }
 	    else if (ss->state == SCALE_STATE_OUT)
 		ss->state = SCALE_STATE_WAIT;
@@ -1840,7 +2550,22 @@ scaleHandleEvent (CompDisplay *d,
 		}
 	    }
 	}
+	break;
     default:
+	if (event->type == d->damageEvent + XDamageNotify)
+	{
+	    XDamageNotifyEvent *de = (XDamageNotifyEvent *) event;
+	    CompWindow	       *w;
+
+	    w = findWindowAtDisplay (d, de->drawable);
+	    if (w)
+	    {
+		SCALE_WINDOW (w);
+
+		if (sw->thumbnail.name)
+		    sw->thumbnail.oldMipmaps = TRUE;
+	    }
+	}
 	break;
     }
 
@@ -2040,7 +2765,9 @@ static const CompMetadataOptionInfo scaleScreenOptionInfo[] = {
     { "opacity", "int", "<min>0</min><max>100</max>", 0, 0 },
     { "overlay_icon", "int", RESTOSTRING (0, SCALE_ICON_LAST), 0, 0 },
     { "hover_time", "int", "<min>50</min>", 0, 0 },
-    { "multioutput_mode", "int", RESTOSTRING (0, SCALE_MOMODE_LAST), 0, 0 }
+    { "multioutput_mode", "int", RESTOSTRING (0, SCALE_MOMODE_LAST), 0, 0 },
+    { "mipmap", "bool", 0, 0, 0 },
+    { "layout", "int", RESTOSTRING (0, SCALE_LAYOUT_LAST), 0, 0 }
 };
 
 static Bool
@@ -2093,6 +2820,8 @@ scaleInitScreen (CompPlugin *p,
 
     matchInit (&ss->match);
 
+    ss->fbo = 0;
+
     ss->layoutSlotsAndAssignWindows = layoutSlotsAndAssignWindows;
     ss->setScaledPaintAttributes    = setScaledPaintAttributes;
     ss->scalePaintDecoration	    = scalePaintDecoration;
@@ -2102,6 +2831,7 @@ scaleInitScreen (CompPlugin *p,
     WRAP (ss, s, donePaintScreen, scaleDonePaintScreen);
     WRAP (ss, s, paintOutput, scalePaintOutput);
     WRAP (ss, s, paintWindow, scalePaintWindow);
+    WRAP (ss, s, drawWindowTexture, scaleDrawWindowTexture);
     WRAP (ss, s, damageWindowRect, scaleDamageWindowRect);
 
     ss->cursor = XCreateFontCursor (s->display->display, XC_left_ptr);
@@ -2121,10 +2851,14 @@ scaleFiniScreen (CompPlugin *p,
     UNWRAP (ss, s, donePaintScreen);
     UNWRAP (ss, s, paintOutput);
     UNWRAP (ss, s, paintWindow);
+    UNWRAP (ss, s, drawWindowTexture);
     UNWRAP (ss, s, damageWindowRect);
 
     matchFini (&ss->match);
 
+    if (ss->fbo)
+	(*s->deleteFramebuffers) (1, &ss->fbo);
+
     if (ss->cursor)
 	XFreeCursor (s->display->display, ss->cursor);
 
@@ -2162,6 +2896,10 @@ scaleInitWindow (CompPlugin *p,
     sw->delta = 1.0f;
     sw->lastThumbOpacity = 0.0f;
 
+    initTexture (w->screen, &sw->thumbnail);
+    sw->thumbWidth = sw->thumbHeight = 0;
+    sw->thumbLevel = -1;
+
     w->base.privates[ss->windowPrivateIndex].ptr = sw;
 
     return TRUE;
@@ -2173,6 +2911,8 @@ scaleFiniWindow (CompPlugin *p,
 {
     SCALE_WINDOW (w);
 
+    finiTexture (w->screen, &sw->thumbnail);
+
     free (sw);
 }
 
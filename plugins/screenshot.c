@@ -25,14 +25,21 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <compiz-core.h>
+#include <compiz-png.h>
 
 static CompMetadata shotMetadata;
 
 static int displayPrivateIndex;
 
+static int pngDisplayPrivateIndex;
+
 #define SHOT_DISPLAY_OPTION_INITIATE_BUTTON 0
 #define SHOT_DISPLAY_OPTION_DIR             1
 #define SHOT_DISPLAY_OPTION_LAUNCH_APP      2
@@ -42,9 +49,36 @@ typedef struct _ShotDisplay {
     int		    screenPrivateIndex;
     HandleEventProc handleEvent;
 
+    /* number of the last screenshot in the output directory,
+       -1 until the directory has been scanned */
+    int number;
+
+    /* png writer that is safe to use from worker threads, NULL when
+       the png plugin wasn't loaded before this one */
+    PngWriteFileProc writePng;
+
     CompOption opt[SHOT_DISPLAY_OPTION_NUM];
 } ShotDisplay;
 
+#define SHOT_NAME_SIZE 256
+
+/* a screenshot being written by a worker thread */
+typedef struct _ShotSave {
+    struct _ShotSave *next;
+    pthread_t	     thread;
+    pthread_mutex_t  *mutex;
+
+    PngWriteFileProc writePng;
+    char	     *dir;
+    char	     name[SHOT_NAME_SIZE];
+    int		     width, height;
+    void	     *buffer;
+
+    /* set by the worker thread when it is done */
+    Bool status;
+    Bool done;
+} ShotSave;
+
 typedef struct _ShotScreen {
     PaintOutputProc paintOutput;
     PaintScreenProc paintScreen;
@@ -52,6 +86,16 @@ typedef struct _ShotScreen {
 
     int  x1, y1, x2, y2;
     Bool grab;
+
+    /* pixel pack buffer of a readback that hasn't been saved yet */
+    GLuint	      pbo;
+    int		      width, height;
+    CompTimeoutHandle readbackHandle;
+
+    /* screenshots that are still being written */
+    ShotSave	      *saves;
+    pthread_mutex_t   saveMutex;
+    CompTimeoutHandle saveHandle;
 } ShotScreen;
 
 #define GET_SHOT_DISPLAY(d)					  \
@@ -69,6 +113,70 @@ typedef struct _ShotScreen {
 #define NUM_OPTIONS(s) (sizeof ((s)->opt) / sizeof (CompOption))
 
 
+static int
+shotFilter (const struct dirent *d)
+{
+    int number;
+
+    if (sscanf (d->d_name, "screenshot%d.png", &number))
+	return 1;
+
+    return 0;
+}
+
+static int
+shotSort (const void *_a,
+	  const void *_b)
+{
+    struct dirent **a = (struct dirent **) _a;
+    struct dirent **b = (struct dirent **) _b;
+    int		  al = strlen ((*a)->d_name);
+    int		  bl = strlen ((*b)->d_name);
+
+    if (al == bl)
+	return strcoll ((*a)->d_name, (*b)->d_name);
+    else
+	return al - bl;
+}
+
+/* looks up the number of the last screenshot in the output directory
+   once, later screenshots just count up from there */
+static Bool
+shotUpdateNumber (CompDisplay *d)
+{
+    struct dirent **namelist;
+    char	  *dir;
+    int		  n;
+
+    SHOT_DISPLAY (d);
+
+    if (sd->number >= 0)
+	return TRUE;
+
+    dir = sd->opt[SHOT_DISPLAY_OPTION_DIR].value.s;
+
+    n = scandir (dir, &namelist, shotFilter, shotSort);
+    if (n < 0)
+    {
+	perror (dir);
+	return FALSE;
+    }
+
+    sd->number = 0;
+
+    if (n > 0)
+    {
+	sscanf (namelist[n - 1]->d_name, "screenshot%d.png", &sd->number);
+
+	while (n--)
+	    free (namelist[n]);
+
+	free (namelist);
+    }
+
+    return TRUE;
+}
+
 static Bool
 shotInitiate (CompDisplay     *d,
 	      CompAction      *action,
@@ -143,6 +251,10 @@ shotTerminate (CompDisplay     *d,
 		reg.extents.y2 = MAX (ss->y1, ss->y2) + 1;
 
 		damageScreenRegion (s, &reg);
+
+		/* scan the output directory now rather than while
+		   painting the frame that is read back */
+		shotUpdateNumber (d);
 	    }
 	}
     }
@@ -152,30 +264,312 @@ shotTerminate (CompDisplay     *d,
     return FALSE;
 }
 
-static int
-shotFilter (const struct dirent *d)
+/* reserves the next free screenshot name by creating the file, the
+   number read from the directory is only where the search starts as
+   other screenshots may have been taken since it was scanned */
+static Bool
+shotReserveName (CompDisplay *d,
+		 char	     *name)
 {
-    int number;
+    char *dir, *file;
+    int	 fd;
 
-    if (sscanf (d->d_name, "screenshot%d.png", &number))
-	return 1;
+    SHOT_DISPLAY (d);
 
-    return 0;
+    if (!shotUpdateNumber (d))
+	return FALSE;
+
+    dir = sd->opt[SHOT_DISPLAY_OPTION_DIR].value.s;
+
+    file = malloc (strlen (dir) + SHOT_NAME_SIZE + 2);
+    if (!file)
+	return FALSE;
+
+    for (;;)
+    {
+	sprintf (name, "screenshot%d.png", ++sd->number);
+	sprintf (file, "%s/%s", dir, name);
+
+	fd = open (file, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (fd >= 0)
+	{
+	    close (fd);
+	    break;
+	}
+
+	if (errno != EEXIST)
+	{
+	    perror (file);
+	    free (file);
+	    return FALSE;
+	}
+    }
+
+    free (file);
+
+    return TRUE;
 }
 
-static int
-shotSort (const void *_a,
-	  const void *_b)
+/* runs in a worker thread, which must not walk the display's image
+   hooks as plugins wrap and unwrap them from the main thread */
+static void *
+shotSaveThread (void *closure)
 {
-    struct dirent **a = (struct dirent **) _a;
-    struct dirent **b = (struct dirent **) _b;
-    int		  al = strlen ((*a)->d_name);
-    int		  bl = strlen ((*b)->d_name);
+    ShotSave *save = (ShotSave *) closure;
+    Bool     status = FALSE;
+    char     *file;
 
-    if (al == bl)
-	return strcoll ((*a)->d_name, (*b)->d_name);
+    file = malloc (strlen (save->dir) + strlen (save->name) + 2);
+    if (file)
+    {
+	sprintf (file, "%s/%s", save->dir, save->name);
+
+	status = (*save->writePng) (file, save->width, save->height,
+				    save->width * 4, save->buffer);
+
+	free (file);
+    }
+
+    pthread_mutex_lock (save->mutex);
+    save->status = status;
+    save->done	 = TRUE;
+    pthread_mutex_unlock (save->mutex);
+
+    return NULL;
+}
+
+static void
+shotFinishSave (CompScreen *s,
+		ShotSave   *save)
+{
+    char *file;
+
+    SHOT_DISPLAY (s->display);
+
+    file = malloc (strlen (save->dir) + strlen (save->name) + 2);
+    if (file)
+	sprintf (file, "%s/%s", save->dir, save->name);
+
+    if (!save->status)
+    {
+	compLogMessage ("screenshot", CompLogLevelError,
+			"failed to write screenshot image");
+
+	/* remove the empty file that reserved the name */
+	if (file)
+	    unlink (file);
+    }
+    else if (file)
+    {
+	char *app = sd->opt[SHOT_DISPLAY_OPTION_LAUNCH_APP].value.s;
+
+	if (*app != '\0')
+	{
+	    char *command;
+
+	    command = malloc (strlen (app) + strlen (file) + 2);
+	    if (command)
+	    {
+		sprintf (command, "%s %s", app, file);
+
+		runCommand (s, command);
+
+		free (command);
+	    }
+	}
+    }
+
+    if (file)
+	free (file);
+
+    free (save->buffer);
+    free (save->dir);
+    free (save);
+}
+
+static Bool
+shotCollectSaves (void *closure)
+{
+    CompScreen *s = (CompScreen *) closure;
+    ShotSave   **p, *save;
+    Bool       done;
+
+    SHOT_SCREEN (s);
+
+    p = &ss->saves;
+    while ((save = *p))
+    {
+	pthread_mutex_lock (&ss->saveMutex);
+	done = save->done;
+	pthread_mutex_unlock (&ss->saveMutex);
+
+	if (!done)
+	{
+	    p = &save->next;
+	    continue;
+	}
+
+	*p = save->next;
+
+	pthread_join (save->thread, NULL);
+	shotFinishSave (s, save);
+    }
+
+    if (ss->saves)
+	return TRUE;
+
+    ss->saveHandle = 0;
+
+    return FALSE;
+}
+
+/* takes over the buffer, encoding and writing happens in a worker
+   thread so that large images don't hold up painting */
+static void
+shotSaveImage (CompScreen *s,
+	       int	  width,
+	       int	  height,
+	       void	  *buffer)
+{
+    ShotSave *save;
+
+    SHOT_DISPLAY (s->display);
+    SHOT_SCREEN (s);
+
+    save = malloc (sizeof (ShotSave));
+    if (!save)
+    {
+	free (buffer);
+	return;
+    }
+
+    save->dir = strdup (sd->opt[SHOT_DISPLAY_OPTION_DIR].value.s);
+    if (!save->dir || !shotReserveName (s->display, save->name))
+    {
+	if (save->dir)
+	    free (save->dir);
+
+	free (save);
+	free (buffer);
+	return;
+    }
+
+    save->writePng = sd->writePng;
+    save->mutex	   = &ss->saveMutex;
+    save->width	   = width;
+    save->height   = height;
+    save->buffer   = buffer;
+    save->status   = FALSE;
+    save->done	   = FALSE;
+
+    if (!save->writePng ||
+	pthread_create (&save->thread, NULL, shotSaveThread, save))
+    {
+	/* write the file right away through the image hooks if there
+	   is no png writer or no thread can be started */
+	save->status = writeImageToFile (s->display, save->dir, save->name,
+					 "png", width, height, buffer);
+
+	shotFinishSave (s, save);
+	return;
+    }
+
+    save->next = ss->saves;
+    ss->saves  = save;
+
+    if (!ss->saveHandle)
+	ss->saveHandle = compAddTimeout (100, 200, shotCollectSaves, s);
+}
+
+static Bool
+shotFinishReadback (void *closure)
+{
+    CompScreen *s = (CompScreen *) closure;
+    GLubyte    *data, *buffer;
+
+    SHOT_SCREEN (s);
+
+    ss->readbackHandle = 0;
+
+    makeScreenCurrent (s);
+
+    (*s->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, ss->pbo);
+
+    data = (*s->mapBuffer) (GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+    if (data)
+    {
+	buffer = malloc (sizeof (GLubyte) * ss->width * ss->height * 4);
+	if (buffer)
+	    memcpy (buffer, data, sizeof (GLubyte) * ss->width * ss->height * 4);
+
+	(*s->unmapBuffer) (GL_PIXEL_PACK_BUFFER_ARB);
+    }
     else
-	return al - bl;
+    {
+	buffer = NULL;
+    }
+
+    /* release the storage, screenshots are rare */
+    (*s->bufferData) (GL_PIXEL_PACK_BUFFER_ARB, 0, NULL, GL_STREAM_READ_ARB);
+    (*s->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+    if (buffer)
+	shotSaveImage (s, ss->width, ss->height, buffer);
+
+    return FALSE;
+}
+
+static void
+shotReadPixels (CompScreen *s,
+		int	   x,
+		int	   y,
+		int	   width,
+		int	   height)
+{
+    SHOT_SCREEN (s);
+
+    /* only one readback can be in flight */
+    if (ss->readbackHandle)
+    {
+	compRemoveTimeout (ss->readbackHandle);
+	shotFinishReadback (s);
+    }
+
+    if (s->pbo)
+    {
+	if (!ss->pbo)
+	    (*s->genBuffers) (1, &ss->pbo);
+
+	/* glReadPixels returns as soon as the copy is queued, the buffer
+	   is mapped from the main loop once the frame has been swapped */
+	(*s->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, ss->pbo);
+	(*s->bufferData) (GL_PIXEL_PACK_BUFFER_ARB,
+			  sizeof (GLubyte) * width * height * 4,
+			  NULL, GL_STREAM_READ_ARB);
+
+	glReadPixels (x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	(*s->bindBuffer) (GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+	ss->width  = width;
+	ss->height = height;
+
+	ss->readbackHandle = compAddTimeout (0, 0, shotFinishReadback, s);
+    }
+    else
+    {
+	GLubyte *buffer;
+
+	buffer = malloc (sizeof (GLubyte) * width * height * 4);
+	if (buffer)
+	{
+	    glReadPixels (x, y, width, height,
+			  GL_RGBA, GL_UNSIGNED_BYTE,
+			  (GLvoid *) buffer);
+
+	    shotSaveImage (s, width, height, buffer);
+	}
+    }
 }
 
 static void
@@ -204,75 +598,8 @@ shotPaintScreen (CompScreen   *s,
 	    int w = x2 - x1;
 	    int h = y2 - y1;
 
-	    SHOT_DISPLAY (s->display);
-
 	    if (w && h)
-	    {
-		GLubyte *buffer;
-		char	*dir = sd->opt[SHOT_DISPLAY_OPTION_DIR].value.s;
-
-		buffer = malloc (sizeof (GLubyte) * w * h * 4);
-		if (buffer)
-		{
-		    struct dirent **namelist;
-		    int		  n;
-
-		    glReadPixels (x1, s->height - y2, w, h,
-				  GL_RGBA, GL_UNSIGNED_BYTE,
-				  (GLvoid *) buffer);
-
-		    n = scandir (dir, &namelist, shotFilter, shotSort);
-		    if (n >= 0)
-		    {
-			char name[256];
-			char *app;
-			int  number = 0;
-
-			if (n > 0)
-			    sscanf (namelist[n - 1]->d_name,
-				    "screenshot%d.png",
-				    &number);
-
-			number++;
-
-			if (n)
-			    free (namelist);
-
-			sprintf (name, "screenshot%d.png", number);
-
-			app = sd->opt[SHOT_DISPLAY_OPTION_LAUNCH_APP].value.s;
-
-			if (!writeImageToFile (s->display, dir, name, "png",
-					       w, h, buffer))
-			{
-			    compLogMessage ("screenshot", CompLogLevelError,
-					    "failed to write screenshot image");
-			}
-			else if (*app != '\0')
-			{
-			    char *command;
-
-			    command = malloc (strlen (app) +
-					      strlen (dir) +
-					      strlen (name) + 3);
-			    if (command)
-			    {
-				sprintf (command, "%s %s/%s", app, dir, name);
-
-				runCommand (s, command);
-
-				free (command);
-			    }
-			}
-		    }
-		    else
-		    {
-			perror (dir);
-		    }
-
-		    free (buffer);
-		}
-	    }
+		shotReadPixels (s, x1, s->height - y2, w, h);
 
 	    ss->grab = FALSE;
 	}
@@ -414,14 +741,27 @@ shotSetDisplayOption (CompPlugin      *plugin,
 		      CompOptionValue *value)
 {
     CompOption *o;
+    int	       index;
 
     SHOT_DISPLAY (display);
 
-    o = compFindOption (sd->opt, NUM_OPTIONS (sd), name, NULL);
+    o = compFindOption (sd->opt, NUM_OPTIONS (sd), name, &index);
     if (!o)
 	return FALSE;
 
-    return compSetDisplayOption (display, o, value);
+    switch (index) {
+    case SHOT_DISPLAY_OPTION_DIR:
+	if (compSetDisplayOption (display, o, value))
+	{
+	    sd->number = -1;
+	    return TRUE;
+	}
+	break;
+    default:
+	return compSetDisplayOption (display, o, value);
+    }
+
+    return FALSE;
 }
 
 static const CompMetadataOptionInfo shotDisplayOptionInfo[] = {
@@ -461,6 +801,19 @@ shotInitDisplay (CompPlugin  *p,
 	return FALSE;
     }
 
+    sd->number = -1;
+
+    /* a png plugin loaded before this one is finalized after us, so
+       its writer stays valid until our workers have been joined */
+    sd->writePng = NULL;
+    if (getPluginABI ("png") == PNG_ABIVERSION &&
+	getPluginDisplayIndex (d, "png", &pngDisplayPrivateIndex))
+    {
+	PNG_DISPLAY (d);
+
+	sd->writePng = pd->writeFile;
+    }
+
     WRAP (sd, d, handleEvent, shotHandleEvent);
 
     d->base.privates[displayPrivateIndex].ptr = sd;
@@ -498,6 +851,14 @@ shotInitScreen (CompPlugin *p,
     ss->grabIndex = 0;
     ss->grab	  = FALSE;
 
+    ss->pbo	       = 0;
+    ss->readbackHandle = 0;
+
+    ss->saves	   = NULL;
+    ss->saveHandle = 0;
+
+    pthread_mutex_init (&ss->saveMutex, NULL);
+
     WRAP (ss, s, paintScreen, shotPaintScreen);
     WRAP (ss, s, paintOutput, shotPaintOutput);
 
@@ -512,6 +873,33 @@ shotFiniScreen (CompPlugin *p,
 {
     SHOT_SCREEN (s);
 
+    if (ss->readbackHandle)
+    {
+	compRemoveTimeout (ss->readbackHandle);
+	shotFinishReadback (s);
+    }
+
+    if (ss->pbo)
+    {
+	makeScreenCurrent (s);
+	(*s->deleteBuffers) (1, &ss->pbo);
+    }
+
+    if (ss->saveHandle)
+	compRemoveTimeout (ss->saveHandle);
+
+    while (ss->saves)
+    {
+	ShotSave *save = ss->saves;
+
+	ss->saves = save->next;
+
+	pthread_join (save->thread, NULL);
+	shotFinishSave (s, save);
+    }
+
+    pthread_mutex_destroy (&ss->saveMutex);
+
     UNWRAP (ss, s, paintScreen);
     UNWRAP (ss, s, paintOutput);
 
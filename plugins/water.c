@@ -31,11 +31,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <compiz-core.h>
 
 #define TEXTURE_SIZE 256
 
+/* the software simulation is split into at most this many bands of
+   rows, each at least WATER_MIN_BAND_ROWS high */
+#define WATER_MAX_BANDS	    4
+#define WATER_MIN_BAND_ROWS 64
+
 #define K 0.1964f
 
 #define TEXTURE_NUM 3
@@ -86,6 +97,13 @@ typedef struct _WaterDisplay {
     float offsetScale;
 } WaterDisplay;
 
+typedef struct _WaterWorker {
+    struct _WaterScreen *ws;
+    pthread_t		thread;
+    int			band;
+    unsigned int	generation;
+} WaterWorker;
+
 typedef struct _WaterScreen {
     PreparePaintScreenProc preparePaintScreen;
     DonePaintScreenProc    donePaintScreen;
@@ -111,6 +129,21 @@ typedef struct _WaterScreen {
     float	  *d1;
     unsigned char *t0;
 
+    float updateDt;
+    float updateFade;
+
+    /* threads updating all but the first band of the software
+       simulation */
+    WaterWorker	    *workers;
+    int		    nWorker;
+    Bool	    workersStarted;
+    Bool	    workersQuit;
+    int		    workersBusy;
+    unsigned int    workerGeneration;
+    pthread_mutex_t workerMutex;
+    pthread_cond_t  workerCond;
+    pthread_cond_t  workerDoneCond;
+
     CompTimeoutHandle rainHandle;
     CompTimeoutHandle wiperHandle;
 
@@ -606,114 +639,309 @@ fboVertices (CompScreen *s,
     return 1;
 }
 
+/* one row of the wave equation, d01 holds the previous heights on entry
+   and the new ones on return */
 static void
-softwareUpdate (CompScreen *s,
-		float      dt,
-		float      fade)
+softwareStencilRow (float	*d01,
+		    const float *d10,
+		    const float *d11,
+		    const float *d12,
+		    int		n,
+		    float	dt,
+		    float	fade)
 {
-    float	   *dTmp;
-    int		   i, j;
-    float	   v0, v1, inv;
-    float	   accel, value;
-    unsigned char *t0, *t;
-    int		  dWidth, dHeight;
-    float	  *d01, *d10, *d11, *d12;
+    float accel, value;
+    int	  j = 1;
+
+#ifdef __SSE2__
+    __m128 vdt   = _mm_set1_ps (dt);
+    __m128 vfade = _mm_set1_ps (fade);
+    __m128 two   = _mm_set1_ps (2.0f);
+    __m128 four  = _mm_set1_ps (4.0f);
+    __m128 zero  = _mm_setzero_ps ();
+    __m128 one   = _mm_set1_ps (1.0f);
+
+    /* same operations in the same order as the scalar loop */
+    for (; j + 3 <= n; j += 4)
+    {
+	__m128 c = _mm_loadu_ps (d11 + j);
+	__m128 v;
+
+	v = _mm_add_ps (_mm_add_ps (_mm_add_ps (_mm_loadu_ps (d10 + j),
+						_mm_loadu_ps (d12 + j)),
+				    _mm_loadu_ps (d11 + j - 1)),
+			_mm_loadu_ps (d11 + j + 1));
+	v = _mm_mul_ps (vdt, _mm_sub_ps (v, _mm_mul_ps (four, c)));
+	v = _mm_add_ps (_mm_sub_ps (_mm_mul_ps (two, c),
+				    _mm_loadu_ps (d01 + j)), v);
+	v = _mm_mul_ps (v, vfade);
+
+	_mm_storeu_ps (d01 + j, _mm_min_ps (_mm_max_ps (v, zero), one));
+    }
+#endif
 
-    WATER_SCREEN (s);
+    for (; j <= n; j++)
+    {
+	accel = dt * (d10[j]     +
+		      d12[j]     +
+		      d11[j - 1] +
+		      d11[j + 1] - 4.0f * d11[j]);
 
-    if (!ws->texture[TINDEX (ws, 0)])
-	allocTexture (s, TINDEX (ws, 0));
+	value = (2.0f * d11[j] - d01[j] + accel) * fade;
 
-    dt *= K * 2.0f;
-    fade *= 0.99f;
+	CLAMP (value, 0.0f, 1.0f);
 
-    dWidth  = ws->width  + 2;
-    dHeight = ws->height + 2;
+	d01[j] = value;
+    }
+}
 
-#define D(d, j) (*((d) + (j)))
+/* normal and height map for one row of the texture */
+static void
+softwareNormalRow (unsigned char *t,
+		   const float	 *d10,
+		   const float	 *d11,
+		   const float	 *d12,
+		   int		 n)
+{
+    float v0, v1, inv;
+    int	  j = 0;
 
-    d01 = ws->d0 + dWidth;
-    d10 = ws->d1;
-    d11 = d10 + dWidth;
-    d12 = d11 + dWidth;
+#ifdef __SSE2__
+    __m128 scale = _mm_set1_ps (1.5f);
+    __m128 half  = _mm_set1_ps (0.5f);
+    __m128 one   = _mm_set1_ps (1.0f);
+    __m128 max   = _mm_set1_ps (255.0f);
 
-    for (i = 1; i < dHeight - 1; i++)
+    for (; j + 4 <= n; j += 4)
     {
-	for (j = 1; j < dWidth - 1; j++)
-	{
-	    accel = dt * (D (d10, j)     +
-			  D (d12, j)     +
-			  D (d11, j - 1) +
-			  D (d11, j + 1) - 4.0f * D (d11, j));
+	__m128	x, y, w;
+	__m128i b, g, r, a;
 
-	    value = (2.0f * D (d11, j) - D (d01, j) + accel) * fade;
+	x = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (d12 + j),
+				    _mm_loadu_ps (d10 + j)), scale);
+	y = _mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (d11 + j - 1),
+				    _mm_loadu_ps (d11 + j + 1)), scale);
 
-	    CLAMP (value, 0.0f, 1.0f);
+	w = _mm_add_ps (_mm_add_ps (_mm_mul_ps (x, x), _mm_mul_ps (y, y)),
+			one);
+	w = _mm_div_ps (half, _mm_sqrt_ps (w));
 
-	    D (d01, j) = value;
-	}
+	x = _mm_add_ps (_mm_mul_ps (x, w), half);
+	y = _mm_add_ps (_mm_mul_ps (y, w), half);
+
+	b = _mm_cvttps_epi32 (_mm_mul_ps (_mm_add_ps (w, half), max));
+	g = _mm_cvttps_epi32 (_mm_mul_ps (y, max));
+	r = _mm_cvttps_epi32 (_mm_mul_ps (x, max));
+	a = _mm_cvttps_epi32 (_mm_mul_ps (_mm_loadu_ps (d11 + j), max));
 
-	d01 += dWidth;
-	d10 += dWidth;
-	d11 += dWidth;
-	d12 += dWidth;
+	b = _mm_or_si128 (b, _mm_slli_epi32 (g, 8));
+	r = _mm_or_si128 (r, _mm_slli_epi32 (a, 8));
+
+	_mm_storeu_si128 ((__m128i *) (t + j * 4),
+			  _mm_or_si128 (b, _mm_slli_epi32 (r, 16)));
     }
+#endif
 
-    /* update border */
-    memcpy (ws->d0, ws->d0 + dWidth, dWidth * sizeof (GLfloat));
-    memcpy (ws->d0 + dWidth * (dHeight - 1),
-	    ws->d0 + dWidth * (dHeight - 2),
-	    dWidth * sizeof (GLfloat));
+    for (; j < n; j++)
+    {
+	v0 = (d12[j]     - d10[j])     * 1.5f;
+	v1 = (d11[j - 1] - d11[j + 1]) * 1.5f;
 
-    d01 = ws->d0 + dWidth;
+	/* 0.5 for scale */
+	inv = 0.5f / sqrtf (v0 * v0 + v1 * v1 + 1.0f);
 
-    for (i = 1; i < dHeight - 1; i++)
+	/* add scale and bias to normal */
+	v0 = v0 * inv + 0.5f;
+	v1 = v1 * inv + 0.5f;
+
+	/* store normal map in RGB components */
+	t[j * 4 + 0] = (unsigned char) ((inv + 0.5f) * 255.0f);
+	t[j * 4 + 1] = (unsigned char) (v1 * 255.0f);
+	t[j * 4 + 2] = (unsigned char) (v0 * 255.0f);
+
+	/* store height in A component */
+	t[j * 4 + 3] = (unsigned char) (d11[j] * 255.0f);
+    }
+}
+
+/* updates the rows of one band, the new height of a row only depends on
+   the previous two height maps and the normal map is computed from the
+   previous one, so bands can be updated in parallel */
+static void
+softwareUpdateBand (WaterScreen *ws,
+		    int		band)
+{
+    float *d10, *d11, *d12;
+    int	  dWidth, y, y1, y2;
+
+    dWidth = ws->width + 2;
+
+    y1 = (ws->height * band) / (ws->nWorker + 1);
+    y2 = (ws->height * (band + 1)) / (ws->nWorker + 1);
+
+    for (y = y1; y < y2; y++)
     {
-	D (d01, 0)	    = D (d01, 1);
-	D (d01, dWidth - 1) = D (d01, dWidth - 2);
+	d10 = ws->d1 + y * dWidth;
+	d11 = d10 + dWidth;
+	d12 = d11 + dWidth;
+
+	softwareStencilRow (ws->d0 + (y + 1) * dWidth, d10, d11, d12,
+			    ws->width, ws->updateDt, ws->updateFade);
+	softwareNormalRow (ws->t0 + y * ws->width * 4, d10, d11, d12,
+			   ws->width);
+    }
+}
+
+static void *
+waterWorkerThread (void *closure)
+{
+    WaterWorker *worker = (WaterWorker *) closure;
+    WaterScreen *ws = worker->ws;
+
+    pthread_mutex_lock (&ws->workerMutex);
+
+    for (;;)
+    {
+	while (worker->generation == ws->workerGeneration && !ws->workersQuit)
+	    pthread_cond_wait (&ws->workerCond, &ws->workerMutex);
+
+	if (ws->workersQuit)
+	    break;
 
-	d01 += dWidth;
+	worker->generation = ws->workerGeneration;
+
+	pthread_mutex_unlock (&ws->workerMutex);
+
+	softwareUpdateBand (ws, worker->band);
+
+	pthread_mutex_lock (&ws->workerMutex);
+
+	if (--ws->workersBusy == 0)
+	    pthread_cond_signal (&ws->workerDoneCond);
     }
 
-    d10 = ws->d1;
-    d11 = d10 + dWidth;
-    d12 = d11 + dWidth;
+    pthread_mutex_unlock (&ws->workerMutex);
 
-    t0 = ws->t0;
+    return NULL;
+}
 
-    /* update texture */
-    for (i = 0; i < ws->height; i++)
+static void
+startWorkers (CompScreen *s)
+{
+    long nBand;
+    int	 i;
+
+    WATER_SCREEN (s);
+
+    ws->workersStarted = TRUE;
+
+    nBand = sysconf (_SC_NPROCESSORS_ONLN);
+    nBand = MIN (nBand, WATER_MAX_BANDS);
+    nBand = MIN (nBand, ws->height / WATER_MIN_BAND_ROWS);
+    if (nBand < 2)
+	return;
+
+    ws->workers = malloc (sizeof (WaterWorker) * (nBand - 1));
+    if (!ws->workers)
+	return;
+
+    for (i = 0; i < nBand - 1; i++)
     {
-	for (j = 0; j < ws->width; j++)
+	WaterWorker *worker = &ws->workers[i];
+
+	worker->ws	   = ws;
+	worker->band	   = i + 1;
+	worker->generation = ws->workerGeneration;
+
+	if (pthread_create (&worker->thread, NULL, waterWorkerThread, worker))
 	{
-	    v0 = (D (d12, j)     - D (d10, j))     * 1.5f;
-	    v1 = (D (d11, j - 1) - D (d11, j + 1)) * 1.5f;
+	    compLogMessage ("water", CompLogLevelWarn,
+			    "Couldn't start simulation thread");
+	    break;
+	}
 
-	    /* 0.5 for scale */
-	    inv = 0.5f / sqrtf (v0 * v0 + v1 * v1 + 1.0f);
+	ws->nWorker++;
+    }
+}
 
-	    /* add scale and bias to normal */
-	    v0 = v0 * inv + 0.5f;
-	    v1 = v1 * inv + 0.5f;
+static void
+stopWorkers (CompScreen *s)
+{
+    int i;
 
-	    /* store normal map in RGB components */
-	    t = t0 + (j * 4);
-	    t[0] = (unsigned char) ((inv + 0.5f) * 255.0f);
-	    t[1] = (unsigned char) (v1 * 255.0f);
-	    t[2] = (unsigned char) (v0 * 255.0f);
+    WATER_SCREEN (s);
 
-	    /* store height in A component */
-	    t[3] = (unsigned char) (D (d11, j) * 255.0f);
-	}
+    pthread_mutex_lock (&ws->workerMutex);
+    ws->workersQuit = TRUE;
+    pthread_cond_broadcast (&ws->workerCond);
+    pthread_mutex_unlock (&ws->workerMutex);
+
+    for (i = 0; i < ws->nWorker; i++)
+	pthread_join (ws->workers[i].thread, NULL);
+
+    if (ws->workers)
+	free (ws->workers);
+
+    ws->workers = NULL;
+    ws->nWorker = 0;
+}
+
+static void
+softwareUpdate (CompScreen *s,
+		float      dt,
+		float      fade)
+{
+    float *dTmp, *d0;
+    int	  i, dWidth, dHeight;
 
-	d10 += dWidth;
-	d11 += dWidth;
-	d12 += dWidth;
+    WATER_SCREEN (s);
+
+    if (!ws->texture[TINDEX (ws, 0)])
+	allocTexture (s, TINDEX (ws, 0));
 
-	t0 += ws->width * 4;
+    if (!ws->workersStarted)
+	startWorkers (s);
+
+    ws->updateDt   = dt * K * 2.0f;
+    ws->updateFade = fade * 0.99f;
+
+    if (ws->nWorker)
+    {
+	pthread_mutex_lock (&ws->workerMutex);
+	ws->workerGeneration++;
+	ws->workersBusy = ws->nWorker;
+	pthread_cond_broadcast (&ws->workerCond);
+	pthread_mutex_unlock (&ws->workerMutex);
     }
 
-#undef D
+    softwareUpdateBand (ws, 0);
+
+    if (ws->nWorker)
+    {
+	pthread_mutex_lock (&ws->workerMutex);
+	while (ws->workersBusy)
+	    pthread_cond_wait (&ws->workerDoneCond, &ws->workerMutex);
+	pthread_mutex_unlock (&ws->workerMutex);
+    }
+
+    dWidth  = ws->width  + 2;
+    dHeight = ws->height + 2;
+
+    /* update border */
+    memcpy (ws->d0, ws->d0 + dWidth, dWidth * sizeof (GLfloat));
+    memcpy (ws->d0 + dWidth * (dHeight - 1),
+	    ws->d0 + dWidth * (dHeight - 2),
+	    dWidth * sizeof (GLfloat));
+
+    d0 = ws->d0 + dWidth;
+
+    for (i = 1; i < dHeight - 1; i++)
+    {
+	d0[0]	       = d0[1];
+	d0[dWidth - 1] = d0[dWidth - 2];
+
+	d0 += dWidth;
+    }
 
     /* swap height maps */
     dTmp   = ws->d0;
@@ -741,7 +969,6 @@ softwareUpdate (CompScreen *s,
     }
 }
 
-
 #define SET(x, y, v) *((ws->d1) + (ws->width + 2) * (y + 1) + (x + 1)) = (v)
 
 static void
@@ -1657,6 +1884,10 @@ waterInitScreen (CompPlugin *p,
 
     ws->grabIndex = 0;
 
+    pthread_mutex_init (&ws->workerMutex, NULL);
+    pthread_cond_init (&ws->workerCond, NULL);
+    pthread_cond_init (&ws->workerDoneCond, NULL);
+
     WRAP (ws, s, preparePaintScreen, waterPreparePaintScreen);
     WRAP (ws, s, donePaintScreen, waterDonePaintScreen);
     WRAP (ws, s, drawWindowTexture, waterDrawWindowTexture);
@@ -1683,6 +1914,12 @@ waterFiniScreen (CompPlugin *p,
     if (ws->wiperHandle)
 	compRemoveTimeout (ws->wiperHandle);
 
+    stopWorkers (s);
+
+    pthread_mutex_destroy (&ws->workerMutex);
+    pthread_cond_destroy (&ws->workerCond);
+    pthread_cond_destroy (&ws->workerDoneCond);
+
     if (ws->fbo)
 	(*s->deleteFramebuffers) (1, &ws->fbo);
 
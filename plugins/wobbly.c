@@ -31,6 +31,10 @@
 #include <string.h>
 #include <math.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <compiz-core.h>
 
 #define WIN_X(w) ((w)->attrib.x - (w)->output.left)
@@ -38,10 +42,8 @@
 #define WIN_W(w) ((w)->width + (w)->output.left + (w)->output.right)
 #define WIN_H(w) ((w)->height + (w)->output.top + (w)->output.bottom)
 
-#define GRID_WIDTH  4
-#define GRID_HEIGHT 4
-
-#define MODEL_MAX_SPRINGS (GRID_WIDTH * GRID_HEIGHT * 2)
+#define MODEL_MIN_GRID_SIZE 3
+#define MODEL_MAX_GRID_SIZE 16
 
 #define MASS 15.0f
 
@@ -69,11 +71,10 @@ typedef struct _Edge {
     Bool  snapped;
 } Edge;
 
+/* Position, velocity and force of each object live in per-model arrays
+   so that several objects can be integrated at a time. Only the state
+   used for edge snapping is kept here. */
 typedef struct _Object {
-    Vector	 force;
-    Point	 position;
-    Vector	 velocity;
-    float	 theta;
     Bool	 immobile;
     unsigned int edgeMask;
     Edge	 vertEdge;
@@ -81,8 +82,8 @@ typedef struct _Object {
 } Object;
 
 typedef struct _Spring {
-    Object *a;
-    Object *b;
+    int	   a;
+    int	   b;
     Vector offset;
 } Spring;
 
@@ -94,9 +95,17 @@ typedef struct _Spring {
 typedef struct _Model {
     Object	 *objects;
     int		 numObjects;
-    Spring	 springs[MODEL_MAX_SPRINGS];
+    int		 gridWidth;
+    int		 gridHeight;
+    float	 *positionX;
+    float	 *positionY;
+    float	 *velocityX;
+    float	 *velocityY;
+    float	 *forceX;
+    float	 *forceY;
+    Spring	 *springs;
     int		 numSprings;
-    Object	 *anchorObject;
+    int		 anchorObject;
     float	 steps;
     Point	 topLeft;
     Point	 bottomRight;
@@ -137,7 +146,8 @@ typedef struct _WobblyDisplay {
 #define WOBBLY_SCREEN_OPTION_GRAB_WINDOW_MATCH  8
 #define WOBBLY_SCREEN_OPTION_MOVE_WINDOW_MATCH  9
 #define WOBBLY_SCREEN_OPTION_MAXIMIZE_EFFECT    10
-#define WOBBLY_SCREEN_OPTION_NUM	        11
+#define WOBBLY_SCREEN_OPTION_MODEL_GRID_SIZE    11
+#define WOBBLY_SCREEN_OPTION_NUM	        12
 
 typedef struct _WobblyScreen {
     int	windowPrivateIndex;
@@ -163,6 +173,29 @@ typedef struct _WobblyScreen {
     Bool         moveWindow;
 } WobblyScreen;
 
+/* A window is usually drawn more than once per frame with the same
+   model, by each output it is on or by the blur plugin. */
+#define WOBBLY_MESH_CACHE_SIZE 2
+
+/* largest distance in pixels allowed between a tessellated mesh and
+   the bezier patch it approximates */
+#define WOBBLY_MESH_TOLERANCE 0.5f
+
+typedef struct _WobblyMesh {
+    float   *positions;
+    int	    positionsSize;
+    int	    numObjects;
+    BoxPtr  rects;
+    int	    nRects;
+    int	    rectsSize;
+    int	    x, y, width, height;
+    int	    gridW, gridH;
+    GLfloat *points;
+    int	    pointsSize;
+    float   *basis;
+    int	    basisSize;
+} WobblyMesh;
+
 #define WobblyInitial  (1L << 0)
 #define WobblyForce    (1L << 1)
 #define WobblyVelocity (1L << 2)
@@ -173,6 +206,14 @@ typedef struct _WobblyWindow {
     Bool	 grabbed;
     Bool	 velocity;
     unsigned int state;
+
+    CompWindow	 *nextStep;
+    int		 steps;
+    float	 velocitySum;
+    float	 forceSum;
+
+    WobblyMesh	 mesh[WOBBLY_MESH_CACHE_SIZE];
+    int		 nextMesh;
 } WobblyWindow;
 
 #define GET_WOBBLY_DISPLAY(d)					    \
@@ -197,6 +238,21 @@ typedef struct _WobblyWindow {
 
 #define NUM_OPTIONS(s) (sizeof ((s)->opt) / sizeof (CompOption))
 
+static void
+freeModel (Model *model)
+{
+    if (model->springs)
+	free (model->springs);
+
+    if (model->positionX)
+	free (model->positionX);
+
+    if (model->objects)
+	free (model->objects);
+
+    free (model);
+}
+
 static CompOption *
 wobblyGetScreenOptions (CompPlugin *plugin,
 			CompScreen *screen,
@@ -215,14 +271,41 @@ wobblySetScreenOption (CompPlugin      *plugin,
 		       CompOptionValue *value)
 {
     CompOption *o;
+    int	       index;
 
     WOBBLY_SCREEN (screen);
 
-    o = compFindOption (ws->opt, NUM_OPTIONS (ws), name, NULL);
+    o = compFindOption (ws->opt, NUM_OPTIONS (ws), name, &index);
     if (!o)
 	return FALSE;
 
-    return compSetScreenOption (screen, o, value);
+    switch (index) {
+    case WOBBLY_SCREEN_OPTION_MODEL_GRID_SIZE:
+	if (compSetIntOption (o, value))
+	{
+	    CompWindow *w;
+
+	    /* models at rest are created again with the new size the
+	       next time they are needed */
+	    for (w = screen->windows; w; w = w->next)
+	    {
+		WobblyWindow *ww = GET_WOBBLY_WINDOW (w, ws);
+
+		if (ww->model && !ww->wobbly && !ww->grabbed)
+		{
+		    freeModel (ww->model);
+		    ww->model = 0;
+		}
+	    }
+
+	    return TRUE;
+	}
+	break;
+    default:
+	return compSetScreenOption (screen, o, value);
+    }
+
+    return FALSE;
 }
 
 static const CompMetadataOptionInfo wobblyScreenOptionInfo[] = {
@@ -236,7 +319,9 @@ static const CompMetadataOptionInfo wobblyScreenOptionInfo[] = {
     { "focus_window_match", "match", 0, 0, 0 },
     { "grab_window_match", "match", 0, 0, 0 },
     { "move_window_match", "match", 0, 0, 0 },
-    { "maximize_effect", "bool", 0, 0, 0 }
+    { "maximize_effect", "bool", 0, 0, 0 },
+    { "model_grid_size", "int",
+      RESTOSTRING (MODEL_MIN_GRID_SIZE, MODEL_MAX_GRID_SIZE), 0, 0 }
 };
 
 #define SNAP_WINDOW_TYPE (CompWindowTypeNormalMask  | \
@@ -246,13 +331,15 @@ static const CompMetadataOptionInfo wobblyScreenOptionInfo[] = {
 
 static void
 findNextWestEdge (CompWindow *w,
-		  Object     *object)
+		  Model      *model,
+		  int        index)
 {
-    int v, v1, v2;
-    int s, start;
-    int e, end;
-    int x;
-    int output;
+    Object *object = &model->objects[index];
+    int    v, v1, v2;
+    int    s, start;
+    int    e, end;
+    int    x;
+    int    output;
 
     start = -65535.0f;
     end   =  65535.0f;
@@ -260,9 +347,9 @@ findNextWestEdge (CompWindow *w,
     v1 = -65535.0f;
     v2 =  65535.0f;
 
-    x = object->position.x + w->output.left - w->input.left;
+    x = model->positionX[index] + w->output.left - w->input.left;
 
-    output = outputDeviceForPoint (w->screen, x, object->position.y);
+    output = outputDeviceForPoint (w->screen, x, model->positionY[index]);
 
     if (x >= w->screen->outputDev[output].region.extents.x1)
     {
@@ -292,12 +379,12 @@ findNextWestEdge (CompWindow *w,
 		continue;
 	    }
 
-	    if (s > object->position.y)
+	    if (s > model->positionY[index])
 	    {
 		if (s < end)
 		    end = s;
 	    }
-	    else if (e < object->position.y)
+	    else if (e < model->positionY[index])
 	    {
 		if (e > start)
 		    start = e;
@@ -351,13 +438,15 @@ findNextWestEdge (CompWindow *w,
 
 static void
 findNextEastEdge (CompWindow *w,
-		  Object     *object)
+		  Model      *model,
+		  int        index)
 {
-    int v, v1, v2;
-    int s, start;
-    int e, end;
-    int x;
-    int output;
+    Object *object = &model->objects[index];
+    int    v, v1, v2;
+    int    s, start;
+    int    e, end;
+    int    x;
+    int    output;
 
     start = -65535.0f;
     end   =  65535.0f;
@@ -365,9 +454,9 @@ findNextEastEdge (CompWindow *w,
     v1 =  65535.0f;
     v2 = -65535.0f;
 
-    x = object->position.x - w->output.right + w->input.right;
+    x = model->positionX[index] - w->output.right + w->input.right;
 
-    output = outputDeviceForPoint (w->screen, x, object->position.y);
+    output = outputDeviceForPoint (w->screen, x, model->positionY[index]);
 
     if (x <= w->screen->outputDev[output].region.extents.x2)
     {
@@ -397,12 +486,12 @@ findNextEastEdge (CompWindow *w,
 		continue;
 	    }
 
-	    if (s > object->position.y)
+	    if (s > model->positionY[index])
 	    {
 		if (s < end)
 		    end = s;
 	    }
-	    else if (e < object->position.y)
+	    else if (e < model->positionY[index])
 	    {
 		if (e > start)
 		    start = e;
@@ -456,13 +545,15 @@ findNextEastEdge (CompWindow *w,
 
 static void
 findNextNorthEdge (CompWindow *w,
-		   Object     *object)
+		   Model      *model,
+		   int        index)
 {
-    int v, v1, v2;
-    int s, start;
-    int e, end;
-    int y;
-    int output;
+    Object *object = &model->objects[index];
+    int    v, v1, v2;
+    int    s, start;
+    int    e, end;
+    int    y;
+    int    output;
 
     start = -65535.0f;
     end   =  65535.0f;
@@ -470,9 +561,9 @@ findNextNorthEdge (CompWindow *w,
     v1 = -65535.0f;
     v2 =  65535.0f;
 
-    y = object->position.y + w->output.top - w->input.top;
+    y = model->positionY[index] + w->output.top - w->input.top;
 
-    output = outputDeviceForPoint (w->screen, object->position.x, y);
+    output = outputDeviceForPoint (w->screen, model->positionX[index], y);
 
     if (y >= w->screen->outputDev[output].region.extents.y1)
     {
@@ -500,12 +591,12 @@ findNextNorthEdge (CompWindow *w,
 		continue;
 	    }
 
-	    if (s > object->position.x)
+	    if (s > model->positionX[index])
 	    {
 		if (s < end)
 		    end = s;
 	    }
-	    else if (e < object->position.x)
+	    else if (e < model->positionX[index])
 	    {
 		if (e > start)
 		    start = e;
@@ -559,13 +650,15 @@ findNextNorthEdge (CompWindow *w,
 
 static void
 findNextSouthEdge (CompWindow *w,
-		   Object     *object)
+		   Model      *model,
+		   int        index)
 {
-    int v, v1, v2;
-    int s, start;
-    int e, end;
-    int y;
-    int output;
+    Object *object = &model->objects[index];
+    int    v, v1, v2;
+    int    s, start;
+    int    e, end;
+    int    y;
+    int    output;
 
     start = -65535.0f;
     end   =  65535.0f;
@@ -573,9 +666,9 @@ findNextSouthEdge (CompWindow *w,
     v1 =  65535.0f;
     v2 = -65535.0f;
 
-    y = object->position.y - w->output.bottom + w->input.bottom;
+    y = model->positionY[index] - w->output.bottom + w->input.bottom;
 
-    output = outputDeviceForPoint (w->screen, object->position.x, y);
+    output = outputDeviceForPoint (w->screen, model->positionX[index], y);
 
     if (y <= w->screen->outputDev[output].region.extents.y2)
     {
@@ -604,12 +697,12 @@ findNextSouthEdge (CompWindow *w,
 		continue;
 	    }
 
-	    if (s > object->position.x)
+	    if (s > model->positionX[index])
 	    {
 		if (s < end)
 		    end = s;
 	    }
-	    else if (e < object->position.x)
+	    else if (e < model->positionX[index])
 	    {
 		if (e > start)
 		    start = e;
@@ -662,22 +755,24 @@ findNextSouthEdge (CompWindow *w,
 }
 
 static void
-objectInit (Object *object,
-	    float  positionX,
-	    float  positionY,
-	    float  velocityX,
-	    float  velocityY)
+objectInit (Model *model,
+	    int	  index,
+	    float positionX,
+	    float positionY,
+	    float velocityX,
+	    float velocityY)
 {
-    object->force.x = 0;
-    object->force.y = 0;
+    Object *object = &model->objects[index];
 
-    object->position.x = positionX;
-    object->position.y = positionY;
+    model->forceX[index] = 0;
+    model->forceY[index] = 0;
 
-    object->velocity.x = velocityX;
-    object->velocity.y = velocityY;
+    model->positionX[index] = positionX;
+    model->positionY[index] = positionY;
+
+    model->velocityX[index] = velocityX;
+    model->velocityY[index] = velocityY;
 
-    object->theta    = 0;
     object->immobile = FALSE;
 
     object->edgeMask = 0;
@@ -691,8 +786,8 @@ objectInit (Object *object,
 
 static void
 springInit (Spring *spring,
-	    Object *a,
-	    Object *b,
+	    int	   a,
+	    int	   b,
 	    float  offsetX,
 	    float  offsetY)
 {
@@ -714,24 +809,24 @@ modelCalcBounds (Model *model)
 
     for (i = 0; i < model->numObjects; i++)
     {
-	if (model->objects[i].position.x < model->topLeft.x)
-	    model->topLeft.x = model->objects[i].position.x;
-	else if (model->objects[i].position.x > model->bottomRight.x)
-	    model->bottomRight.x = model->objects[i].position.x;
-
-	if (model->objects[i].position.y < model->topLeft.y)
-	    model->topLeft.y = model->objects[i].position.y;
-	else if (model->objects[i].position.y > model->bottomRight.y)
-	    model->bottomRight.y = model->objects[i].position.y;
+	if (model->positionX[i] < model->topLeft.x)
+	    model->topLeft.x = model->positionX[i];
+	else if (model->positionX[i] > model->bottomRight.x)
+	    model->bottomRight.x = model->positionX[i];
+
+	if (model->positionY[i] < model->topLeft.y)
+	    model->topLeft.y = model->positionY[i];
+	else if (model->positionY[i] > model->bottomRight.y)
+	    model->bottomRight.y = model->positionY[i];
     }
 }
 
 static void
-modelAddSpring (Model  *model,
-		Object *a,
-		Object *b,
-		float  offsetX,
-		float  offsetY)
+modelAddSpring (Model *model,
+		int   a,
+		int   b,
+		float offsetX,
+		float offsetY)
 {
     Spring *spring;
 
@@ -741,6 +836,23 @@ modelAddSpring (Model  *model,
     springInit (spring, a, b, offsetX, offsetY);
 }
 
+static void
+modelReleaseAnchor (Model *model)
+{
+    if (model->anchorObject >= 0)
+	model->objects[model->anchorObject].immobile = FALSE;
+
+    model->anchorObject = -1;
+}
+
+static void
+modelSetAnchor (Model *model,
+		int   index)
+{
+    model->anchorObject = index;
+    model->objects[index].immobile = TRUE;
+}
+
 static void
 modelSetMiddleAnchor (Model *model,
 		      int   x,
@@ -748,21 +860,19 @@ modelSetMiddleAnchor (Model *model,
 		      int   width,
 		      int   height)
 {
+    int   gridWidth = model->gridWidth;
+    int   gridHeight = model->gridHeight;
     float gx, gy;
 
-    gx = ((GRID_WIDTH  - 1) / 2 * width)  / (float) (GRID_WIDTH  - 1);
-    gy = ((GRID_HEIGHT - 1) / 2 * height) / (float) (GRID_HEIGHT - 1);
-
-    if (model->anchorObject)
-	model->anchorObject->immobile = FALSE;
+    gx = ((gridWidth  - 1) / 2 * width)  / (float) (gridWidth  - 1);
+    gy = ((gridHeight - 1) / 2 * height) / (float) (gridHeight - 1);
 
-    model->anchorObject = &model->objects[GRID_WIDTH *
-					  ((GRID_HEIGHT - 1) / 2) +
-					  (GRID_WIDTH - 1) / 2];
-    model->anchorObject->position.x = x + gx;
-    model->anchorObject->position.y = y + gy;
+    modelReleaseAnchor (model);
+    modelSetAnchor (model,
+		    gridWidth * ((gridHeight - 1) / 2) + (gridWidth - 1) / 2);
 
-    model->anchorObject->immobile = TRUE;
+    model->positionX[model->anchorObject] = x + gx;
+    model->positionY[model->anchorObject] = y + gy;
 }
 
 static void
@@ -771,18 +881,32 @@ modelSetTopAnchor (Model *model,
 		   int   y,
 		   int   width)
 {
+    int   gridWidth = model->gridWidth;
     float gx;
 
-    gx = ((GRID_WIDTH - 1) / 2 * width)  / (float) (GRID_WIDTH - 1);
+    gx = ((gridWidth - 1) / 2 * width)  / (float) (gridWidth - 1);
 
-    if (model->anchorObject)
-	model->anchorObject->immobile = FALSE;
+    modelReleaseAnchor (model);
+    modelSetAnchor (model, (gridWidth - 1) / 2);
+
+    model->positionX[model->anchorObject] = x + gx;
+    model->positionY[model->anchorObject] = y;
+}
 
-    model->anchorObject = &model->objects[(GRID_WIDTH - 1) / 2];
-    model->anchorObject->position.x = x + gx;
-    model->anchorObject->position.y = y;
+static void
+modelSetCorner (Model *model,
+		int   index,
+		float x,
+		float y,
+		Bool  immobile)
+{
+    model->positionX[index] = x;
+    model->positionY[index] = y;
 
-    model->anchorObject->immobile = TRUE;
+    if (immobile)
+	model->objects[index].immobile = TRUE;
+    else if (index != model->anchorObject)
+	model->objects[index].immobile = FALSE;
 }
 
 static void
@@ -792,30 +916,17 @@ modelAddEdgeAnchors (Model *model,
 		     int   width,
 		     int   height)
 {
-    Object *o;
-
-    o = &model->objects[0];
-    o->position.x = x;
-    o->position.y = y;
-    o->immobile = TRUE;
-
-    o = &model->objects[GRID_WIDTH - 1];
-    o->position.x = x + width;
-    o->position.y = y;
-    o->immobile = TRUE;
-
-    o = &model->objects[GRID_WIDTH * (GRID_HEIGHT - 1)];
-    o->position.x = x;
-    o->position.y = y + height;
-    o->immobile = TRUE;
+    int gridWidth = model->gridWidth;
 
-    o = &model->objects[model->numObjects - 1];
-    o->position.x = x + width;
-    o->position.y = y + height;
-    o->immobile = TRUE;
+    modelSetCorner (model, 0, x, y, TRUE);
+    modelSetCorner (model, gridWidth - 1, x + width, y, TRUE);
+    modelSetCorner (model, model->numObjects - gridWidth,
+		    x, y + height, TRUE);
+    modelSetCorner (model, model->numObjects - 1,
+		    x + width, y + height, TRUE);
 
-    if (!model->anchorObject)
-	model->anchorObject = &model->objects[0];
+    if (model->anchorObject < 0)
+	model->anchorObject = 0;
 }
 
 static void
@@ -825,60 +936,29 @@ modelRemoveEdgeAnchors (Model *model,
 			int   width,
 			int   height)
 {
-    Object *o;
+    int gridWidth = model->gridWidth;
 
-    o = &model->objects[0];
-    o->position.x = x;
-    o->position.y = y;
-    if (o != model->anchorObject)
-	o->immobile = FALSE;
-
-    o = &model->objects[GRID_WIDTH - 1];
-    o->position.x = x + width;
-    o->position.y = y;
-    if (o != model->anchorObject)
-	o->immobile = FALSE;
-
-    o = &model->objects[GRID_WIDTH * (GRID_HEIGHT - 1)];
-    o->position.x = x;
-    o->position.y = y + height;
-    if (o != model->anchorObject)
-	o->immobile = FALSE;
-
-    o = &model->objects[model->numObjects - 1];
-    o->position.x = x + width;
-    o->position.y = y + height;
-    if (o != model->anchorObject)
-	o->immobile = FALSE;
+    modelSetCorner (model, 0, x, y, FALSE);
+    modelSetCorner (model, gridWidth - 1, x + width, y, FALSE);
+    modelSetCorner (model, model->numObjects - gridWidth,
+		    x, y + height, FALSE);
+    modelSetCorner (model, model->numObjects - 1,
+		    x + width, y + height, FALSE);
 }
 
 static void
-modelAdjustObjectPosition (Model  *model,
-			   Object *object,
-			   int    x,
-			   int    y,
-			   int    width,
-			   int    height)
+modelAdjustObjectPosition (Model *model,
+			   int   index,
+			   int   x,
+			   int   y,
+			   int   width,
+			   int   height)
 {
-    Object *o;
-    int	   gridX, gridY, i = 0;
-
-    for (gridY = 0; gridY < GRID_HEIGHT; gridY++)
-    {
-	for (gridX = 0; gridX < GRID_WIDTH; gridX++)
-	{
-	    o = &model->objects[i];
-	    if (o == object)
-	    {
-		o->position.x = x + (gridX * width) / (GRID_WIDTH - 1);
-		o->position.y = y + (gridY * height) / (GRID_HEIGHT - 1);
-
-		return;
-	    }
+    int gridX = index % model->gridWidth;
+    int gridY = index / model->gridWidth;
 
-	    i++;
-	}
-    }
+    model->positionX[index] = x + (gridX * width) / (model->gridWidth - 1);
+    model->positionY[index] = y + (gridY * height) / (model->gridHeight - 1);
 }
 
 static void
@@ -891,14 +971,14 @@ modelInitObjects (Model *model,
     int	  gridX, gridY, i = 0;
     float gw, gh;
 
-    gw = GRID_WIDTH  - 1;
-    gh = GRID_HEIGHT - 1;
+    gw = model->gridWidth  - 1;
+    gh = model->gridHeight - 1;
 
-    for (gridY = 0; gridY < GRID_HEIGHT; gridY++)
+    for (gridY = 0; gridY < model->gridHeight; gridY++)
     {
-	for (gridX = 0; gridX < GRID_WIDTH; gridX++)
+	for (gridX = 0; gridX < model->gridWidth; gridX++)
 	{
-	    objectInit (&model->objects[i],
+	    objectInit (model, i,
 			x + (gridX * width) / gw,
 			y + (gridY * height) / gh,
 			0, 0);
@@ -928,22 +1008,22 @@ modelUpdateSnapping (CompWindow *window,
     else if (model->snapCnt[EAST])
 	edgeMask &= ~WestEdgeMask;
 
-    for (gridY = 0; gridY < GRID_HEIGHT; gridY++)
+    for (gridY = 0; gridY < model->gridHeight; gridY++)
     {
 	if (gridY == 0)
 	    gridMask = edgeMask & NorthEdgeMask;
-	else if (gridY == GRID_HEIGHT - 1)
+	else if (gridY == model->gridHeight - 1)
 	    gridMask = edgeMask & SouthEdgeMask;
 	else
 	    gridMask = 0;
 
-	for (gridX = 0; gridX < GRID_WIDTH; gridX++)
+	for (gridX = 0; gridX < model->gridWidth; gridX++)
 	{
 	    mask = gridMask;
 
 	    if (gridX == 0)
 		mask |= edgeMask & WestEdgeMask;
-	    else if (gridX == GRID_WIDTH - 1)
+	    else if (gridX == model->gridWidth - 1)
 		mask |= edgeMask & EastEdgeMask;
 
 	    if (mask != model->objects[i].edgeMask)
@@ -953,12 +1033,12 @@ modelUpdateSnapping (CompWindow *window,
 		if (mask & WestEdgeMask)
 		{
 		    if (!model->objects[i].vertEdge.snapped)
-			findNextWestEdge (window, &model->objects[i]);
+			findNextWestEdge (window, model, i);
 		}
 		else if (mask & EastEdgeMask)
 		{
 		    if (!model->objects[i].vertEdge.snapped)
-			findNextEastEdge (window, &model->objects[i]);
+			findNextEastEdge (window, model, i);
 		}
 		else
 		    model->objects[i].vertEdge.snapped = FALSE;
@@ -966,12 +1046,12 @@ modelUpdateSnapping (CompWindow *window,
 		if (mask & NorthEdgeMask)
 		{
 		    if (!model->objects[i].horzEdge.snapped)
-			findNextNorthEdge (window, &model->objects[i]);
+			findNextNorthEdge (window, model, i);
 		}
 		else if (mask & SouthEdgeMask)
 		{
 		    if (!model->objects[i].horzEdge.snapped)
-			findNextSouthEdge (window, &model->objects[i]);
+			findNextSouthEdge (window, model, i);
 		}
 		else
 		    model->objects[i].horzEdge.snapped = FALSE;
@@ -985,20 +1065,15 @@ modelUpdateSnapping (CompWindow *window,
 static void
 modelReduceEdgeEscapeVelocity (Model *model)
 {
-    int	gridX, gridY, i = 0;
+    int	i;
 
-    for (gridY = 0; gridY < GRID_HEIGHT; gridY++)
+    for (i = 0; i < model->numObjects; i++)
     {
-	for (gridX = 0; gridX < GRID_WIDTH; gridX++)
-	{
-	    if (model->objects[i].vertEdge.snapped)
-		model->objects[i].vertEdge.velocity *= drand48 () * 0.25f;
+	if (model->objects[i].vertEdge.snapped)
+	    model->objects[i].vertEdge.velocity *= drand48 () * 0.25f;
 
-	    if (model->objects[i].horzEdge.snapped)
-		model->objects[i].horzEdge.velocity *= drand48 () * 0.25f;
-
-	    i++;
-	}
+	if (model->objects[i].horzEdge.snapped)
+	    model->objects[i].horzEdge.velocity *= drand48 () * 0.25f;
     }
 }
 
@@ -1006,24 +1081,19 @@ static Bool
 modelDisableSnapping (CompWindow *window,
 		      Model      *model)
 {
-    int	 gridX, gridY, i = 0;
+    int	 i;
     Bool snapped = FALSE;
 
-    for (gridY = 0; gridY < GRID_HEIGHT; gridY++)
+    for (i = 0; i < model->numObjects; i++)
     {
-	for (gridX = 0; gridX < GRID_WIDTH; gridX++)
-	{
-	    if (model->objects[i].vertEdge.snapped ||
-		model->objects[i].horzEdge.snapped)
-		snapped = TRUE;
-
-	    model->objects[i].vertEdge.snapped = FALSE;
-	    model->objects[i].horzEdge.snapped = FALSE;
+	if (model->objects[i].vertEdge.snapped ||
+	    model->objects[i].horzEdge.snapped)
+	    snapped = TRUE;
 
-	    model->objects[i].edgeMask = 0;
+	model->objects[i].vertEdge.snapped = FALSE;
+	model->objects[i].horzEdge.snapped = FALSE;
 
-	    i++;
-	}
+	model->objects[i].edgeMask = 0;
     }
 
     memset (model->snapCnt, 0, sizeof (model->snapCnt));
@@ -1038,7 +1108,7 @@ modelAdjustObjectsForShiver (Model *model,
 			     int   width,
 			     int   height)
 {
-    int   gridX, gridY, i = 0;
+    int   i;
     float vX, vY;
     float w, h;
     float scale;
@@ -1046,25 +1116,20 @@ modelAdjustObjectsForShiver (Model *model,
     w = width;
     h = height;
 
-    for (gridY = 0; gridY < GRID_HEIGHT; gridY++)
+    for (i = 0; i < model->numObjects; i++)
     {
-	for (gridX = 0; gridX < GRID_WIDTH; gridX++)
+	if (!model->objects[i].immobile)
 	{
-	    if (!model->objects[i].immobile)
-	    {
-		vX = model->objects[i].position.x - (x + w / 2);
-		vY = model->objects[i].position.y - (y + h / 2);
+	    vX = model->positionX[i] - (x + w / 2);
+	    vY = model->positionY[i] - (y + h / 2);
 
-		vX /= w;
-		vY /= h;
+	    vX /= w;
+	    vY /= h;
 
-		scale = ((float) rand () * 7.5f) / RAND_MAX;
-
-		model->objects[i].velocity.x += vX * scale;
-		model->objects[i].velocity.y += vY * scale;
-	    }
+	    scale = ((float) rand () * 7.5f) / RAND_MAX;
 
-	    i++;
+	    model->velocityX[i] += vX * scale;
+	    model->velocityY[i] += vY * scale;
 	}
     }
 }
@@ -1081,24 +1146,18 @@ modelInitSprings (Model *model,
 
     model->numSprings = 0;
 
-    hpad = ((float) width) / (GRID_WIDTH  - 1);
-    vpad = ((float) height) / (GRID_HEIGHT - 1);
+    hpad = ((float) width) / (model->gridWidth  - 1);
+    vpad = ((float) height) / (model->gridHeight - 1);
 
-    for (gridY = 0; gridY < GRID_HEIGHT; gridY++)
+    for (gridY = 0; gridY < model->gridHeight; gridY++)
     {
-	for (gridX = 0; gridX < GRID_WIDTH; gridX++)
+	for (gridX = 0; gridX < model->gridWidth; gridX++)
 	{
 	    if (gridX > 0)
-		modelAddSpring (model,
-				&model->objects[i - 1],
-				&model->objects[i],
-				hpad, 0);
+		modelAddSpring (model, i - 1, i, hpad, 0);
 
 	    if (gridY > 0)
-		modelAddSpring (model,
-				&model->objects[i - GRID_WIDTH],
-				&model->objects[i],
-				0, vpad);
+		modelAddSpring (model, i - model->gridWidth, i, 0, vpad);
 
 	    i++;
 	}
@@ -1114,8 +1173,8 @@ modelMove (Model *model,
 
     for (i = 0; i < model->numObjects; i++)
     {
-	model->objects[i].position.x += tx;
-	model->objects[i].position.y += ty;
+	model->positionX[i] += tx;
+	model->positionY[i] += ty;
     }
 }
 
@@ -1124,23 +1183,40 @@ createModel (int	  x,
 	     int	  y,
 	     int	  width,
 	     int	  height,
+	     int	  gridSize,
 	     unsigned int edgeMask)
 {
     Model *model;
+    int   n;
 
-    model = malloc (sizeof (Model));
+    model = calloc (1, sizeof (Model));
     if (!model)
 	return 0;
 
-    model->numObjects = GRID_WIDTH * GRID_HEIGHT;
-    model->objects = malloc (sizeof (Object) * model->numObjects);
-    if (!model->objects)
+    model->gridWidth  = gridSize;
+    model->gridHeight = gridSize;
+
+    n = model->numObjects = model->gridWidth * model->gridHeight;
+
+    model->objects   = malloc (sizeof (Object) * n);
+    model->positionX = malloc (sizeof (float) * n * 6);
+    model->springs   = malloc (sizeof (Spring) *
+			       ((model->gridWidth - 1) * model->gridHeight +
+				model->gridWidth * (model->gridHeight - 1)));
+    if (!model->objects || !model->positionX || !model->springs)
     {
-	free (model);
+	freeModel (model);
 	return 0;
     }
 
-    model->anchorObject = 0;
+    /* all six state arrays share one allocation */
+    model->positionY = model->positionX + n;
+    model->velocityX = model->positionY + n;
+    model->velocityY = model->velocityX + n;
+    model->forceX    = model->velocityY + n;
+    model->forceY    = model->forceX + n;
+
+    model->anchorObject = -1;
     model->numSprings = 0;
 
     model->steps = 0;
@@ -1158,42 +1234,47 @@ createModel (int	  x,
 }
 
 static void
-objectApplyForce (Object *object,
-		  float  fx,
-		  float  fy)
-{
-    object->force.x += fx;
-    object->force.y += fy;
-}
-
-static void
-springExertForces (Spring *spring,
-		   float  k)
+modelExertSpringForces (Model *model,
+			float k)
 {
+    Spring *spring;
     Vector da, db;
-    Vector a, b;
+    int	   a, b, i;
 
-    a = spring->a->position;
-    b = spring->b->position;
+    for (i = 0; i < model->numSprings; i++)
+    {
+	spring = &model->springs[i];
 
-    da.x = 0.5f * (b.x - a.x - spring->offset.x);
-    da.y = 0.5f * (b.y - a.y - spring->offset.y);
+	a = spring->a;
+	b = spring->b;
 
-    db.x = 0.5f * (a.x - b.x + spring->offset.x);
-    db.y = 0.5f * (a.y - b.y + spring->offset.y);
+	da.x = 0.5f * (model->positionX[b] - model->positionX[a] -
+		       spring->offset.x);
+	da.y = 0.5f * (model->positionY[b] - model->positionY[a] -
+		       spring->offset.y);
 
-    objectApplyForce (spring->a, k * da.x, k * da.y);
-    objectApplyForce (spring->b, k * db.x, k * db.y);
+	db.x = 0.5f * (model->positionX[a] - model->positionX[b] +
+		       spring->offset.x);
+	db.y = 0.5f * (model->positionY[a] - model->positionY[b] +
+		       spring->offset.y);
+
+	model->forceX[a] += k * da.x;
+	model->forceY[a] += k * da.y;
+	model->forceX[b] += k * db.x;
+	model->forceY[b] += k * db.y;
+    }
 }
 
 static Bool
 objectReleaseWestEdge (CompWindow *w,
 		       Model	  *model,
-		       Object	  *object)
+		       int	   index)
 {
-    if (fabs (object->velocity.x) > object->vertEdge.velocity)
+    Object *object = &model->objects[index];
+
+    if (fabs (model->velocityX[index]) > object->vertEdge.velocity)
     {
-	object->position.x += object->velocity.x * 2.0f;
+	model->positionX[index] += model->velocityX[index] * 2.0f;
 
 	model->snapCnt[WEST]--;
 
@@ -1205,7 +1286,7 @@ objectReleaseWestEdge (CompWindow *w,
 	return TRUE;
     }
 
-    object->velocity.x = 0.0f;
+    model->velocityX[index] = 0.0f;
 
     return FALSE;
 }
@@ -1213,11 +1294,13 @@ objectReleaseWestEdge (CompWindow *w,
 static Bool
 objectReleaseEastEdge (CompWindow *w,
 		       Model	  *model,
-		       Object	  *object)
+		       int	   index)
 {
-    if (fabs (object->velocity.x) > object->vertEdge.velocity)
+    Object *object = &model->objects[index];
+
+    if (fabs (model->velocityX[index]) > object->vertEdge.velocity)
     {
-	object->position.x += object->velocity.x * 2.0f;
+	model->positionX[index] += model->velocityX[index] * 2.0f;
 
 	model->snapCnt[EAST]--;
 
@@ -1229,7 +1312,7 @@ objectReleaseEastEdge (CompWindow *w,
 	return TRUE;
     }
 
-    object->velocity.x = 0.0f;
+    model->velocityX[index] = 0.0f;
 
     return FALSE;
 }
@@ -1237,11 +1320,13 @@ objectReleaseEastEdge (CompWindow *w,
 static Bool
 objectReleaseNorthEdge (CompWindow *w,
 			Model	   *model,
-			Object	   *object)
+			int	    index)
 {
-    if (fabs (object->velocity.y) > object->horzEdge.velocity)
+    Object *object = &model->objects[index];
+
+    if (fabs (model->velocityY[index]) > object->horzEdge.velocity)
     {
-	object->position.y += object->velocity.y * 2.0f;
+	model->positionY[index] += model->velocityY[index] * 2.0f;
 
 	model->snapCnt[NORTH]--;
 
@@ -1253,7 +1338,7 @@ objectReleaseNorthEdge (CompWindow *w,
 	return TRUE;
     }
 
-    object->velocity.y = 0.0f;
+    model->velocityY[index] = 0.0f;
 
     return FALSE;
 }
@@ -1261,11 +1346,13 @@ objectReleaseNorthEdge (CompWindow *w,
 static Bool
 objectReleaseSouthEdge (CompWindow *w,
 			Model	   *model,
-			Object	   *object)
+			int	    index)
 {
-    if (fabs (object->velocity.y) > object->horzEdge.velocity)
+    Object *object = &model->objects[index];
+
+    if (fabs (model->velocityY[index]) > object->horzEdge.velocity)
     {
-	object->position.y += object->velocity.y * 2.0f;
+	model->positionY[index] += model->velocityY[index] * 2.0f;
 
 	model->snapCnt[SOUTH]--;
 
@@ -1277,7 +1364,7 @@ objectReleaseSouthEdge (CompWindow *w,
 	return TRUE;
     }
 
-    object->velocity.y = 0.0f;
+    model->velocityY[index] = 0.0f;
 
     return FALSE;
 }
@@ -1285,19 +1372,19 @@ objectReleaseSouthEdge (CompWindow *w,
 static float
 modelStepObject (CompWindow *window,
 		 Model	    *model,
-		 Object	    *object,
+		 int	     index,
 		 float	    friction,
 		 float	    *force)
 {
-    object->theta += 0.05f;
+    Object *object = &model->objects[index];
 
     if (object->immobile)
     {
-	object->velocity.x = 0.0f;
-	object->velocity.y = 0.0f;
+	model->velocityX[index] = 0.0f;
+	model->velocityY[index] = 0.0f;
 
-	object->force.x = 0.0f;
-	object->force.y = 0.0f;
+	model->forceX[index] = 0.0f;
+	model->forceY[index] = 0.0f;
 
 	*force = 0.0f;
 
@@ -1305,33 +1392,33 @@ modelStepObject (CompWindow *window,
     }
     else
     {
-	object->force.x -= friction * object->velocity.x;
-	object->force.y -= friction * object->velocity.y;
+	model->forceX[index] -= friction * model->velocityX[index];
+	model->forceY[index] -= friction * model->velocityY[index];
 
-	object->velocity.x += object->force.x / MASS;
-	object->velocity.y += object->force.y / MASS;
+	model->velocityX[index] += model->forceX[index] / MASS;
+	model->velocityY[index] += model->forceY[index] / MASS;
 
 	if (object->edgeMask)
 	{
 	    if (object->edgeMask & WestEdgeMask)
 	    {
-		if (object->position.y < object->vertEdge.start ||
-		    object->position.y > object->vertEdge.end)
-		    findNextWestEdge (window, object);
+		if (model->positionY[index] < object->vertEdge.start ||
+		    model->positionY[index] > object->vertEdge.end)
+		    findNextWestEdge (window, model, index);
 
 		if (!object->vertEdge.snapped ||
-		    objectReleaseWestEdge (window, model, object))
+		    objectReleaseWestEdge (window, model, index))
 		{
-		    object->position.x += object->velocity.x;
+		    model->positionX[index] += model->velocityX[index];
 
-		    if (object->velocity.x < 0.0f &&
-			object->position.x < object->vertEdge.attract)
+		    if (model->velocityX[index] < 0.0f &&
+			model->positionX[index] < object->vertEdge.attract)
 		    {
-			if (object->position.x < object->vertEdge.next)
+			if (model->positionX[index] < object->vertEdge.next)
 			{
 			    object->vertEdge.snapped = TRUE;
-			    object->position.x = object->vertEdge.next;
-			    object->velocity.x = 0.0f;
+			    model->positionX[index] = object->vertEdge.next;
+			    model->velocityX[index] = 0.0f;
 
 			    model->snapCnt[WEST]++;
 
@@ -1339,34 +1426,35 @@ modelStepObject (CompWindow *window,
 			}
 			else
 			{
-			    object->velocity.x -=
-				object->vertEdge.attract - object->position.x;
+			    model->velocityX[index] -=
+				object->vertEdge.attract -
+				model->positionX[index];
 			}
 		    }
 
-		    if (object->position.x > object->vertEdge.prev)
-			findNextWestEdge (window, object);
+		    if (model->positionX[index] > object->vertEdge.prev)
+			findNextWestEdge (window, model, index);
 		}
 	    }
 	    else if (object->edgeMask & EastEdgeMask)
 	    {
-		if (object->position.y < object->vertEdge.start ||
-		    object->position.y > object->vertEdge.end)
-		    findNextEastEdge (window, object);
+		if (model->positionY[index] < object->vertEdge.start ||
+		    model->positionY[index] > object->vertEdge.end)
+		    findNextEastEdge (window, model, index);
 
 		if (!object->vertEdge.snapped ||
-		    objectReleaseEastEdge (window, model, object))
+		    objectReleaseEastEdge (window, model, index))
 		{
-		    object->position.x += object->velocity.x;
+		    model->positionX[index] += model->velocityX[index];
 
-		    if (object->velocity.x > 0.0f &&
-			object->position.x > object->vertEdge.attract)
+		    if (model->velocityX[index] > 0.0f &&
+			model->positionX[index] > object->vertEdge.attract)
 		    {
-			if (object->position.x > object->vertEdge.next)
+			if (model->positionX[index] > object->vertEdge.next)
 			{
 			    object->vertEdge.snapped = TRUE;
-			    object->position.x = object->vertEdge.next;
-			    object->velocity.x = 0.0f;
+			    model->positionX[index] = object->vertEdge.next;
+			    model->velocityX[index] = 0.0f;
 
 			    model->snapCnt[EAST]++;
 
@@ -1374,37 +1462,38 @@ modelStepObject (CompWindow *window,
 			}
 			else
 			{
-			    object->velocity.x =
-				object->position.x - object->vertEdge.attract;
+			    model->velocityX[index] =
+				model->positionX[index] -
+				object->vertEdge.attract;
 			}
 		    }
 
-		    if (object->position.x < object->vertEdge.prev)
-			findNextEastEdge (window, object);
+		    if (model->positionX[index] < object->vertEdge.prev)
+			findNextEastEdge (window, model, index);
 		}
 	    }
 	    else
-		object->position.x += object->velocity.x;
+		model->positionX[index] += model->velocityX[index];
 
 	    if (object->edgeMask & NorthEdgeMask)
 	    {
-		if (object->position.x < object->horzEdge.start ||
-		    object->position.x > object->horzEdge.end)
-		    findNextNorthEdge (window, object);
+		if (model->positionX[index] < object->horzEdge.start ||
+		    model->positionX[index] > object->horzEdge.end)
+		    findNextNorthEdge (window, model, index);
 
 		if (!object->horzEdge.snapped ||
-		    objectReleaseNorthEdge (window, model, object))
+		    objectReleaseNorthEdge (window, model, index))
 		{
-		    object->position.y += object->velocity.y;
+		    model->positionY[index] += model->velocityY[index];
 
-		    if (object->velocity.y < 0.0f &&
-			object->position.y < object->horzEdge.attract)
+		    if (model->velocityY[index] < 0.0f &&
+			model->positionY[index] < object->horzEdge.attract)
 		    {
-			if (object->position.y < object->horzEdge.next)
+			if (model->positionY[index] < object->horzEdge.next)
 			{
 			    object->horzEdge.snapped = TRUE;
-			    object->position.y = object->horzEdge.next;
-			    object->velocity.y = 0.0f;
+			    model->positionY[index] = object->horzEdge.next;
+			    model->velocityY[index] = 0.0f;
 
 			    model->snapCnt[NORTH]++;
 
@@ -1412,34 +1501,35 @@ modelStepObject (CompWindow *window,
 			}
 			else
 			{
-			    object->velocity.y -=
-				object->horzEdge.attract - object->position.y;
+			    model->velocityY[index] -=
+				object->horzEdge.attract -
+				model->positionY[index];
 			}
 		    }
 
-		    if (object->position.y > object->horzEdge.prev)
-			findNextNorthEdge (window, object);
+		    if (model->positionY[index] > object->horzEdge.prev)
+			findNextNorthEdge (window, model, index);
 		}
 	    }
 	    else if (object->edgeMask & SouthEdgeMask)
 	    {
-		if (object->position.x < object->horzEdge.start ||
-		    object->position.x > object->horzEdge.end)
-		    findNextSouthEdge (window, object);
+		if (model->positionX[index] < object->horzEdge.start ||
+		    model->positionX[index] > object->horzEdge.end)
+		    findNextSouthEdge (window, model, index);
 
 		if (!object->horzEdge.snapped ||
-		    objectReleaseSouthEdge (window, model, object))
+		    objectReleaseSouthEdge (window, model, index))
 		{
-		    object->position.y += object->velocity.y;
+		    model->positionY[index] += model->velocityY[index];
 
-		    if (object->velocity.y > 0.0f &&
-			object->position.y > object->horzEdge.attract)
+		    if (model->velocityY[index] > 0.0f &&
+			model->positionY[index] > object->horzEdge.attract)
 		    {
-			if (object->position.y > object->horzEdge.next)
+			if (model->positionY[index] > object->horzEdge.next)
 			{
 			    object->horzEdge.snapped = TRUE;
-			    object->position.y = object->horzEdge.next;
-			    object->velocity.y = 0.0f;
+			    model->positionY[index] = object->horzEdge.next;
+			    model->velocityY[index] = 0.0f;
 
 			    model->snapCnt[SOUTH]++;
 
@@ -1447,67 +1537,165 @@ modelStepObject (CompWindow *window,
 			}
 			else
 			{
-			    object->velocity.y =
-				object->position.y - object->horzEdge.attract;
+			    model->velocityY[index] =
+				model->positionY[index] -
+				object->horzEdge.attract;
 			}
 		    }
 
-		    if (object->position.y < object->horzEdge.prev)
-			findNextSouthEdge (window, object);
+		    if (model->positionY[index] < object->horzEdge.prev)
+			findNextSouthEdge (window, model, index);
 		}
 	    }
 	    else
-		object->position.y += object->velocity.y;
+		model->positionY[index] += model->velocityY[index];
 	}
 	else
 	{
-	    object->position.x += object->velocity.x;
-	    object->position.y += object->velocity.y;
+	    model->positionX[index] += model->velocityX[index];
+	    model->positionY[index] += model->velocityY[index];
 	}
 
-	*force = fabs (object->force.x) + fabs (object->force.y);
+	*force = fabs (model->forceX[index]) + fabs (model->forceY[index]);
 
-	object->force.x = 0.0f;
-	object->force.y = 0.0f;
+	model->forceX[index] = 0.0f;
+	model->forceY[index] = 0.0f;
 
-	return fabs (object->velocity.x) + fabs (object->velocity.y);
+	return fabs (model->velocityX[index]) + fabs (model->velocityY[index]);
     }
 }
 
-static int
-modelStep (CompWindow *window,
-	   Model      *model,
-	   float      friction,
-	   float      k,
-	   float      time)
+/* Integrates all objects of a model that has no edges to snap to.
+   Immobile objects must have zero velocity and force on entry, which
+   leaves them where they are. */
+static void
+modelIntegrateObjects (Model *model,
+		       float friction)
 {
-    int   i, j, steps, wobbly = 0;
-    float velocitySum = 0.0f;
-    float force, forceSum = 0.0f;
+    float *px = model->positionX, *py = model->positionY;
+    float *vx = model->velocityX, *vy = model->velocityY;
+    float *fx = model->forceX, *fy = model->forceY;
+    int   i = 0, n = model->numObjects;
 
-    model->steps += time / 15.0f;
-    steps = floor (model->steps);
-    model->steps -= steps;
+#ifdef __SSE2__
+    __m128 vfriction = _mm_set1_ps (friction);
+    __m128 vmass     = _mm_set1_ps (MASS);
 
-    if (!steps)
-	return TRUE;
+    for (; i + 4 <= n; i += 4)
+    {
+	__m128 f, v;
+
+	v = _mm_loadu_ps (vx + i);
+	f = _mm_sub_ps (_mm_loadu_ps (fx + i), _mm_mul_ps (vfriction, v));
+	v = _mm_add_ps (v, _mm_div_ps (f, vmass));
+	_mm_storeu_ps (fx + i, f);
+	_mm_storeu_ps (vx + i, v);
+	_mm_storeu_ps (px + i, _mm_add_ps (_mm_loadu_ps (px + i), v));
+
+	v = _mm_loadu_ps (vy + i);
+	f = _mm_sub_ps (_mm_loadu_ps (fy + i), _mm_mul_ps (vfriction, v));
+	v = _mm_add_ps (v, _mm_div_ps (f, vmass));
+	_mm_storeu_ps (fy + i, f);
+	_mm_storeu_ps (vy + i, v);
+	_mm_storeu_ps (py + i, _mm_add_ps (_mm_loadu_ps (py + i), v));
+    }
+#endif
 
-    for (j = 0; j < steps; j++)
+    for (; i < n; i++)
     {
-	for (i = 0; i < model->numSprings; i++)
-	    springExertForces (&model->springs[i], k);
+	fx[i] -= friction * vx[i];
+	fy[i] -= friction * vy[i];
+
+	vx[i] += fx[i] / MASS;
+	vy[i] += fy[i] / MASS;
+
+	px[i] += vx[i];
+	py[i] += vy[i];
+    }
+}
 
+static void
+modelStepOnce (CompWindow *window,
+	       Model	  *model,
+	       float	  friction,
+	       float	  k,
+	       float	  *velocitySum,
+	       float	  *forceSum)
+{
+    float velocity, force;
+    int   i;
+
+    modelExertSpringForces (model, k);
+
+    for (i = 0; i < model->numObjects; i++)
+	if (model->objects[i].edgeMask)
+	    break;
+
+    /* snapping an object can change the edge mask of the objects that
+       follow it so they have to be stepped one at a time, in order */
+    if (i < model->numObjects)
+    {
 	for (i = 0; i < model->numObjects; i++)
 	{
-	    velocitySum += modelStepObject (window,
-					    model,
-					    &model->objects[i],
-					    friction,
-					    &force);
-	    forceSum += force;
+	    *velocitySum += modelStepObject (window, model, i, friction,
+					     &force);
+	    *forceSum += force;
 	}
+
+	return;
     }
 
+    for (i = 0; i < model->numObjects; i++)
+    {
+	if (model->objects[i].immobile)
+	{
+	    model->velocityX[i] = 0.0f;
+	    model->velocityY[i] = 0.0f;
+
+	    model->forceX[i] = 0.0f;
+	    model->forceY[i] = 0.0f;
+	}
+    }
+
+    modelIntegrateObjects (model, friction);
+
+    for (i = 0; i < model->numObjects; i++)
+    {
+	velocity = fabs (model->velocityX[i]) + fabs (model->velocityY[i]);
+	force	 = fabs (model->forceX[i]) + fabs (model->forceY[i]);
+
+	*velocitySum += velocity;
+	*forceSum    += force;
+
+	model->forceX[i] = 0.0f;
+	model->forceY[i] = 0.0f;
+    }
+}
+
+static int
+modelAdvance (Model *model,
+	      float time)
+{
+    int steps;
+
+    model->steps += time / 15.0f;
+    steps = floor (model->steps);
+    model->steps -= steps;
+
+    return steps;
+}
+
+static int
+modelFinishStep (Model *model,
+		 int   steps,
+		 float velocitySum,
+		 float forceSum)
+{
+    int wobbly = 0;
+
+    if (!steps)
+	return TRUE;
+
     modelCalcBounds (model);
 
     if (velocitySum > 0.5f)
@@ -1519,59 +1707,116 @@ modelStep (CompWindow *window,
     return wobbly;
 }
 
+/* Computes the degree n - 1 Bernstein polynomials at t by repeated
+   degree elevation, which avoids the binomial coefficients. */
 static void
-bezierPatchEvaluate (Model *model,
-		     float u,
-		     float v,
-		     float *patchX,
-		     float *patchY)
+bernsteinBasis (float t,
+		int   n,
+		float *coeffs)
 {
-    float coeffsU[4], coeffsV[4];
-    float x, y;
+    float s = 1.0f - t;
     int   i, j;
 
-    coeffsU[0] = (1 - u) * (1 - u) * (1 - u);
-    coeffsU[1] = 3 * u * (1 - u) * (1 - u);
-    coeffsU[2] = 3 * u * u * (1 - u);
-    coeffsU[3] = u * u * u;
+    coeffs[0] = 1.0f;
 
-    coeffsV[0] = (1 - v) * (1 - v) * (1 - v);
-    coeffsV[1] = 3 * v * (1 - v) * (1 - v);
-    coeffsV[2] = 3 * v * v * (1 - v);
-    coeffsV[3] = v * v * v;
+    for (i = 1; i < n; i++)
+    {
+	coeffs[i] = t * coeffs[i - 1];
 
-    x = y = 0.0f;
+	for (j = i - 1; j > 0; j--)
+	    coeffs[j] = s * coeffs[j] + t * coeffs[j - 1];
+
+	coeffs[0] *= s;
+    }
+}
+
+/* Returns the largest steps in patch coordinates for which a mesh of
+   flat quads stays within WOBBLY_MESH_TOLERANCE pixels of the patch.
+   The bound follows from the second differences of the control grid,
+   which limit the second derivatives of the patch. A model at rest has
+   an affine control grid and is drawn with a single quad. */
+static void
+modelTessellationStep (Model *model,
+		       float *stepU,
+		       float *stepV)
+{
+    float *px = model->positionX, *py = model->positionY;
+    int   gw = model->gridWidth, gh = model->gridHeight;
+    float du = 0.0f, dv = 0.0f, duv = 0.0f, d;
+    int   i, j, k;
 
-    for (i = 0; i < 4; i++)
+    for (j = 0; j < gh; j++)
     {
-	for (j = 0; j < 4; j++)
+	for (i = 0; i < gw; i++)
 	{
-	    x += coeffsU[i] * coeffsV[j] *
-		model->objects[j * GRID_WIDTH + i].position.x;
-	    y += coeffsU[i] * coeffsV[j] *
-		model->objects[j * GRID_WIDTH + i].position.y;
+	    k = j * gw + i;
+
+	    if (i > 0 && i < gw - 1)
+	    {
+		d = fabs (px[k - 1] - 2.0f * px[k] + px[k + 1]) +
+		    fabs (py[k - 1] - 2.0f * py[k] + py[k + 1]);
+		if (d > du)
+		    du = d;
+	    }
+
+	    if (j > 0 && j < gh - 1)
+	    {
+		d = fabs (px[k - gw] - 2.0f * px[k] + px[k + gw]) +
+		    fabs (py[k - gw] - 2.0f * py[k] + py[k + gw]);
+		if (d > dv)
+		    dv = d;
+	    }
+
+	    if (i > 0 && j > 0)
+	    {
+		d = fabs (px[k] - px[k - 1] - px[k - gw] + px[k - gw - 1]) +
+		    fabs (py[k] - py[k - 1] - py[k - gw] + py[k - gw - 1]);
+		if (d > duv)
+		    duv = d;
+	    }
 	}
     }
 
-    *patchX = x;
-    *patchY = y;
+    du  *= (gw - 1) * (gw - 2);
+    dv  *= (gh - 1) * (gh - 2);
+    duv *= (gw - 1) * (gh - 1);
+
+    *stepU = 1.0f;
+    if (du + duv > 0.0f)
+    {
+	d = sqrt (4.0f * WOBBLY_MESH_TOLERANCE / (du + duv));
+	if (d < *stepU)
+	    *stepU = d;
+    }
+
+    *stepV = 1.0f;
+    if (dv + duv > 0.0f)
+    {
+	d = sqrt (4.0f * WOBBLY_MESH_TOLERANCE / (dv + duv));
+	if (d < *stepV)
+	    *stepV = d;
+    }
 }
 
 static Bool
 wobblyEnsureModel (CompWindow *w)
 {
+    WOBBLY_SCREEN (w->screen);
     WOBBLY_WINDOW (w);
 
     if (!ww->model)
     {
 	unsigned int edgeMask = 0;
+	int	     gridSize;
 
 	if (w->type & CompWindowTypeNormalMask)
 	    edgeMask = WestEdgeMask | EastEdgeMask | NorthEdgeMask |
 		SouthEdgeMask;
 
+	gridSize = ws->opt[WOBBLY_SCREEN_OPTION_MODEL_GRID_SIZE].value.i;
+
 	ww->model = createModel (WIN_X (w), WIN_Y (w), WIN_W (w), WIN_H (w),
-				 edgeMask);
+				 gridSize, edgeMask);
 	if (!ww->model)
 	    return FALSE;
     }
@@ -1580,34 +1825,34 @@ wobblyEnsureModel (CompWindow *w)
 }
 
 static float
-objectDistance (Object *object,
-		float  x,
-		float  y)
+objectDistance (Model *model,
+		int   index,
+		float x,
+		float y)
 {
     float dx, dy;
 
-    dx = object->position.x - x;
-    dy = object->position.y - y;
+    dx = model->positionX[index] - x;
+    dy = model->positionY[index] - y;
 
     return sqrt (dx * dx + dy * dy);
 }
 
-static Object *
+static int
 modelFindNearestObject (Model *model,
 			float x,
 			float y)
 {
-    Object *object = &model->objects[0];
-    float  distance, minDistance = 0.0;
-    int    i;
+    float distance, minDistance = 0.0;
+    int   i, object = 0;
 
     for (i = 0; i < model->numObjects; i++)
     {
-	distance = objectDistance (&model->objects[i], x, y);
+	distance = objectDistance (model, i, x, y);
 	if (i == 0 || distance < minDistance)
 	{
 	    minDistance = distance;
-	    object = &model->objects[i];
+	    object = i;
 	}
     }
 
@@ -1636,6 +1881,62 @@ isWobblyWin (CompWindow *w)
     return TRUE;
 }
 
+/* Steps the models of all windows that are wobbling in one pass. The
+   models are independent of each other so they are advanced together
+   one substep at a time instead of one window after another. */
+static void
+wobblyStepModels (CompScreen *s,
+		  int	     msSinceLastPaint)
+{
+    WobblyWindow *ww;
+    CompWindow   *w, *first = NULL, **last = &first;
+    float	 friction, springK, time;
+    int		 i, steps = 0;
+
+    WOBBLY_SCREEN (s);
+
+    friction = ws->opt[WOBBLY_SCREEN_OPTION_FRICTION].value.f;
+    springK  = ws->opt[WOBBLY_SCREEN_OPTION_SPRING_K].value.f;
+
+    for (w = s->windows; w; w = w->next)
+    {
+	ww = GET_WOBBLY_WINDOW (w, ws);
+
+	ww->steps	= 0;
+	ww->velocitySum = 0.0f;
+	ww->forceSum	= 0.0f;
+
+	if (!(ww->wobbly & (WobblyInitial | WobblyVelocity)))
+	    continue;
+
+	time = (ww->wobbly & WobblyVelocity) ? msSinceLastPaint :
+	    s->redrawTime;
+
+	ww->steps = modelAdvance (ww->model, time);
+	if (!ww->steps)
+	    continue;
+
+	if (ww->steps > steps)
+	    steps = ww->steps;
+
+	ww->nextStep = NULL;
+	*last = w;
+	last = &ww->nextStep;
+    }
+
+    for (i = 0; i < steps; i++)
+    {
+	for (w = first; w; w = ww->nextStep)
+	{
+	    ww = GET_WOBBLY_WINDOW (w, ws);
+
+	    if (i < ww->steps)
+		modelStepOnce (w, ww->model, friction, springK,
+			       &ww->velocitySum, &ww->forceSum);
+	}
+    }
+}
+
 static void
 wobblyPreparePaintScreen (CompScreen *s,
 			  int	     msSinceLastPaint)
@@ -1649,11 +1950,9 @@ wobblyPreparePaintScreen (CompScreen *s,
     {
 	BoxRec box;
 	Point  topLeft, bottomRight;
-	float  friction, springK;
 	Model  *model;
 
-	friction = ws->opt[WOBBLY_SCREEN_OPTION_FRICTION].value.f;
-	springK  = ws->opt[WOBBLY_SCREEN_OPTION_SPRING_K].value.f;
+	wobblyStepModels (s, msSinceLastPaint);
 
 	ws->wobblyWindows = 0;
 	for (w = s->windows; w; w = w->next)
@@ -1669,10 +1968,9 @@ wobblyPreparePaintScreen (CompScreen *s,
 		    topLeft     = model->topLeft;
 		    bottomRight = model->bottomRight;
 
-		    ww->wobbly = modelStep (w, model, friction, springK,
-					    (ww->wobbly & WobblyVelocity) ?
-					    msSinceLastPaint :
-					    s->redrawTime);
+		    ww->wobbly = modelFinishStep (model, ww->steps,
+						  ww->velocitySum,
+						  ww->forceSum);
 
 		    if ((ww->state & MAXIMIZE_STATE) && ww->grabbed)
 			ww->wobbly |= WobblyForce;
@@ -1799,6 +2097,240 @@ wobblyDrawWindowGeometry (CompWindow *w)
     }
 }
 
+static Bool
+wobblyMeshMatches (WobblyMesh *mesh,
+		   Model      *model,
+		   Region     region,
+		   int	      x,
+		   int	      y,
+		   int	      width,
+		   int	      height,
+		   int	      gridW,
+		   int	      gridH)
+{
+    int n = model->numObjects;
+
+    if (mesh->numObjects != n || mesh->nRects != region->numRects)
+	return FALSE;
+
+    if (mesh->x != x || mesh->y != y ||
+	mesh->width != width || mesh->height != height ||
+	mesh->gridW != gridW || mesh->gridH != gridH)
+	return FALSE;
+
+    if (memcmp (mesh->positions, model->positionX, sizeof (float) * n) ||
+	memcmp (mesh->positions + n, model->positionY, sizeof (float) * n))
+	return FALSE;
+
+    return !memcmp (mesh->rects, region->rects,
+		    sizeof (BoxRec) * region->numRects);
+}
+
+/* Evaluates the patch at the vertices wobblyAddWindowGeometry emits for
+   region, in the same order. The patch is reduced to a bezier curve per
+   row first, so each vertex only costs one curve evaluation with the
+   basis of its column. */
+static Bool
+wobblyBuildMesh (WobblyMesh *mesh,
+		 Model	    *model,
+		 Region     region,
+		 int	    wx,
+		 int	    wy,
+		 int	    width,
+		 int	    height,
+		 int	    gridW,
+		 int	    gridH)
+{
+    float  rowX[MODEL_MAX_GRID_SIZE], rowY[MODEL_MAX_GRID_SIZE];
+    float  coeffsV[MODEL_MAX_GRID_SIZE];
+    float  *basis, px, py;
+    int	   gw = model->gridWidth, gh = model->gridHeight;
+    int	   n = model->numObjects;
+    int	   nPoints = 0, maxColumns = 0;
+    int	   iw, ih, i, j, c, x, y;
+    BoxPtr pClip;
+    GLfloat *p;
+
+    for (i = 0; i < region->numRects; i++)
+    {
+	pClip = &region->rects[i];
+
+	iw = ((pClip->x2 - pClip->x1 - 1) / gridW) + 2;
+	ih = ((pClip->y2 - pClip->y1 - 1) / gridH) + 2;
+
+	nPoints += iw * ih;
+	if (iw > maxColumns)
+	    maxColumns = iw;
+    }
+
+    if (nPoints * 2 > mesh->pointsSize)
+    {
+	p = realloc (mesh->points, sizeof (GLfloat) * nPoints * 2);
+	if (!p)
+	    return FALSE;
+
+	mesh->points	 = p;
+	mesh->pointsSize = nPoints * 2;
+    }
+
+    if (maxColumns * gw > mesh->basisSize)
+    {
+	basis = realloc (mesh->basis, sizeof (float) * maxColumns * gw);
+	if (!basis)
+	    return FALSE;
+
+	mesh->basis	= basis;
+	mesh->basisSize = maxColumns * gw;
+    }
+
+    if (region->numRects > mesh->rectsSize)
+    {
+	pClip = realloc (mesh->rects, sizeof (BoxRec) * region->numRects);
+	if (!pClip)
+	    return FALSE;
+
+	mesh->rects	= pClip;
+	mesh->rectsSize = region->numRects;
+    }
+
+    if (n * 2 > mesh->positionsSize)
+    {
+	basis = realloc (mesh->positions, sizeof (float) * n * 2);
+	if (!basis)
+	    return FALSE;
+
+	mesh->positions	    = basis;
+	mesh->positionsSize = n * 2;
+    }
+
+    /* invalid until it is completely built */
+    mesh->numObjects = 0;
+
+    p = mesh->points;
+
+    for (c = 0; c < region->numRects; c++)
+    {
+	pClip = &region->rects[c];
+
+	iw = ((pClip->x2 - pClip->x1 - 1) / gridW) + 2;
+
+	for (i = 0; i < iw; i++)
+	{
+	    x = pClip->x1 + i * gridW;
+	    if (x > pClip->x2)
+		x = pClip->x2;
+
+	    bernsteinBasis ((x - wx) / (float) width, gw,
+			    mesh->basis + i * gw);
+	}
+
+	for (y = pClip->y1;; y += gridH)
+	{
+	    if (y > pClip->y2)
+		y = pClip->y2;
+
+	    bernsteinBasis ((y - wy) / (float) height, gh, coeffsV);
+
+	    for (i = 0; i < gw; i++)
+	    {
+		rowX[i] = rowY[i] = 0.0f;
+
+		for (j = 0; j < gh; j++)
+		{
+		    rowX[i] += coeffsV[j] * model->positionX[j * gw + i];
+		    rowY[i] += coeffsV[j] * model->positionY[j * gw + i];
+		}
+	    }
+
+	    basis = mesh->basis;
+
+	    for (i = 0; i < iw; i++)
+	    {
+		px = py = 0.0f;
+
+		for (j = 0; j < gw; j++)
+		{
+		    px += basis[j] * rowX[j];
+		    py += basis[j] * rowY[j];
+		}
+
+		*p++ = px;
+		*p++ = py;
+
+		basis += gw;
+	    }
+
+	    if (y == pClip->y2)
+		break;
+	}
+    }
+
+    memcpy (mesh->positions, model->positionX, sizeof (float) * n);
+    memcpy (mesh->positions + n, model->positionY, sizeof (float) * n);
+    memcpy (mesh->rects, region->rects, sizeof (BoxRec) * region->numRects);
+
+    mesh->nRects     = region->numRects;
+    mesh->x	     = wx;
+    mesh->y	     = wy;
+    mesh->width	     = width;
+    mesh->height     = height;
+    mesh->gridW	     = gridW;
+    mesh->gridH	     = gridH;
+    mesh->numObjects = n;
+
+    return TRUE;
+}
+
+/* Returns the cached mesh for region, tessellating it again only when
+   the model or the region changed since it was built. */
+static WobblyMesh *
+wobblyGetMesh (CompWindow *w,
+	       Region     region,
+	       int	  gridW,
+	       int	  gridH)
+{
+    WobblyMesh *mesh;
+    int	       i;
+
+    WOBBLY_WINDOW (w);
+
+    for (i = 0; i < WOBBLY_MESH_CACHE_SIZE; i++)
+    {
+	mesh = &ww->mesh[i];
+
+	if (wobblyMeshMatches (mesh, ww->model, region,
+			       WIN_X (w), WIN_Y (w), WIN_W (w), WIN_H (w),
+			       gridW, gridH))
+	    return mesh;
+    }
+
+    mesh = &ww->mesh[ww->nextMesh];
+    ww->nextMesh = (ww->nextMesh + 1) % WOBBLY_MESH_CACHE_SIZE;
+
+    if (!wobblyBuildMesh (mesh, ww->model, region,
+			  WIN_X (w), WIN_Y (w), WIN_W (w), WIN_H (w),
+			  gridW, gridH))
+	return NULL;
+
+    return mesh;
+}
+
+static void
+wobblyFiniMesh (WobblyMesh *mesh)
+{
+    if (mesh->positions)
+	free (mesh->positions);
+
+    if (mesh->rects)
+	free (mesh->rects);
+
+    if (mesh->points)
+	free (mesh->points);
+
+    if (mesh->basis)
+	free (mesh->basis);
+}
+
 static void
 wobblyAddWindowGeometry (CompWindow *w,
 			 CompMatrix *matrix,
@@ -1811,17 +2343,18 @@ wobblyAddWindowGeometry (CompWindow *w,
 
     if (ww->wobbly)
     {
-	BoxPtr   pClip;
-	int      nClip, nVertices, nIndices;
-	GLushort *i;
-	GLfloat  *v;
-	int      x1, y1, x2, y2;
-	float    width, height;
-	float    deformedX, deformedY;
-	int      x, y, iw, ih, wx, wy;
-	int      vSize, it;
-	int      gridW, gridH;
-	Bool     rect = TRUE;
+	BoxPtr     pClip;
+	int        nClip, nVertices, nIndices;
+	GLushort   *i;
+	GLfloat    *v, *p;
+	int        x1, y1, x2, y2;
+	float      width, height;
+	float      stepU, stepV;
+	int        x, y, iw, ih;
+	int        vSize, it;
+	int        gridW, gridH;
+	Bool       rect = TRUE;
+	WobblyMesh *mesh;
 
 	for (it = 0; it < nMatrix; it++)
 	{
@@ -1832,8 +2365,6 @@ wobblyAddWindowGeometry (CompWindow *w,
 	    }
 	}
 
-	wx     = WIN_X (w);
-	wy     = WIN_Y (w);
 	width  = WIN_W (w);
 	height = WIN_H (w);
 
@@ -1845,6 +2376,22 @@ wobblyAddWindowGeometry (CompWindow *w,
 	if (gridH < ws->opt[WOBBLY_SCREEN_OPTION_MIN_GRID_SIZE].value.i)
 	    gridH = ws->opt[WOBBLY_SCREEN_OPTION_MIN_GRID_SIZE].value.i;
 
+	/* the options give the finest grid, use a coarser one where the
+	   model is flat enough */
+	modelTessellationStep (ww->model, &stepU, &stepV);
+
+	if (gridW < stepU * width)
+	    gridW = stepU * width;
+
+	if (gridH < stepV * height)
+	    gridH = stepV * height;
+
+	mesh = wobblyGetMesh (w, region, gridW, gridH);
+	if (!mesh)
+	    return;
+
+	p = mesh->points;
+
 	nClip = region->numRects;
 	pClip = region->rects;
 
@@ -1910,12 +2457,6 @@ wobblyAddWindowGeometry (CompWindow *w,
 		    if (x > x2)
 			x = x2;
 
-		    bezierPatchEvaluate (ww->model,
-					 (x - wx) / width,
-					 (y - wy) / height,
-					 &deformedX,
-					 &deformedY);
-
 		    if (rect)
 		    {
 			for (it = 0; it < nMatrix; it++)
@@ -1933,8 +2474,8 @@ wobblyAddWindowGeometry (CompWindow *w,
 			}
 		    }
 
-		    *v++ = deformedX;
-		    *v++ = deformedY;
+		    *v++ = *p++;
+		    *v++ = *p++;
 		    *v++ = 0.0;
 
 		    nVertices++;
@@ -2187,8 +2728,8 @@ wobblyHandleEvent (CompDisplay *d,
 			else
 			    dy = 0;
 
-			ww->model->anchorObject->position.x += dx;
-			ww->model->anchorObject->position.y += dy;
+			ww->model->positionX[ww->model->anchorObject] += dx;
+			ww->model->positionY[ww->model->anchorObject] += dy;
 
 			ww->wobbly |= WobblyInitial;
 			ws->wobblyWindows |= ww->wobbly;
@@ -2340,11 +2881,8 @@ wobblyWindowResizeNotify (CompWindow *w,
 	{
 	    if (w->state & MAXIMIZE_STATE)
 	    {
-		if (!ww->grabbed && ww->model->anchorObject)
-		{
-		    ww->model->anchorObject->immobile = FALSE;
-		    ww->model->anchorObject = NULL;
-		}
+		if (!ww->grabbed)
+		    modelReleaseAnchor (ww->model);
 
 		modelAddEdgeAnchors (ww->model,
 				     WIN_X (w), WIN_Y (w),
@@ -2389,13 +2927,10 @@ wobblyWindowResizeNotify (CompWindow *w,
     /* update grab */
     if (ww->model && ww->grabbed)
     {
-	if (ww->model->anchorObject)
-	    ww->model->anchorObject->immobile = FALSE;
-
-	ww->model->anchorObject = modelFindNearestObject (ww->model,
-							  pointerX,
-							  pointerY);
-	ww->model->anchorObject->immobile = TRUE;
+	modelReleaseAnchor (ww->model);
+	modelSetAnchor (ww->model, modelFindNearestObject (ww->model,
+							   pointerX,
+							   pointerY));
 
 	modelAdjustObjectPosition (ww->model,
 				   ww->model->anchorObject,
@@ -2429,15 +2964,15 @@ wobblyWindowMoveNotify (CompWindow *w,
 		{
 		    if (ww->model->objects[i].immobile)
 		    {
-			ww->model->objects[i].position.x += dx;
-			ww->model->objects[i].position.y += dy;
+			ww->model->positionX[i] += dx;
+			ww->model->positionY[i] += dy;
 		    }
 		}
 	    }
 	    else
 	    {
-		ww->model->anchorObject->position.x += dx;
-		ww->model->anchorObject->position.y += dy;
+		ww->model->positionX[ww->model->anchorObject] += dx;
+		ww->model->positionY[ww->model->anchorObject] += dy;
 	    }
 
 	    ww->wobbly |= WobblyInitial;
@@ -2501,18 +3036,16 @@ wobblyWindowGrabNotify (CompWindow   *w,
 					    WIN_X (w), WIN_Y (w),
 					    WIN_W (w), WIN_H (w));
 
-		    if (ww->model->anchorObject)
-			ww->model->anchorObject->immobile = FALSE;
+		    modelReleaseAnchor (ww->model);
 		}
 	    }
 	    else
 	    {
-		if (ww->model->anchorObject)
-		    ww->model->anchorObject->immobile = FALSE;
+		modelReleaseAnchor (ww->model);
 	    }
 
-	    ww->model->anchorObject = modelFindNearestObject (ww->model, x, y);
-	    ww->model->anchorObject->immobile = TRUE;
+	    modelSetAnchor (ww->model,
+			    modelFindNearestObject (ww->model, x, y));
 
 	    ww->grabbed = TRUE;
 
@@ -2535,13 +3068,13 @@ wobblyWindowGrabNotify (CompWindow   *w,
 
 		    if (s->a == ww->model->anchorObject)
 		    {
-			s->b->velocity.x -= s->offset.x * 0.05f;
-			s->b->velocity.y -= s->offset.y * 0.05f;
+			ww->model->velocityX[s->b] -= s->offset.x * 0.05f;
+			ww->model->velocityY[s->b] -= s->offset.y * 0.05f;
 		    }
 		    else if (s->b == ww->model->anchorObject)
 		    {
-			s->a->velocity.x += s->offset.x * 0.05f;
-			s->a->velocity.y += s->offset.y * 0.05f;
+			ww->model->velocityX[s->a] += s->offset.x * 0.05f;
+			ww->model->velocityY[s->a] += s->offset.y * 0.05f;
 		    }
 		}
 
@@ -2574,10 +3107,7 @@ wobblyWindowUngrabNotify (CompWindow *w)
     {
 	if (ww->model)
 	{
-	    if (ww->model->anchorObject)
-		ww->model->anchorObject->immobile = FALSE;
-
-	    ww->model->anchorObject = NULL;
+	    modelReleaseAnchor (ww->model);
 
 	    if (ws->opt[WOBBLY_SCREEN_OPTION_MAXIMIZE_EFFECT].value.b)
 	    {
@@ -2820,6 +3350,9 @@ wobblyInitWindow (CompPlugin *p,
     ww->grabbed = FALSE;
     ww->state   = w->state;
 
+    memset (ww->mesh, 0, sizeof (ww->mesh));
+    ww->nextMesh = 0;
+
     w->base.privates[ws->windowPrivateIndex].ptr = ww;
 
     if (w->mapNum && ws->opt[WOBBLY_SCREEN_OPTION_MAXIMIZE_EFFECT].value.b)
@@ -2835,6 +3368,8 @@ static void
 wobblyFiniWindow (CompPlugin *p,
 		  CompWindow *w)
 {
+    int i;
+
     WOBBLY_WINDOW (w);
     WOBBLY_SCREEN (w->screen);
 
@@ -2845,10 +3380,10 @@ wobblyFiniWindow (CompPlugin *p,
     }
 
     if (ww->model)
-    {
-	free (ww->model->objects);
-	free (ww->model);
-    }
+	freeModel (ww->model);
+
+    for (i = 0; i < WOBBLY_MESH_CACHE_SIZE; i++)
+	wobblyFiniMesh (&ww->mesh[i]);
 
     free (ww);
 }
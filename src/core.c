@@ -174,6 +174,10 @@ initCore (void)
     core.lastFileWatchHandle = 1;
 
     core.timeouts	   = NULL;
+    core.nTimeout	   = 0;
+    core.timeoutSize	   = 0;
+    core.timeoutHash	   = NULL;
+    core.timeoutHashSize   = 0;
     core.lastTimeoutHandle = 1;
 
     core.watchFds	   = NULL;
@@ -181,8 +185,6 @@ initCore (void)
     core.watchPollFds	   = NULL;
     core.nWatchFds	   = 0;
 
-    gettimeofday (&core.lastTimeout, 0);
-
     core.initPluginForObject = initCorePluginForObject;
     core.finiPluginForObject = finiCorePluginForObject;
 
@@ -229,6 +231,15 @@ finiCore (void)
     while ((p = popPlugin ()))
 	unloadPlugin (p);
 
+    while (core.nTimeout)
+	compRemoveTimeout (core.timeouts[0]->handle);
+
+    if (core.timeouts)
+	free (core.timeouts);
+
+    if (core.timeoutHash)
+	free (core.timeoutHash);
+
     XDestroyRegion (core.outputRegion);
     XDestroyRegion (core.tmpRegion);
 }
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/poll.h>
 #include <assert.h>
 
@@ -474,6 +475,16 @@ shade (CompDisplay     *d,
     return TRUE;
 }
 
+static Bool
+dumpPaintProfile (CompDisplay     *d,
+		  CompAction      *action,
+		  CompActionState state,
+		  CompOption      *option,
+		  int		  nOption)
+{
+    return writePaintProfile (d->opt[COMP_DISPLAY_OPTION_PAINT_PROFILE_FILE].value.s);
+}
+
 const CompMetadataOptionInfo coreDisplayOptionInfo[COMP_DISPLAY_OPTION_NUM] = {
     { "abi", "int", 0, 0, 0 },
     { "active_plugins", "list", "<type>string</type>", 0, 0 },
@@ -510,7 +521,11 @@ const CompMetadataOptionInfo coreDisplayOptionInfo[COMP_DISPLAY_OPTION_NUM] = {
     { "toggle_window_shaded_key", "key", 0, shade, 0 },
     { "ignore_hints_when_maximized", "bool", 0, 0, 0 },
     { "ping_delay", "int", "<min>1000</min>", 0, 0 },
-    { "edge_delay", "int", "<min>0</min>", 0, 0 }
+    { "edge_delay", "int", "<min>0</min>", 0, 0 },
+    { "paint_profile", "bool", 0, 0, 0 },
+    { "paint_profile_file", "string", 0, 0, 0 },
+    { "dump_paint_profile_key", "key", 0, dumpPaintProfile, 0 },
+    { "image_cache_size", "int", "<min>0</min>", 0, 0 }
 };
 
 CompOption *
@@ -778,27 +793,223 @@ updatePlugins (CompDisplay *d)
     (*core.setOptionForPlugin) (&d->base, "core", o->name, &d->plugin);
 }
 
+#define TIMEOUT_HASH_MIN_SIZE 32
+
+#define TIMEVAL_BEFORE(tv1, tv2)				\
+    ((tv1)->tv_sec < (tv2)->tv_sec ||				\
+     ((tv1)->tv_sec == (tv2)->tv_sec && (tv1)->tv_usec < (tv2)->tv_usec))
+
+void
+compGetCurrentTime (struct timeval *tv)
+{
+
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    {
+	tv->tv_sec  = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+	return;
+    }
+#endif
+
+    gettimeofday (tv, 0);
+}
+
+static void
+addTimeToTimeval (struct timeval       *result,
+		  const struct timeval *tv,
+		  int		       ms)
+{
+    result->tv_sec  = tv->tv_sec + ms / 1000;
+    result->tv_usec = tv->tv_usec + (ms % 1000) * 1000;
+
+    if (result->tv_usec >= 1000000)
+    {
+	result->tv_sec++;
+	result->tv_usec -= 1000000;
+    }
+}
+
 static void
-addTimeout (CompTimeout *timeout)
+siftTimeoutUp (int i)
 {
-    CompTimeout *p = 0, *t;
+    CompTimeout *t = core.timeouts[i];
+    int		parent;
 
-    for (t = core.timeouts; t; t = t->next)
+    while (i > 0)
     {
-	if (timeout->minTime < t->minLeft)
+	parent = (i - 1) / 2;
+
+	if (!TIMEVAL_BEFORE (&t->minDeadline,
+			     &core.timeouts[parent]->minDeadline))
 	    break;
 
-	p = t;
+	core.timeouts[i] = core.timeouts[parent];
+	core.timeouts[i]->heapIndex = i;
+
+	i = parent;
     }
 
-    timeout->next = t;
-    timeout->minLeft = timeout->minTime;
-    timeout->maxLeft = timeout->maxTime;
+    core.timeouts[i] = t;
+    t->heapIndex = i;
+}
 
-    if (p)
-	p->next = timeout;
-    else
-	core.timeouts = timeout;
+static void
+siftTimeoutDown (int i)
+{
+    CompTimeout *t = core.timeouts[i];
+    int		child;
+
+    for (;;)
+    {
+	child = 2 * i + 1;
+	if (child >= core.nTimeout)
+	    break;
+
+	if (child + 1 < core.nTimeout &&
+	    TIMEVAL_BEFORE (&core.timeouts[child + 1]->minDeadline,
+			    &core.timeouts[child]->minDeadline))
+	    child++;
+
+	if (!TIMEVAL_BEFORE (&core.timeouts[child]->minDeadline,
+			     &t->minDeadline))
+	    break;
+
+	core.timeouts[i] = core.timeouts[child];
+	core.timeouts[i]->heapIndex = i;
+
+	i = child;
+    }
+
+    core.timeouts[i] = t;
+    t->heapIndex = i;
+}
+
+static Bool
+resizeTimeoutHash (int size)
+{
+    CompTimeout **hash, *t, *next;
+    int		i;
+
+    hash = calloc (size, sizeof (CompTimeout *));
+    if (!hash)
+	return FALSE;
+
+    for (i = 0; i < core.timeoutHashSize; i++)
+    {
+	for (t = core.timeoutHash[i]; t; t = next)
+	{
+	    next = t->next;
+
+	    t->next = hash[t->handle & (size - 1)];
+	    hash[t->handle & (size - 1)] = t;
+	}
+    }
+
+    if (core.timeoutHash)
+	free (core.timeoutHash);
+
+    core.timeoutHash     = hash;
+    core.timeoutHashSize = size;
+
+    return TRUE;
+}
+
+static CompTimeout *
+findTimeout (CompTimeoutHandle handle)
+{
+    CompTimeout *t;
+
+    if (!core.timeoutHashSize)
+	return NULL;
+
+    for (t = core.timeoutHash[handle & (core.timeoutHashSize - 1)]; t;
+	 t = t->next)
+	if (t->handle == handle)
+	    return t;
+
+    return NULL;
+}
+
+/* timeouts are kept in a binary min-heap ordered by their absolute
+   minDeadline and in a hash table indexed by handle so that adding
+   and removing a timeout is O(log n) no matter how many are pending */
+static Bool
+addTimeout (CompTimeout    *timeout,
+	    struct timeval *tv)
+{
+    int i;
+
+    if (core.nTimeout == core.timeoutSize)
+    {
+	CompTimeout **timeouts;
+	int	    size = core.timeoutSize ? core.timeoutSize * 2 :
+				TIMEOUT_HASH_MIN_SIZE;
+
+	timeouts = realloc (core.timeouts, size * sizeof (CompTimeout *));
+	if (!timeouts)
+	    return FALSE;
+
+	core.timeouts    = timeouts;
+	core.timeoutSize = size;
+    }
+
+    /* a failed resize only makes the hash chains longer */
+    if (core.nTimeout >= core.timeoutHashSize)
+    {
+	if (!resizeTimeoutHash (core.timeoutHashSize ?
+				core.timeoutHashSize * 2 :
+				TIMEOUT_HASH_MIN_SIZE) &&
+	    !core.timeoutHashSize)
+	    return FALSE;
+    }
+
+    addTimeToTimeval (&timeout->minDeadline, tv, timeout->minTime);
+    addTimeToTimeval (&timeout->maxDeadline, tv, timeout->maxTime);
+
+    i = timeout->handle & (core.timeoutHashSize - 1);
+
+    timeout->next = core.timeoutHash[i];
+    core.timeoutHash[i] = timeout;
+
+    core.timeouts[core.nTimeout] = timeout;
+    siftTimeoutUp (core.nTimeout++);
+
+    return TRUE;
+}
+
+static void
+removeTimeout (CompTimeout *timeout)
+{
+    CompTimeout **p, *last;
+    int		i = timeout->heapIndex;
+
+    for (p = &core.timeoutHash[timeout->handle & (core.timeoutHashSize - 1)];
+	 *p; p = &(*p)->next)
+    {
+	if (*p == timeout)
+	{
+	    *p = timeout->next;
+	    break;
+	}
+    }
+
+    core.nTimeout--;
+
+    if (i != core.nTimeout)
+    {
+	last = core.timeouts[core.nTimeout];
+
+	core.timeouts[i] = last;
+	last->heapIndex  = i;
+
+	siftTimeoutDown (i);
+	siftTimeoutUp (last->heapIndex);
+    }
+
+    timeout->heapIndex = -1;
 }
 
 CompTimeoutHandle
@@ -807,22 +1018,30 @@ compAddTimeout (int	     minTime,
 		CallBackProc callBack,
 		void	     *closure)
 {
-    CompTimeout *timeout;
+    CompTimeout    *timeout;
+    struct timeval tv;
 
     timeout = malloc (sizeof (CompTimeout));
     if (!timeout)
 	return 0;
 
-    timeout->minTime  = minTime;
-    timeout->maxTime  = (maxTime >= minTime) ? maxTime : minTime;
-    timeout->callBack = callBack;
-    timeout->closure  = closure;
-    timeout->handle   = core.lastTimeoutHandle++;
+    timeout->minTime   = minTime;
+    timeout->maxTime   = (maxTime >= minTime) ? maxTime : minTime;
+    timeout->heapIndex = -1;
+    timeout->callBack  = callBack;
+    timeout->closure   = closure;
+    timeout->handle    = core.lastTimeoutHandle++;
 
     if (core.lastTimeoutHandle == MAXSHORT)
 	core.lastTimeoutHandle = 1;
 
-    addTimeout (timeout);
+    compGetCurrentTime (&tv);
+
+    if (!addTimeout (timeout, &tv))
+    {
+	free (timeout);
+	return 0;
+    }
 
     return timeout->handle;
 }
@@ -830,23 +1049,13 @@ compAddTimeout (int	     minTime,
 void *
 compRemoveTimeout (CompTimeoutHandle handle)
 {
-    CompTimeout *p = 0, *t;
+    CompTimeout *t;
     void        *closure = NULL;
 
-    for (t = core.timeouts; t; t = t->next)
-    {
-	if (t->handle == handle)
-	    break;
-
-	p = t;
-    }
-
+    t = findTimeout (handle);
     if (t)
     {
-	if (p)
-	    p->next = t->next;
-	else
-	    core.timeouts = t->next;
+	removeTimeout (t);
 
 	closure = t->closure;
 
@@ -1004,10 +1213,60 @@ getTimeToNextRedraw (CompScreen     *s,
 	}
     }
 
-    if (diff > s->redrawTime)
+    /* start painting early enough for the frame to be ready when
+       the next redraw is due */
+    if (diff + s->predictedPaintTime >= s->redrawTime)
 	return 0;
 
-    return s->redrawTime - diff;
+    return s->redrawTime - s->predictedPaintTime - diff;
+}
+
+static int
+timevalDiffUs (struct timeval *tv1,
+	       struct timeval *tv2)
+{
+    return (tv1->tv_sec - tv2->tv_sec) * 1000000 +
+	(tv1->tv_usec - tv2->tv_usec);
+}
+
+static void
+updateFrameHistory (CompScreen	   *s,
+		    struct timeval *paintStart,
+		    struct timeval *paintEnd,
+		    struct timeval *swapEnd,
+		    Bool	   idle)
+{
+    int i, interval, maxPaintTime = 0;
+
+    s->paintTimeHistory[s->frameHistoryIndex] =
+	MAX (0, timevalDiffUs (paintEnd, paintStart));
+    s->swapTimeHistory[s->frameHistoryIndex] =
+	MAX (0, timevalDiffUs (swapEnd, paintEnd));
+
+    s->frameHistoryIndex = (s->frameHistoryIndex + 1) % FRAME_HISTORY_SIZE;
+
+    /* the slowest of the recent frames is what we have to be prepared
+       for, anything less makes us miss the vertical retrace */
+    for (i = 0; i < FRAME_HISTORY_SIZE; i++)
+	if (s->paintTimeHistory[i] > maxPaintTime)
+	    maxPaintTime = s->paintTimeHistory[i];
+
+    s->predictedPaintTime = MIN ((maxPaintTime + 999) / 1000,
+				 s->optimalRedrawTime);
+
+    s->frameCount++;
+
+    /* frames that were painted continuously should be presented one
+       refresh period apart, longer intervals mean we skipped some */
+    if (!idle && s->optimalRedrawTime)
+    {
+	interval = TIMEVALDIFF (swapEnd, &s->lastSwap);
+	if (interval > s->optimalRedrawTime + s->optimalRedrawTime / 2)
+	    s->missedFrameCount += (interval + s->optimalRedrawTime / 2) /
+		s->optimalRedrawTime - 1;
+    }
+
+    s->lastSwap = *swapEnd;
 }
 
 static const int maskTable[] = {
@@ -1179,39 +1438,82 @@ doPoll (int timeout)
 }
 
 static void
-handleTimeouts (struct timeval *tv)
+coalesceTimeouts (int		 i,
+		  struct timeval *wakeup)
 {
     CompTimeout *t;
-    int		timeDiff;
 
-    timeDiff = TIMEVALDIFF (tv, &core.lastTimeout);
+    if (i >= core.nTimeout)
+	return;
 
-    /* handle clock rollback */
-    if (timeDiff < 0)
-	timeDiff = 0;
+    t = core.timeouts[i];
+
+    /* the min-heap property guarantees that nothing below this
+       node can become due before the current wakeup time */
+    if (TIMEVAL_BEFORE (wakeup, &t->minDeadline))
+	return;
+
+    if (TIMEVAL_BEFORE (&t->maxDeadline, wakeup))
+	*wakeup = t->maxDeadline;
 
-    for (t = core.timeouts; t; t = t->next)
+    coalesceTimeouts (2 * i + 1, wakeup);
+    coalesceTimeouts (2 * i + 2, wakeup);
+}
+
+static int
+getTimeToNextTimeout (struct timeval *tv)
+{
+    struct timeval wakeup;
+    long	   sec, usec;
+    int		   time;
+
+    /* wake up as late as the maxTime slack of the first timeout allows
+       while still being early enough for every other timeout that
+       can be handled at the same time */
+    wakeup = core.timeouts[0]->maxDeadline;
+    coalesceTimeouts (0, &wakeup);
+
+    sec  = wakeup.tv_sec  - tv->tv_sec;
+    usec = wakeup.tv_usec - tv->tv_usec;
+    if (usec < 0)
     {
-	t->minLeft -= timeDiff;
-	t->maxLeft -= timeDiff;
+	sec--;
+	usec += 1000000;
     }
 
-    while (core.timeouts && core.timeouts->minLeft <= 0)
+    if (sec < 0)
+	return 0;
+
+    time = sec * 1000 + (usec + 999) / 1000;
+
+    /* handleTimeouts only runs timeouts that expired strictly before
+       the time it is called with, so a first timeout that is due right
+       now needs a poll of at least one millisecond or the idle loop
+       spins until the clock moves on */
+    if (!time && !TIMEVAL_BEFORE (&core.timeouts[0]->minDeadline, tv))
+	time = 1;
+
+    return time;
+}
+
+static void
+handleTimeouts (struct timeval *tv)
+{
+    CompTimeout *t;
+
+    /* only timeouts that expired strictly before tv are handled, which
+       makes sure that a timeout with a minTime of zero that is
+       rescheduled by its callback doesn't run again in this pass */
+    while (core.nTimeout &&
+	   TIMEVAL_BEFORE (&core.timeouts[0]->minDeadline, tv))
     {
-	t = core.timeouts;
-	if ((*t->callBack) (t->closure))
-	{
-	    core.timeouts = t->next;
-	    addTimeout (t);
-	}
-	else
-	{
-	    core.timeouts = t->next;
+	t = core.timeouts[0];
+
+	removeTimeout (t);
+
+	if (!(*t->callBack) (t->closure) || !addTimeout (t, tv))
 	    free (t);
-	}
     }
-
-    core.lastTimeout = *tv;
 }
 
 static void
@@ -1296,18 +1598,131 @@ paintScreen (CompScreen   *s,
     }
 }
 
+/* extends the damage of this frame with the damage of the frames the
+   back buffer hasn't seen yet, the whole screen is repainted when the
+   age of the back buffer is unknown. The damage of this frame is kept
+   in the next history slot until recordBufferAge commits it */
+static unsigned int
+repairBufferAge (CompScreen   *s,
+		 unsigned int mask,
+		 int	      *nRepair)
+{
+    unsigned int age = 0;
+    int		 i, index;
+
+    *nRepair = 0;
+
+    if (!(mask & COMP_SCREEN_DAMAGE_REGION_MASK) ||
+	(mask & COMP_SCREEN_DAMAGE_ALL_MASK))
+	return mask;
+
+    index = (s->damageHistoryIndex + 1) % BUFFER_AGE_HISTORY;
+    XUnionRegion (&emptyRegion, core.tmpRegion, s->damageHistory[index]);
+
+    (*s->queryDrawable) (s->display->display, s->output,
+			 GLX_BACK_BUFFER_AGE_EXT, &age);
+
+    if (!age || age - 1 > (unsigned int) s->damageHistoryCount)
+    {
+	s->bufferAgeFullFrames++;
+
+	return (mask & ~COMP_SCREEN_DAMAGE_REGION_MASK) |
+	    COMP_SCREEN_DAMAGE_ALL_MASK;
+    }
+
+    for (i = 0; i < (int) age - 1; i++)
+    {
+	index = (s->damageHistoryIndex + BUFFER_AGE_HISTORY - i) %
+	    BUFFER_AGE_HISTORY;
+
+	XUnionRegion (core.tmpRegion, s->damageHistory[index],
+		      core.tmpRegion);
+    }
+
+    *nRepair = age - 1;
+
+    s->bufferAgeFrames++;
+
+    return mask;
+}
+
+/* records what this frame changed once it has been painted, as
+   paintScreen may widen the damage to whole outputs. Damage pulled in
+   from older frames only brings the back buffer up to date and isn't
+   recorded again, frames that painted nothing aren't recorded at all */
+static void
+recordBufferAge (CompScreen   *s,
+		 unsigned int mask,
+		 int	      nRepair)
+{
+    Region damage;
+    int	   i, index;
+
+    if (!(mask & (COMP_SCREEN_DAMAGE_REGION_MASK |
+		  COMP_SCREEN_DAMAGE_ALL_MASK)))
+	return;
+
+    index  = (s->damageHistoryIndex + 1) % BUFFER_AGE_HISTORY;
+    damage = s->damageHistory[index];
+
+    if (mask & COMP_SCREEN_DAMAGE_ALL_MASK)
+    {
+	XUnionRegion (&emptyRegion, &s->region, damage);
+    }
+    else
+    {
+	/* core.outputRegion is only used while paintScreen runs */
+	XUnionRegion (&emptyRegion, damage, core.outputRegion);
+
+	for (i = 0; i < nRepair; i++)
+	    XUnionRegion (core.outputRegion,
+			  s->damageHistory[(s->damageHistoryIndex +
+					    BUFFER_AGE_HISTORY - i) %
+					   BUFFER_AGE_HISTORY],
+			  core.outputRegion);
+
+	XSubtractRegion (core.tmpRegion, core.outputRegion,
+			 core.outputRegion);
+	XUnionRegion (damage, core.outputRegion, damage);
+    }
+
+    /* the slot after the newest entry holds the damage of the frame
+       being painted, so one slot is never part of the history */
+    s->damageHistoryIndex = index;
+    if (s->damageHistoryCount < BUFFER_AGE_HISTORY - 1)
+	s->damageHistoryCount++;
+}
+
+static void
+updateRepaintStats (CompScreen   *s,
+		    unsigned int mask)
+{
+    int area;
+
+    if (mask & COMP_SCREEN_DAMAGE_ALL_MASK)
+	area = s->width * s->height;
+    else
+	area = regionArea (core.tmpRegion);
+
+    s->repaintFrames++;
+    s->repaintArea += area;
+    if (area > s->maxRepaintArea)
+	s->maxRepaintArea = area;
+}
+
 void
 eventLoop (void)
 {
     XEvent	   event;
     int		   timeDiff;
-    struct timeval tv;
+    struct timeval tv, paintStart, paintEnd, swapEnd;
     CompDisplay    *d;
     CompScreen	   *s;
     CompWindow	   *w;
-    CompTimeout    *t;
     int		   time, timeToNextRedraw = 0;
     unsigned int   damageMask, mask;
+    Bool	   bufferAge;
+    int		   nRepair = 0;
 
     for (d = core.displays; d; d = d->next)
 	d->watchFdHandle =
@@ -1359,8 +1774,14 @@ eventLoop (void)
 
 		sn_display_process_event (d->snDisplay, &event);
 
+		if (deferPropertyNotify (d, &event))
+		    continue;
+
 		inHandleEvent = TRUE;
 
+		if (d->windowPropertiesPending)
+		    updatePendingPropertiesForEvent (d, &event);
+
 		(*d->handleEvent) (d, &event);
 
 		inHandleEvent = FALSE;
@@ -1368,6 +1789,14 @@ eventLoop (void)
 		lastPointerX = pointerX;
 		lastPointerY = pointerY;
 	    }
+
+	    /* once per iteration, after the queue has been drained */
+	    if (d->windowPropertiesPending)
+	    {
+		inHandleEvent = TRUE;
+		updatePendingWindowProperties (d);
+		inHandleEvent = FALSE;
+	    }
 	}
 
 	for (d = core.displays; d; d = d->next)
@@ -1397,11 +1826,11 @@ eventLoop (void)
 
 		if (!damageMask)
 		{
-		    gettimeofday (&tv, 0);
+		    compGetCurrentTime (&tv);
 		    damageMask |= s->damageMask;
 		}
 
-		s->timeLeft = getTimeToNextRedraw (s, &tv, &s->lastRedraw,
+		s->timeLeft = getTimeToNextRedraw (s, &tv, &s->lastSwap,
 						   s->idle);
 		if (s->timeLeft < timeToNextRedraw)
 		    timeToNextRedraw = s->timeLeft;
@@ -1416,9 +1845,9 @@ eventLoop (void)
 
 	    if (time == 0)
 	    {
-		gettimeofday (&tv, 0);
+		compGetCurrentTime (&tv);
 
-		if (core.timeouts)
+		if (core.nTimeout)
 		    handleTimeouts (&tv);
 
 		for (d = core.displays; d; d = d->next)
@@ -1438,6 +1867,13 @@ eventLoop (void)
 
 			makeScreenCurrent (s);
 
+			/* tv was taken before timeouts and any screens
+			   painted earlier in this pass, so it's no good
+			   for measuring this screen's paint time */
+			compGetCurrentTime (&paintStart);
+
+			beginPaintProfile (s);
+
 			if (s->slowAnimations)
 			{
 			    (*s->preparePaintScreen) (s,
@@ -1494,6 +1930,14 @@ eventLoop (void)
 			mask = s->damageMask;
 			s->damageMask = 0;
 
+			bufferAge = s->bufferAge &&
+			    s->opt[COMP_SCREEN_OPTION_BUFFER_AGE].value.b;
+
+			if (bufferAge)
+			    mask = repairBufferAge (s, mask, &nRepair);
+			else
+			    s->damageHistoryCount = 0;
+
 			if (s->clearBuffers)
 			{
 			    if (mask & COMP_SCREEN_DAMAGE_ALL_MASK)
@@ -1512,11 +1956,28 @@ eventLoop (void)
 			targetScreen = NULL;
 			targetOutput = &s->outputDev[0];
 
+			if (bufferAge)
+			    recordBufferAge (s, mask, nRepair);
+
+			updateRepaintStats (s, mask);
+
+			compGetCurrentTime (&paintEnd);
+
+			profileCore ("swapBuffers");
+
 			if (!noWait)
 			    waitForVideoSync (s);
 
-			if ((mask & COMP_SCREEN_DAMAGE_ALL_MASK) ||
-			    (alwaysSwap == TRUE))
+			if (bufferAge)
+			{
+			    /* the back buffer holds nothing new when only
+			       pending damage was set */
+			    if (mask & (COMP_SCREEN_DAMAGE_REGION_MASK |
+					COMP_SCREEN_DAMAGE_ALL_MASK))
+				glXSwapBuffers (d->display, s->output);
+			}
+			else if ((mask & COMP_SCREEN_DAMAGE_ALL_MASK) ||
+				 (alwaysSwap == TRUE))
 			{
 			    glXSwapBuffers (d->display, s->output);
 			}
@@ -1578,10 +2039,17 @@ eventLoop (void)
 			    }
 			}
 
+			compGetCurrentTime (&swapEnd);
+
+			updateFrameHistory (s, &paintStart, &paintEnd, &swapEnd,
+					    s->idle);
+
 			s->lastRedraw = tv;
 
 			(*s->donePaintScreen) (s);
 
+			endPaintProfile (s);
+
 			/* remove destroyed windows */
 			while (s->pendingDestroys)
 			{
@@ -1607,22 +2075,15 @@ eventLoop (void)
 	}
 	else
 	{
-	    if (core.timeouts)
+	    if (core.nTimeout)
 	    {
-		if (core.timeouts->minLeft > 0)
-		{
-		    t = core.timeouts;
-		    time = t->maxLeft;
-		    while (t && t->minLeft <= time)
-		    {
-			if (t->maxLeft < time)
-			    time = t->maxLeft;
-			t = t->next;
-		    }
+		compGetCurrentTime (&tv);
+
+		time = getTimeToNextTimeout (&tv);
+		if (time)
 		    doPoll (time);
-		}
 
-		gettimeofday (&tv, 0);
+		compGetCurrentTime (&tv);
 
 		handleTimeouts (&tv);
 	    }
@@ -1816,6 +2277,20 @@ addDisplay (const char *name)
 
     d->dirtyPluginList = TRUE;
 
+    d->windowPropertiesPending = FALSE;
+    d->pendingPropertyTime     = CurrentTime;
+    d->propertyEvents	       = 0;
+    d->propertyUpdates	       = 0;
+
+    d->prefetchedWindows = NULL;
+    d->nPrefetchedWindow = 0;
+    d->prefetchHash	 = NULL;
+    d->prefetchHashSize	 = 0;
+
+    d->imageCache	 = NULL;
+    d->imageCacheWatches = NULL;
+    d->imageCacheSize	 = 0;
+
     d->textureFilter = GL_LINEAR;
     d->below	     = None;
 
@@ -2401,6 +2876,8 @@ removeDisplay (CompDisplay *d)
     XSync (d->display, False);
     XCloseDisplay (d->display);
 
+    finiImageCache (d);
+
     freeDisplay (d);
 }
 
@@ -2730,9 +3207,16 @@ readImageFromFile (CompDisplay *display,
     Bool status;
     int  stride;
 
+    if (readCachedImage (display, name, width, height, data))
+	return TRUE;
+
     status = (*display->fileToImage) (display, NULL, name, width, height,
 				      &stride, data);
-    if (!status)
+    if (status)
+    {
+	cacheImage (display, NULL, name, *width, *height, *data);
+    }
+    else
     {
 	char *home;
 
@@ -2749,6 +3233,9 @@ readImageFromFile (CompDisplay *display,
 						  width, height, &stride,
 						  data);
 
+		if (status)
+		    cacheImage (display, path, name, *width, *height, *data);
+
 		free (path);
 
 		if (status)
@@ -2758,6 +3245,8 @@ readImageFromFile (CompDisplay *display,
 
 	status = (*display->fileToImage) (display, IMAGEDIR, name,
 					  width, height, &stride, data);
+	if (status)
+	    cacheImage (display, IMAGEDIR, name, *width, *height, *data);
     }
 
     return status;
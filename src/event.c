@@ -37,6 +37,261 @@
 static Window xdndWindow = None;
 static Window edgeWindow = None;
 
+/* properties that are only read by core are fetched once after the
+   event queue has been drained instead of once per PropertyNotify */
+#define PROPERTY_NORMAL_HINTS_MASK  (1 << 0)
+#define PROPERTY_WM_HINTS_MASK	    (1 << 1)
+#define PROPERTY_TRANSIENT_FOR_MASK (1 << 2)
+#define PROPERTY_CLIENT_LEADER_MASK (1 << 3)
+#define PROPERTY_ICON_GEOMETRY_MASK (1 << 4)
+#define PROPERTY_OPACITY_MASK	    (1 << 5)
+#define PROPERTY_BRIGHTNESS_MASK    (1 << 6)
+#define PROPERTY_SATURATION_MASK    (1 << 7)
+#define PROPERTY_STRUT_MASK	    (1 << 8)
+#define PROPERTY_PROTOCOLS_MASK	    (1 << 9)
+
+/* properties that plugins act on, for those the PropertyNotify event
+   itself is held back and handed out once through handleEvent */
+#define PROPERTY_WM_NAME_MASK	    (1 << 10)
+#define PROPERTY_NET_WM_NAME_MASK   (1 << 11)
+#define PROPERTY_ICON_MASK	    (1 << 12)
+#define PROPERTY_USER_TIME_MASK	    (1 << 13)
+
+#define PROPERTY_NOTIFY_MASK (PROPERTY_WM_NAME_MASK	| \
+			      PROPERTY_NET_WM_NAME_MASK | \
+			      PROPERTY_ICON_MASK	| \
+			      PROPERTY_USER_TIME_MASK)
+
+static void
+deferWindowPropertyUpdate (CompDisplay	*d,
+			   Window	id,
+			   unsigned int mask)
+{
+    CompWindow *w;
+
+    w = findWindowAtDisplay (d, id);
+    if (!w)
+	return;
+
+    w->pendingProperties |= mask;
+
+    d->windowPropertiesPending = TRUE;
+    d->propertyEvents++;
+}
+
+/* called by the event loop before an event is dispatched, returns
+   TRUE when the event has been held back */
+Bool
+deferPropertyNotify (CompDisplay *d,
+		     XEvent	 *event)
+{
+    unsigned int mask;
+
+    if (event->type != PropertyNotify)
+	return FALSE;
+
+    if (event->xproperty.atom == XA_WM_NAME)
+	mask = PROPERTY_WM_NAME_MASK;
+    else if (event->xproperty.atom == d->wmNameAtom)
+	mask = PROPERTY_NET_WM_NAME_MASK;
+    else if (event->xproperty.atom == d->wmIconAtom)
+	mask = PROPERTY_ICON_MASK;
+    else if (event->xproperty.atom == d->wmUserTimeAtom)
+	mask = PROPERTY_USER_TIME_MASK;
+    else
+	return FALSE;
+
+    /* events for windows core doesn't know about go through as is */
+    if (!findWindowAtDisplay (d, event->xproperty.window))
+	return FALSE;
+
+    deferWindowPropertyUpdate (d, event->xproperty.window, mask);
+
+    d->pendingPropertyTime = event->xproperty.time;
+
+    return TRUE;
+}
+
+static void
+notifyWindowProperty (CompWindow *w,
+		      Atom	 atom)
+{
+    CompDisplay *d = w->screen->display;
+    XEvent	event;
+
+    event.xproperty.type       = PropertyNotify;
+    event.xproperty.serial     = 0;
+    event.xproperty.send_event = FALSE;
+    event.xproperty.display    = d->display;
+    event.xproperty.window     = w->id;
+    event.xproperty.atom       = atom;
+    event.xproperty.time       = d->pendingPropertyTime;
+    event.xproperty.state      = PropertyNewValue;
+
+    (*d->handleEvent) (d, &event);
+}
+
+static void
+updateWindowProperties (CompWindow   *w,
+			unsigned int mask)
+{
+    CompDisplay *d = w->screen->display;
+    unsigned int bits;
+
+    for (bits = mask; bits; bits &= bits - 1)
+	d->propertyUpdates++;
+
+    if (mask & PROPERTY_NORMAL_HINTS_MASK)
+    {
+	updateNormalHints (w);
+	recalcWindowActions (w);
+    }
+
+    if (mask & PROPERTY_WM_HINTS_MASK)
+	updateWmHints (w);
+
+    if (mask & PROPERTY_TRANSIENT_FOR_MASK)
+    {
+	updateTransientHint (w);
+	recalcWindowActions (w);
+    }
+
+    if (mask & PROPERTY_CLIENT_LEADER_MASK)
+	w->clientLeader = getClientLeader (w);
+
+    if (mask & PROPERTY_ICON_GEOMETRY_MASK)
+	updateIconGeometry (w);
+
+    if ((mask & PROPERTY_OPACITY_MASK) &&
+	!(w->type & CompWindowTypeDesktopMask))
+    {
+	int opacity;
+
+	opacity = getWindowProp32 (d, w->id, d->winOpacityAtom, OPAQUE);
+	if (opacity != w->paint.opacity)
+	{
+	    w->paint.opacity = opacity;
+	    addWindowDamage (w);
+	}
+    }
+
+    if (mask & PROPERTY_BRIGHTNESS_MASK)
+    {
+	int brightness;
+
+	brightness = getWindowProp32 (d, w->id, d->winBrightnessAtom, BRIGHT);
+	if (brightness != w->paint.brightness)
+	{
+	    w->paint.brightness = brightness;
+	    addWindowDamage (w);
+	}
+    }
+
+    if ((mask & PROPERTY_SATURATION_MASK) && w->screen->canDoSaturated)
+    {
+	int saturation;
+
+	saturation = getWindowProp32 (d, w->id, d->winSaturationAtom, COLOR);
+	if (saturation != w->paint.saturation)
+	{
+	    w->paint.saturation = saturation;
+	    addWindowDamage (w);
+	}
+    }
+
+    if (mask & PROPERTY_STRUT_MASK)
+    {
+	if (updateWindowStruts (w))
+	    updateWorkareaForScreen (w->screen);
+    }
+
+    if (mask & PROPERTY_PROTOCOLS_MASK)
+	w->protocols = getProtocols (d, w->id);
+
+    /* plugins may restack or look up other windows from here on */
+    if (mask & PROPERTY_WM_NAME_MASK)
+	notifyWindowProperty (w, XA_WM_NAME);
+
+    if (mask & PROPERTY_NET_WM_NAME_MASK)
+	notifyWindowProperty (w, d->wmNameAtom);
+
+    if (mask & PROPERTY_ICON_MASK)
+	notifyWindowProperty (w, d->wmIconAtom);
+
+    if (mask & PROPERTY_USER_TIME_MASK)
+	notifyWindowProperty (w, d->wmUserTimeAtom);
+}
+
+void
+updatePendingWindowProperties (CompDisplay *d)
+{
+    CompScreen	 *s;
+    CompWindow	 *w;
+    unsigned int mask;
+
+    d->windowPropertiesPending = FALSE;
+
+    for (s = d->screens; s; s = s->next)
+    {
+	w = s->windows;
+	while (w)
+	{
+	    mask = w->pendingProperties;
+	    if (!mask)
+	    {
+		w = w->next;
+		continue;
+	    }
+
+	    w->pendingProperties = 0;
+
+	    updateWindowProperties (w, mask);
+
+	    /* handlers of the held back events may have restacked
+	       windows, start over as updated windows are skipped */
+	    if (mask & PROPERTY_NOTIFY_MASK)
+		w = s->windows;
+	    else
+		w = w->next;
+	}
+    }
+}
+
+/* requests from a client are handled with the hints it has set
+   before making them, so the properties of the window a request is
+   for are updated right away */
+void
+updatePendingPropertiesForEvent (CompDisplay *d,
+				 XEvent	     *event)
+{
+    CompWindow   *w;
+    unsigned int mask;
+    Window	 id;
+
+    switch (event->type) {
+    case MapRequest:
+	id = event->xmaprequest.window;
+	break;
+    case ConfigureRequest:
+	id = event->xconfigurerequest.window;
+	break;
+    case ClientMessage:
+	id = event->xclient.window;
+	break;
+    default:
+	return;
+    }
+
+    w = findWindowAtDisplay (d, id);
+    if (!w || !w->pendingProperties)
+	return;
+
+    mask = w->pendingProperties;
+    w->pendingProperties = 0;
+
+    updateWindowProperties (w, mask);
+}
+
 static void
 handleWindowDamageRect (CompWindow *w,
 			int	   x,
@@ -54,6 +309,8 @@ handleWindowDamageRect (CompWindow *w,
     {
 	w->damaged = initial = TRUE;
 	w->invisible = WINDOW_INVISIBLE (w);
+
+	invalidateScreenOcclusion (w->screen);
     }
 
     region.extents.x1 = x;
@@ -1508,86 +1765,43 @@ handleEvent (CompDisplay *d,
 	}
 	else if (event->xproperty.atom == XA_WM_NORMAL_HINTS)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w)
-	    {
-		updateNormalHints (w);
-		recalcWindowActions (w);
-	    }
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_NORMAL_HINTS_MASK);
 	}
 	else if (event->xproperty.atom == XA_WM_HINTS)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w)
-		updateWmHints (w);
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_WM_HINTS_MASK);
 	}
 	else if (event->xproperty.atom == XA_WM_TRANSIENT_FOR)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w)
-	    {
-		updateTransientHint (w);
-		recalcWindowActions (w);
-	    }
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_TRANSIENT_FOR_MASK);
 	}
 	else if (event->xproperty.atom == d->wmClientLeaderAtom)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w)
-		w->clientLeader = getClientLeader (w);
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_CLIENT_LEADER_MASK);
 	}
 	else if (event->xproperty.atom == d->wmIconGeometryAtom)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w)
-		updateIconGeometry (w);
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_ICON_GEOMETRY_MASK);
 	}
 	else if (event->xproperty.atom == d->winOpacityAtom)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w && !(w->type & CompWindowTypeDesktopMask))
-	    {
-		int opacity;
-
-		opacity = getWindowProp32 (d, w->id, d->winOpacityAtom, OPAQUE);
-		if (opacity != w->paint.opacity)
-		{
-		    w->paint.opacity = opacity;
-		    addWindowDamage (w);
-		}
-	    }
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_OPACITY_MASK);
 	}
 	else if (event->xproperty.atom == d->winBrightnessAtom)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w)
-	    {
-		int brightness;
-
-		brightness = getWindowProp32 (d, w->id,
-	     				      d->winBrightnessAtom, BRIGHT);
-		if (brightness != w->paint.brightness)
-		{
-		    w->paint.brightness = brightness;
-		    addWindowDamage (w);
-		}
-	    }
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_BRIGHTNESS_MASK);
 	}
 	else if (event->xproperty.atom == d->winSaturationAtom)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w && w->screen->canDoSaturated)
-	    {
-		int saturation;
-
-		saturation = getWindowProp32 (d, w->id,
-					      d->winSaturationAtom, COLOR);
-		if (saturation != w->paint.saturation)
-		{
-		    w->paint.saturation = saturation;
-		    addWindowDamage (w);
-		}
-	    }
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_SATURATION_MASK);
 	}
 	else if (event->xproperty.atom == d->xBackgroundAtom[0] ||
 		 event->xproperty.atom == d->xBackgroundAtom[1])
@@ -1608,12 +1822,8 @@ handleEvent (CompDisplay *d,
 	else if (event->xproperty.atom == d->wmStrutAtom ||
 		 event->xproperty.atom == d->wmStrutPartialAtom)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w)
-	    {
-		if (updateWindowStruts (w))
-		    updateWorkareaForScreen (w->screen);
-	    }
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_STRUT_MASK);
 	}
 	else if (event->xproperty.atom == d->mwmHintsAtom)
 	{
@@ -1627,9 +1837,8 @@ handleEvent (CompDisplay *d,
 	}
 	else if (event->xproperty.atom == d->wmProtocolsAtom)
 	{
-	    w = findWindowAtDisplay (d, event->xproperty.window);
-	    if (w)
-		w->protocols = getProtocols (d, w->id);
+	    deferWindowPropertyUpdate (d, event->xproperty.window,
+				       PROPERTY_PROTOCOLS_MASK);
 	}
 	else if (event->xproperty.atom == d->wmIconAtom)
 	{
@@ -25,8 +25,12 @@
 
 #include <compiz-core.h>
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #define COMP_FUNCTION_TYPE_ARB 0
 #define COMP_FUNCTION_TYPE_NUM 1
@@ -34,16 +38,45 @@
 #define COMP_FUNCTION_ARB_MASK (1 << 0)
 #define COMP_FUNCTION_MASK     (COMP_FUNCTION_ARB_MASK)
 
+/* maximum number of fragment programs kept around, the least recently
+   used one is released when more are needed */
+#define FRAGMENT_PROGRAM_CACHE_SIZE 64
+
+/* stored programs are compiled this many at a time, every
+   FRAGMENT_PROGRAM_PREWARM_DELAY ms */
+#define FRAGMENT_PROGRAM_PREWARM_BATCH 4
+#define FRAGMENT_PROGRAM_PREWARM_DELAY 50
+
+#define FRAGMENT_PROGRAM_CACHE_VERSION 1
+#define FRAGMENT_PROGRAM_CACHE_HEADER  "compiz fragment program cache"
+
 struct _CompProgram {
     struct _CompProgram *next;
+    struct _CompProgram *prev;
+    struct _CompProgram *hashNext;
 
-    int *signature;
-    int nSignature;
+    int		 *signature;
+    int		 nSignature;
+    unsigned int hash;
 
     Bool blending;
 
     GLuint name;
     GLenum type;
+
+    char *source;
+};
+
+/* program built by an earlier instance and read from the disk cache,
+   it's compiled as soon as all its functions exist */
+struct _CompStoredProgram {
+    struct _CompStoredProgram *next;
+
+    uint64_t *functionHash;
+    int	     nFunctionHash;
+
+    Bool blending;
+    char *source;
 };
 
 typedef enum {
@@ -117,6 +150,9 @@ struct _CompFunction {
     char	     *name;
     CompFunctionData data[COMP_FUNCTION_TYPE_NUM];
     int		     mask;
+
+    /* hash of the function data, stable across restarts */
+    uint64_t	     hash;
 };
 
 typedef struct _FetchInfo {
@@ -184,27 +220,209 @@ findFragmentFunctionWithName (CompScreen *s,
     return NULL;
 }
 
+static unsigned int
+hashFragmentSignature (int *signature,
+		       int nSignature)
+{
+    unsigned int hash = 2166136261U;
+    int		 i;
+
+    for (i = 0; i < nSignature; i++)
+    {
+	hash ^= (unsigned int) signature[i];
+	hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static void
+unlinkFragmentProgram (CompScreen  *s,
+		       CompProgram *program)
+{
+    if (program->prev)
+	program->prev->next = program->next;
+    else
+	s->fragmentPrograms = program->next;
+
+    if (program->next)
+	program->next->prev = program->prev;
+    else
+	s->lastFragmentProgram = program->prev;
+
+    program->next = program->prev = NULL;
+}
+
+static void
+linkFragmentProgram (CompScreen  *s,
+		     CompProgram *program)
+{
+    program->prev = NULL;
+    program->next = s->fragmentPrograms;
+
+    if (s->fragmentPrograms)
+	s->fragmentPrograms->prev = program;
+    else
+	s->lastFragmentProgram = program;
+
+    s->fragmentPrograms = program;
+}
+
+static void
+freeStoredProgram (CompStoredProgram *stored)
+{
+    free (stored->functionHash);
+    free (stored->source);
+    free (stored);
+}
+
+/* keeps the source of a program that is about to be released so that
+   it still ends up in the disk cache. Programs are released when they
+   are evicted or when one of their functions is destroyed, which
+   plugins do in finiScreen before core writes the cache */
+static void
+storeFragmentProgram (CompScreen  *s,
+		      CompProgram *program)
+{
+    CompStoredProgram *stored, **prev;
+    CompFunction      *function;
+    uint64_t	      hash[MAX_FRAGMENT_FUNCTIONS];
+    int		      i, n = 0;
+
+    if (!s->fragmentProgramDriver || !program->source ||
+	program->nSignature > MAX_FRAGMENT_FUNCTIONS)
+	return;
+
+    for (i = 0; i < program->nSignature; i++)
+    {
+	function = findFragmentFunction (s, program->signature[i]);
+	if (!function)
+	    return;
+
+	hash[i] = function->hash;
+    }
+
+    /* drop an older copy and whatever doesn't fit in the cache */
+    prev = &s->storedFragmentPrograms;
+    while ((stored = *prev))
+    {
+	if (n >= FRAGMENT_PROGRAM_CACHE_SIZE - 1	  ||
+	    (stored->nFunctionHash == program->nSignature &&
+	     !memcmp (stored->functionHash, hash,
+		      program->nSignature * sizeof (uint64_t))))
+	{
+	    *prev = stored->next;
+	    freeStoredProgram (stored);
+	    continue;
+	}
+
+	prev = &stored->next;
+	n++;
+    }
+
+    stored = calloc (1, sizeof (CompStoredProgram));
+    if (!stored)
+	return;
+
+    stored->functionHash = malloc (program->nSignature * sizeof (uint64_t));
+    if (!stored->functionHash)
+    {
+	free (stored);
+	return;
+    }
+
+    memcpy (stored->functionHash, hash,
+	    program->nSignature * sizeof (uint64_t));
+
+    stored->nFunctionHash = program->nSignature;
+    stored->blending	  = program->blending;
+    stored->source	  = program->source;
+
+    program->source = NULL;
+
+    stored->next = s->storedFragmentPrograms;
+    s->storedFragmentPrograms = stored;
+}
+
+static void
+removeFragmentProgram (CompScreen  *s,
+		       CompProgram *program)
+{
+    CompProgram **p;
+
+    p = &s->fragmentProgramHash[program->hash % FRAGMENT_PROGRAM_HASH_SIZE];
+    while (*p != program)
+	p = &(*p)->hashNext;
+
+    *p = program->hashNext;
+
+    unlinkFragmentProgram (s, program);
+
+    s->nFragmentProgram--;
+
+    storeFragmentProgram (s, program);
+
+    if (program->name)
+	(*s->deletePrograms) (1, &program->name);
+
+    if (program->source)
+	free (program->source);
+
+    free (program->signature);
+    free (program);
+}
+
+static void
+addFragmentProgram (CompScreen  *s,
+		    CompProgram *program)
+{
+    int i;
+
+    while (s->nFragmentProgram >= FRAGMENT_PROGRAM_CACHE_SIZE)
+    {
+	removeFragmentProgram (s, s->lastFragmentProgram);
+	s->fragmentProgramEvictions++;
+    }
+
+    i = program->hash % FRAGMENT_PROGRAM_HASH_SIZE;
+
+    program->hashNext	      = s->fragmentProgramHash[i];
+    s->fragmentProgramHash[i] = program;
+
+    linkFragmentProgram (s, program);
+
+    s->nFragmentProgram++;
+}
+
 static CompProgram *
 findFragmentProgram (CompScreen *s,
 		     int	*signature,
 		     int	nSignature)
 {
-    CompProgram *program;
-    int		i;
+    CompProgram  *program;
+    unsigned int hash;
+
+    hash = hashFragmentSignature (signature, nSignature);
 
-    for (program = s->fragmentPrograms; program; program = program->next)
+    for (program = s->fragmentProgramHash[hash % FRAGMENT_PROGRAM_HASH_SIZE];
+	 program;
+	 program = program->hashNext)
     {
-	if (nSignature != program->nSignature)
+	if (program->hash != hash || program->nSignature != nSignature)
 	    continue;
 
-	for (i = 0; i < nSignature; i++)
+	if (memcmp (program->signature, signature,
+		    nSignature * sizeof (int)) == 0)
 	{
-	    if (program->signature[i] != signature[i])
-		break;
-	}
+	    /* move to the front of the LRU list */
+	    if (program != s->fragmentPrograms)
+	    {
+		unlinkFragmentProgram (s, program);
+		linkFragmentProgram (s, program);
+	    }
 
-	if (i == nSignature)
 	    return program;
+	}
     }
 
     return NULL;
@@ -546,6 +764,35 @@ addData (CompDataOp *op,
     }
 }
 
+static void
+compileFragmentProgram (CompScreen  *s,
+			CompProgram *program)
+{
+    GLint errorPos;
+
+    program->type = GL_FRAGMENT_PROGRAM_ARB;
+
+    glGetError ();
+
+    (*s->genPrograms) (1, &program->name);
+    (*s->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, program->name);
+    (*s->programString) (GL_FRAGMENT_PROGRAM_ARB,
+			 GL_PROGRAM_FORMAT_ASCII_ARB,
+			 strlen (program->source), program->source);
+
+    glGetIntegerv (GL_PROGRAM_ERROR_POSITION_ARB, &errorPos);
+    if (glGetError () != GL_NO_ERROR || errorPos != -1)
+    {
+	compLogMessage ("core", CompLogLevelError,
+			"failed to load fragment program");
+
+	(*s->deletePrograms) (1, &program->name);
+
+	program->name = 0;
+	program->type = 0;
+    }
+}
+
 static CompProgram *
 buildFragmentProgram (CompScreen     *s,
 		      FragmentAttrib *attrib)
@@ -555,7 +802,6 @@ buildFragmentProgram (CompScreen     *s,
     int		 nFunctionList;
     int		 mask = COMP_FUNCTION_MASK;
     int		 type;
-    GLint	 errorPos;
     FetchInfo    info;
     int		 i;
 
@@ -613,6 +859,8 @@ buildFragmentProgram (CompScreen     *s,
 	program->signature[i] = attrib->function[i];
 
     program->nSignature = attrib->nFunction;
+    program->hash	= hashFragmentSignature (program->signature,
+						 program->nSignature);
 
     type = functionMaskToType (mask);
 
@@ -626,32 +874,134 @@ buildFragmentProgram (CompScreen     *s,
     program->blending = forEachDataOp (functionList, nFunctionList, type,
 				       addData, (void *) &info);
 
-    program->type = GL_FRAGMENT_PROGRAM_ARB;
+    /* kept for the disk cache */
+    program->source = info.data;
 
-    glGetError ();
+    compileFragmentProgram (s, program);
 
-    (*s->genPrograms) (1, &program->name);
-    (*s->bindProgram) (GL_FRAGMENT_PROGRAM_ARB, program->name);
-    (*s->programString) (GL_FRAGMENT_PROGRAM_ARB,
-			 GL_PROGRAM_FORMAT_ASCII_ARB,
-			 strlen (info.data), info.data);
+    free (functionList);
 
-    glGetIntegerv (GL_PROGRAM_ERROR_POSITION_ARB, &errorPos);
-    if (glGetError () != GL_NO_ERROR || errorPos != -1)
+    return program;
+}
+
+static CompFunction *
+findFragmentFunctionWithHash (CompScreen *s,
+			      uint64_t	 hash)
+{
+    CompFunction *function;
+
+    for (function = s->fragmentFunctions; function; function = function->next)
     {
-	compLogMessage ("core", CompLogLevelError,
-			"failed to load fragment program");
+	if (function->hash == hash)
+	    return function;
+    }
 
-	(*s->deletePrograms) (1, &program->name);
+    return NULL;
+}
 
-	program->name = 0;
-	program->type = 0;
+/* compiles the stored programs that all functions now exist for, a
+   few at a time from a timeout so that no single frame pays for the
+   whole set. Programs are only added to free cache slots, live ones
+   are never evicted to make room */
+static Bool
+prewarmFragmentPrograms (void *closure)
+{
+    CompScreen	      *s = (CompScreen *) closure;
+    CompStoredProgram *stored, *pending, *kept = NULL, **keptLast = &kept;
+    CompFunction      *function;
+    CompProgram	      *program;
+    int		      *signature;
+    int		      i, n = 0;
+
+    /* walk a private list, nothing else may change it meanwhile */
+    pending = s->storedFragmentPrograms;
+    s->storedFragmentPrograms = NULL;
+
+    makeScreenCurrent (s);
+
+    while ((stored = pending))
+    {
+	if (n >= FRAGMENT_PROGRAM_PREWARM_BATCH ||
+	    s->nFragmentProgram >= FRAGMENT_PROGRAM_CACHE_SIZE)
+	    break;
+
+	pending = stored->next;
+	stored->next = NULL;
+
+	signature = malloc (stored->nFunctionHash * sizeof (int));
+	if (!signature)
+	{
+	    freeStoredProgram (stored);
+	    continue;
+	}
+
+	for (i = 0; i < stored->nFunctionHash; i++)
+	{
+	    function = findFragmentFunctionWithHash (s,
+						     stored->functionHash[i]);
+	    if (!function)
+		break;
+
+	    signature[i] = function->id;
+	}
+
+	/* some functions don't exist yet, try again once they do */
+	if (i < stored->nFunctionHash)
+	{
+	    free (signature);
+
+	    *keptLast = stored;
+	    keptLast  = &stored->next;
+	    continue;
+	}
+
+	if (findFragmentProgram (s, signature, stored->nFunctionHash))
+	{
+	    free (signature);
+	    freeStoredProgram (stored);
+	    continue;
+	}
+
+	program = malloc (sizeof (CompProgram));
+	if (!program)
+	{
+	    free (signature);
+	    freeStoredProgram (stored);
+	    continue;
+	}
+
+	program->signature  = signature;
+	program->nSignature = stored->nFunctionHash;
+	program->hash	    = hashFragmentSignature (signature,
+						     stored->nFunctionHash);
+	program->blending   = stored->blending;
+	program->source	    = stored->source;
+
+	stored->source = NULL;
+	freeStoredProgram (stored);
+
+	compileFragmentProgram (s, program);
+	addFragmentProgram (s, program);
+
+	n++;
     }
 
-    free (info.data);
-    free (functionList);
+    /* put back what is left, in the same order */
+    *keptLast = pending;
+    while (*keptLast)
+	keptLast = &(*keptLast)->next;
 
-    return program;
+    *keptLast = s->storedFragmentPrograms;
+    s->storedFragmentPrograms = kept;
+
+    /* a full batch means there may be more to compile */
+    if (n == FRAGMENT_PROGRAM_PREWARM_BATCH && pending &&
+	s->nFragmentProgram < FRAGMENT_PROGRAM_CACHE_SIZE)
+	return TRUE;
+
+    s->fragmentProgramPrewarmHandle = 0;
+
+    return FALSE;
 }
 
 static GLuint
@@ -666,14 +1016,31 @@ getFragmentProgram (CompScreen	   *s,
 	return 0;
 
     program = findFragmentProgram (s, attrib->function, attrib->nFunction);
-    if (!program)
+    if (program)
+    {
+	s->fragmentProgramHits++;
+    }
+    else
     {
+	struct timeval start, end;
+	int	       usec;
+
+	s->fragmentProgramMisses++;
+
+	compGetCurrentTime (&start);
+
 	program = buildFragmentProgram (s, attrib);
 	if (program)
-	{
-	    program->next = s->fragmentPrograms;
-	    s->fragmentPrograms = program;
-	}
+	    addFragmentProgram (s, program);
+
+	compGetCurrentTime (&end);
+
+	usec = (end.tv_sec - start.tv_sec) * 1000000 +
+	    (end.tv_usec - start.tv_usec);
+
+	s->fragmentProgramCompileTime += usec;
+	if (usec > s->fragmentProgramMaxCompileTime)
+	    s->fragmentProgramMaxCompileTime = usec;
     }
 
     if (program)
@@ -1137,6 +1504,83 @@ addBlendOpToFunctionData (CompFunctionData *data,
     return TRUE;
 }
 
+static uint64_t
+hashString (uint64_t   hash,
+	    const char *str)
+{
+    if (!str)
+	return hash * 1099511628211ULL;
+
+    while (*str)
+    {
+	hash ^= (unsigned char) *str++;
+	hash *= 1099511628211ULL;
+    }
+
+    /* separator */
+    hash ^= 0xff;
+    hash *= 1099511628211ULL;
+
+    return hash;
+}
+
+/* the hash is computed before the data is prefixed with the function
+   name so that identical functions hash the same across restarts */
+static uint64_t
+hashFunctionData (const CompFunctionData *data)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    char     type[16];
+    int	     i, j;
+
+    for (i = 0; i < data->nHeader; i++)
+    {
+	snprintf (type, sizeof (type), "%d", data->header[i].type);
+	hash = hashString (hash, type);
+	hash = hashString (hash, data->header[i].name);
+    }
+
+    for (i = 0; i < data->nBody; i++)
+    {
+	const CompBodyOp *op = &data->body[i];
+
+	snprintf (type, sizeof (type), "%d", op->type);
+	hash = hashString (hash, type);
+
+	switch (op->type) {
+	case CompOpTypeFetch:
+	    snprintf (type, sizeof (type), "%d", op->fetch.target);
+	    hash = hashString (hash, type);
+	    hash = hashString (hash, op->fetch.dst);
+	    hash = hashString (hash, op->fetch.offset);
+	    break;
+	case CompOpTypeLoad:
+	    for (j = 0; j < COMP_FETCH_TARGET_NUM; j++)
+	    {
+		hash = hashString (hash, op->load.noOffset[j]);
+		hash = hashString (hash, op->load.offset[j]);
+	    }
+	    break;
+	case CompOpTypeHeaderTemp:
+	case CompOpTypeHeaderParam:
+	case CompOpTypeHeaderAttrib:
+	    break;
+	case CompOpTypeData:
+	case CompOpTypeDataBlend:
+	case CompOpTypeDataStore:
+	case CompOpTypeDataOffset:
+	    hash = hashString (hash, op->data.data);
+	    break;
+	case CompOpTypeColor:
+	    hash = hashString (hash, op->color.dst);
+	    hash = hashString (hash, op->color.src);
+	    break;
+	}
+    }
+
+    return hash;
+}
+
 static int
 allocFunctionId (CompScreen *s)
 {
@@ -1189,6 +1633,7 @@ createFragmentFunction (CompScreen	 *s,
     function->name = strdup (validName);
     function->mask = COMP_FUNCTION_ARB_MASK;
     function->id   = allocFunctionId (s);
+    function->hash = hashFunctionData (data);
 
     function->next = s->fragmentFunctions;
     s->fragmentFunctions = function;
@@ -1196,6 +1641,12 @@ createFragmentFunction (CompScreen	 *s,
     if (nameBuffer)
 	free (nameBuffer);
 
+    if (s->storedFragmentPrograms && !s->fragmentProgramPrewarmHandle)
+	s->fragmentProgramPrewarmHandle =
+	    compAddTimeout (FRAGMENT_PROGRAM_PREWARM_DELAY,
+			    FRAGMENT_PROGRAM_PREWARM_DELAY * 2,
+			    prewarmFragmentPrograms, s);
+
     return function->id;
 }
 
@@ -1204,7 +1655,7 @@ destroyFragmentFunction (CompScreen *s,
 			 int	    id)
 {
     CompFunction *function, *prevFunction = NULL;
-    CompProgram  *program, *prevProgram = NULL;
+    CompProgram  *program;
     int		 i;
 
     for (function = s->fragmentFunctions; function; function = function->next)
@@ -1221,6 +1672,8 @@ destroyFragmentFunction (CompScreen *s,
     program = s->fragmentPrograms;
     while (program)
     {
+	CompProgram *next = program->next;
+
 	for (i = 0; i < program->nSignature; i++)
 	{
 	    if (program->signature[i] == id)
@@ -1228,26 +1681,9 @@ destroyFragmentFunction (CompScreen *s,
 	}
 
 	if (i < program->nSignature)
-	{
-	    CompProgram *tmp = program;
-
-	    if (prevProgram)
-		prevProgram->next = program->next;
-	    else
-		s->fragmentPrograms = program->next;
+	    removeFragmentProgram (s, program);
 
-	    program = program->next;
-
-	    (*s->deletePrograms) (1, &tmp->name);
-
-	    free (tmp->signature);
-	    free (tmp);
-	}
-	else
-	{
-	    prevProgram = program;
-	    program = program->next;
-	}
+	program = next;
     }
 
     if (prevFunction)
@@ -1400,3 +1836,303 @@ disableFragmentAttrib (CompScreen     *s,
 {
     glDisable (GL_FRAGMENT_PROGRAM_ARB);
 }
+
+#define HOME_CACHEDIR ".compiz/cache"
+
+/* path of the disk cache for a screen, created if create is TRUE */
+static char *
+getFragmentProgramCachePath (CompScreen *s,
+			     Bool	create)
+{
+    char *home, *path;
+
+    home = getenv ("HOME");
+    if (!home)
+	return NULL;
+
+    path = malloc (strlen (home) + strlen (HOME_CACHEDIR) + 64);
+    if (!path)
+	return NULL;
+
+    if (create)
+    {
+	sprintf (path, "%s/.compiz", home);
+	mkdir (path, 0700);
+
+	sprintf (path, "%s/%s", home, HOME_CACHEDIR);
+	mkdir (path, 0700);
+    }
+
+    sprintf (path, "%s/%s/fragment-programs.%d", home, HOME_CACHEDIR,
+	     s->screenNum);
+
+    return path;
+}
+
+static char *
+getFragmentProgramDriver (void)
+{
+    const char *vendor, *renderer, *version;
+    char       *driver, *c;
+
+    vendor   = (const char *) glGetString (GL_VENDOR);
+    renderer = (const char *) glGetString (GL_RENDERER);
+    version  = (const char *) glGetString (GL_VERSION);
+
+    if (!vendor || !renderer || !version)
+	return NULL;
+
+    driver = malloc (strlen (vendor) + strlen (renderer) +
+		     strlen (version) + 3);
+    if (!driver)
+	return NULL;
+
+    sprintf (driver, "%s;%s;%s", vendor, renderer, version);
+
+    /* keep it on one line */
+    for (c = driver; *c; c++)
+	if (*c == '\n')
+	    *c = ' ';
+
+    return driver;
+}
+
+static CompStoredProgram *
+readStoredProgram (FILE *fp)
+{
+    CompStoredProgram  *stored;
+    unsigned long long hash;
+    int		       nFunction, blending, length, i;
+
+    if (fscanf (fp, "program %d %d %d\n", &nFunction, &blending, &length) != 3)
+	return NULL;
+
+    if (nFunction < 1 || nFunction > MAX_FRAGMENT_FUNCTIONS ||
+	length < 1 || length > 1024 * 1024)
+	return NULL;
+
+    stored = calloc (1, sizeof (CompStoredProgram));
+    if (!stored)
+	return NULL;
+
+    stored->functionHash = malloc (nFunction * sizeof (uint64_t));
+    stored->source	 = malloc (length + 1);
+    if (!stored->functionHash || !stored->source)
+    {
+	freeStoredProgram (stored);
+	return NULL;
+    }
+
+    for (i = 0; i < nFunction; i++)
+    {
+	if (fscanf (fp, "%llx", &hash) != 1)
+	{
+	    freeStoredProgram (stored);
+	    return NULL;
+	}
+
+	stored->functionHash[i] = hash;
+    }
+
+    if (fgetc (fp) != '\n'					     ||
+	fread (stored->source, 1, length, fp) != (size_t) length ||
+	fgetc (fp) != '\n')
+    {
+	freeStoredProgram (stored);
+	return NULL;
+    }
+
+    stored->source[length] = '\0';
+    stored->nFunctionHash  = nFunction;
+    stored->blending	   = blending;
+
+    return stored;
+}
+
+/* reads the programs built by earlier instances, they're only used if
+   they were built with the same driver and core ABI */
+void
+loadFragmentProgramCache (CompScreen *s)
+{
+    CompStoredProgram *stored, **last = &s->storedFragmentPrograms;
+    char	      line[1024], *path, *driver;
+    FILE	      *fp;
+    int		      version, abi, n = 0;
+
+    if (!s->fragmentProgram)
+	return;
+
+    driver = getFragmentProgramDriver ();
+    if (!driver)
+	return;
+
+    s->fragmentProgramDriver = driver;
+
+    path = getFragmentProgramCachePath (s, FALSE);
+    if (!path)
+	return;
+
+    fp = fopen (path, "r");
+    free (path);
+
+    if (!fp)
+	return;
+
+    if (fscanf (fp, FRAGMENT_PROGRAM_CACHE_HEADER " %d\n", &version) != 1 ||
+	version != FRAGMENT_PROGRAM_CACHE_VERSION			  ||
+	fscanf (fp, "abi %d\n", &abi) != 1				  ||
+	abi != CORE_ABIVERSION						  ||
+	!fgets (line, sizeof (line), fp)				  ||
+	strncmp (line, "driver ", 7) != 0				  ||
+	strncmp (line + 7, driver, strlen (driver)) != 0		  ||
+	line[7 + strlen (driver)] != '\n')
+    {
+	fclose (fp);
+	return;
+    }
+
+    while (n < FRAGMENT_PROGRAM_CACHE_SIZE && (stored = readStoredProgram (fp)))
+    {
+	*last = stored;
+	last  = &stored->next;
+	n++;
+    }
+
+    fclose (fp);
+}
+
+static Bool
+writeFragmentProgram (FILE	*fp,
+		      uint64_t	*hash,
+		      int	nHash,
+		      Bool	blending,
+		      const char *source)
+{
+    int i;
+
+    fprintf (fp, "program %d %d %d\n", nHash, blending ? 1 : 0,
+	     (int) strlen (source));
+
+    for (i = 0; i < nHash; i++)
+	fprintf (fp, "%s%llx", i ? " " : "", (unsigned long long) hash[i]);
+
+    fprintf (fp, "\n%s\n", source);
+
+    return !ferror (fp);
+}
+
+static void
+saveFragmentProgramCache (CompScreen *s)
+{
+    CompStoredProgram *stored;
+    CompProgram	      *program;
+    CompFunction      *function;
+    uint64_t	      hash[MAX_FRAGMENT_FUNCTIONS];
+    char	      *path, *tmpPath;
+    FILE	      *fp;
+    Bool	      status = TRUE;
+    int		      i, n = 0;
+
+    path = getFragmentProgramCachePath (s, TRUE);
+    if (!path)
+	return;
+
+    tmpPath = malloc (strlen (path) + 5);
+    if (!tmpPath)
+    {
+	free (path);
+	return;
+    }
+
+    sprintf (tmpPath, "%s.tmp", path);
+
+    fp = fopen (tmpPath, "w");
+    if (!fp)
+    {
+	free (tmpPath);
+	free (path);
+	return;
+    }
+
+    fprintf (fp, FRAGMENT_PROGRAM_CACHE_HEADER " %d\n",
+	     FRAGMENT_PROGRAM_CACHE_VERSION);
+    fprintf (fp, "abi %d\n", CORE_ABIVERSION);
+    fprintf (fp, "driver %s\n", s->fragmentProgramDriver);
+
+    /* most recently used programs first */
+    for (program = s->fragmentPrograms; program && status;
+	 program = program->next)
+    {
+	if (!program->name || !program->source ||
+	    program->nSignature > MAX_FRAGMENT_FUNCTIONS)
+	    continue;
+
+	for (i = 0; i < program->nSignature; i++)
+	{
+	    function = findFragmentFunction (s, program->signature[i]);
+	    if (!function)
+		break;
+
+	    hash[i] = function->hash;
+	}
+
+	if (i < program->nSignature)
+	    continue;
+
+	status = writeFragmentProgram (fp, hash, program->nSignature,
+				       program->blending, program->source);
+	n++;
+    }
+
+    /* programs of earlier instances that weren't needed this time */
+    for (stored = s->storedFragmentPrograms;
+	 stored && status && n < FRAGMENT_PROGRAM_CACHE_SIZE;
+	 stored = stored->next)
+    {
+	status = writeFragmentProgram (fp, stored->functionHash,
+				       stored->nFunctionHash,
+				       stored->blending, stored->source);
+	n++;
+    }
+
+    if (fclose (fp) != 0)
+	status = FALSE;
+
+    if (status)
+	rename (tmpPath, path);
+    else
+	unlink (tmpPath);
+
+    free (tmpPath);
+    free (path);
+}
+
+/* writes the disk cache and releases all fragment programs */
+void
+finiFragmentPrograms (CompScreen *s)
+{
+    CompStoredProgram *stored;
+
+    if (s->fragmentProgramPrewarmHandle)
+    {
+	compRemoveTimeout (s->fragmentProgramPrewarmHandle);
+	s->fragmentProgramPrewarmHandle = 0;
+    }
+
+    if (s->fragmentProgramDriver)
+    {
+	saveFragmentProgramCache (s);
+
+	free (s->fragmentProgramDriver);
+	s->fragmentProgramDriver = NULL;
+    }
+
+    while (s->fragmentPrograms)
+	removeFragmentProgram (s, s->fragmentPrograms);
+
+    while ((stored = s->storedFragmentPrograms))
+    {
+	s->storedFragmentPrograms = stored->next;
+	freeStoredProgram (stored);
+    }
+}
@@ -0,0 +1,376 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "../config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <compiz-core.h>
+
+/*
+ * Decoded images are kept by the name they were requested with so that
+ * plugin reloads and option changes don't decode the same cube caps,
+ * backgrounds and icons again. An entry is dropped when the file it was
+ * read from changes size or modification time, or when a file watch
+ * reports a change in its directory. Entries in the same directory
+ * share one watch, as the watch plugin only keeps one per path.
+ */
+
+struct _CompImageCacheWatch {
+    struct _CompImageCacheWatch *next;
+
+    CompDisplay		*display;
+    char		*path;
+    int			refCount;
+    CompFileWatchHandle handle;
+};
+
+struct _CompImageCacheEntry {
+    struct _CompImageCacheEntry *next;
+
+    char   *name;
+    char   *file;
+    time_t mtime;
+    off_t  size;
+    Bool   valid;
+
+    int	 width;
+    int	 height;
+    void *data;
+
+    CompImageCacheWatch *watch;
+};
+
+static int
+imageCacheEntrySize (CompImageCacheEntry *entry)
+{
+    return entry->width * entry->height * 4;
+}
+
+static int
+imageCacheMaxSize (CompDisplay *d)
+{
+    return d->opt[COMP_DISPLAY_OPTION_IMAGE_CACHE_SIZE].value.i << 20;
+}
+
+static void
+imageCacheFileChanged (const char *name,
+		       void	  *closure)
+{
+    CompImageCacheWatch *watch = (CompImageCacheWatch *) closure;
+    CompImageCacheEntry *entry;
+    const char		*base;
+
+    for (entry = watch->display->imageCache; entry; entry = entry->next)
+    {
+	if (entry->watch != watch)
+	    continue;
+
+	base = strrchr (entry->file, '/');
+	base = base ? base + 1 : entry->file;
+
+	/* image plugins may have added an extension to the name, entries
+	   are freed on the next lookup as the watch list is being walked */
+	if (!name || strncmp (name, base, strlen (base)) == 0)
+	    entry->valid = FALSE;
+    }
+}
+
+static CompImageCacheWatch *
+getImageCacheWatch (CompDisplay *d,
+		    const char	*path)
+{
+    CompImageCacheWatch *watch;
+
+    for (watch = d->imageCacheWatches; watch; watch = watch->next)
+    {
+	if (strcmp (watch->path, path) == 0)
+	{
+	    watch->refCount++;
+	    return watch;
+	}
+    }
+
+    watch = malloc (sizeof (CompImageCacheWatch));
+    if (!watch)
+	return NULL;
+
+    watch->path = strdup (path);
+    if (!watch->path)
+    {
+	free (watch);
+	return NULL;
+    }
+
+    watch->display  = d;
+    watch->refCount = 1;
+    watch->handle   = addFileWatch (path,
+				    NOTIFY_CREATE_MASK |
+				    NOTIFY_DELETE_MASK |
+				    NOTIFY_MOVE_MASK   |
+				    NOTIFY_MODIFY_MASK,
+				    imageCacheFileChanged,
+				    (void *) watch);
+
+    watch->next = d->imageCacheWatches;
+    d->imageCacheWatches = watch;
+
+    return watch;
+}
+
+static void
+releaseImageCacheWatch (CompDisplay	    *d,
+			CompImageCacheWatch *watch)
+{
+    CompImageCacheWatch **w;
+
+    if (--watch->refCount)
+	return;
+
+    for (w = &d->imageCacheWatches; *w; w = &(*w)->next)
+    {
+	if (*w == watch)
+	{
+	    *w = watch->next;
+	    break;
+	}
+    }
+
+    if (watch->handle)
+	removeFileWatch (watch->handle);
+
+    free (watch->path);
+    free (watch);
+}
+
+static void
+freeImageCacheEntry (CompDisplay	 *d,
+		     CompImageCacheEntry *entry)
+{
+    d->imageCacheSize -= imageCacheEntrySize (entry);
+
+    if (entry->watch)
+	releaseImageCacheWatch (d, entry->watch);
+
+    free (entry->name);
+    free (entry->file);
+    free (entry->data);
+    free (entry);
+}
+
+/* evicts least recently used entries */
+static void
+trimImageCache (CompDisplay *d,
+		int	    maxSize)
+{
+    CompImageCacheEntry *entry, *prev;
+
+    while (d->imageCache && d->imageCacheSize > maxSize)
+    {
+	prev = NULL;
+	for (entry = d->imageCache; entry->next; entry = entry->next)
+	    prev = entry;
+
+	if (prev)
+	    prev->next = NULL;
+	else
+	    d->imageCache = NULL;
+
+	freeImageCacheEntry (d, entry);
+    }
+}
+
+static char *
+imageCacheFileName (const char *path,
+		    const char *name)
+{
+    char *file;
+
+    if (!path)
+	return strdup (name);
+
+    file = malloc (strlen (path) + strlen (name) + 2);
+    if (file)
+	sprintf (file, "%s/%s", path, name);
+
+    return file;
+}
+
+Bool
+readCachedImage (CompDisplay *d,
+		 const char  *name,
+		 int	     *width,
+		 int	     *height,
+		 void	     **data)
+{
+    CompImageCacheEntry *entry, *prev = NULL;
+    struct stat		st;
+
+    /* the cache size may have been lowered since the last insertion */
+    trimImageCache (d, imageCacheMaxSize (d));
+
+    for (entry = d->imageCache; entry; entry = entry->next)
+    {
+	if (strcmp (entry->name, name) == 0)
+	    break;
+
+	prev = entry;
+    }
+
+    if (!entry)
+	return FALSE;
+
+    /* files that can't be stat'ed under the requested name, like ones
+       an image plugin added an extension to, rely on the file watch */
+    if (entry->valid && stat (entry->file, &st) == 0)
+    {
+	if (st.st_mtime != entry->mtime || st.st_size != entry->size)
+	    entry->valid = FALSE;
+    }
+
+    if (prev)
+	prev->next = entry->next;
+    else
+	d->imageCache = entry->next;
+
+    if (!entry->valid)
+    {
+	freeImageCacheEntry (d, entry);
+	return FALSE;
+    }
+
+    /* most recently used first */
+    entry->next = d->imageCache;
+    d->imageCache = entry;
+
+    *data = malloc (imageCacheEntrySize (entry));
+    if (!*data)
+	return FALSE;
+
+    memcpy (*data, entry->data, imageCacheEntrySize (entry));
+
+    *width  = entry->width;
+    *height = entry->height;
+
+    return TRUE;
+}
+
+void
+cacheImage (CompDisplay *d,
+	    const char	*path,
+	    const char	*name,
+	    int		width,
+	    int		height,
+	    const void	*data)
+{
+    CompImageCacheEntry *entry;
+    struct stat		st;
+    char		*dir, *base;
+    int			size = width * height * 4;
+    int			maxSize = imageCacheMaxSize (d);
+
+    /* a single image may take all of the cache, backgrounds at 4K are
+       about 32 MiB */
+    if (size <= 0 || size > maxSize)
+	return;
+
+    entry = malloc (sizeof (CompImageCacheEntry));
+    if (!entry)
+	return;
+
+    entry->name = strdup (name);
+    entry->file = imageCacheFileName (path, name);
+    entry->data = malloc (size);
+    if (!entry->name || !entry->file || !entry->data)
+    {
+	free (entry->name);
+	free (entry->file);
+	free (entry->data);
+	free (entry);
+	return;
+    }
+
+    memcpy (entry->data, data, size);
+
+    entry->width  = width;
+    entry->height = height;
+    entry->valid  = TRUE;
+    entry->mtime  = 0;
+    entry->size   = 0;
+
+    if (stat (entry->file, &st) == 0)
+    {
+	entry->mtime = st.st_mtime;
+	entry->size  = st.st_size;
+    }
+
+    entry->watch = NULL;
+
+    dir = strdup (entry->file);
+    if (dir)
+    {
+	base = strrchr (dir, '/');
+	if (base)
+	{
+	    if (base == dir)
+		base++;
+
+	    *base = '\0';
+	}
+	else
+	{
+	    strcpy (dir, ".");
+	}
+
+	entry->watch = getImageCacheWatch (d, dir);
+
+	free (dir);
+    }
+
+    /* make room before adding the entry so that it isn't evicted */
+    trimImageCache (d, maxSize - size);
+
+    entry->next = d->imageCache;
+    d->imageCache = entry;
+
+    d->imageCacheSize += size;
+}
+
+void
+finiImageCache (CompDisplay *d)
+{
+    CompImageCacheEntry *entry;
+
+    while (d->imageCache)
+    {
+	entry = d->imageCache;
+	d->imageCache = entry->next;
+
+	freeImageCacheEntry (d, entry);
+    }
+}
@@ -28,6 +28,23 @@
 
 #include <compiz-core.h>
 
+typedef enum {
+    CompMatchCodeEval,
+    CompMatchCodeEvalNot,
+    CompMatchCodeNot,
+    CompMatchCodeFalse,
+    CompMatchCodeJumpIfFalse,
+    CompMatchCodeJumpIfTrue
+} CompMatchCode;
+
+struct _CompMatchInstruction {
+    CompMatchCode code;
+    int		  target;
+    CompMatchExp  *exp;
+};
+
+static unsigned int lastMatchId = 0;
+
 static void
 matchResetOps (CompDisplay *display,
 	       CompMatchOp *op,
@@ -46,8 +63,9 @@ matchResetOps (CompDisplay *display,
 		op->exp.e.fini = NULL;
 	    }
 
-	    op->exp.e.eval     = NULL;
-	    op->exp.e.priv.val = 0;
+	    op->exp.e.eval	 = NULL;
+	    op->exp.e.priv.val	 = 0;
+	    op->exp.e.properties = 0;
 	    break;
 	}
 
@@ -61,15 +79,25 @@ matchReset (CompMatch *match)
     if (match->display)
 	matchResetOps (match->display, match->op, match->nOp);
 
-    match->display = NULL;
+    if (match->code)
+	free (match->code);
+
+    match->display    = NULL;
+    match->code	      = NULL;
+    match->nCode      = 0;
+    match->properties = 0;
 }
 
 void
 matchInit (CompMatch *match)
 {
-    match->display = NULL;
-    match->op	   = NULL;
-    match->nOp	    = 0;
+    match->display    = NULL;
+    match->op	      = NULL;
+    match->nOp	      = 0;
+    match->code	      = NULL;
+    match->nCode      = 0;
+    match->id	      = 0;
+    match->properties = 0;
 }
 
 static void
@@ -157,6 +185,14 @@ matchAddOp (CompMatch	    *match,
     if (!match->nOp)
 	flags &= ~MATCH_OP_AND_MASK;
 
+    /* compiled code points into the op array that is about to move */
+    if (match->code)
+    {
+	free (match->code);
+	match->code  = NULL;
+	match->nCode = 0;
+    }
+
     op = realloc (match->op, sizeof (CompMatchOp) * (match->nOp + 1));
     if (!op)
 	return FALSE;
@@ -240,8 +276,12 @@ matchCopy (CompMatch *dst,
 	return FALSE;
     }
 
-    dst->op  = opDst;
-    dst->nOp = src->nOp;
+    dst->op	    = opDst;
+    dst->nOp	    = src->nOp;
+    dst->code	    = NULL;
+    dst->nCode	    = 0;
+    dst->id	    = 0;
+    dst->properties = 0;
 
     return TRUE;
 }
@@ -296,10 +336,11 @@ matchAddExp (CompMatch  *match,
 	return FALSE;
     }
 
-    op->exp.value      = value;
-    op->exp.e.fini     = NULL;
-    op->exp.e.eval     = NULL;
-    op->exp.e.priv.val = 0;
+    op->exp.value	 = value;
+    op->exp.e.fini	 = NULL;
+    op->exp.e.eval	 = NULL;
+    op->exp.e.priv.val	 = 0;
+    op->exp.e.properties = 0;
 
     return TRUE;
 }
@@ -563,6 +604,7 @@ matchUpdateOps (CompDisplay *display,
 	    matchUpdateOps (display, op->group.op, op->group.nOp);
 	    break;
 	case CompMatchOpTypeExp:
+	    op->exp.e.properties = 0;
 	    (*display->matchInitExp) (display, &op->exp.e, op->exp.value);
 	    break;
 	}
@@ -571,12 +613,173 @@ matchUpdateOps (CompDisplay *display,
     }
 }
 
+/* number of instructions needed for a group, not including the
+   NOT that negates it */
+static int
+matchCountCode (CompMatchOp *op,
+		int	    nOp)
+{
+    int i, count = 0;
+
+    if (!nOp)
+	return 1;
+
+    for (i = 0; i < nOp; i++)
+    {
+	if (i)
+	    count++;
+
+	switch (op[i].type) {
+	case CompMatchOpTypeGroup:
+	    count += matchCountCode (op[i].group.op, op[i].group.nOp);
+	    if (op[i].any.flags & MATCH_OP_NOT_MASK)
+		count++;
+	    break;
+	case CompMatchOpTypeExp:
+	    count++;
+	    break;
+	}
+    }
+
+    return count;
+}
+
+/*
+  Flatten a group into a sequence of instructions working on a single
+  result register. Every op but the first is preceded by a jump to the
+  end of the group, taken when the result can no longer change; this
+  is the same short-circuit evaluation matchEvalOps performs.
+*/
+static int
+matchCompileOps (CompMatchInstruction *code,
+		 int		      pc,
+		 CompMatchOp	      *op,
+		 int		      nOp,
+		 unsigned int	      *properties,
+		 Bool		      *cacheable)
+{
+    int i, end;
+
+    if (!nOp)
+    {
+	code[pc].code = CompMatchCodeFalse;
+	code[pc].exp  = NULL;
+
+	return pc + 1;
+    }
+
+    end = pc + matchCountCode (op, nOp);
+
+    for (i = 0; i < nOp; i++)
+    {
+	if (i)
+	{
+	    if (op[i].any.flags & MATCH_OP_AND_MASK)
+		code[pc].code = CompMatchCodeJumpIfFalse;
+	    else
+		code[pc].code = CompMatchCodeJumpIfTrue;
+
+	    code[pc].target = end;
+	    code[pc].exp    = NULL;
+	    pc++;
+	}
+
+	switch (op[i].type) {
+	case CompMatchOpTypeGroup:
+	    pc = matchCompileOps (code, pc, op[i].group.op, op[i].group.nOp,
+				  properties, cacheable);
+	    if (op[i].any.flags & MATCH_OP_NOT_MASK)
+	    {
+		code[pc].code = CompMatchCodeNot;
+		code[pc].exp  = NULL;
+		pc++;
+	    }
+	    break;
+	case CompMatchOpTypeExp:
+	    if (op[i].any.flags & MATCH_OP_NOT_MASK)
+		code[pc].code = CompMatchCodeEvalNot;
+	    else
+		code[pc].code = CompMatchCodeEval;
+
+	    code[pc].exp = &op[i].exp.e;
+	    pc++;
+
+	    if (op[i].exp.e.properties)
+		*properties |= op[i].exp.e.properties;
+	    else
+		*cacheable = FALSE;
+	    break;
+	}
+    }
+
+    return pc;
+}
+
+/* a jump landing on another jump can go straight to where that one
+   leads, as the result register is known when it is taken */
+static void
+matchThreadJumps (CompMatchInstruction *code,
+		  int		       nCode)
+{
+    int i, target;
+
+    for (i = 0; i < nCode; i++)
+    {
+	if (code[i].code != CompMatchCodeJumpIfFalse &&
+	    code[i].code != CompMatchCodeJumpIfTrue)
+	    continue;
+
+	for (;;)
+	{
+	    target = code[i].target;
+	    if (target >= nCode)
+		break;
+
+	    if (code[target].code == code[i].code)
+		code[i].target = code[target].target;
+	    else if (code[target].code == CompMatchCodeJumpIfFalse ||
+		     code[target].code == CompMatchCodeJumpIfTrue)
+		code[i].target = target + 1;
+	    else
+		break;
+	}
+    }
+}
+
+static void
+matchCompile (CompMatch *match)
+{
+    CompMatchInstruction *code;
+    unsigned int	 properties = 0;
+    Bool		 cacheable = TRUE;
+    int			 nCode;
+
+    nCode = matchCountCode (match->op, match->nOp);
+
+    code = malloc (sizeof (CompMatchInstruction) * nCode);
+    if (!code)
+	return;
+
+    matchCompileOps (code, 0, match->op, match->nOp, &properties, &cacheable);
+    matchThreadJumps (code, nCode);
+
+    /* zero is reserved for empty cache entries */
+    if (!++lastMatchId)
+	lastMatchId++;
+
+    match->code	      = code;
+    match->nCode      = nCode;
+    match->id	      = lastMatchId;
+    match->properties = cacheable ? properties : 0;
+}
+
 void
 matchUpdate (CompDisplay *display,
 	     CompMatch   *match)
 {
     matchReset (match);
     matchUpdateOps (display, match->op, match->nOp);
+    matchCompile (match);
     match->display = display;
 }
 
@@ -628,14 +831,123 @@ matchEvalOps (CompDisplay *display,
     return result;
 }
 
+static Bool
+matchRunCode (CompDisplay	   *display,
+	      CompMatchInstruction *code,
+	      int		   nCode,
+	      CompWindow	   *window)
+{
+    Bool value = FALSE;
+    int  pc = 0;
+
+    while (pc < nCode)
+    {
+	CompMatchInstruction *insn = &code[pc++];
+
+	switch (insn->code) {
+	case CompMatchCodeEval:
+	    value = (*insn->exp->eval) (display, window, insn->exp->priv);
+	    break;
+	case CompMatchCodeEvalNot:
+	    value = !(*insn->exp->eval) (display, window, insn->exp->priv);
+	    break;
+	case CompMatchCodeNot:
+	    value = !value;
+	    break;
+	case CompMatchCodeFalse:
+	    value = FALSE;
+	    break;
+	case CompMatchCodeJumpIfFalse:
+	    if (!value)
+		pc = insn->target;
+	    break;
+	case CompMatchCodeJumpIfTrue:
+	    if (value)
+		pc = insn->target;
+	    break;
+	}
+    }
+
+    return value ? TRUE : FALSE;
+}
+
+/* core properties are changed in many places without going through
+   matchPropertyChanged so compare them against what cached results
+   were computed from */
+static void
+validateWindowMatchCache (CompWindow *w)
+{
+    unsigned int changed = 0;
+
+    if (w->wmType != w->matchCacheWmType)
+    {
+	w->matchCacheWmType = w->wmType;
+	changed |= MATCH_PROPERTY_TYPE_MASK;
+    }
+
+    if (w->state != w->matchCacheState)
+    {
+	w->matchCacheState = w->state;
+	changed |= MATCH_PROPERTY_STATE_MASK;
+    }
+
+    if (!w->attrib.override_redirect != !w->matchCacheOverrideRedirect)
+    {
+	w->matchCacheOverrideRedirect = w->attrib.override_redirect;
+	changed |= MATCH_PROPERTY_OVERRIDE_REDIRECT_MASK;
+    }
+
+    if (!w->alpha != !w->matchCacheAlpha)
+    {
+	w->matchCacheAlpha = w->alpha;
+	changed |= MATCH_PROPERTY_ALPHA_MASK;
+    }
+
+    if (changed)
+	invalidateWindowMatchCache (w, changed);
+}
+
+void
+invalidateWindowMatchCache (CompWindow   *w,
+			    unsigned int properties)
+{
+    int i;
+
+    for (i = 0; i < MATCH_CACHE_SIZE; i++)
+	if (w->matchCache[i].properties & properties)
+	    w->matchCache[i].id = 0;
+}
+
 Bool
 matchEval (CompMatch  *match,
 	   CompWindow *window)
 {
-    if (match->display)
+    CompMatchCacheEntry *entry;
+    Bool		value;
+
+    if (!match->display)
+	return FALSE;
+
+    if (!match->code)
 	return matchEvalOps (match->display, match->op, match->nOp, window);
 
-    return FALSE;
+    if (!match->properties)
+	return matchRunCode (match->display, match->code, match->nCode,
+			     window);
+
+    validateWindowMatchCache (window);
+
+    entry = &window->matchCache[match->id % MATCH_CACHE_SIZE];
+    if (entry->id == match->id)
+	return entry->value;
+
+    value = matchRunCode (match->display, match->code, match->nCode, window);
+
+    entry->id	      = match->id;
+    entry->properties = match->properties;
+    entry->value      = value;
+
+    return value;
 }
 
 static Bool
@@ -688,31 +1000,36 @@ matchInitExp (CompDisplay  *display,
 {
     if (strncmp (value, "xid=", 4) == 0)
     {
-	exp->eval     = matchEvalIdExp;
-	exp->priv.val = strtol (value + 4, NULL, 0);
+	exp->eval	= matchEvalIdExp;
+	exp->priv.val	= strtol (value + 4, NULL, 0);
+	exp->properties = MATCH_PROPERTY_ID_MASK;
     }
     else if (strncmp (value, "state=", 6) == 0)
     {
-	exp->eval      = matchEvalStateExp;
-	exp->priv.uval = windowStateFromString (value + 6);
+	exp->eval	= matchEvalStateExp;
+	exp->priv.uval	= windowStateFromString (value + 6);
+	exp->properties = MATCH_PROPERTY_STATE_MASK;
     }
     else if (strncmp (value, "override_redirect=", 18) == 0)
     {
-	exp->eval     = matchEvalOverrideRedirectExp;
-	exp->priv.val = strtol (value + 18, NULL, 0);
+	exp->eval	= matchEvalOverrideRedirectExp;
+	exp->priv.val	= strtol (value + 18, NULL, 0);
+	exp->properties = MATCH_PROPERTY_OVERRIDE_REDIRECT_MASK;
     }
     else if (strncmp (value, "rgba=", 5) == 0)
     {
-	exp->eval     = matchEvalAlphaExp;
-	exp->priv.val = strtol (value + 5, NULL, 0);
+	exp->eval	= matchEvalAlphaExp;
+	exp->priv.val	= strtol (value + 5, NULL, 0);
+	exp->properties = MATCH_PROPERTY_ALPHA_MASK;
     }
     else
     {
 	if (strncmp (value, "type=", 5) == 0)
 	    value += 5;
 
-	exp->eval      = matchEvalTypeExp;
-	exp->priv.uval = windowTypeFromString (value);
+	exp->eval	= matchEvalTypeExp;
+	exp->priv.uval	= windowTypeFromString (value);
+	exp->properties = MATCH_PROPERTY_TYPE_MASK;
     }
 }
 
@@ -244,123 +244,251 @@ paintBackground (CompScreen   *s,
    difference with most hardware but occlusion detection in the
    transformed screen case should be made optional for those who do
    see a difference. */
-static void
-paintOutputRegion (CompScreen	       *screen,
-		   const CompTransform *transform,
-		   Region	       region,
-		   CompOutput	       *output,
-		   unsigned int	       mask)
+/* The occlusion pass asks every visible window whether it is opaque,
+   top to bottom, which gets expensive with many windows when only a
+   small part of the screen is repainted. The opaque coverage above each
+   window is therefore kept from the last pass and reused until the
+   stacking order, geometry, shape, opacity or mapping of a window
+   changes, or the whole screen is damaged. Plugins that change the
+   paint attributes of a window without damaging it must call this. */
+void
+invalidateScreenOcclusion (CompScreen *screen)
 {
-    static Region tmpRegion = NULL;
-    CompWindow    *w;
-    CompCursor	  *c;
-    int		  count, windowMask, odMask, i;
-    CompWindow	  *fullscreenWindow = NULL;
-    CompWalker    walk;
-    Bool          status;
-    Bool          withOffset = FALSE;
-    CompTransform vTransform;
-    int           offX, offY;
-    Region        clip = region;
+    screen->occlusionValid = FALSE;
+}
 
-    if (!tmpRegion)
+#define OCCLUSION_UNCACHEABLE_MASK		   \
+    (PAINT_SCREEN_TRANSFORMED_MASK		 | \
+     PAINT_SCREEN_WITH_TRANSFORMED_WINDOWS_MASK)
+
+static Bool
+getWindowOffset (CompScreen *screen,
+		 CompWindow *w,
+		 int	    *offX,
+		 int	    *offY)
+{
+    if ((screen->windowOffsetX != 0 || screen->windowOffsetY != 0) &&
+	!windowOnAllViewports (w))
     {
-	tmpRegion = XCreateRegion ();
-	if (!tmpRegion)
-	    return;
+	getWindowMovementForOffset (w, screen->windowOffsetX,
+				    screen->windowOffsetY, offX, offY);
+
+	return TRUE;
     }
 
-    if (mask & PAINT_SCREEN_TRANSFORMED_MASK)
+    return FALSE;
+}
+
+/* sets up the clip regions from the coverage computed by the last
+   occlusion pass, returns FALSE if a window wasn't part of that pass */
+static Bool
+clipWindowsFromOcclusion (CompScreen *screen,
+			  CompWalker *walk,
+			  Region     region,
+			  Region     tmpRegion)
+{
+    CompWindow *w;
+    int	       offX, offY;
+
+    for (w = (*walk->last) (screen); w; w = (*walk->prev) (w))
     {
-	windowMask     = PAINT_WINDOW_ON_TRANSFORMED_SCREEN_MASK;
-	count	       = 1;
+	if (w->destroyed)
+	    continue;
+
+	if (!w->shaded)
+	{
+	    if (w->attrib.map_state != IsViewable || !w->damaged)
+		continue;
+	}
+
+	if (w->occlusionSerial != screen->occlusionSerial)
+	    return FALSE;
     }
-    else
+
+    for (w = (*walk->last) (screen); w; w = (*walk->prev) (w))
     {
-	windowMask     = 0;
-	count	       = 0;
+	if (w->destroyed)
+	    continue;
+
+	if (!w->shaded)
+	{
+	    if (w->attrib.map_state != IsViewable || !w->damaged)
+		continue;
+	}
+
+	XSubtractRegion (region, w->occlusion, w->clip);
+
+	if (getWindowOffset (screen, w, &offX, &offY))
+	    XOffsetRegion (w->clip, -offX, -offY);
     }
 
-    XSubtractRegion (region, &emptyRegion, tmpRegion);
+    XSubtractRegion (region, screen->occlusion, tmpRegion);
 
-    (*screen->initWindowWalker) (screen, &walk);
+    return TRUE;
+}
 
-    if (!(mask & PAINT_SCREEN_NO_OCCLUSION_DETECTION_MASK))
+static CompWindow *
+detectOcclusion (CompScreen	     *screen,
+		 CompWalker	     *walk,
+		 const CompTransform *transform,
+		 Region		     tmpRegion,
+		 unsigned int	     mask)
+{
+    CompWindow    *w;
+    CompWindow	  *fullscreenWindow = NULL;
+    CompTransform vTransform;
+    Bool          status;
+    Bool          withOffset;
+    int           offX, offY;
+    int		  count, odMask, i;
+
+    count = (mask & PAINT_SCREEN_TRANSFORMED_MASK) ? 1 : 0;
+
+    EMPTY_REGION (screen->occlusion);
+
+    screen->occlusionSerial++;
+
+    for (w = (*walk->last) (screen); w; w = (*walk->prev) (w))
     {
-	/* detect occlusions */
-	for (w = (*walk.last) (screen); w; w = (*walk.prev) (w))
+	if (w->destroyed)
+	    continue;
+
+	if (!w->shaded)
 	{
-	    if (w->destroyed)
+	    if (w->attrib.map_state != IsViewable || !w->damaged)
 		continue;
+	}
 
-	    if (!w->shaded)
-	    {
-		if (w->attrib.map_state != IsViewable || !w->damaged)
-		    continue;
-	    }
-
-	    /* copy region */
-	    XSubtractRegion (tmpRegion, &emptyRegion, w->clip);
+	/* copy region */
+	XSubtractRegion (tmpRegion, &emptyRegion, w->clip);
+	XSubtractRegion (screen->occlusion, &emptyRegion, w->occlusion);
+	w->occlusionSerial = screen->occlusionSerial;
 
-	    odMask = PAINT_WINDOW_OCCLUSION_DETECTION_MASK;
-		
-	    if ((screen->windowOffsetX != 0 || screen->windowOffsetY != 0) &&
-		!windowOnAllViewports (w))
-	    {
-		withOffset = TRUE;
+	odMask = PAINT_WINDOW_OCCLUSION_DETECTION_MASK;
 
-		getWindowMovementForOffset (w, screen->windowOffsetX,
-					    screen->windowOffsetY,
-					    &offX, &offY);
+	withOffset = getWindowOffset (screen, w, &offX, &offY);
+	if (withOffset)
+	{
+	    vTransform = *transform;
+	    matrixTranslate (&vTransform, offX, offY, 0);
 
-		vTransform = *transform;
-		matrixTranslate (&vTransform, offX, offY, 0);
+	    XOffsetRegion (w->clip, -offX, -offY);
 
-		XOffsetRegion (w->clip, -offX, -offY);
+	    odMask |= PAINT_WINDOW_WITH_OFFSET_MASK;
+	    status = (*screen->paintWindow) (w, &w->paint, &vTransform,
+					     tmpRegion, odMask);
+	}
+	else
+	{
+	    status = (*screen->paintWindow) (w, &w->paint, transform, tmpRegion,
+					     odMask);
+	}
 
-		odMask |= PAINT_WINDOW_WITH_OFFSET_MASK;
-		status = (*screen->paintWindow) (w, &w->paint, &vTransform,
-						 tmpRegion, odMask);
+	if (status)
+	{
+	    if (withOffset)
+	    {
+		XOffsetRegion (w->region, offX, offY);
+		XSubtractRegion (tmpRegion, w->region, tmpRegion);
+		XUnionRegion (screen->occlusion, w->region, screen->occlusion);
+		XOffsetRegion (w->region, -offX, -offY);
 	    }
 	    else
 	    {
-		withOffset = FALSE;
-		status = (*screen->paintWindow) (w, &w->paint, transform, tmpRegion,
-						 odMask);
+		XSubtractRegion (tmpRegion, w->region, tmpRegion);
+		XUnionRegion (screen->occlusion, w->region, screen->occlusion);
 	    }
 
-	    if (status)
+	    /* unredirect top most fullscreen windows. */
+	    if (count == 0 &&
+		screen->opt[COMP_SCREEN_OPTION_UNREDIRECT_FS].value.b)
 	    {
-		if (withOffset)
+		if (XEqualRegion (w->region, &screen->region) &&
+		    !REGION_NOT_EMPTY (tmpRegion))
 		{
-		    XOffsetRegion (w->region, offX, offY);
-		    XSubtractRegion (tmpRegion, w->region, tmpRegion);
-		    XOffsetRegion (w->region, -offX, -offY);
+		    fullscreenWindow = w;
 		}
 		else
-		    XSubtractRegion (tmpRegion, w->region, tmpRegion);
-
-		/* unredirect top most fullscreen windows. */
-		if (count == 0 &&
-		    screen->opt[COMP_SCREEN_OPTION_UNREDIRECT_FS].value.b)
 		{
-		    if (XEqualRegion (w->region, &screen->region) &&
-			!REGION_NOT_EMPTY (tmpRegion))
-		    {
-			fullscreenWindow = w;
-		    }
-		    else
-		    {
-			for (i = 0; i < screen->nOutputDev; i++)
-			    if (XEqualRegion (w->region,
-					      &screen->outputDev[i].region))
-				fullscreenWindow = w;
-		    }
+		    for (i = 0; i < screen->nOutputDev; i++)
+			if (XEqualRegion (w->region,
+					  &screen->outputDev[i].region))
+			    fullscreenWindow = w;
 		}
 	    }
+	}
+
+	if (!w->invisible)
+	    count++;
+    }
+
+    /* verdicts of transformed paints are not reusable */
+    if (mask & OCCLUSION_UNCACHEABLE_MASK)
+    {
+	screen->occlusionValid = FALSE;
+    }
+    else
+    {
+	screen->occlusionValid		  = TRUE;
+	screen->occlusionFullscreenWindow = fullscreenWindow;
+	screen->occlusionWalkLast	  = walk->last;
+	screen->occlusionWalkPrev	  = walk->prev;
+	screen->occlusionOffsetX	  = screen->windowOffsetX;
+	screen->occlusionOffsetY	  = screen->windowOffsetY;
+    }
+
+    return fullscreenWindow;
+}
+
+static void
+paintOutputRegion (CompScreen	       *screen,
+		   const CompTransform *transform,
+		   Region	       region,
+		   CompOutput	       *output,
+		   unsigned int	       mask)
+{
+    static Region tmpRegion = NULL;
+    CompWindow    *w;
+    CompCursor	  *c;
+    int		  windowMask;
+    CompWindow	  *fullscreenWindow = NULL;
+    CompWalker    walk;
+    CompTransform vTransform;
+    int           offX, offY;
+    Region        clip = region;
+
+    if (!tmpRegion)
+    {
+	tmpRegion = XCreateRegion ();
+	if (!tmpRegion)
+	    return;
+    }
+
+    if (mask & PAINT_SCREEN_TRANSFORMED_MASK)
+	windowMask = PAINT_WINDOW_ON_TRANSFORMED_SCREEN_MASK;
+    else
+	windowMask = 0;
+
+    XSubtractRegion (region, &emptyRegion, tmpRegion);
+
+    (*screen->initWindowWalker) (screen, &walk);
 
-	    if (!w->invisible)
-		count++;
+    if (!(mask & PAINT_SCREEN_NO_OCCLUSION_DETECTION_MASK))
+    {
+	if (screen->occlusionValid				&&
+	    !(mask & OCCLUSION_UNCACHEABLE_MASK)		&&
+	    screen->occlusionWalkLast == walk.last		&&
+	    screen->occlusionWalkPrev == walk.prev		&&
+	    screen->occlusionOffsetX  == screen->windowOffsetX	&&
+	    screen->occlusionOffsetY  == screen->windowOffsetY	&&
+	    clipWindowsFromOcclusion (screen, &walk, region, tmpRegion))
+	{
+	    fullscreenWindow = screen->occlusionFullscreenWindow;
+	}
+	else
+	{
+	    fullscreenWindow = detectOcclusion (screen, &walk, transform,
+						tmpRegion, mask);
 	}
     }
 
@@ -389,12 +517,8 @@ paintOutputRegion (CompScreen	       *screen,
 	if (!(mask & PAINT_SCREEN_NO_OCCLUSION_DETECTION_MASK))
 	    clip = w->clip;
 
-	if ((screen->windowOffsetX != 0 || screen->windowOffsetY != 0) &&
-	    !windowOnAllViewports (w))
+	if (getWindowOffset (screen, w, &offX, &offY))
 	{
-	    getWindowMovementForOffset (w, screen->windowOffsetX,
-					screen->windowOffsetY, &offX, &offY);
-
 	    vTransform = *transform;
 	    matrixTranslate (&vTransform, offX, offY, 0);
 	    (*screen->paintWindow) (w, &w->paint, &vTransform, clip,
@@ -714,12 +838,12 @@ drawWindowGeometry (CompWindow *w)
     }
 }
 
-void
-addWindowGeometry (CompWindow *w,
-		   CompMatrix *matrix,
-		   int	      nMatrix,
-		   Region     region,
-		   Region     clip)
+static void
+addWindowGeometryToArray (CompWindow *w,
+			  CompMatrix *matrix,
+			  int	     nMatrix,
+			  Region     region,
+			  Region     clip)
 {
     BoxRec full;
 
@@ -860,6 +984,247 @@ addWindowGeometry (CompWindow *w,
     }
 }
 
+#define GEOMETRY_BUFFER_MIN_SIZE 1024
+
+/* clipping a cached draw takes one draw call per clip rectangle, with
+   more than this many it's cheaper to clip on the CPU */
+#define GEOMETRY_MAX_CLIP_RECTS 16
+
+static void
+drawWindowGeometryBuffer (CompWindow *w)
+{
+    CompScreen *s = w->screen;
+    GLsizei    stride = w->vertexStride * sizeof (GLfloat);
+
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, s->geometryBuffer);
+
+    glTexCoordPointer (2, GL_FLOAT, stride, (GLvoid *) 0);
+    glVertexPointer (3, GL_FLOAT, stride,
+		     (GLvoid *) (2 * sizeof (GLfloat)));
+
+    if (w->geometryClipped)
+    {
+	BoxPtr pBox = w->geometryClip->rects;
+	int    nBox = w->geometryClip->numRects;
+	GLint  scissor[4];
+	Bool   scissored;
+	int    x1, y1, x2, y2;
+
+	/* a scissor set up by a plugin still applies */
+	scissored = glIsEnabled (GL_SCISSOR_TEST);
+	if (scissored)
+	    glGetIntegerv (GL_SCISSOR_BOX, scissor);
+
+	glPushAttrib (GL_SCISSOR_BIT);
+	glEnable (GL_SCISSOR_TEST);
+
+	for (; nBox--; pBox++)
+	{
+	    x1 = pBox->x1;
+	    y1 = s->height - pBox->y2;
+	    x2 = pBox->x2;
+	    y2 = s->height - pBox->y1;
+
+	    if (scissored)
+	    {
+		x1 = MAX (x1, scissor[0]);
+		y1 = MAX (y1, scissor[1]);
+		x2 = MIN (x2, scissor[0] + scissor[2]);
+		y2 = MIN (y2, scissor[1] + scissor[3]);
+
+		if (x1 >= x2 || y1 >= y2)
+		    continue;
+	    }
+
+	    glScissor (x1, y1, x2 - x1, y2 - y1);
+
+	    glDrawArrays (GL_QUADS, w->geometryOffset, w->vCount);
+	}
+
+	glPopAttrib ();
+    }
+    else
+    {
+	glDrawArrays (GL_QUADS, w->geometryOffset, w->vCount);
+    }
+
+    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+}
+
+/* all windows share one buffer object. Space is handed out from the
+   end of it and when it runs out the buffer is orphaned, possibly
+   grown, and every window uploads its geometry again the next time
+   it is drawn */
+static Bool
+allocWindowGeometry (CompWindow *w,
+		     int	count)
+{
+    CompScreen *s = w->screen;
+    int	       size;
+
+    if (w->geometrySerial == s->geometryBufferSerial)
+    {
+	if (count <= w->geometrySize)
+	    return TRUE;
+
+	s->geometryBufferLive -= w->geometrySize;
+    }
+
+    w->geometrySerial = 0;
+
+    if (s->geometryBufferUsed + count > s->geometryBufferSize)
+    {
+	size = MAX (s->geometryBufferSize, GEOMETRY_BUFFER_MIN_SIZE);
+	while (size < 2 * (s->geometryBufferLive + count))
+	    size *= 2;
+
+	if (!s->geometryBuffer)
+	{
+	    (*s->genBuffers) (1, &s->geometryBuffer);
+	    if (!s->geometryBuffer)
+		return FALSE;
+	}
+
+	(*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, s->geometryBuffer);
+	(*s->bufferData) (GL_ARRAY_BUFFER_ARB,
+			  size * 5 * sizeof (GLfloat),
+			  NULL, GL_DYNAMIC_DRAW_ARB);
+	(*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+
+	s->geometryBufferSize = size;
+	s->geometryBufferUsed = 0;
+	s->geometryBufferLive = 0;
+
+	if (!++s->geometryBufferSerial)
+	    s->geometryBufferSerial = 1;
+    }
+
+    w->geometryOffset = s->geometryBufferUsed;
+    w->geometrySize   = count;
+    w->geometrySerial = s->geometryBufferSerial;
+
+    s->geometryBufferUsed += count;
+    s->geometryBufferLive += count;
+
+    return TRUE;
+}
+
+void
+freeWindowGeometry (CompWindow *w)
+{
+    if (w->geometrySerial == w->screen->geometryBufferSerial)
+	w->screen->geometryBufferLive -= w->geometrySize;
+
+    w->geometrySerial = 0;
+}
+
+/* the unclipped geometry of the window contents only depends on the
+   window region and texture matrix, so it is kept in the shared
+   buffer and only uploaded again when one of them changes. Coordinates
+   are untransformed, transformations are applied by the modelview
+   matrix as usual */
+static Bool
+addWindowGeometryToBuffer (CompWindow *w)
+{
+    CompScreen *s = w->screen;
+
+    if (w->geometryValid					      &&
+	w->geometrySerial == s->geometryBufferSerial		      &&
+	!memcmp (&w->geometryMatrix, &w->matrix, sizeof (CompMatrix)) &&
+	!memcmp (&w->geometryExtents, &w->region->extents, sizeof (BoxRec)))
+    {
+	w->vCount = w->geometryCount;
+    }
+    else
+    {
+	addWindowGeometryToArray (w, &w->matrix, 1, w->region,
+				  &infiniteRegion);
+
+	if (w->vCount && !allocWindowGeometry (w, w->vCount))
+	{
+	    w->vCount = 0;
+	    return FALSE;
+	}
+
+	if (w->vCount)
+	{
+	    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, s->geometryBuffer);
+	    (*s->bufferSubData) (GL_ARRAY_BUFFER_ARB,
+				 w->geometryOffset * 5 * sizeof (GLfloat),
+				 w->vCount * 5 * sizeof (GLfloat),
+				 w->vertices);
+	    (*s->bindBuffer) (GL_ARRAY_BUFFER_ARB, 0);
+	}
+
+	w->geometryMatrix  = w->matrix;
+	w->geometryExtents = w->region->extents;
+	w->geometryCount   = w->vCount;
+	w->geometryValid   = TRUE;
+    }
+
+    w->texUnits	    = 1;
+    w->vertexStride = 5;
+    w->texCoordSize = 2;
+
+    w->drawWindowGeometry = drawWindowGeometryBuffer;
+
+    return TRUE;
+}
+
+void
+addWindowGeometry (CompWindow *w,
+		   CompMatrix *matrix,
+		   int	      nMatrix,
+		   Region     region,
+		   Region     clip)
+{
+    /* more geometry is added after the cached one, the client-side
+       array needs to hold all of it */
+    if (w->vCount && w->drawWindowGeometry == drawWindowGeometryBuffer)
+    {
+	w->vCount = 0;
+	addWindowGeometryToArray (w, &w->matrix, 1, w->region,
+				  w->geometryClipped ? w->geometryClip :
+				  &infiniteRegion);
+    }
+
+    /* plugins that replace the geometry of a window, like wobbly, don't
+       call this for it and keep using client-side arrays */
+    if (w->screen->vbo && !w->vCount &&
+	nMatrix == 1 && matrix == &w->matrix && region == w->region)
+    {
+	/* the clip is applied with the scissor test when drawing, which
+	   only works when window coordinates are screen coordinates */
+	w->geometryClipped = FALSE;
+
+	if (clip != &infiniteRegion)
+	{
+	    XIntersectRegion (clip, w->region, w->geometryClip);
+
+	    if (!w->geometryClip->numRects)
+		return;
+
+	    if (!XEqualRegion (w->geometryClip, w->region))
+	    {
+		if (!w->geometryScissor ||
+		    w->geometryClip->numRects > GEOMETRY_MAX_CLIP_RECTS)
+		{
+		    addWindowGeometryToArray (w, matrix, nMatrix, region,
+					      clip);
+		    return;
+		}
+
+		w->geometryClipped = TRUE;
+	    }
+	}
+
+	if (addWindowGeometryToBuffer (w))
+	    return;
+    }
+
+    addWindowGeometryToArray (w, matrix, nMatrix, region, clip);
+}
+
 static Bool
 enableFragmentProgramAndDrawGeometry (CompWindow	   *w,
 				      CompTexture	   *texture,
@@ -1203,11 +1568,21 @@ drawWindow (CompWindow		 *w,
     if (mask & PAINT_WINDOW_TRANSLUCENT_MASK)
 	mask |= PAINT_WINDOW_BLEND_MASK;
 
+    /* core's addWindowGeometry may clip cached geometry with the
+       scissor test, but only when we know that the window is drawn
+       untransformed. Clip regions of offset windows are in window
+       coordinates, which differ from screen coordinates */
+    w->geometryScissor = !(mask & (PAINT_WINDOW_TRANSFORMED_MASK		|
+				   PAINT_WINDOW_ON_TRANSFORMED_SCREEN_MASK	|
+				   PAINT_WINDOW_WITH_OFFSET_MASK));
+
     w->vCount = w->indexCount = 0;
     (*w->screen->addWindowGeometry) (w, &w->matrix, 1, w->region, region);
     if (w->vCount)
 	(*w->screen->drawWindowTexture) (w, w->texture, fragment, mask);
 
+    w->geometryScissor = FALSE;
+
     return TRUE;
 }
 
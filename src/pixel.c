@@ -0,0 +1,269 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "../config.h"
+#endif
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef HAVE_AVX2_DISPATCH
+#include <immintrin.h>
+#endif
+
+#include <compiz-core.h>
+
+/*
+ * Conversions applied to whole images when they are imported or
+ * exported. Pixels are 32 bit with blue in the lowest byte, the SSE2
+ * and AVX2 versions give exactly the same results as the scalar loops.
+ * AVX2 is used when the CPU has it, SSE2 handles what is left and
+ * targets without either use the scalar loop.
+ */
+
+#ifdef HAVE_AVX2_DISPATCH
+
+static Bool
+cpuHasAVX2 (void)
+{
+    static int hasAVX2 = -1;
+
+    if (hasAVX2 < 0)
+    {
+	__builtin_cpu_init ();
+	hasAVX2 = __builtin_cpu_supports ("avx2") ? 1 : 0;
+    }
+
+    return hasAVX2;
+}
+
+/* same as premultiplyChannels below, for eight pixels */
+__attribute__ ((target ("avx2"))) static inline __m256i
+premultiplyChannelsAVX2 (__m256i channels,
+			 __m256i opaque)
+{
+    __m256i alpha;
+
+    alpha = _mm256_shufflelo_epi16 (channels, _MM_SHUFFLE (3, 3, 3, 3));
+    alpha = _mm256_shufflehi_epi16 (alpha, _MM_SHUFFLE (3, 3, 3, 3));
+    alpha = _mm256_or_si256 (alpha, opaque);
+
+    channels = _mm256_mullo_epi16 (channels, alpha);
+    channels = _mm256_add_epi16 (channels,
+				 _mm256_add_epi16 (_mm256_srli_epi16 (channels,
+								      8),
+						   _mm256_set1_epi16 (1)));
+
+    return _mm256_srli_epi16 (channels, 8);
+}
+
+/* returns the number of pixels converted, always a multiple of eight */
+__attribute__ ((target ("avx2"))) static int
+premultiplyPixelsAVX2 (unsigned char *base,
+		       int	     n)
+{
+    __m256i zero   = _mm256_setzero_si256 ();
+    __m256i opaque = _mm256_set_epi16 (0xff, 0, 0, 0, 0xff, 0, 0, 0,
+				       0xff, 0, 0, 0, 0xff, 0, 0, 0);
+    int	    i;
+
+    for (i = 0; i + 8 <= n; i += 8, base += 32)
+    {
+	__m256i pixels = _mm256_loadu_si256 ((__m256i *) base);
+	__m256i lo, hi;
+
+	/* unpacking and packing both work within 128 bit lanes, so the
+	   pixels come out in the order they went in */
+	lo = premultiplyChannelsAVX2 (_mm256_unpacklo_epi8 (pixels, zero),
+				      opaque);
+	hi = premultiplyChannelsAVX2 (_mm256_unpackhi_epi8 (pixels, zero),
+				      opaque);
+
+	_mm256_storeu_si256 ((__m256i *) base, _mm256_packus_epi16 (lo, hi));
+    }
+
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static int
+swapRedBluePixelsAVX2 (unsigned char *base,
+		       int	     n)
+{
+    __m256i rb = _mm256_set1_epi32 (0x00ff00ff);
+    int	    i;
+
+    for (i = 0; i + 8 <= n; i += 8, base += 32)
+    {
+	__m256i pixels = _mm256_loadu_si256 ((__m256i *) base);
+	__m256i ga, swapped;
+
+	ga = _mm256_andnot_si256 (rb, pixels);
+	pixels = _mm256_and_si256 (pixels, rb);
+
+	swapped = _mm256_or_si256 (_mm256_slli_epi32 (pixels, 16),
+				   _mm256_srli_epi32 (pixels, 16));
+
+	_mm256_storeu_si256 ((__m256i *) base, _mm256_or_si256 (ga, swapped));
+    }
+
+    return i;
+}
+
+#endif
+
+#ifdef __SSE2__
+
+/* (x + 1 + (x >> 8)) >> 8 is x / 255 rounded down for x <= 255 * 255 */
+static inline __m128i
+premultiplyChannels (__m128i channels,
+		     __m128i opaque)
+{
+    __m128i alpha;
+
+    alpha = _mm_shufflelo_epi16 (channels, _MM_SHUFFLE (3, 3, 3, 3));
+    alpha = _mm_shufflehi_epi16 (alpha, _MM_SHUFFLE (3, 3, 3, 3));
+
+    /* alpha is multiplied by 255 so that it stays the same */
+    alpha = _mm_or_si128 (alpha, opaque);
+
+    channels = _mm_mullo_epi16 (channels, alpha);
+    channels = _mm_add_epi16 (channels,
+			      _mm_add_epi16 (_mm_srli_epi16 (channels, 8),
+					     _mm_set1_epi16 (1)));
+
+    return _mm_srli_epi16 (channels, 8);
+}
+
+#endif
+
+void
+premultiplyPixels (void *data,
+		   int  n)
+{
+    unsigned char *base = (unsigned char *) data;
+    int		  i = 0;
+
+#ifdef HAVE_AVX2_DISPATCH
+    if (cpuHasAVX2 ())
+    {
+	i = premultiplyPixelsAVX2 (base, n);
+	base += i * 4;
+    }
+#endif
+
+#ifdef __SSE2__
+    __m128i zero   = _mm_setzero_si128 ();
+    __m128i opaque = _mm_set_epi16 (0xff, 0, 0, 0, 0xff, 0, 0, 0);
+
+    for (; i + 4 <= n; i += 4, base += 16)
+    {
+	__m128i pixels = _mm_loadu_si128 ((__m128i *) base);
+	__m128i lo, hi;
+
+	lo = premultiplyChannels (_mm_unpacklo_epi8 (pixels, zero), opaque);
+	hi = premultiplyChannels (_mm_unpackhi_epi8 (pixels, zero), opaque);
+
+	_mm_storeu_si128 ((__m128i *) base, _mm_packus_epi16 (lo, hi));
+    }
+#endif
+
+    for (; i < n; i++, base += 4)
+    {
+	unsigned char blue  = base[0];
+	unsigned char green = base[1];
+	unsigned char red   = base[2];
+	unsigned char alpha = base[3];
+	int	      p;
+
+	red   = (unsigned) red   * (unsigned) alpha / 255;
+	green = (unsigned) green * (unsigned) alpha / 255;
+	blue  = (unsigned) blue  * (unsigned) alpha / 255;
+
+	p = (alpha << 24) | (red << 16) | (green << 8) | (blue << 0);
+	memcpy (base, &p, sizeof (int));
+    }
+}
+
+/* converts between RGBA and BGRA byte order */
+void
+swapRedBluePixels (void *data,
+		   int  n)
+{
+    unsigned char *base = (unsigned char *) data;
+    unsigned char tmp;
+    int		  i = 0;
+
+#ifdef HAVE_AVX2_DISPATCH
+    if (cpuHasAVX2 ())
+    {
+	i = swapRedBluePixelsAVX2 (base, n);
+	base += i * 4;
+    }
+#endif
+
+#ifdef __SSE2__
+    __m128i rb = _mm_set1_epi32 (0x00ff00ff);
+
+    for (; i + 4 <= n; i += 4, base += 16)
+    {
+	__m128i pixels = _mm_loadu_si128 ((__m128i *) base);
+	__m128i ga, swapped;
+
+	ga = _mm_andnot_si128 (rb, pixels);
+	pixels = _mm_and_si128 (pixels, rb);
+
+	/* red and blue are 16 bits apart */
+	swapped = _mm_or_si128 (_mm_slli_epi32 (pixels, 16),
+				_mm_srli_epi32 (pixels, 16));
+
+	_mm_storeu_si128 ((__m128i *) base, _mm_or_si128 (ga, swapped));
+    }
+#endif
+
+    for (; i < n; i++, base += 4)
+    {
+	tmp	= base[0];
+	base[0] = base[2];
+	base[2] = tmp;
+    }
+}
+
+/* copies an image while turning it upside down, dst and src must not
+   overlap */
+void
+flipImage (void	      *dst,
+	   const void *src,
+	   int	      stride,
+	   int	      height)
+{
+    unsigned char	*d = (unsigned char *) dst;
+    const unsigned char *s = (const unsigned char *) src;
+    int			i;
+
+    for (i = 0; i < height; i++)
+	memcpy (d + i * stride, s + (height - i - 1) * stride, stride);
+}
@@ -0,0 +1,732 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "../config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/Xproto.h>
+
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#endif
+
+#include <compiz-core.h>
+
+/*
+ * Adding a window needs its attributes and more than a dozen
+ * properties, each of them a round-trip when fetched through Xlib.
+ * When a batch of windows is added at once, like all children of the
+ * root window at startup, the requests for all of them are sent up
+ * front through XCB and the replies kept here. The property getters
+ * below hand out each prefetched reply once and fall back to a
+ * synchronous request for anything else, so callers always see the
+ * same results XGetWindowProperty would give them.
+ */
+
+#define PREFETCH_PROPERTY_NUM	 18
+#define PREFETCH_PROPERTY_LENGTH 1024
+
+typedef struct _CompPrefetchedProperty {
+    Atom	  atom;
+    Atom	  type;
+    int		  format;
+    unsigned long nBytes;
+    unsigned long bytesAfter;
+    unsigned char *data;
+    Bool	  used;
+} CompPrefetchedProperty;
+
+struct _CompPrefetchedWindow {
+    CompPrefetchedWindow   *next;
+    Window		   id;
+    Bool		   attribUsed;
+    Status		   attribStatus;
+    XWindowAttributes	   attrib;
+    CompPrefetchedProperty property[PREFETCH_PROPERTY_NUM];
+    int			   nProperty;
+};
+
+static int
+prefetchHashIndex (CompDisplay *d,
+		   Window      id)
+{
+    return (id ^ (id >> 11) ^ (id >> 21)) & (d->prefetchHashSize - 1);
+}
+
+static CompPrefetchedWindow *
+findPrefetchedWindow (CompDisplay *d,
+		      Window	  id)
+{
+    CompPrefetchedWindow *pw;
+
+    if (!d->prefetchHashSize)
+	return NULL;
+
+    for (pw = d->prefetchHash[prefetchHashIndex (d, id)]; pw; pw = pw->next)
+	if (pw->id == id)
+	    return pw;
+
+    return NULL;
+}
+
+static CompPrefetchedProperty *
+findPrefetchedProperty (CompDisplay *d,
+			Window	    id,
+			Atom	    atom)
+{
+    CompPrefetchedWindow *pw;
+    int			 i;
+
+    pw = findPrefetchedWindow (d, id);
+    if (!pw)
+	return NULL;
+
+    for (i = 0; i < pw->nProperty; i++)
+	if (pw->property[i].atom == atom)
+	    return &pw->property[i];
+
+    return NULL;
+}
+
+#ifdef HAVE_XCB
+static Visual *
+findVisual (Display  *dpy,
+	    VisualID id)
+{
+    Screen *screen;
+    int	   i, j, k;
+
+    for (i = 0; i < ScreenCount (dpy); i++)
+    {
+	screen = ScreenOfDisplay (dpy, i);
+
+	for (j = 0; j < screen->ndepths; j++)
+	    for (k = 0; k < screen->depths[j].nvisuals; k++)
+		if (screen->depths[j].visuals[k].visualid == id)
+		    return &screen->depths[j].visuals[k];
+    }
+
+    return NULL;
+}
+
+static Screen *
+findScreenOfRoot (Display *dpy,
+		  Window  root)
+{
+    int i;
+
+    for (i = 0; i < ScreenCount (dpy); i++)
+	if (RootWindow (dpy, i) == root)
+	    return ScreenOfDisplay (dpy, i);
+
+    return NULL;
+}
+
+static Status
+convertWindowAttributes (Display			   *dpy,
+			 xcb_get_window_attributes_reply_t *attr,
+			 xcb_get_geometry_reply_t	   *geom,
+			 XWindowAttributes		   *attrib)
+{
+    if (!attr || !geom)
+	return 0;
+
+    attrib->x		      = geom->x;
+    attrib->y		      = geom->y;
+    attrib->width	      = geom->width;
+    attrib->height	      = geom->height;
+    attrib->border_width      = geom->border_width;
+    attrib->depth	      = geom->depth;
+    attrib->root	      = geom->root;
+    attrib->visual	      = findVisual (dpy, attr->visual);
+    attrib->class	      = attr->_class;
+    attrib->bit_gravity	      = attr->bit_gravity;
+    attrib->win_gravity	      = attr->win_gravity;
+    attrib->backing_store     = attr->backing_store;
+    attrib->backing_planes    = attr->backing_planes;
+    attrib->backing_pixel     = attr->backing_pixel;
+    attrib->save_under	      = attr->save_under;
+    attrib->colormap	      = attr->colormap;
+    attrib->map_installed     = attr->map_is_installed;
+    attrib->map_state	      = attr->map_state;
+    attrib->all_event_masks   = attr->all_event_masks;
+    attrib->your_event_mask   = attr->your_event_mask;
+    attrib->do_not_propagate_mask = attr->do_not_propagate_mask;
+    attrib->override_redirect = attr->override_redirect;
+    attrib->screen	      = findScreenOfRoot (dpy, geom->root);
+
+    return 1;
+}
+
+static void
+storePrefetchedProperty (CompPrefetchedProperty	  *pp,
+			 xcb_get_property_reply_t *reply)
+{
+    pp->type	   = reply->type;
+    pp->format	   = reply->format;
+    pp->bytesAfter = reply->bytes_after;
+    pp->nBytes	   = 0;
+    pp->data	   = NULL;
+
+    if (pp->type == None)
+	return;
+
+    pp->nBytes = xcb_get_property_value_length (reply);
+    if (pp->nBytes)
+    {
+	pp->data = malloc (pp->nBytes);
+	if (!pp->data)
+	{
+	    /* a synchronous request will be made instead */
+	    pp->used = TRUE;
+	    return;
+	}
+
+	memcpy (pp->data, xcb_get_property_value (reply), pp->nBytes);
+    }
+}
+#endif
+
+void
+prefetchWindows (CompDisplay *d,
+		 Window	     *id,
+		 int	     nId)
+{
+#ifdef HAVE_XCB
+    xcb_connection_t			*c = XGetXCBConnection (d->display);
+    xcb_get_window_attributes_cookie_t	*attrCookie;
+    xcb_get_geometry_cookie_t		*geomCookie;
+    xcb_get_property_cookie_t		*propCookie;
+    CompPrefetchedWindow		*pw;
+    Atom				atoms[PREFETCH_PROPERTY_NUM];
+    int					i, j, size;
+
+    releasePrefetchedWindows (d);
+
+    if (nId <= 1)
+	return;
+
+    atoms[0]  = d->winStateAtom;
+    atoms[1]  = d->winTypeAtom;
+    atoms[2]  = d->wmProtocolsAtom;
+    atoms[3]  = XA_WM_CLASS;
+    atoms[4]  = XA_WM_NORMAL_HINTS;
+    atoms[5]  = XA_WM_HINTS;
+    atoms[6]  = XA_WM_TRANSIENT_FOR;
+    atoms[7]  = d->wmStrutPartialAtom;
+    atoms[8]  = d->wmStrutAtom;
+    atoms[9]  = d->wmClientLeaderAtom;
+    atoms[10] = d->startupIdAtom;
+    atoms[11] = d->mwmHintsAtom;
+    atoms[12] = d->winDesktopAtom;
+    atoms[13] = d->winOpacityAtom;
+    atoms[14] = d->winBrightnessAtom;
+    atoms[15] = d->winSaturationAtom;
+    atoms[16] = d->wmStateAtom;
+    atoms[17] = d->wmIconGeometryAtom;
+
+    /* _NET_WM_ICON is left out on purpose. It is only read when a
+       plugin asks for an icon through getWindowIcon, usually long
+       after the prefetched replies have been released, and it can
+       be hundreds of kilobytes per window */
+
+    for (size = 1; size < nId; size <<= 1);
+
+    d->prefetchedWindows = calloc (nId, sizeof (CompPrefetchedWindow));
+    d->prefetchHash	 = calloc (size, sizeof (CompPrefetchedWindow *));
+    attrCookie = malloc (sizeof (xcb_get_window_attributes_cookie_t) * nId);
+    geomCookie = malloc (sizeof (xcb_get_geometry_cookie_t) * nId);
+    propCookie = malloc (sizeof (xcb_get_property_cookie_t) * nId *
+			 PREFETCH_PROPERTY_NUM);
+
+    if (!d->prefetchedWindows || !d->prefetchHash ||
+	!attrCookie || !geomCookie || !propCookie)
+    {
+	if (attrCookie)
+	    free (attrCookie);
+	if (geomCookie)
+	    free (geomCookie);
+	if (propCookie)
+	    free (propCookie);
+
+	releasePrefetchedWindows (d);
+	return;
+    }
+
+    d->nPrefetchedWindow = nId;
+    d->prefetchHashSize	 = size;
+
+    /* property changes after the requests below have been processed
+       must generate events as they would otherwise be missed. This
+       selects the same mask addWindow does, which replaces whatever
+       was selected before, so windows that are already added are
+       left alone */
+    for (i = 0; i < nId; i++)
+	if (!findWindowAtDisplay (d, id[i]))
+	    XSelectInput (d->display, id[i], CLIENT_WINDOW_EVENT_MASK);
+
+    XFlush (d->display);
+
+    for (i = 0; i < nId; i++)
+    {
+	attrCookie[i] = xcb_get_window_attributes_unchecked (c, id[i]);
+	geomCookie[i] = xcb_get_geometry_unchecked (c, id[i]);
+
+	for (j = 0; j < PREFETCH_PROPERTY_NUM; j++)
+	    propCookie[i * PREFETCH_PROPERTY_NUM + j] =
+		xcb_get_property_unchecked (c, FALSE, id[i], atoms[j],
+					    XCB_GET_PROPERTY_TYPE_ANY, 0,
+					    PREFETCH_PROPERTY_LENGTH);
+    }
+
+    xcb_flush (c);
+
+    for (i = 0; i < nId; i++)
+    {
+	xcb_get_window_attributes_reply_t *attr;
+	xcb_get_geometry_reply_t	  *geom;
+	xcb_generic_error_t		  *error;
+	int				  index;
+
+	pw = &d->prefetchedWindows[i];
+
+	attr = xcb_get_window_attributes_reply (c, attrCookie[i], &error);
+	if (error)
+	    free (error);
+
+	geom = xcb_get_geometry_reply (c, geomCookie[i], &error);
+	if (error)
+	    free (error);
+
+	pw->id		 = id[i];
+	pw->attribUsed	 = FALSE;
+	pw->attribStatus = convertWindowAttributes (d->display, attr, geom,
+						    &pw->attrib);
+
+	if (attr)
+	    free (attr);
+	if (geom)
+	    free (geom);
+
+	for (j = 0; j < PREFETCH_PROPERTY_NUM; j++)
+	{
+	    xcb_get_property_reply_t *reply;
+
+	    reply = xcb_get_property_reply (c,
+					    propCookie[i * PREFETCH_PROPERTY_NUM
+						       + j],
+					    &error);
+	    if (error)
+		free (error);
+
+	    /* leave failed requests to the synchronous fallback */
+	    if (!reply)
+		continue;
+
+	    pw->property[pw->nProperty].atom = atoms[j];
+	    pw->property[pw->nProperty].used = FALSE;
+
+	    storePrefetchedProperty (&pw->property[pw->nProperty], reply);
+
+	    pw->nProperty++;
+
+	    free (reply);
+	}
+
+	index = prefetchHashIndex (d, pw->id);
+
+	pw->next = d->prefetchHash[index];
+	d->prefetchHash[index] = pw;
+    }
+
+    free (attrCookie);
+    free (geomCookie);
+    free (propCookie);
+#endif
+}
+
+void
+releasePrefetchedWindows (CompDisplay *d)
+{
+    int i, j;
+
+    if (d->prefetchedWindows)
+    {
+	for (i = 0; i < d->nPrefetchedWindow; i++)
+	    for (j = 0; j < d->prefetchedWindows[i].nProperty; j++)
+		if (d->prefetchedWindows[i].property[j].data)
+		    free (d->prefetchedWindows[i].property[j].data);
+
+	free (d->prefetchedWindows);
+    }
+
+    if (d->prefetchHash)
+	free (d->prefetchHash);
+
+    d->prefetchedWindows = NULL;
+    d->nPrefetchedWindow = 0;
+    d->prefetchHash	 = NULL;
+    d->prefetchHashSize	 = 0;
+}
+
+Status
+getWindowAttributes (CompDisplay       *d,
+		     Window	       id,
+		     XWindowAttributes *attrib)
+{
+    CompPrefetchedWindow *pw;
+
+    pw = findPrefetchedWindow (d, id);
+    if (pw && !pw->attribUsed)
+    {
+	pw->attribUsed = TRUE;
+
+	if (pw->attribStatus)
+	    *attrib = pw->attrib;
+
+	return pw->attribStatus;
+    }
+
+    return XGetWindowAttributes (d->display, id, attrib);
+}
+
+/* same semantics as XGetWindowProperty with delete set to False */
+int
+getWindowProperty (CompDisplay	 *d,
+		   Window	 id,
+		   Atom		 property,
+		   long		 offset,
+		   long		 length,
+		   Atom		 type,
+		   Atom		 *actualType,
+		   int		 *format,
+		   unsigned long *nItems,
+		   unsigned long *bytesAfter,
+		   unsigned char **data)
+{
+    CompPrefetchedProperty *pp;
+    unsigned long	   total, start, size = 0, n, i, bytes;
+    unsigned char	   *value;
+
+    pp = findPrefetchedProperty (d, id, property);
+    if (!pp || pp->used)
+	return XGetWindowProperty (d->display, id, property, offset, length,
+				   FALSE, type, actualType, format, nItems,
+				   bytesAfter, data);
+
+    total = pp->nBytes + pp->bytesAfter;
+    start = 4 * offset;
+
+    if (pp->type != None && (type == AnyPropertyType || type == pp->type))
+    {
+	/* the caller wants more than what was prefetched */
+	if (offset < 0 || start > total)
+	    return XGetWindowProperty (d->display, id, property, offset, length,
+				       FALSE, type, actualType, format, nItems,
+				       bytesAfter, data);
+
+	size = MIN (total - start, 4 * length);
+	if (start + size > pp->nBytes)
+	    return XGetWindowProperty (d->display, id, property, offset, length,
+				       FALSE, type, actualType, format, nItems,
+				       bytesAfter, data);
+    }
+
+    pp->used = TRUE;
+
+    *actualType = pp->type;
+    *format	= pp->format;
+    *nItems	= 0;
+    *bytesAfter = 0;
+    *data	= NULL;
+
+    if (pp->type == None)
+    {
+	*format = 0;
+	return Success;
+    }
+
+    if (type != AnyPropertyType && type != pp->type)
+    {
+	*bytesAfter = total;
+
+	/* Xlib always hands out a buffer for existing properties */
+	*data = calloc (1, 1);
+
+	return Success;
+    }
+
+    n = size / (pp->format / 8);
+
+    switch (pp->format) {
+    case 32:
+	bytes = n * sizeof (long);
+	break;
+    case 16:
+	bytes = n * sizeof (short);
+	break;
+    default:
+	bytes = n;
+	break;
+    }
+
+    /* Xlib null terminates the data it returns */
+    value = malloc (bytes + 1);
+    if (!value)
+	return BadAlloc;
+
+    if (pp->format == 32)
+    {
+	for (i = 0; i < n; i++)
+	    ((long *) value)[i] = ((CARD32 *) (pp->data + start))[i];
+    }
+    else
+    {
+	memcpy (value, pp->data + start, bytes);
+    }
+
+    value[bytes] = '\0';
+
+    *nItems	= n;
+    *bytesAfter = total - (start + size);
+    *data	= value;
+
+    return Success;
+}
+
+/* the helpers below decode the ICCCM properties the same way the
+   corresponding Xlib functions do, but go through getWindowProperty */
+
+Status
+getWMNormalHints (CompDisplay *d,
+		  Window      id,
+		  XSizeHints  *hints,
+		  long	      *supplied)
+{
+    Atom	  actual;
+    int		  result, format;
+    unsigned long n, left;
+    unsigned char *data;
+    long	  *prop;
+
+    result = getWindowProperty (d, id, XA_WM_NORMAL_HINTS, 0L, 18L,
+				XA_WM_SIZE_HINTS, &actual, &format,
+				&n, &left, &data);
+    if (result != Success)
+	return 0;
+
+    if (actual != XA_WM_SIZE_HINTS || n < 15 || format != 32)
+    {
+	if (data)
+	    XFree (data);
+
+	return 0;
+    }
+
+    prop = (long *) data;
+
+    hints->flags	= prop[0] & (USPosition | USSize | PAllHints);
+    hints->x		= (int) prop[1];
+    hints->y		= (int) prop[2];
+    hints->width	= (int) prop[3];
+    hints->height	= (int) prop[4];
+    hints->min_width	= (int) prop[5];
+    hints->min_height	= (int) prop[6];
+    hints->max_width	= (int) prop[7];
+    hints->max_height	= (int) prop[8];
+    hints->width_inc	= (int) prop[9];
+    hints->height_inc	= (int) prop[10];
+    hints->min_aspect.x = (int) prop[11];
+    hints->min_aspect.y = (int) prop[12];
+    hints->max_aspect.x = (int) prop[13];
+    hints->max_aspect.y = (int) prop[14];
+
+    *supplied = USPosition | USSize | PAllHints;
+
+    if (n >= 18)
+    {
+	hints->base_width  = (int) prop[15];
+	hints->base_height = (int) prop[16];
+	hints->win_gravity = (int) prop[17];
+
+	hints->flags |= prop[0] & (PBaseSize | PWinGravity);
+	*supplied    |= PBaseSize | PWinGravity;
+    }
+
+    XFree (data);
+
+    return 1;
+}
+
+XWMHints *
+getWMHints (CompDisplay *d,
+	    Window	id)
+{
+    Atom	  actual;
+    int		  result, format;
+    unsigned long n, left;
+    unsigned char *data;
+    XWMHints	  *hints;
+    long	  *prop;
+
+    result = getWindowProperty (d, id, XA_WM_HINTS, 0L, 9L, XA_WM_HINTS,
+				&actual, &format, &n, &left, &data);
+    if (result != Success)
+	return NULL;
+
+    if (actual != XA_WM_HINTS || n < 8 || format != 32)
+    {
+	if (data)
+	    XFree (data);
+
+	return NULL;
+    }
+
+    hints = XAllocWMHints ();
+    if (hints)
+    {
+	prop = (long *) data;
+
+	hints->flags	     = prop[0];
+	hints->input	     = prop[1] ? True : False;
+	hints->initial_state = (int) prop[2];
+	hints->icon_pixmap   = prop[3];
+	hints->icon_window   = prop[4];
+	hints->icon_x	     = (int) prop[5];
+	hints->icon_y	     = (int) prop[6];
+	hints->icon_mask     = prop[7];
+	hints->window_group  = (n >= 9) ? prop[8] : 0;
+    }
+
+    XFree (data);
+
+    return hints;
+}
+
+Status
+getClassHint (CompDisplay *d,
+	      Window	  id,
+	      XClassHint  *classHint)
+{
+    Atom	  actual;
+    int		  result, format;
+    unsigned long n, left;
+    unsigned char *data;
+    int		  nameLength;
+
+    result = getWindowProperty (d, id, XA_WM_CLASS, 0L, BUFSIZ, XA_STRING,
+				&actual, &format, &n, &left, &data);
+    if (result != Success)
+	return 0;
+
+    if (actual != XA_STRING || format != 8)
+    {
+	if (data)
+	    XFree (data);
+
+	return 0;
+    }
+
+    nameLength = strlen ((char *) data);
+
+    classHint->res_name = strdup ((char *) data);
+
+    if (nameLength == n)
+	nameLength--;
+
+    classHint->res_class = strdup ((char *) data + nameLength + 1);
+
+    XFree (data);
+
+    return 1;
+}
+
+Status
+getTransientForHint (CompDisplay *d,
+		     Window	 id,
+		     Window	 *transientFor)
+{
+    Atom	  actual;
+    int		  result, format;
+    unsigned long n, left;
+    unsigned char *data;
+
+    *transientFor = None;
+
+    result = getWindowProperty (d, id, XA_WM_TRANSIENT_FOR, 0L, 1L,
+				XA_WINDOW, &actual, &format, &n, &left, &data);
+    if (result != Success)
+	return 0;
+
+    if (actual == XA_WINDOW && format == 32 && n)
+    {
+	memcpy (transientFor, data, sizeof (Window));
+	XFree (data);
+
+	return 1;
+    }
+
+    if (data)
+	XFree (data);
+
+    return 0;
+}
+
+Status
+getWMProtocols (CompDisplay *d,
+		Window	    id,
+		Atom	    **protocols,
+		int	    *count)
+{
+    Atom	  actual;
+    int		  result, format;
+    unsigned long n, left;
+    unsigned char *data;
+
+    result = getWindowProperty (d, id, d->wmProtocolsAtom, 0L, 1000000L,
+				XA_ATOM, &actual, &format, &n, &left, &data);
+    if (result != Success)
+	return 0;
+
+    if (actual != XA_ATOM || format != 32)
+    {
+	if (data)
+	    XFree (data);
+
+	return 0;
+    }
+
+    *protocols = (Atom *) data;
+    *count     = n;
+
+    return 1;
+}
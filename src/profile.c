@@ -0,0 +1,782 @@
+/*
+ * Copyright © 2026 Compiz developers
+ *
+ * Permission to use, copy, modify, distribute, and sell this software
+ * and its documentation for any purpose is hereby granted without
+ * fee, provided that the above copyright notice appear in all copies
+ * and that both that copyright notice and this permission notice
+ * appear in supporting documentation, and that the name of
+ * the copyright holders not be used in advertising or publicity
+ * pertaining to distribution of the software without specific,
+ * written prior permission. The copyright holders make no
+ * representations about the suitability of this software for any
+ * purpose. It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "../config.h"
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include <compiz-core.h>
+
+/*
+ * The paint profiler hooks into the WRAP and UNWRAP macros. A plugin
+ * function that is running calls UNWRAP right before it passes control
+ * to the next function in the chain and WRAP as soon as that function
+ * returns. The time between two such events is attributed to the
+ * function that must have been running in between:
+ *
+ * - UNWRAP (f) after UNWRAP (g): entry code of f, called by g's chain
+ * - WRAP (f) after UNWRAP (f): core's own implementation of the hook
+ * - WRAP (f) after WRAP (g): exit code of g, which returned to f
+ * - UNWRAP (f) after WRAP (g): the function g returned to
+ *
+ * Core can also mark work of its own between hooks, like swapping
+ * buffers, with profileCore.
+ *
+ * CPU time is taken from the monotonic clock and GPU time from
+ * timestamp queries when GL_ARB_timer_query is available. GPU results
+ * are read back one frame late so that the profiler never stalls the
+ * pipeline.
+ */
+
+#define PROFILE_HASH_SIZE	    64
+#define PROFILE_STACK_SIZE	    64
+#define PROFILE_MAX_EVENTS	    1024
+#define PROFILE_HISTOGRAM_SIZE	    16
+#define PROFILE_HISTOGRAM_MIN_USEC  16
+
+typedef struct _CompProfileEntry {
+    struct _CompProfileEntry *next;
+
+    FuncPtr    func;
+    const char *hook;
+
+    unsigned int calls;
+
+    double	 cpuFrameTime;
+    unsigned int cpuFrames;
+    double	 cpuTotalTime;
+    double	 cpuMaxTime;
+    unsigned int cpuHistogram[PROFILE_HISTOGRAM_SIZE];
+
+    double	 gpuFrameTime;
+    unsigned int gpuFrames;
+    double	 gpuTotalTime;
+    double	 gpuMaxTime;
+    unsigned int gpuHistogram[PROFILE_HISTOGRAM_SIZE];
+} CompProfileEntry;
+
+typedef struct _CompProfileLog {
+    GLuint	     query[PROFILE_MAX_EVENTS];
+    CompProfileEntry *owner[PROFILE_MAX_EVENTS];
+    int		     nEvent;
+    Bool	     pending;
+} CompProfileLog;
+
+struct _CompPaintProfile {
+    CompProfileLog log[2];
+    int		   current;
+    Bool	   hasQueries;
+};
+
+typedef enum {
+    ProfileEventNone = 0,
+    ProfileEventUnwrap,
+    ProfileEventWrap,
+    ProfileEventCore
+} ProfileEventType;
+
+Bool paintProfileActive = FALSE;
+
+static CompProfileEntry *profileHash[PROFILE_HASH_SIZE];
+static CompProfileEntry *coreEntries = NULL;
+static CompProfileEntry otherEntry = { NULL, NULL, "other" };
+
+static CompScreen	*profileScreen = NULL;
+static double		lastEventTime;
+static ProfileEventType lastEventType;
+static CompProfileEntry *lastEntry;
+
+static CompProfileEntry *stack[PROFILE_STACK_SIZE];
+static int		stackDepth;
+
+static unsigned int nProfiledFrames = 0;
+
+static double
+getProfileTime (void)
+{
+    struct timeval tv;
+
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+#endif
+
+    gettimeofday (&tv, 0);
+
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+static CompProfileEntry *
+allocProfileEntry (FuncPtr    func,
+		   const char *hook)
+{
+    CompProfileEntry *e;
+
+    e = calloc (1, sizeof (CompProfileEntry));
+    if (!e)
+	return &otherEntry;
+
+    e->func = func;
+    e->hook = hook;
+
+    return e;
+}
+
+static CompProfileEntry *
+findFuncEntry (FuncPtr	  func,
+	       const char *hook)
+{
+    CompProfileEntry *e;
+    unsigned int     i;
+
+    i = ((unsigned long) func >> 4) % PROFILE_HASH_SIZE;
+
+    for (e = profileHash[i]; e; e = e->next)
+	if (e->func == func)
+	    return e;
+
+    e = allocProfileEntry (func, hook);
+    if (e != &otherEntry)
+    {
+	e->next = profileHash[i];
+	profileHash[i] = e;
+    }
+
+    return e;
+}
+
+/* time spent in the hook implementation at the bottom of the chain */
+static CompProfileEntry *
+findCoreEntry (const char *hook)
+{
+    CompProfileEntry *e;
+
+    for (e = coreEntries; e; e = e->next)
+	if (strcmp (e->hook, hook) == 0)
+	    return e;
+
+    e = allocProfileEntry (NULL, hook);
+    if (e != &otherEntry)
+    {
+	e->next = coreEntries;
+	coreEntries = e;
+    }
+
+    return e;
+}
+
+static void
+addProfileEvent (CompProfileEntry *owner)
+{
+    CompPaintProfile *p = profileScreen->paintProfile;
+    double	     now;
+
+    now = getProfileTime ();
+
+    owner->cpuFrameTime += now - lastEventTime;
+    lastEventTime = now;
+
+    if (p && p->hasQueries)
+    {
+	CompProfileLog *log = &p->log[p->current];
+
+	/* drop the GPU timings of this frame if it has more events
+	   than we have queries for */
+	if (log->nEvent < PROFILE_MAX_EVENTS)
+	{
+	    (*profileScreen->queryCounter) (log->query[log->nEvent],
+					    GL_TIMESTAMP);
+	    log->owner[log->nEvent++] = owner;
+	}
+	else
+	{
+	    log->nEvent = PROFILE_MAX_EVENTS + 1;
+	}
+    }
+}
+
+void
+profileUnwrap (FuncPtr	  func,
+	       const char *hook)
+{
+    CompProfileEntry *e, *owner;
+
+    e = findFuncEntry (func, hook);
+
+    switch (lastEventType) {
+    case ProfileEventUnwrap:
+	owner = e;
+	break;
+    case ProfileEventWrap:
+	owner = stackDepth ? stack[stackDepth - 1] : &otherEntry;
+	break;
+    case ProfileEventCore:
+	owner = lastEntry;
+	break;
+    default:
+	owner = &otherEntry;
+	break;
+    }
+
+    addProfileEvent (owner);
+
+    e->calls++;
+
+    if (stackDepth < PROFILE_STACK_SIZE)
+	stack[stackDepth++] = e;
+
+    lastEventType = ProfileEventUnwrap;
+    lastEntry     = e;
+}
+
+void
+profileWrap (FuncPtr	func,
+	     const char *hook)
+{
+    CompProfileEntry *owner;
+    int		     i;
+
+    /* ignore WRAP calls that don't complete a previous UNWRAP, like
+       the ones done when a plugin is initialized */
+    for (i = stackDepth - 1; i >= 0; i--)
+	if (stack[i]->func == func)
+	    break;
+
+    if (i < 0)
+	return;
+
+    if (lastEventType == ProfileEventWrap || lastEventType == ProfileEventCore)
+	owner = lastEntry;
+    else
+	owner = findCoreEntry (hook);
+
+    addProfileEvent (owner);
+
+    stackDepth = i;
+
+    lastEventType = ProfileEventWrap;
+    lastEntry     = stack[i];
+}
+
+static CompProfileEntry *
+getCurrentOwner (void)
+{
+    switch (lastEventType) {
+    case ProfileEventWrap:
+	if (stackDepth)
+	    return stack[stackDepth - 1];
+	break;
+    case ProfileEventCore:
+	return lastEntry;
+    default:
+	break;
+    }
+
+    return &otherEntry;
+}
+
+/* attributes the time until the next event to core's entry for name */
+void
+profileCore (const char *name)
+{
+    if (!paintProfileActive)
+	return;
+
+    addProfileEvent (getCurrentOwner ());
+
+    lastEventType = ProfileEventCore;
+    lastEntry     = findCoreEntry (name);
+}
+
+static int
+histogramBucket (double usec)
+{
+    int i = 0;
+
+    while (usec >= PROFILE_HISTOGRAM_MIN_USEC &&
+	   i < PROFILE_HISTOGRAM_SIZE - 1)
+    {
+	usec /= 2.0;
+	i++;
+    }
+
+    return i;
+}
+
+static void
+forEachProfileEntry (void (*proc) (CompProfileEntry *e))
+{
+    CompProfileEntry *e, *next;
+    int		     i;
+
+    for (i = 0; i < PROFILE_HASH_SIZE; i++)
+    {
+	for (e = profileHash[i]; e; e = next)
+	{
+	    next = e->next;
+	    (*proc) (e);
+	}
+    }
+
+    for (e = coreEntries; e; e = next)
+    {
+	next = e->next;
+	(*proc) (e);
+    }
+
+    (*proc) (&otherEntry);
+}
+
+static void
+accumulateCpuTime (CompProfileEntry *e)
+{
+    if (e->cpuFrameTime <= 0.0)
+	return;
+
+    e->cpuFrames++;
+    e->cpuTotalTime += e->cpuFrameTime;
+    if (e->cpuFrameTime > e->cpuMaxTime)
+	e->cpuMaxTime = e->cpuFrameTime;
+
+    e->cpuHistogram[histogramBucket (e->cpuFrameTime)]++;
+
+    e->cpuFrameTime = 0.0;
+}
+
+static void
+accumulateGpuTime (CompProfileEntry *e)
+{
+    if (e->gpuFrameTime <= 0.0)
+	return;
+
+    e->gpuFrames++;
+    e->gpuTotalTime += e->gpuFrameTime;
+    if (e->gpuFrameTime > e->gpuMaxTime)
+	e->gpuMaxTime = e->gpuFrameTime;
+
+    e->gpuHistogram[histogramBucket (e->gpuFrameTime)]++;
+
+    e->gpuFrameTime = 0.0;
+}
+
+static void
+readProfileLog (CompScreen     *s,
+		CompProfileLog *log)
+{
+    uint64_t timestamp, lastTimestamp;
+    GLint    available = 0;
+    int	     i;
+
+    if (!log->pending)
+	return;
+
+    log->pending = FALSE;
+
+    if (log->nEvent < 2 || log->nEvent > PROFILE_MAX_EVENTS)
+	return;
+
+    /* results that are not ready yet are dropped instead of waited for */
+    (*s->getQueryObjectiv) (log->query[log->nEvent - 1],
+			    GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+	return;
+
+    (*s->getQueryObjectui64v) (log->query[0], GL_QUERY_RESULT,
+			       &lastTimestamp);
+
+    for (i = 1; i < log->nEvent; i++)
+    {
+	(*s->getQueryObjectui64v) (log->query[i], GL_QUERY_RESULT,
+				   &timestamp);
+
+	if (timestamp > lastTimestamp)
+	    log->owner[i]->gpuFrameTime +=
+		(double) (timestamp - lastTimestamp) / 1000.0;
+
+	lastTimestamp = timestamp;
+    }
+
+    forEachProfileEntry (accumulateGpuTime);
+}
+
+static CompPaintProfile *
+getPaintProfile (CompScreen *s)
+{
+    CompPaintProfile *p;
+
+    if (s->paintProfile)
+	return s->paintProfile;
+
+    p = calloc (1, sizeof (CompPaintProfile));
+    if (!p)
+	return NULL;
+
+    if (s->timerQuery)
+    {
+	(*s->genQueries) (PROFILE_MAX_EVENTS, p->log[0].query);
+	(*s->genQueries) (PROFILE_MAX_EVENTS, p->log[1].query);
+
+	p->hasQueries = TRUE;
+    }
+
+    s->paintProfile = p;
+
+    return p;
+}
+
+void
+beginPaintProfile (CompScreen *s)
+{
+    CompPaintProfile *p;
+
+    if (!s->display->opt[COMP_DISPLAY_OPTION_PAINT_PROFILE].value.b)
+	return;
+
+    p = getPaintProfile (s);
+    if (p)
+    {
+	/* the previous user of this log is two frames old by now */
+	readProfileLog (s, &p->log[p->current]);
+	p->log[p->current].nEvent = 0;
+    }
+
+    profileScreen = s;
+    stackDepth    = 0;
+    lastEventType = ProfileEventNone;
+    lastEntry     = NULL;
+    lastEventTime = getProfileTime ();
+
+    paintProfileActive = TRUE;
+
+    /* time stamp for the start of the frame */
+    addProfileEvent (&otherEntry);
+}
+
+void
+endPaintProfile (CompScreen *s)
+{
+    CompPaintProfile *p = s->paintProfile;
+
+    if (!paintProfileActive)
+	return;
+
+    addProfileEvent (getCurrentOwner ());
+
+    paintProfileActive = FALSE;
+    profileScreen      = NULL;
+
+    forEachProfileEntry (accumulateCpuTime);
+
+    if (p && p->hasQueries)
+    {
+	p->log[p->current].pending = TRUE;
+	p->current = !p->current;
+
+	readProfileLog (s, &p->log[p->current]);
+    }
+
+    nProfiledFrames++;
+}
+
+void
+finiPaintProfile (CompScreen *s)
+{
+    CompPaintProfile *p = s->paintProfile;
+
+    if (!p)
+	return;
+
+    if (p->hasQueries)
+    {
+	(*s->deleteQueries) (PROFILE_MAX_EVENTS, p->log[0].query);
+	(*s->deleteQueries) (PROFILE_MAX_EVENTS, p->log[1].query);
+    }
+
+    free (p);
+
+    s->paintProfile = NULL;
+}
+
+static const char *
+getFuncOwnerName (FuncPtr func)
+{
+    CompPlugin *p;
+    Dl_info    funcInfo, pluginInfo;
+
+    if (!func)
+	return "core";
+
+    if (!dladdr ((void *) func, &funcInfo))
+	return "unknown";
+
+    for (p = getPlugins (); p; p = p->next)
+    {
+	if (!dladdr ((void *) p->vTable, &pluginInfo))
+	    continue;
+
+	if (pluginInfo.dli_fbase == funcInfo.dli_fbase)
+	    return p->vTable->name;
+    }
+
+    if (funcInfo.dli_fname)
+    {
+	const char *name = strrchr (funcInfo.dli_fname, '/');
+
+	return name ? name + 1 : funcInfo.dli_fname;
+    }
+
+    return "unknown";
+}
+
+static FILE *profileFile;
+
+static void
+profilePrintf (const char *format,
+	       ...)
+{
+    va_list args;
+    char    line[1024];
+
+    va_start (args, format);
+    vsnprintf (line, sizeof (line), format, args);
+    va_end (args);
+
+    if (profileFile)
+	fprintf (profileFile, "%s\n", line);
+    else
+	compLogMessage ("core", CompLogLevelInfo, "%s", line);
+}
+
+static void
+printHistogram (const char	   *name,
+		const unsigned int *histogram)
+{
+    char line[512];
+    int  i, len = 0;
+
+    for (i = 0; i < PROFILE_HISTOGRAM_SIZE; i++)
+    {
+	if (!histogram[i])
+	    continue;
+
+	if (i == PROFILE_HISTOGRAM_SIZE - 1)
+	    len += snprintf (line + len, sizeof (line) - len, " >=%d:%u",
+			     PROFILE_HISTOGRAM_MIN_USEC << (i - 1),
+			     histogram[i]);
+	else
+	    len += snprintf (line + len, sizeof (line) - len, " <%d:%u",
+			     PROFILE_HISTOGRAM_MIN_USEC << i, histogram[i]);
+
+	if (len >= (int) sizeof (line))
+	    break;
+    }
+
+    if (len)
+	profilePrintf ("    %s usec/frame:%s", name, line);
+}
+
+static void
+printProfileEntry (CompProfileEntry *e)
+{
+    if (!e->cpuFrames && !e->gpuFrames)
+	return;
+
+    profilePrintf ("%-16s %-28s %8u %10.1f %10.1f %10.1f %10.1f",
+		   e == &otherEntry ? "core" : getFuncOwnerName (e->func),
+		   e->hook ? e->hook : "",
+		   e->calls,
+		   nProfiledFrames ? e->cpuTotalTime / nProfiledFrames : 0.0,
+		   e->cpuMaxTime,
+		   nProfiledFrames ? e->gpuTotalTime / nProfiledFrames : 0.0,
+		   e->gpuMaxTime);
+
+    printHistogram ("cpu", e->cpuHistogram);
+    printHistogram ("gpu", e->gpuHistogram);
+}
+
+static void
+resetProfileEntry (CompProfileEntry *e)
+{
+    e->calls = 0;
+
+    e->cpuFrames    = 0;
+    e->cpuTotalTime = 0.0;
+    e->cpuMaxTime   = 0.0;
+    memset (e->cpuHistogram, 0, sizeof (e->cpuHistogram));
+
+    e->gpuFrames    = 0;
+    e->gpuTotalTime = 0.0;
+    e->gpuMaxTime   = 0.0;
+    memset (e->gpuHistogram, 0, sizeof (e->gpuHistogram));
+}
+
+static void
+printFragmentProgramStats (void)
+{
+    CompDisplay *d;
+    CompScreen  *s;
+
+    for (d = core.displays; d; d = d->next)
+    {
+	for (s = d->screens; s; s = s->next)
+	{
+	    unsigned int misses = s->fragmentProgramMisses;
+
+	    profilePrintf ("screen %d fragment programs: %d cached, "
+			   "%u hits, %u misses, %u evictions, "
+			   "compile avg %.1f max %d usec",
+			   s->screenNum, s->nFragmentProgram,
+			   s->fragmentProgramHits, misses,
+			   s->fragmentProgramEvictions,
+			   misses ? (double) s->fragmentProgramCompileTime /
+			   misses : 0.0,
+			   s->fragmentProgramMaxCompileTime);
+	}
+    }
+}
+
+static void
+printPropertyUpdateStats (void)
+{
+    CompDisplay *d;
+
+    for (d = core.displays; d; d = d->next)
+    {
+	unsigned int saved = 0;
+
+	if (d->propertyEvents > d->propertyUpdates)
+	    saved = d->propertyEvents - d->propertyUpdates;
+
+	profilePrintf ("property updates: %u events, %u fetched, "
+		       "%u round-trips saved",
+		       d->propertyEvents, d->propertyUpdates, saved);
+    }
+}
+
+static void
+printRepaintStats (void)
+{
+    CompDisplay *d;
+    CompScreen  *s;
+
+    for (d = core.displays; d; d = d->next)
+    {
+	for (s = d->screens; s; s = s->next)
+	{
+	    profilePrintf ("screen %d repaint: %u frames, "
+			   "avg %.0f max %d pixels/frame, "
+			   "buffer age %s: %u partial, %u full",
+			   s->screenNum, s->repaintFrames,
+			   s->repaintFrames ? s->repaintArea /
+			   s->repaintFrames : 0.0,
+			   s->maxRepaintArea,
+			   s->bufferAge ? "supported" : "unsupported",
+			   s->bufferAgeFrames, s->bufferAgeFullFrames);
+	}
+    }
+}
+
+static void
+printFrameTimingStats (void)
+{
+    CompDisplay *d;
+    CompScreen  *s;
+    int		i, n, paintTime, swapTime, maxSwapTime;
+
+    for (d = core.displays; d; d = d->next)
+    {
+	for (s = d->screens; s; s = s->next)
+	{
+	    paintTime = swapTime = maxSwapTime = 0;
+
+	    n = MIN (s->frameCount, FRAME_HISTORY_SIZE);
+	    for (i = 0; i < n; i++)
+	    {
+		paintTime += s->paintTimeHistory[i];
+		swapTime  += s->swapTimeHistory[i];
+
+		maxSwapTime = MAX (maxSwapTime, s->swapTimeHistory[i]);
+	    }
+
+	    profilePrintf ("screen %d frames: %u presented, %u missed, "
+			   "predicted paint %d msec, last %d frames "
+			   "paint avg %d usec, swap avg %d max %d usec",
+			   s->screenNum, s->frameCount, s->missedFrameCount,
+			   s->predictedPaintTime, n,
+			   n ? paintTime / n : 0, n ? swapTime / n : 0,
+			   maxSwapTime);
+	}
+    }
+}
+
+/* writes the collected statistics to file, or to the log if no file is
+   given, and starts collecting from scratch */
+Bool
+writePaintProfile (const char *file)
+{
+    profileFile = NULL;
+
+    if (file && *file)
+    {
+	profileFile = fopen (file, "a");
+	if (!profileFile)
+	{
+	    compLogMessage ("core", CompLogLevelWarn,
+			    "Couldn't open paint profile file: %s", file);
+	    return FALSE;
+	}
+    }
+
+    profilePrintf ("paint profile: %u frames", nProfiledFrames);
+    profilePrintf ("%-16s %-28s %8s %10s %10s %10s %10s",
+		   "plugin", "hook", "calls", "cpu avg", "cpu max",
+		   "gpu avg", "gpu max");
+
+    forEachProfileEntry (printProfileEntry);
+    forEachProfileEntry (resetProfileEntry);
+
+    printFragmentProgramStats ();
+    printPropertyUpdateStats ();
+    printRepaintStats ();
+    printFrameTimingStats ();
+
+    nProfiledFrames = 0;
+
+    if (profileFile)
+    {
+	fclose (profileFile);
+	profileFile = NULL;
+    }
+
+    return TRUE;
+}
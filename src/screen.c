@@ -49,6 +49,8 @@
 
 #define NUM_OPTIONS(s) (sizeof ((s)->opt) / sizeof (CompOption))
 
+#define WINDOW_HASH_MIN_SIZE 64
+
 static int
 reallocScreenPrivate (int  size,
 		      void *closure)
@@ -644,7 +646,9 @@ const CompMetadataOptionInfo coreScreenOptionInfo[COMP_SCREEN_OPTION_NUM] = {
       RESTOSTRING (0, FOCUS_PREVENTION_LEVEL_LAST), 0, 0 },
     { "focus_prevention_match", "match", 0, 0, 0 },
     { "texture_compression", "bool", 0, 0, 0 },
-    { "force_independent_output_painting", "bool", 0, 0, 0 }
+    { "force_independent_output_painting", "bool", 0, 0, 0 },
+    { "damage_rect_budget", "int", "<min>1</min><max>10000</max>", 0, 0 },
+    { "buffer_age", "bool", 0, 0, 0 }
 };
 
 static void
@@ -1581,12 +1585,25 @@ freeScreen (CompScreen *s)
     if (s->damage)
 	XDestroyRegion (s->damage);
 
+    if (s->occlusion)
+	XDestroyRegion (s->occlusion);
+
+    for (i = 0; i < BUFFER_AGE_HISTORY; i++)
+	if (s->damageHistory[i])
+	    XDestroyRegion (s->damageHistory[i]);
+
     if (s->grabs)
 	free (s->grabs);
 
     if (s->exposeRects)
 	free (s->exposeRects);
 
+    if (s->windowHash)
+	free (s->windowHash);
+
+    if (s->frameHash)
+	free (s->frameHash);
+
     /* XXX: Maybe we should free all fragment functions here? But
        the definition of CompFunction is private to fragment.c ... */
     for (i = 0; i < 2; i++)
@@ -1669,6 +1686,33 @@ addScreen (CompDisplay *display,
     if (!s->damage)
 	return FALSE;
 
+    s->occlusion = XCreateRegion ();
+    if (!s->occlusion)
+	return FALSE;
+
+    for (i = 0; i < BUFFER_AGE_HISTORY; i++)
+    {
+	s->damageHistory[i] = XCreateRegion ();
+	if (!s->damageHistory[i])
+	    return FALSE;
+    }
+
+    s->damageHistoryIndex  = 0;
+    s->damageHistoryCount  = 0;
+    s->bufferAgeFrames	   = 0;
+    s->bufferAgeFullFrames = 0;
+    s->repaintFrames	   = 0;
+    s->repaintArea	   = 0.0;
+    s->maxRepaintArea	   = 0;
+
+    s->occlusionValid		 = FALSE;
+    s->occlusionSerial		 = 0;
+    s->occlusionFullscreenWindow = NULL;
+    s->occlusionWalkLast	 = NULL;
+    s->occlusionWalkPrev	 = NULL;
+    s->occlusionOffsetX		 = 0;
+    s->occlusionOffsetY		 = 0;
+
     s->x     = 0;
     s->y     = 0;
     s->hsize = s->opt[COMP_SCREEN_OPTION_HSIZE].value.i;
@@ -1737,6 +1781,17 @@ addScreen (CompDisplay *display,
     s->windows = 0;
     s->reverseWindows = 0;
 
+    s->windowHash = calloc (WINDOW_HASH_MIN_SIZE, sizeof (CompWindow *));
+    if (!s->windowHash)
+	return FALSE;
+
+    s->frameHash = calloc (WINDOW_HASH_MIN_SIZE, sizeof (CompWindow *));
+    if (!s->frameHash)
+	return FALSE;
+
+    s->windowHashSize = WINDOW_HASH_MIN_SIZE;
+    s->nHashedWindows = 0;
+
     s->nextRedraw  = 0;
     s->frameStatus = 0;
     s->timeMult    = 1;
@@ -1748,7 +1803,21 @@ addScreen (CompDisplay *display,
     s->lastFunctionId = 0;
 
     s->fragmentFunctions = NULL;
-    s->fragmentPrograms = NULL;
+
+    s->fragmentPrograms		     = NULL;
+    s->lastFragmentProgram	     = NULL;
+    s->nFragmentProgram		     = 0;
+    s->fragmentProgramHits	     = 0;
+    s->fragmentProgramMisses	     = 0;
+    s->fragmentProgramEvictions	     = 0;
+    s->fragmentProgramCompileTime    = 0;
+    s->fragmentProgramMaxCompileTime = 0;
+
+    memset (s->fragmentProgramHash, 0, sizeof (s->fragmentProgramHash));
+
+    s->storedFragmentPrograms	    = NULL;
+    s->fragmentProgramPrewarmHandle = 0;
+    s->fragmentProgramDriver	    = NULL;
 
     memset (s->saturateFunction, 0, sizeof (s->saturateFunction));
 
@@ -1766,7 +1835,17 @@ addScreen (CompDisplay *display,
 
     s->clearBuffers = TRUE;
 
-    gettimeofday (&s->lastRedraw, 0);
+    compGetCurrentTime (&s->lastRedraw);
+    s->lastSwap = s->lastRedraw;
+
+    memset (s->paintTimeHistory, 0, sizeof (s->paintTimeHistory));
+    memset (s->swapTimeHistory, 0, sizeof (s->swapTimeHistory));
+    s->frameHistoryIndex  = 0;
+    s->predictedPaintTime = 0;
+    s->frameCount	  = 0;
+    s->missedFrameCount   = 0;
+
+    s->paintProfile = NULL;
 
     s->preparePaintScreen	   = preparePaintScreen;
     s->donePaintScreen		   = donePaintScreen;
@@ -1951,6 +2030,10 @@ addScreen (CompDisplay *display,
 	s->copySubBuffer = (GLXCopySubBufferProc)
 	    getProcAddress (s, "glXCopySubBufferMESA");
 
+    s->bufferAge = 0;
+    if (strstr (glxExtensions, "GLX_EXT_buffer_age"))
+	s->bufferAge = 1;
+
     s->getVideoSync = NULL;
     s->waitVideoSync = NULL;
     if (strstr (glxExtensions, "GLX_SGI_video_sync"))
@@ -2087,6 +2170,71 @@ addScreen (CompDisplay *display,
 	    s->fbo = 1;
     }
 
+    s->vbo = 0;
+    if (strstr (glExtensions, "GL_ARB_vertex_buffer_object"))
+    {
+	s->genBuffers = (GLGenBuffersProc)
+	    getProcAddress (s, "glGenBuffersARB");
+	s->deleteBuffers = (GLDeleteBuffersProc)
+	    getProcAddress (s, "glDeleteBuffersARB");
+	s->bindBuffer = (GLBindBufferProc)
+	    getProcAddress (s, "glBindBufferARB");
+	s->bufferData = (GLBufferDataProc)
+	    getProcAddress (s, "glBufferDataARB");
+	s->bufferSubData = (GLBufferSubDataProc)
+	    getProcAddress (s, "glBufferSubDataARB");
+
+	if (s->genBuffers    &&
+	    s->deleteBuffers &&
+	    s->bindBuffer    &&
+	    s->bufferData    &&
+	    s->bufferSubData)
+	    s->vbo = 1;
+    }
+
+    s->geometryBuffer	    = 0;
+    s->geometryBufferSize   = 0;
+    s->geometryBufferUsed   = 0;
+    s->geometryBufferLive   = 0;
+    s->geometryBufferSerial = 1;
+
+    s->pbo = 0;
+    if (s->vbo && strstr (glExtensions, "GL_ARB_pixel_buffer_object"))
+    {
+	s->mapBuffer = (GLMapBufferProc)
+	    getProcAddress (s, "glMapBufferARB");
+	s->unmapBuffer = (GLUnmapBufferProc)
+	    getProcAddress (s, "glUnmapBufferARB");
+
+	if (s->mapBuffer &&
+	    s->unmapBuffer)
+	    s->pbo = 1;
+    }
+
+    s->timerQuery = 0;
+    if (strstr (glExtensions, "GL_ARB_timer_query"))
+    {
+	s->genQueries = (GLGenQueriesProc)
+	    getProcAddress (s, "glGenQueries");
+	s->deleteQueries = (GLDeleteQueriesProc)
+	    getProcAddress (s, "glDeleteQueries");
+	s->queryCounter = (GLQueryCounterProc)
+	    getProcAddress (s, "glQueryCounter");
+	s->getQueryObjectiv = (GLGetQueryObjectivProc)
+	    getProcAddress (s, "glGetQueryObjectiv");
+	s->getQueryObjectui64v = (GLGetQueryObjectui64vProc)
+	    getProcAddress (s, "glGetQueryObjectui64v");
+
+	if (s->genQueries	&&
+	    s->deleteQueries	&&
+	    s->queryCounter	&&
+	    s->getQueryObjectiv &&
+	    s->getQueryObjectui64v)
+	    s->timerQuery = 1;
+    }
+
+    loadFragmentProgramCache (s);
+
     s->textureCompression = 0;
     if (strstr (glExtensions, "GL_ARB_texture_compression"))
 	s->textureCompression = 1;
@@ -2300,9 +2448,13 @@ addScreen (CompDisplay *display,
 		&rootReturn, &parentReturn,
 		&children, &nchildren);
 
+    prefetchWindows (display, children, nchildren);
+
     for (i = 0; i < nchildren; i++)
 	addWindow (s, children[i], i ? children[i - 1] : 0);
 
+    releasePrefetchedWindows (display);
+
     for (w = s->windows; w; w = w->next)
     {
 	if (w->attrib.map_state == IsViewable)
@@ -2406,6 +2558,12 @@ removeScreen (CompScreen *s)
 	free (s->defaultIcon);
     }
 
+    if (s->geometryBuffer)
+	(*s->deleteBuffers) (1, &s->geometryBuffer);
+
+    finiPaintProfile (s);
+    finiFragmentPrograms (s);
+
     glXDestroyContext (d->display, s->ctx);
 
     XFreeCursor (d->display, s->invisibleCursor);
@@ -2418,10 +2576,186 @@ removeScreen (CompScreen *s)
     freeScreen (s);
 }
 
+/* amount of overdraw, in pixels, that costs about as much as painting
+   and copying one more damage rectangle */
+#define DAMAGE_RECT_COST 4096
+
+int
+regionArea (Region region)
+{
+    int i, area = 0;
+
+    for (i = 0; i < region->numRects; i++)
+	area += (region->rects[i].x2 - region->rects[i].x1) *
+	    (region->rects[i].y2 - region->rects[i].y1);
+
+    return area;
+}
+
+/* joins boxes within a band when the gap between them is cheaper to
+   paint than an extra rectangle */
+static void
+mergeDamageBands (Region damage,
+		  Region result)
+{
+    XRectangle rect;
+    BOX	       box, *pBox = damage->rects;
+    int	       i, gap;
+
+    EMPTY_REGION (result);
+
+    if (!damage->numRects)
+	return;
+
+    box = pBox[0];
+
+    for (i = 1; i <= damage->numRects; i++)
+    {
+	if (i < damage->numRects &&
+	    pBox[i].y1 == box.y1 &&
+	    pBox[i].y2 == box.y2)
+	{
+	    gap = (pBox[i].x1 - box.x2) * (box.y2 - box.y1);
+	    if (gap <= DAMAGE_RECT_COST)
+	    {
+		box.x2 = pBox[i].x2;
+		continue;
+	    }
+	}
+
+	rect.x	    = box.x1;
+	rect.y	    = box.y1;
+	rect.width  = box.x2 - box.x1;
+	rect.height = box.y2 - box.y1;
+
+	XUnionRectWithRegion (&rect, result, result);
+
+	if (i < damage->numRects)
+	    box = pBox[i];
+    }
+}
+
+typedef struct _DamageOutputCost {
+    int output;
+    int overdraw;
+    int saved;
+} DamageOutputCost;
+
+/* outputs with the least overdraw per rectangle saved come first,
+   outputs where nothing can be saved last */
+static int
+compareDamageOutputCost (const void *c1,
+			 const void *c2)
+{
+    const DamageOutputCost *a = c1;
+    const DamageOutputCost *b = c2;
+    double		   costA, costB;
+
+    if (!a->saved || !b->saved)
+	return !a->saved - !b->saved;
+
+    costA = (double) a->overdraw / a->saved;
+    costB = (double) b->overdraw / b->saved;
+
+    if (costA < costB)
+	return -1;
+
+    return costA > costB;
+}
+
+/* brings the number of damage rectangles back well below the budget,
+   first by merging neighbouring boxes and then by replacing the
+   damage on each output with its bounding box, starting with the
+   outputs where that adds the least overdraw per rectangle saved */
+static void
+coarsenScreenDamage (CompScreen *s,
+		     int	budget)
+{
+    DamageOutputCost *cost;
+    Region	     merged, part, result;
+    int		     i, n, target = MAX (budget / 2, 1);
+
+    merged = XCreateRegion ();
+    part   = XCreateRegion ();
+    result = XCreateRegion ();
+    cost   = malloc (sizeof (DamageOutputCost) * s->nOutputDev);
+
+    if (!merged || !part || !result || !cost)
+    {
+	damageScreen (s);
+    }
+    else
+    {
+	mergeDamageBands (s->damage, merged);
+
+	n = merged->numRects;
+	if (n <= target)
+	{
+	    XUnionRegion (merged, &emptyRegion, s->damage);
+	}
+	else
+	{
+	    XRectangle rect;
+
+	    for (i = 0; i < s->nOutputDev; i++)
+	    {
+		XIntersectRegion (merged, &s->outputDev[i].region, part);
+
+		cost[i].output	 = i;
+		cost[i].saved	 = MAX (part->numRects - 1, 0);
+		cost[i].overdraw = (part->extents.x2 - part->extents.x1) *
+		    (part->extents.y2 - part->extents.y1) - regionArea (part);
+	    }
+
+	    qsort (cost, s->nOutputDev, sizeof (DamageOutputCost),
+		   compareDamageOutputCost);
+
+	    for (i = 0; i < s->nOutputDev; i++)
+	    {
+		XIntersectRegion (merged, &s->outputDev[cost[i].output].region,
+				  part);
+
+		if (cost[i].saved &&
+		    (n > target ||
+		     cost[i].overdraw <= cost[i].saved * DAMAGE_RECT_COST))
+		{
+		    rect.x	= part->extents.x1;
+		    rect.y	= part->extents.y1;
+		    rect.width  = part->extents.x2 - part->extents.x1;
+		    rect.height = part->extents.y2 - part->extents.y1;
+
+		    n -= cost[i].saved;
+
+		    EMPTY_REGION (part);
+		    XUnionRectWithRegion (&rect, part, part);
+		}
+
+		XUnionRegion (part, result, result);
+	    }
+
+	    XUnionRegion (result, &emptyRegion, s->damage);
+
+	    if (s->damage->numRects > budget)
+		damageScreen (s);
+	}
+    }
+
+    if (merged)
+	XDestroyRegion (merged);
+    if (part)
+	XDestroyRegion (part);
+    if (result)
+	XDestroyRegion (result);
+    if (cost)
+	free (cost);
+}
+
 void
 damageScreenRegion (CompScreen *screen,
 		    Region     region)
 {
+    int budget;
+
     if (screen->damageMask & COMP_SCREEN_DAMAGE_ALL_MASK)
 	return;
 
@@ -2431,15 +2765,18 @@ damageScreenRegion (CompScreen *screen,
 
     /* if the number of damage rectangles grows two much between repaints,
        we have a lot of overhead just for doing the damage tracking -
-       in order to make sure we're not having too much overhead, damage
-       the whole screen if we have a lot of damage rects */
-    if (screen->damage->numRects > 100)
-	damageScreen (screen);
+       in order to make sure we're not having too much overhead, coarsen
+       the damage once it has more rectangles than allowed */
+    budget = screen->opt[COMP_SCREEN_OPTION_DAMAGE_RECT_BUDGET].value.i;
+    if (screen->damage->numRects > budget)
+	coarsenScreenDamage (screen, budget);
 }
 
 void
 damageScreen (CompScreen *s)
 {
+    invalidateScreenOcclusion (s);
+
     s->damageMask |= COMP_SCREEN_DAMAGE_ALL_MASK;
     s->damageMask &= ~COMP_SCREEN_DAMAGE_REGION_MASK;
 }
@@ -2543,6 +2880,137 @@ focusDefaultWindow (CompScreen *s)
     }
 }
 
+static unsigned int
+windowHashIndex (CompScreen *s,
+		 Window     id)
+{
+    return (id ^ (id >> 11) ^ (id >> 21)) & (s->windowHashSize - 1);
+}
+
+static Bool
+resizeWindowHash (CompScreen   *s,
+		  unsigned int size)
+{
+    CompWindow	 **windowHash, **frameHash, *w, *next;
+    unsigned int oldSize, i;
+
+    windowHash = calloc (size, sizeof (CompWindow *));
+    if (!windowHash)
+	return FALSE;
+
+    frameHash = calloc (size, sizeof (CompWindow *));
+    if (!frameHash)
+    {
+	free (windowHash);
+	return FALSE;
+    }
+
+    oldSize = s->windowHashSize;
+    s->windowHashSize = size;
+
+    for (i = 0; i < oldSize; i++)
+    {
+	for (w = s->windowHash[i]; w; w = next)
+	{
+	    next = w->hashNext;
+
+	    w->hashNext = windowHash[windowHashIndex (s, w->id)];
+	    windowHash[windowHashIndex (s, w->id)] = w;
+	}
+
+	for (w = s->frameHash[i]; w; w = next)
+	{
+	    next = w->frameHashNext;
+
+	    w->frameHashNext = frameHash[windowHashIndex (s, w->frame)];
+	    frameHash[windowHashIndex (s, w->frame)] = w;
+	}
+    }
+
+    free (s->windowHash);
+    free (s->frameHash);
+
+    s->windowHash = windowHash;
+    s->frameHash  = frameHash;
+
+    return TRUE;
+}
+
+void
+hashWindow (CompWindow *w)
+{
+    CompScreen	 *s = w->screen;
+    unsigned int i;
+
+    /* keep the current table if we're out of memory, lookups
+       just get slower as the chains grow */
+    if (s->nHashedWindows >= s->windowHashSize)
+	resizeWindowHash (s, s->windowHashSize * 2);
+
+    i = windowHashIndex (s, w->id);
+
+    w->hashNext = s->windowHash[i];
+    s->windowHash[i] = w;
+
+    s->nHashedWindows++;
+}
+
+void
+unhashWindow (CompWindow *w)
+{
+    CompScreen *s = w->screen;
+    CompWindow **p;
+
+    for (p = &s->windowHash[windowHashIndex (s, w->id)]; *p;
+	 p = &(*p)->hashNext)
+    {
+	if (*p == w)
+	{
+	    *p = w->hashNext;
+	    w->hashNext = NULL;
+
+	    s->nHashedWindows--;
+	    break;
+	}
+    }
+}
+
+void
+hashWindowFrame (CompWindow *w)
+{
+    CompScreen	 *s = w->screen;
+    unsigned int i;
+
+    if (!w->frame)
+	return;
+
+    i = windowHashIndex (s, w->frame);
+
+    w->frameHashNext = s->frameHash[i];
+    s->frameHash[i] = w;
+}
+
+void
+unhashWindowFrame (CompWindow *w)
+{
+    CompScreen *s = w->screen;
+    CompWindow **p;
+
+    if (!w->frame)
+	return;
+
+    for (p = &s->frameHash[windowHashIndex (s, w->frame)]; *p;
+	 p = &(*p)->frameHashNext)
+    {
+	if (*p == w)
+	{
+	    *p = w->frameHashNext;
+	    w->frameHashNext = NULL;
+	    break;
+	}
+    }
+}
+
 CompWindow *
 findWindowAtScreen (CompScreen *s,
 		    Window     id)
@@ -2555,7 +3023,7 @@ findWindowAtScreen (CompScreen *s,
     {
 	CompWindow *w;
 
-	for (w = s->windows; w; w = w->next)
+	for (w = s->windowHash[windowHashIndex (s, id)]; w; w = w->hashNext)
 	    if (w->id == id)
 		return (lastFoundWindow = w);
     }
@@ -2578,7 +3046,8 @@ findTopLevelWindowAtScreen (CompScreen *s,
 	/* likely a frame window */
 	if (w->attrib.class == InputOnly)
 	{
-	    for (w = s->windows; w; w = w->next)
+	    for (w = s->frameHash[windowHashIndex (s, id)]; w;
+		 w = w->frameHashNext)
 		if (w->frame == id)
 		    return w;
 	}
@@ -2596,6 +3065,8 @@ insertWindowIntoScreen (CompScreen *s,
 {
     CompWindow *p;
 
+    invalidateScreenOcclusion (s);
+
     if (s->windows)
     {
 	if (!aboveId)
@@ -2649,6 +3120,11 @@ unhookWindowFromScreen (CompScreen *s,
 {
     CompWindow *next, *prev;
 
+    invalidateScreenOcclusion (s);
+
+    if (w == s->occlusionFullscreenWindow)
+	s->occlusionFullscreenWindow = NULL;
+
     next = w->next;
     prev = w->prev;
 
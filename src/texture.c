@@ -103,17 +103,13 @@ imageToTexture (CompScreen   *screen,
 		GLenum       type)
 {
     char *data;
-    int	 i;
     GLint internalFormat;
 
     data = malloc (4 * width * height);
     if (!data)
 	return FALSE;
 
-    for (i = 0; i < height; i++)
-	memcpy (&data[i * width * 4],
-		&image[(height - i - 1) * width * 4],
-		width * 4);
+    flipImage (data, image, width * 4, height);
 
     makeScreenCurrent (screen);
     releasePixmapFromTexture (screen, texture);
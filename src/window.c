@@ -135,9 +135,9 @@ findWindowObject (CompObject *parent,
 
 	CORE_SCREEN (parent);
 
-	for (w = s->windows; w; w = w->next)
-	    if (w->id == id)
-		return &w->base;
+	w = findWindowAtScreen (s, id);
+	if (w)
+	    return &w->base;
     }
 
     return NULL;
@@ -302,8 +302,8 @@ updateNormalHints (CompWindow *w)
     Status status;
     long   supplied;
 
-    status = XGetWMNormalHints (w->screen->display->display, w->id,
-				&w->sizeHints, &supplied);
+    status = getWMNormalHints (w->screen->display, w->id,
+			       &w->sizeHints, &supplied);
 
     if (!status)
 	w->sizeHints.flags = 0;
@@ -323,7 +323,7 @@ updateWmHints (CompWindow *w)
 
     w->inputHint = TRUE;
 
-    hints = XGetWMHints (w->screen->display->display, w->id);
+    hints = getWMHints (w->screen->display, w->id);
     if (hints)
     {
 	dFlags ^= hints->flags;
@@ -375,7 +375,7 @@ updateWindowClassHints (CompWindow *w)
 	w->resClass = NULL;
     }
 
-    status = XGetClassHint (w->screen->display->display, w->id, &classHint);
+    status = getClassHint (w->screen->display, w->id, &classHint);
     if (status)
     {
 	if (classHint.res_name)
@@ -400,8 +400,7 @@ updateTransientHint (CompWindow *w)
 
     w->transientFor = None;
 
-    status = XGetTransientForHint (w->screen->display->display,
-				   w->id, &transientFor);
+    status = getTransientForHint (w->screen->display, w->id, &transientFor);
 
     if (status)
     {
@@ -427,10 +426,10 @@ updateIconGeometry (CompWindow *w)
     unsigned long n, left;
     unsigned char *data;
 
-    result = XGetWindowProperty (w->screen->display->display, w->id,
-				 w->screen->display->wmIconGeometryAtom,
-				 0L, 1024L, False, XA_CARDINAL,
-				 &actual, &format, &n, &left, &data);
+    result = getWindowProperty (w->screen->display, w->id,
+				w->screen->display->wmIconGeometryAtom,
+				0L, 1024L, XA_CARDINAL,
+				&actual, &format, &n, &left, &data);
 
     w->iconGeometrySet = FALSE;
 
@@ -478,10 +477,10 @@ getClientLeader (CompWindow *w)
     unsigned long n, left;
     unsigned char *data;
 
-    result = XGetWindowProperty (w->screen->display->display, w->id,
-				 w->screen->display->wmClientLeaderAtom,
-				 0L, 1L, False, XA_WINDOW, &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (w->screen->display, w->id,
+				w->screen->display->wmClientLeaderAtom,
+				0L, 1L, XA_WINDOW, &actual, &format,
+				&n, &left, &data);
 
     if (result == Success && data)
     {
@@ -506,12 +505,12 @@ getStartupId (CompWindow *w)
     unsigned long n, left;
     unsigned char *data;
 
-    result = XGetWindowProperty (w->screen->display->display, w->id,
-				 w->screen->display->startupIdAtom,
-				 0L, 1024L, False,
-				 w->screen->display->utf8StringAtom,
-				 &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (w->screen->display, w->id,
+				w->screen->display->startupIdAtom,
+				0L, 1024L,
+				w->screen->display->utf8StringAtom,
+				&actual, &format,
+				&n, &left, &data);
 
     if (result == Success && data)
     {
@@ -537,10 +536,10 @@ getWmState (CompDisplay *display,
     unsigned char *data;
     unsigned long state = NormalState;
 
-    result = XGetWindowProperty (display->display, id,
-				 display->wmStateAtom, 0L, 2L, FALSE,
-				 display->wmStateAtom, &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (display, id,
+				display->wmStateAtom, 0L, 2L,
+				display->wmStateAtom, &actual, &format,
+				&n, &left, &data);
 
     if (result == Success && data)
     {
@@ -642,9 +641,9 @@ getWindowState (CompDisplay *display,
     unsigned char *data;
     unsigned int  state = 0;
 
-    result = XGetWindowProperty (display->display, id, display->winStateAtom,
-				 0L, 1024L, FALSE, XA_ATOM, &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (display, id, display->winStateAtom,
+				0L, 1024L, XA_ATOM, &actual, &format,
+				&n, &left, &data);
 
     if (result == Success && data)
     {
@@ -948,9 +947,9 @@ getWindowType (CompDisplay *display,
     unsigned long n, left;
     unsigned char *data;
 
-    result = XGetWindowProperty (display->display, id, display->winTypeAtom,
-				 0L, 1L, FALSE, XA_ATOM, &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (display, id, display->winTypeAtom,
+				0L, 1L, XA_ATOM, &actual, &format,
+				&n, &left, &data);
 
     if (result == Success && data)
     {
@@ -1038,9 +1037,9 @@ getMwmHints (CompDisplay  *display,
     *func  = MwmFuncAll;
     *decor = MwmDecorAll;
 
-    result = XGetWindowProperty (display->display, id, display->mwmHintsAtom,
-				 0L, 20L, FALSE, display->mwmHintsAtom,
-				 &actual, &format, &n, &left, &data);
+    result = getWindowProperty (display, id, display->mwmHintsAtom,
+				0L, 20L, display->mwmHintsAtom,
+				&actual, &format, &n, &left, &data);
 
     if (result == Success && data)
     {
@@ -1067,7 +1066,7 @@ getProtocols (CompDisplay *display,
     int          count;
     unsigned int protocols = 0;
 
-    if (XGetWMProtocols (display->display, id, &protocol, &count))
+    if (getWMProtocols (display, id, &protocol, &count))
     {
 	int  i;
 
@@ -1101,9 +1100,9 @@ getWindowProp (CompDisplay  *display,
     unsigned char *data;
     unsigned int  retval = defaultValue;
 
-    result = XGetWindowProperty (display->display, id, property,
-				 0L, 1L, FALSE, XA_CARDINAL, &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (display, id, property,
+				0L, 1L, XA_CARDINAL, &actual, &format,
+				&n, &left, &data);
 
     if (result == Success && data)
     {
@@ -1146,9 +1145,9 @@ readWindowProp32 (CompDisplay    *display,
     unsigned char *data;
     Bool          retval = FALSE;
 
-    result = XGetWindowProperty (display->display, id, property,
-				 0L, 1L, FALSE, XA_CARDINAL, &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (display, id, property,
+				0L, 1L, XA_CARDINAL, &actual, &format,
+				&n, &left, &data);
 
     if (result == Success && data)
     {
@@ -1247,6 +1246,8 @@ updateFrameWindow (CompWindow *w)
 	    XChangeProperty (d->display, w->id, d->frameWindowAtom,
 			     XA_WINDOW, 32, PropModeReplace,
 			     (unsigned char *) &w->frame, 1);
+
+	    hashWindowFrame (w);
 	}
 
 	XMoveResizeWindow (d->display, w->frame, x, y, width, height);
@@ -1297,6 +1298,8 @@ updateFrameWindow (CompWindow *w)
     {
 	if (w->frame)
 	{
+	    unhashWindowFrame (w);
+
 	    XDeleteProperty (d->display, w->id, d->frameWindowAtom);
 	    XDestroyWindow (d->display, w->frame);
 	    w->frame = None;
@@ -1504,6 +1507,14 @@ freeWindow (CompWindow *w)
     if (w->clip)
 	XDestroyRegion (w->clip);
 
+    if (w->occlusion)
+	XDestroyRegion (w->occlusion);
+
+    if (w->geometryClip)
+	XDestroyRegion (w->geometryClip);
+
+    freeWindowGeometry (w);
+
     if (w->region)
 	XDestroyRegion (w->region);
 
@@ -1664,6 +1675,8 @@ getOutputExtentsForWindow (CompWindow	     *w,
 void
 addWindowDamage (CompWindow *w)
 {
+    invalidateScreenOcclusion (w->screen);
+
     if (w->screen->damageMask & COMP_SCREEN_DAMAGE_ALL_MASK)
 	return;
 
@@ -1687,6 +1700,10 @@ updateWindowRegion (CompWindow *w)
     XRectangle r, *rects, *shapeRects = 0;
     int	       i, n = 0;
 
+    invalidateScreenOcclusion (w->screen);
+
+    w->geometryValid = FALSE;
+
     EMPTY_REGION (w->region);
 
     if (w->screen->display->shapeExtension)
@@ -1793,10 +1810,10 @@ updateWindowStruts (CompWindow *w)
     new.bottom.width  = w->screen->width;
     new.bottom.height = 0;
 
-    result = XGetWindowProperty (w->screen->display->display, w->id,
-				 w->screen->display->wmStrutPartialAtom,
-				 0L, 12L, FALSE, XA_CARDINAL, &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (w->screen->display, w->id,
+				w->screen->display->wmStrutPartialAtom,
+				0L, 12L, XA_CARDINAL, &actual, &format,
+				&n, &left, &data);
 
     if (result == Success && data)
     {
@@ -1830,10 +1847,10 @@ updateWindowStruts (CompWindow *w)
 
     if (!hasNew)
     {
-	result = XGetWindowProperty (w->screen->display->display, w->id,
-				     w->screen->display->wmStrutAtom,
-				     0L, 4L, FALSE, XA_CARDINAL,
-				     &actual, &format, &n, &left, &data);
+	result = getWindowProperty (w->screen->display, w->id,
+				    w->screen->display->wmStrutAtom,
+				    0L, 4L, XA_CARDINAL,
+				    &actual, &format, &n, &left, &data);
 
 	if (result == Success && data)
 	{
@@ -1994,6 +2011,9 @@ addWindow (CompScreen *screen,
     w->next = NULL;
     w->prev = NULL;
 
+    w->hashNext	     = NULL;
+    w->frameHashNext = NULL;
+
     w->mapNum	 = 0;
     w->activeNum = 0;
 
@@ -2046,6 +2066,26 @@ addWindow (CompScreen *screen,
     w->sizeDamage  = 0;
     w->nDamage	   = 0;
 
+    w->occlusion       = NULL;
+    w->occlusionSerial = 0;
+
+    w->pendingProperties = 0;
+
+    w->geometryValid   = FALSE;
+    w->geometrySerial  = 0;
+    w->geometryOffset  = 0;
+    w->geometrySize    = 0;
+    w->geometryCount   = 0;
+    w->geometryClip    = NULL;
+    w->geometryClipped = FALSE;
+    w->geometryScissor = FALSE;
+
+    memset (w->matchCache, 0, sizeof (w->matchCache));
+    w->matchCacheWmType		  = 0;
+    w->matchCacheState		  = 0;
+    w->matchCacheOverrideRedirect = FALSE;
+    w->matchCacheAlpha		  = FALSE;
+
     w->vertices     = 0;
     w->vertexSize   = 0;
     w->vertexStride = 0;
@@ -2129,11 +2169,25 @@ addWindow (CompScreen *screen,
 	return;
     }
 
+    w->occlusion = XCreateRegion ();
+    if (!w->occlusion)
+    {
+	freeWindow (w);
+	return;
+    }
+
+    w->geometryClip = XCreateRegion ();
+    if (!w->geometryClip)
+    {
+	freeWindow (w);
+	return;
+    }
+
     /* Failure means that window has been destroyed. We still have to add the
        window to the window list as we might get configure requests which
        require us to stack other windows relative to it. Setting some default
        values if this is the case. */
-    if (!XGetWindowAttributes (d->display, id, &w->attrib))
+    if (!getWindowAttributes (d, id, &w->attrib))
 	setDefaultWindowAttributes (&w->attrib);
 
     w->serverWidth	 = w->attrib.width;
@@ -2162,10 +2216,7 @@ addWindow (CompScreen *screen,
 
     w->saveMask = 0;
 
-    XSelectInput (d->display, id,
-		  PropertyChangeMask |
-		  EnterWindowMask    |
-		  FocusChangeMask);
+    XSelectInput (d->display, id, CLIENT_WINDOW_EVENT_MASK);
 
     w->id = id;
 
@@ -2186,6 +2237,7 @@ addWindow (CompScreen *screen,
 	XShapeSelectInput (d->display, id, ShapeNotifyMask);
 
     insertWindowIntoScreen (screen, w, aboveId);
+    hashWindow (w);
 
     EMPTY_REGION (w->region);
 
@@ -2354,6 +2406,8 @@ void
 removeWindow (CompWindow *w)
 {
     unhookWindowFromScreen (w->screen, w);
+    unhashWindow (w);
+    unhashWindowFrame (w);
 
     if (!w->destroyed)
     {
@@ -2413,6 +2467,8 @@ removeWindow (CompWindow *w)
 void
 destroyWindow (CompWindow *w)
 {
+    unhashWindow (w);
+
     w->id = 1;
     w->mapNum = 0;
 
@@ -2424,6 +2480,8 @@ destroyWindow (CompWindow *w)
     {
 	w->destroyed = TRUE;
 	w->screen->pendingDestroys++;
+
+	invalidateScreenOcclusion (w->screen);
     }
 }
 
@@ -2486,6 +2544,8 @@ mapWindow (CompWindow *w)
     if (w->attrib.map_state == IsViewable)
 	return;
 
+    invalidateScreenOcclusion (w->screen);
+
     if (w->pendingMaps > 0)
 	w->pendingMaps--;
 
@@ -2719,10 +2779,10 @@ initializeSyncCounter (CompWindow *w)
     if (!(w->protocols & CompWindowProtocolSyncRequestMask))
 	return FALSE;
 
-    result = XGetWindowProperty (w->screen->display->display, w->id,
-				 w->screen->display->wmSyncRequestCounterAtom,
-				 0L, 1L, FALSE, XA_CARDINAL, &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (w->screen->display, w->id,
+				w->screen->display->wmSyncRequestCounterAtom,
+				0L, 1L, XA_CARDINAL, &actual, &format,
+				&n, &left, &data);
 
     if (result == Success && n && data)
     {
@@ -2892,6 +2952,8 @@ moveWindow (CompWindow *w,
 
 	XOffsetRegion (w->region, dx, dy);
 
+	invalidateScreenOcclusion (w->screen);
+
 	setWindowMatrix (w);
 
 	w->invisible = WINDOW_INVISIBLE (w);
@@ -4799,10 +4861,10 @@ getWindowUserTime (CompWindow *w,
     unsigned char *data;
     Bool          retval = FALSE;
 
-    result = XGetWindowProperty (w->screen->display->display, w->id,
-				 w->screen->display->wmUserTimeAtom,
-				 0L, 1L, False, XA_CARDINAL, &actual, &format,
-				 &n, &left, &data);
+    result = getWindowProperty (w->screen->display, w->id,
+				w->screen->display->wmUserTimeAtom,
+				0L, 1L, XA_CARDINAL, &actual, &format,
+				&n, &left, &data);
 
     if (result == Success && data)
     {
@@ -5203,7 +5265,6 @@ getWindowIcon (CompWindow *w,
 	if (result == Success && data)
 	{
 	    CARD32   *p;
-	    CARD32   alpha, red, green, blue;
 	    int      iw, ih, j;
 
 	    for (i = 0; i + 2 < n; i += iw * ih + 2)
@@ -5225,16 +5286,24 @@ getWindowIcon (CompWindow *w,
 		    /* EWMH doesn't say if icon data is premultiplied or
 		       not but most applications seem to assume data should
 		       be unpremultiplied. */
+#if IMAGE_BYTE_ORDER == LSBFirst
+		    for (j = 0; j < iw * ih; j++)
+			p[j] = idata[i + j + 2];
+
+		    premultiplyPixels (p, iw * ih);
+#else
 		    for (j = 0; j < iw * ih; j++)
 		    {
+			CARD32 alpha, red, green, blue;
+
 			alpha = (idata[i + j + 2] >> 24) & 0xff;
 			red   = (idata[i + j + 2] >> 16) & 0xff;
 			green = (idata[i + j + 2] >>  8) & 0xff;
 			blue  = (idata[i + j + 2] >>  0) & 0xff;
 
-			red   = (red   * alpha) >> 8;
-			green = (green * alpha) >> 8;
-			blue  = (blue  * alpha) >> 8;
+			red   = red   * alpha / 255;
+			green = green * alpha / 255;
+			blue  = blue  * alpha / 255;
 
 			p[j] =
 			    (alpha << 24) |
@@ -5242,6 +5311,7 @@ getWindowIcon (CompWindow *w,
 			    (green <<  8) |
 			    (blue  <<  0);
 		    }
+#endif
 		}
 	    }
 